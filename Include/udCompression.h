@@ -5,7 +5,7 @@
 //
 // Creator: Dave Pevreal, November 2017
 //
-// This module wraps zlib/miniz/gzip etc
+// This module wraps zlib/miniz/gzip etc, and provides a built-in fast LZ codec
 //
 
 #include "udPlatform.h"
@@ -16,19 +16,54 @@ enum udCompressionType
   udCT_RawDeflate, // Raw deflate compression
   udCT_ZlibDeflate, // Deflate compression with zlib header and footer
   udCT_GzipDeflate, // Deflate compression with gzip header and footer
+  udCT_FastLZ, // Fast LZ77 compression (LZ4 block format), much faster than deflate but with a lower compression ratio
 
   udCT_Count
 };
 const char *udCompressionTypeAsString(udCompressionType type); // Return a string of the enum (eg "RawDeflate"), or null if not defined
 
+// A preset dictionary, primes the compressor's history with data typical of the blocks being compressed
+// Greatly improves the compression ratio of small blocks (eg a few KB of JSON). Dictionaries are read-only once
+// created and can be shared between threads. Only supported by udCT_RawDeflate and udCT_ZlibDeflate
+struct udCompressionDictionary;
+
+// Create a dictionary from raw bytes, most common strings should be placed at the end. Only the last 32KB is used
+udResult udCompressionDictionary_Create(udCompressionDictionary **ppDictionary, const void *pData, size_t dataLength);
+
+// Train a dictionary of up to maxDictionaryLength bytes from representative sample buffers
+// Returns udR_NotFound if the samples have no content in common
+udResult udCompressionDictionary_Train(udCompressionDictionary **ppDictionary, const void * const *ppSamples, const size_t *pSampleLengths, size_t sampleCount, size_t maxDictionaryLength = 4096);
+
+// Get the bytes of a dictionary, for example to store a trained dictionary for later use with udCompressionDictionary_Create
+udResult udCompressionDictionary_GetData(const udCompressionDictionary *pDictionary, const void **ppData, size_t *pDataLength);
+
+// Destroy a dictionary
+void udCompressionDictionary_Destroy(udCompressionDictionary **ppDictionary);
+
 // Compress a buffer, providing an allocate buffer of the compressed data
-udResult udCompression_Deflate(void **ppDest, size_t *pDestSize, const void *pSource, size_t sourceSize, udCompressionType type = udCT_ZlibDeflate);
+// If pDictionary is supplied the same dictionary must be passed to udCompression_Inflate
+udResult udCompression_Deflate(void **ppDest, size_t *pDestSize, const void *pSource, size_t sourceSize, udCompressionType type = udCT_ZlibDeflate, const udCompressionDictionary *pDictionary = nullptr);
 
 // Decompress a buffer. If pInflatedSize is null, an error is returned if inflated size doesn't equal destSize exactly.
 // In-place decompression is supported, pDest must equal pSource exactly, ie, overlapping decompression is not supported
-udResult udCompression_Inflate(void *pDest, size_t destSize, const void *pSource, size_t sourceSize, size_t *pInflatedSize = nullptr, udCompressionType type = udCT_ZlibDeflate);
+udResult udCompression_Inflate(void *pDest, size_t destSize, const void *pSource, size_t sourceSize, size_t *pInflatedSize = nullptr, udCompressionType type = udCT_ZlibDeflate, const udCompressionDictionary *pDictionary = nullptr);
+
+// Writes a zip archive, entries are compressed in parallel on worker threads and written in the order they are added
+// zip:// files are read-only, archives are created with this API. ZIP64 is used where sizes, offsets or counts require it
+struct udZipWriter;
+
+// Create a new zip archive, threadCount of zero uses one thread per hardware thread
+udResult udZipWriter_Create(udZipWriter **ppWriter, const char *pFilename, int threadCount = 0);
+
+// Add a file to the archive, pData is copied so can be released on return. Blocks if too many entries are waiting to be written
+// Only udCT_RawDeflate (entries that don't compress are stored) and udCT_None are supported
+udResult udZipWriter_AddFile(udZipWriter *pWriter, const char *pSubFilename, const void *pData, size_t dataLength, udCompressionType type = udCT_RawDeflate);
+
+// Wait for all entries to be written, then write the central directory and close the archive. Returns the first error encountered
+udResult udZipWriter_Close(udZipWriter **ppWriter);
 
-// Generate a compressed PNG from a raw image, caller to udFree the memory
-udResult udCompression_CreatePNG(void **ppPNG, size_t *pPNGLen, const uint8_t *pImage, int width, int height, int channels);
+// Generate a compressed PNG from a raw 8 bit image of 1 (grey), 2 (grey, alpha), 3 (RGB) or 4 (RGBA) channels, caller to udFree the memory
+// compressionLevel ranges from 0 (fastest, uncompressed) to 12 (smallest), large images are filtered on multiple threads
+udResult udCompression_CreatePNG(void **ppPNG, size_t *pPNGLen, const uint8_t *pImage, int width, int height, int channels, int compressionLevel = 6);
 
 #endif // UDCOMPRESSION_H
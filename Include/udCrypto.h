@@ -55,6 +55,12 @@ enum udCryptoChainMode
   udCCM_None,   // Sentinal meaning no chaining mode has been set yet
   udCCM_CBC,    // Sequential access, requires IV unique to each call to encrypt
   udCCM_CTR,    // Random access, requires a nonce unique to file
+  udCCM_GCM,    // Authenticated CTR, requires an IV unique to each message (or a nonce unique to file for per-block tags)
+};
+
+enum udCryptoTagLength
+{
+  udCTL_GCMTagLength = 16,
 };
 
 struct udCryptoCipherContext;
@@ -62,6 +68,10 @@ struct udCryptoIV // All IV's are 16-bytes, however it is possible a future ciph
 {
   uint8_t iv[16];
 };
+struct udCryptoTag // Authentication tag for GCM mode
+{
+  uint8_t tag[udCTL_GCMTagLength];
+};
 
 // Initialise a cipher
 udResult udCryptoCipher_Create(udCryptoCipherContext **ppCtx, udCryptoCiphers cipher, udCryptoPaddingMode padMode, const char *pKeyBase64, udCryptoChainMode chainMode);
@@ -73,6 +83,34 @@ udResult udCrypto_CreateIVForCTRMode(udCryptoCipherContext *pCtx, udCryptoIV *pI
 udResult udCryptoCipher_Encrypt(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pPlainText, size_t plainTextLen, void *pCipherText, size_t cipherTextLen, size_t *pPaddedCipherTextLen = nullptr, udCryptoIV *pOutIV = nullptr);
 udResult udCryptoCipher_Decrypt(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pCipherText, size_t cipherTextLen, void *pPlainText, size_t plainTextLen, size_t *pActualPlainTextLen = nullptr, udCryptoIV *pOutIV = nullptr);
 
+// Encrypt/decrypt (the same operation) a buffer of any length in CTR mode, starting blockOffset blocks after the counter in pIV
+// pInput and pOutput may be the same buffer. Large buffers are split across threadCount threads, 0 uses all hardware threads
+udResult udCryptoCipher_CryptCTR(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pInput, void *pOutput, size_t length, uint64_t blockOffset = 0, uint32_t threadCount = 0);
+
+// Encrypt/decrypt with authentication in GCM mode. Only the first 12 bytes of pIV are used, and must be unique for each message
+// Optional pAAD is authenticated but not encrypted. Decrypt returns udR_SignatureMismatch and zeroes the output if the tag doesn't match
+udResult udCryptoCipher_EncryptGCM(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pPlainText, void *pCipherText, size_t length, udCryptoTag *pTag, const void *pAAD = nullptr, size_t aadLength = 0);
+udResult udCryptoCipher_DecryptGCM(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pCipherText, void *pPlainText, size_t length, const udCryptoTag *pTag, const void *pAAD = nullptr, size_t aadLength = 0);
+
+// GCM mode with one tag per blockSize bytes (the last block may be short), so any block can be decrypted and verified independently
+// Block n uses the IV formed from nonce and (firstBlockIndex + n), pTags has one entry per block. threadCount of 0 uses all hardware threads
+// Decrypt returns udR_SignatureMismatch if any block fails verification, and zeroes the output of those blocks
+udResult udCryptoCipher_EncryptBlocksGCM(udCryptoCipherContext *pCtx, uint64_t nonce, uint64_t firstBlockIndex, const void *pPlainText, void *pCipherText, size_t length, size_t blockSize, udCryptoTag *pTags, uint32_t threadCount = 0);
+udResult udCryptoCipher_DecryptBlocksGCM(udCryptoCipherContext *pCtx, uint64_t nonce, uint64_t firstBlockIndex, const void *pCipherText, void *pPlainText, size_t length, size_t blockSize, const udCryptoTag *pTags, uint32_t threadCount = 0);
+
+// Streaming encrypt/decrypt for CTR and GCM modes, keeping the counter and keystream in the context between calls
+// Begin starts a stream at pIV (GCM uses the first 12 bytes, and optional pAAD), Update processes chunks of any length in order
+// Finish is only required for GCM: when encrypting it outputs the tag, when decrypting it returns udR_SignatureMismatch if pTag doesn't match
+// NOTE: When decrypting GCM, Update outputs plaintext before it has been verified, it must not be trusted until Finish succeeds
+enum udCryptoStreamDirection
+{
+  udCSD_Encrypt,
+  udCSD_Decrypt,
+};
+udResult udCryptoCipher_Begin(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, udCryptoStreamDirection direction, const void *pAAD = nullptr, size_t aadLength = 0);
+udResult udCryptoCipher_Update(udCryptoCipherContext *pCtx, const void *pInput, void *pOutput, size_t length);
+udResult udCryptoCipher_Finish(udCryptoCipherContext *pCtx, udCryptoTag *pTag = nullptr);
+
 // Free resources
 udResult udCryptoCipher_Destroy(udCryptoCipherContext **ppCtx);
 
@@ -113,15 +151,52 @@ udResult udCryptoHash_Digest(udCryptoHashContext *pCtx, const void *pBytes, size
 // Digest some bytes
 udResult udCryptoHash_Finalise(udCryptoHashContext *pCtx, const char **ppHashBase64);
 
+// Finalise to the raw digest, digestLength must be at least udCryptoHash_GetLength bytes (udCHL_MaxHashLength is always enough)
+udResult udCryptoHash_FinaliseRaw(udCryptoHashContext *pCtx, uint8_t *pDigest, size_t digestLength, size_t *pDigestLengthWritten = nullptr);
+
 // Free resources
 udResult udCryptoHash_Destroy(udCryptoHashContext **ppCtx);
 
 // Helper to create/digest/finalise/destroy for a given block (or two) of data
 udResult udCryptoHash_Hash(udCryptoHashes hash, const void *pMessage, size_t messageLength, const char **ppHashBase64, const void *pMessage2 = nullptr, size_t message2Length = 0);
 
+// As above but producing the raw digest without any allocations
+udResult udCryptoHash_HashRaw(udCryptoHashes hash, const void *pMessage, size_t messageLength, uint8_t *pDigest, size_t digestLength, const void *pMessage2 = nullptr, size_t message2Length = 0);
+
+// Length in bytes of the raw digest of a hash, or 0 for an invalid hash
+size_t udCryptoHash_GetLength(udCryptoHashes hash);
+
+// Hash count independent messages, writing each raw digest to pDigests at a stride of the hash length.
+// Many small messages are hashed in parallel SIMD lanes where the CPU lacks dedicated SHA instructions
+udResult udCryptoHash_HashMany(udCryptoHashes hash, size_t count, const void * const *ppMessages, const size_t *pLengths, uint8_t *pDigests);
+
+// Kernels udCryptoHash_HashMany can be pinned to for SHA-1 and SHA-256
+enum udCryptoHashManyKernel
+{
+  udCHMK_Auto,      // Fastest kernel the CPU supports (default)
+  udCHMK_Portable,  // One message at a time in portable code
+  udCHMK_SHA,       // One message at a time with the SHA instructions
+  udCHMK_AVX2Lanes, // SHA-256 only, 8 messages at a time in AVX2 lanes, SHA-1 falls back to udCHMK_Auto
+
+  udCHMK_Count
+};
+
+// Pin udCryptoHash_HashMany to a kernel so tests can cover kernels the CPU wouldn't otherwise choose.
+// Returns udR_Unsupported if the CPU can't run the kernel, udCHMK_Auto restores the default
+udResult udCryptoHash_SetHashManyKernel(udCryptoHashManyKernel kernel);
+
+// Hash tree (Merkle) helpers, all digests are raw bytes of udCryptoHash_GetLength(hash).
+// Leaves are H(0x00 || data), parents are H(0x01 || left || right) with an odd node at the end of a level promoted unchanged.
+// Combined with udFile_TreeHash, a single leaf can be checked against its digest without rehashing the rest of the file
+udResult udCryptoHash_TreeLeaf(udCryptoHashes hash, const void *pData, size_t length, uint8_t *pLeafDigest);
+udResult udCryptoHash_TreeRoot(udCryptoHashes hash, const uint8_t *pLeafDigests, size_t leafCount, uint8_t *pRootDigest);
+
 // Generate a keyed hash
 udResult udCryptoHash_HMAC(udCryptoHashes hash, const char *pKeyBase64, const void *pMessage, size_t messageLength, const char **ppHMACBase64);
 
+// Generate a keyed hash from a raw key to a raw result without any allocations, identical to udCryptoHash_HMAC for the same key
+udResult udCryptoHash_HMACRaw(udCryptoHashes hash, const void *pKey, size_t keyLength, const void *pMessage, size_t messageLength, uint8_t *pHMAC, size_t hmacLength, size_t *pHMACLengthWritten = nullptr);
+
 // Internal self-test
 udResult udCryptoHash_SelfTest(udCryptoHashes hash);
 
@@ -178,6 +253,11 @@ enum udCryptoSigType
   udCST_ECPBP384 = 384
 };
 
+enum udCryptoSigLength
+{
+  udCSL_MaxSignatureLength = udCST_RSA4096 / 8 // Large enough for a raw signature of any type
+};
+
 enum udCryptoSigPadScheme
 {
   udCSPS_Deterministic   // A deterministic signature that doesn't require entropy. For RSA PKCS #1.5
@@ -190,15 +270,29 @@ udResult udCryptoSig_CreateKeyPair(udCryptoSigContext **ppSigCtx, udCryptoSigTyp
 udResult udCryptoSig_ImportKeyPair(udCryptoSigContext **pSigCtx, const char *pKeyText);
 udResult udCryptoSig_ImportMSBlob(udCryptoSigContext **ppSigCtx, void *pBlob, size_t blobLen);
 
+// Import a key for verification through a cache, importing the same key text again returns the same context without reparsing
+// Each import must be matched by a udCryptoSig_Destroy, the context is destroyed with the last reference
+udResult udCryptoSig_ImportVerifyKey(udCryptoSigContext **ppSigCtx, const char *pKeyText);
+
 // Export a public/keypair as JSON
 udResult udCryptoSig_ExportKeyPair(udCryptoSigContext *pSigCtx, const char **ppKeyText, bool exportPrivate = false);
 
 // Sign a hash, be sure to udFree the result signature string when finished
 udResult udCryptoSig_Sign(udCryptoSigContext *pSigCtx, const char *pHashBase64, const char **ppSignatureBase64, udCryptoHashes hashMethod, udCryptoSigPadScheme pad = udCSPS_Deterministic);
 
-// Verify a signed hash
+// Verify a signed hash, a context may be used by several threads at once for verification
 udResult udCryptoSig_Verify(udCryptoSigContext *pSigCtx, const char *pHashBase64, const char *pSignatureBase64, udCryptoHashes hashMethod, udCryptoSigPadScheme pad = udCSPS_Deterministic);
 
+// Sign and verify raw digests with raw signatures in caller supplied buffers, avoiding base64 and any udAlloc allocations
+udResult udCryptoSig_SignRaw(udCryptoSigContext *pSigCtx, const uint8_t *pHash, size_t hashLength, uint8_t *pSignature, size_t signatureLength, size_t *pSignatureLengthWritten, udCryptoHashes hashMethod, udCryptoSigPadScheme pad = udCSPS_Deterministic);
+udResult udCryptoSig_VerifyRaw(udCryptoSigContext *pSigCtx, const uint8_t *pHash, size_t hashLength, const uint8_t *pSignature, size_t signatureLength, udCryptoHashes hashMethod, udCryptoSigPadScheme pad = udCSPS_Deterministic);
+
+// Verify count raw signatures against one key across threadCount threads (0 uses all hardware threads)
+// pHashes holds count digests of udCryptoHash_GetLength(hashMethod) bytes each. Optional pResults receives the result for each signature
+// Returns udR_SignatureMismatch if any signature fails to verify
+udResult udCryptoSig_VerifyMany(udCryptoSigContext *pSigCtx, udCryptoHashes hashMethod, size_t count, const uint8_t *pHashes, const uint8_t * const *ppSignatures,
+                                const size_t *pSignatureLengths, udResult *pResults = nullptr, uint32_t threadCount = 0, udCryptoSigPadScheme pad = udCSPS_Deterministic);
+
 // Destroy a signature context
 void udCryptoSig_Destroy(udCryptoSigContext **pSigCtx);
 
@@ -15,6 +15,7 @@
 #include "udPlatform.h"
 #include "udResult.h"
 #include "udCompression.h"
+#include "udCrypto.h"
 
 struct udFile;
 enum udFileOpenFlags
@@ -23,7 +24,7 @@ enum udFileOpenFlags
   udFOF_Write = 2,
   udFOF_Create = 4,
   udFOF_Multithread = 8,
-  udFOF_FastOpen = 16   // No checks performed, file length not supported. Currently functional for FILE (deferred open) and HTTP (stateless)
+  udFOF_FastOpen = 16   // No checks performed, file length not supported. Currently functional for FILE (deferred open), HTTP (stateless) and raw (decoded on read, so the filename must remain valid until closed)
 };
 // Inline of operator to allow flags to be combined and retain type-safety
 inline udFileOpenFlags operator|(udFileOpenFlags a, udFileOpenFlags b) { return (udFileOpenFlags)(int(a) | int(b)); }
@@ -70,6 +71,15 @@ udResult udFile_SetSubFilename(udFile *pFile, const char *pSubFilename, int64_t
 // Set the encryption key/nonce (currently only supported on files opened for read due to alignment complexities)
 udResult udFile_SetEncryption(udFile *pFile, uint8_t *pKey, int keylen, uint64_t nonce, int64_t counterOffset = 0);
 
+// Set the key/nonce for a file written with udCryptoCipher_EncryptBlocksGCM, each read decrypts and verifies only the blocks it touches
+// The tags (one per blockSize bytes, starting at block 0) are copied. Reads of blocks that fail verification return udR_SignatureMismatch
+udResult udFile_SetAuthenticatedEncryption(udFile *pFile, uint8_t *pKey, int keylen, uint64_t nonce, uint32_t blockSize, const struct udCryptoTag *pTags, size_t tagCount);
+
+// Hash the file as a tree of leafSize byte leaves (see udCryptoHash_TreeRoot), reading and hashing leaves on up to threadCount threads (0 for all hardware threads).
+// The root digest is the same regardless of thread count. The file must be opened with udFOF_Multithread to use more than one thread.
+// Optionally returns the leaf digests (udFree when done) so individual leaves can later be verified with udCryptoHash_TreeLeaf
+udResult udFile_TreeHash(udFile *pFile, udCryptoHashes hash, uint32_t leafSize, uint8_t *pRootDigest, uint8_t **ppLeafDigests = nullptr, size_t *pLeafCount = nullptr, uint32_t threadCount = 0);
+
 // Get the filename associated with the file
 const char *udFile_GetFilename(udFile *pFile);
 
@@ -54,6 +54,9 @@ struct udFile
   udFile_CloseHandlerFunc *fpClose;
   struct udCryptoCipherContext *pCipherCtx;
   int64_t nonce, counterOffset;  // For CTR mode, the nonce and an offset added to calculated counter, used mainly by split files or to add perceived security
+  struct udCryptoTag *pAuthTags; // For GCM mode, one tag per authBlockSize bytes of the file
+  size_t authTagCount;
+  uint32_t authBlockSize;
   int64_t seekBase;
   int64_t filePos;
   int64_t fileLength;
@@ -185,6 +185,8 @@ public:
   // Remember to remove the existing "signature" attribute before calculating the signature
   // The result is always 32 bytes
   udResult CalculateHMAC(const char **ppHMACBase64, const char *pKeyBase64 = nullptr) const;
+  // As above with a raw key (keyLength of 0 gives the SHA256), writing the raw 32 bytes to pDigest
+  udResult CalculateHMACRaw(uint8_t pDigest[32], const void *pKey = nullptr, size_t keyLength = 0) const;
 
 protected:
   typedef udChunkedArray<const char*> LineList;
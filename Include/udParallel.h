@@ -0,0 +1,135 @@
+#ifndef UDPARALLEL_H
+#define UDPARALLEL_H
+//
+// Copyright (c) Euclideon Pty Ltd
+//
+// Data parallel loops over index ranges and udChunkedArrays, run on a udWorkerPool
+// The calling thread works through ranges alongside the pool's workers rather than blocking, and when called from
+// within one of the pool's tasks the waiting worker keeps running other tasks, so nested loops can't deadlock
+//
+
+#include "udResult.h"
+#include "udCallback.h"
+#include "udChunkedArray.h"
+#include "udWorkerPool.h"
+#include <algorithm>
+#include <new>
+
+// Called with a range [begin, end) of indices to process, from several threads at once
+using udParallelForCallback = udCallback<void(size_t begin, size_t end)>;
+
+// Splits [begin, end) into ranges of grain indices and calls func on each, returning once every range is done
+// A grain of 0 uses udParallel_DefaultGrain
+udResult udParallelFor(udWorkerPool *pPool, size_t begin, size_t end, size_t grain, udParallelForCallback func);
+
+// A grain that gives each thread (including the caller) a few ranges so uneven work balances out
+size_t udParallel_DefaultGrain(udWorkerPool *pPool, size_t count);
+
+// Calls func(T *pElements, size_t count, size_t firstIndex) on runs of contiguous elements, split along the array's chunks
+template <typename T, typename Func>
+udResult udParallelFor(udWorkerPool *pPool, udChunkedArray<T> &array, Func func);
+
+// Calls map(size_t begin, size_t end) for ranges of grain indices and combines the results in index order, starting from identity
+// So combine only needs to be associative, not commutative
+template <typename T, typename MapFunc, typename CombineFunc>
+udResult udParallelReduce(udWorkerPool *pPool, size_t begin, size_t end, size_t grain, const T &identity, MapFunc map, CombineFunc combine, T *pResult);
+
+// Calls map(const E *pElements, size_t count, size_t firstIndex) on runs of contiguous elements and combines the results in index order
+template <typename T, typename E, typename MapFunc, typename CombineFunc>
+udResult udParallelReduce(udWorkerPool *pPool, const udChunkedArray<E> &array, const T &identity, MapFunc map, CombineFunc combine, T *pResult);
+
+// Number of chunks the array's elements span, chunk 0 may be partial if elements were popped from the front
+template <typename T>
+inline size_t udParallel_ChunkSpan(const udChunkedArray<T> &array)
+{
+  if (array.length == 0)
+    return 0;
+  return (array.inset + array.length + array.chunkElementCount - 1) / array.chunkElementCount;
+}
+
+// Index of the first element in one of the chunks counted by udParallel_ChunkSpan
+template <typename T>
+inline size_t udParallel_ChunkFirstIndex(const udChunkedArray<T> &array, size_t chunk)
+{
+  return (chunk == 0) ? 0 : chunk * array.chunkElementCount - array.inset;
+}
+
+// ****************************************************************************
+template <typename T, typename Func>
+udResult udParallelFor(udWorkerPool *pPool, udChunkedArray<T> &array, Func func)
+{
+  return udParallelFor(pPool, 0, udParallel_ChunkSpan(array), 0, [&array, &func](size_t firstChunk, size_t lastChunk)
+  {
+    for (size_t chunk = firstChunk; chunk < lastChunk; ++chunk)
+    {
+      size_t index = udParallel_ChunkFirstIndex(array, chunk);
+      func(array.GetElement(index), array.GetElementRunLength(index), index);
+    }
+  });
+}
+
+// ****************************************************************************
+template <typename T, typename MapFunc, typename CombineFunc>
+udResult udParallelReduce(udWorkerPool *pPool, size_t begin, size_t end, size_t grain, const T &identity, MapFunc map, CombineFunc combine, T *pResult)
+{
+  udResult result = udR_Failure;
+  T *pPartials = nullptr;
+  size_t rangeCount = 0;
+
+  UD_ERROR_NULL(pResult, udR_InvalidParameter);
+  UD_ERROR_IF(end < begin, udR_InvalidParameter);
+
+  if (grain == 0)
+    grain = udParallel_DefaultGrain(pPool, end - begin);
+  rangeCount = (end - begin + grain - 1) / grain;
+
+  if (rangeCount > 0)
+  {
+    pPartials = udAllocType(T, rangeCount, udAF_None);
+    UD_ERROR_NULL(pPartials, udR_MemoryAllocationFailure);
+    for (size_t i = 0; i < rangeCount; ++i)
+      new (&pPartials[i]) T(identity);
+  }
+
+  result = udParallelFor(pPool, 0, rangeCount, 1, [pPartials, begin, end, grain, &map](size_t firstRange, size_t lastRange)
+  {
+    for (size_t range = firstRange; range < lastRange; ++range)
+    {
+      size_t first = begin + range * grain;
+      pPartials[range] = map(first, first + std::min(grain, end - first));
+    }
+  });
+
+  if (result == udR_Success)
+  {
+    T total = identity;
+    for (size_t i = 0; i < rangeCount; ++i)
+      total = combine(total, pPartials[i]);
+    *pResult = total;
+  }
+
+epilogue:
+  for (size_t i = 0; pPartials != nullptr && i < rangeCount; ++i)
+    pPartials[i].~T();
+  udFree(pPartials);
+  return result;
+}
+
+// ****************************************************************************
+template <typename T, typename E, typename MapFunc, typename CombineFunc>
+udResult udParallelReduce(udWorkerPool *pPool, const udChunkedArray<E> &array, const T &identity, MapFunc map, CombineFunc combine, T *pResult)
+{
+  return udParallelReduce(pPool, 0, udParallel_ChunkSpan(array), 0, identity, [&array, &map, &combine](size_t firstChunk, size_t lastChunk)
+  {
+    size_t index = udParallel_ChunkFirstIndex(array, firstChunk);
+    T partial = map(array.GetElement(index), array.GetElementRunLength(index), index);
+    for (size_t chunk = firstChunk + 1; chunk < lastChunk; ++chunk)
+    {
+      index = udParallel_ChunkFirstIndex(array, chunk);
+      partial = combine(partial, map(array.GetElement(index), array.GetElementRunLength(index), index));
+    }
+    return partial;
+  }, combine, pResult);
+}
+
+#endif // UDPARALLEL_H
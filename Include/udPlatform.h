@@ -353,8 +353,14 @@ template <typename T, size_t N> constexpr size_t udLengthOf(T(&)[N]) { return N;
 udResult udGetTotalPhysicalMemory(uint64_t *pTotalMemory);
 
 // CPU Feature tests
+bool udCPUSupportsSSSE3();  // Supplemental SSE3, including byte shuffles
+bool udCPUSupportsSSE42();  // SSE4.2, including the CRC32C instruction
 bool udCPUSupportsAVX();
 bool udCPUSupportsAVX2();
+bool udCPUSupportsAES();    // AES-NI
+bool udCPUSupportsVAES();   // 256-bit vector AES (requires AVX2)
+bool udCPUSupportsPCLMUL(); // Carry-less multiply
+bool udCPUSupportsSHA();    // SHA-1/SHA-256 instructions (SHA-NI on x86, crypto extensions on ARMv8)
 
 #include "udDebug.h"
 
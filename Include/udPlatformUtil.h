@@ -11,6 +11,7 @@
 #include "udPlatform.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <atomic>
 
 class udJSON;
 
@@ -79,6 +80,16 @@ inline udResult udWriteValueToPointer(T value, P *&pDest, int *pBytesRemaining =
   return udWriteToPointer(&value, pDest, pBytesRemaining);
 }
 
+// *********************************************************************
+// Spin lock for guarding static data, it requires no creation but should only be held briefly
+// *********************************************************************
+struct udSpinLock
+{
+  std::atomic_flag flag = ATOMIC_FLAG_INIT;
+};
+void udLockSpinLock(udSpinLock *pLock);
+void udReleaseSpinLock(udSpinLock *pLock);
+
 // *********************************************************************
 // Time and timing
 // *********************************************************************
@@ -183,6 +194,39 @@ uint32_t udCrc(const void *pBuffer, size_t length, uint32_t updateCrc = 0);
 // Create (or optionally update) a iSCSI standard 32-bit CRC (polynomial 0x1edc6f41)
 uint32_t udCrc32c(const void *pBuffer, size_t length, uint32_t updateCrc = 0);
 
+// Given the CRCs of two adjacent buffers and the length of the second, return the CRC of both (allowing large buffers to be split across threads)
+uint32_t udCrcCombine(uint32_t crc1, uint32_t crc2, uint64_t length2);
+uint32_t udCrc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t length2);
+
+
+// *********************************************************************
+// Fast non-cryptographic hashes (XXH3 compatible), for hash tables and content checksums
+struct udHash128Value
+{
+  uint64_t low64;
+  uint64_t high64;
+};
+
+uint64_t udHash64(const void *pBuffer, size_t length, uint64_t seed = 0);
+udHash128Value udHash128(const void *pBuffer, size_t length, uint64_t seed = 0);
+
+// Streaming form, both digests can be taken at any point and the state may be updated afterwards
+struct udHashState
+{
+  uint64_t acc[8];
+  uint8_t customSecret[192]; // Only used when seed is non-zero
+  uint8_t buffer[256];
+  uint64_t totalLength;
+  uint64_t seed;
+  uint32_t bufferedSize;
+  uint32_t stripesSoFar;
+};
+
+void udHash_Init(udHashState *pState, uint64_t seed = 0);
+void udHash_Update(udHashState *pState, const void *pBuffer, size_t length);
+uint64_t udHash_Digest64(const udHashState *pState);
+udHash128Value udHash_Digest128(const udHashState *pState);
+
 
 // *********************************************************************
 // Simple base64 decoder, output can be same memory as input
@@ -190,6 +234,21 @@ uint32_t udCrc32c(const void *pBuffer, size_t length, uint32_t updateCrc = 0);
 udResult udBase64Decode(const char *pString, size_t length, uint8_t *pOutput, size_t outputLength, size_t *pOutputLengthWritten = nullptr);
 udResult udBase64Decode(uint8_t **ppOutput, size_t *pOutputLength, const char *pString);
 
+// *********************************************************************
+// Incremental base64 decoder, for decoding large text a piece at a time straight to where it's needed
+// As with udBase64Decode, characters outside the base64 alphabet (padding, whitespace) are skipped
+struct udBase64Decoder
+{
+  uint32_t accum;      // Bits of a partially decoded byte
+  int32_t accumBits;
+  size_t skippedCount; // Number of characters skipped so far
+};
+void udBase64Decoder_Init(udBase64Decoder *pDecoder);
+
+// Decode up to length characters of pString, stopping early when pOutput is full. Pass nullptr for pOutput to count the exact output bytes
+// Characters not consumed (*pInputUsed < length) should be passed again once there is room for more output
+udResult udBase64Decoder_Update(udBase64Decoder *pDecoder, const char *pString, size_t length, uint8_t *pOutput, size_t outputLength, size_t *pInputUsed = nullptr, size_t *pOutputWritten = nullptr);
+
 // *********************************************************************
 // Simple base64 encoder, unlike decode output CANNOT be the same memory as input
 // encodes binaryLength bytes from pBinary to strLength characters in pString
@@ -83,6 +83,31 @@ epilogue:
   return result;
 }
 
+// ****************************************************************************
+// Pushes count values under a single lock, either all of them are pushed or none are
+template <typename T>
+inline udResult udSafeDeque_PushBack(udSafeDeque<T> *pDeque, const T *pValues, size_t count)
+{
+  udResult result = udR_Failure;
+  udMutex *pMutex = nullptr;
+
+  UD_ERROR_NULL(pDeque, udR_InvalidParameter);
+  UD_ERROR_IF(pValues == nullptr && count > 0, udR_InvalidParameter);
+
+  pMutex = udLockMutex(pDeque->pMutex);
+
+  UD_ERROR_NULL(pMutex, udR_NotInitialized);
+  UD_ERROR_CHECK(pDeque->chunkedArray.ReserveBack(pDeque->chunkedArray.length + count));
+  for (size_t i = 0; i < count; ++i)
+    UD_ERROR_CHECK(pDeque->chunkedArray.PushBack(pValues[i]));
+  result = udR_Success;
+
+epilogue:
+  udReleaseMutex(pMutex);
+
+  return result;
+}
+
 // ****************************************************************************
 // Author: Paul Fox, November 2015
 template <typename T>
@@ -147,4 +172,19 @@ epilogue:
   return result;
 }
 
+// ****************************************************************************
+// Number of elements queued, already stale if other threads are pushing or popping
+template <typename T>
+inline size_t udSafeDeque_GetLength(udSafeDeque<T> *pDeque)
+{
+  if (pDeque == nullptr)
+    return 0;
+
+  udMutex *pMutex = udLockMutex(pDeque->pMutex);
+  size_t length = pDeque->chunkedArray.length;
+  udReleaseMutex(pMutex);
+
+  return length;
+}
+
 #endif // UDSAFEDEQUE_H
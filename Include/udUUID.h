@@ -27,7 +27,7 @@ const char* udUUID_GetAsString(const udUUID &UUID); //Do not free, you do not ow
 const char* udUUID_GetAsString(const udUUID *pUUID); //Do not free, you do not own this
 
 // These functions generate UUIDs
-udResult udUUID_GenerateFromRandom(udUUID *pUUID); // Fills out pUUID as a version 4 UUID
+udResult udUUID_GenerateFromRandom(udUUID *pUUIDs, size_t count = 1); // Fills out count UUIDs at pUUIDs as version 4 UUIDs
 udResult udUUID_GenerateFromString(udUUID *pUUID, const char *pStr); // Fills out pUUID as a version 5 UUID
 udResult udUUID_GenerateFromInt(udUUID *pUUID, int64_t value); // Fills out pUUID as a version 5 UUID
 
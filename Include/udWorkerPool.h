@@ -10,16 +10,76 @@
 
 #include "udResult.h"
 #include "udCallback.h"
+#include "udThread.h"
 
 // Function definition for async and marshalled work
 using udWorkerPoolCallback = udCallback<void(void *)>;
 struct udWorkerPool;
+class udJSON;
+struct udWorkerPoolTask; // Handle to a task, returned by udWorkerPool_AddTask and udWorkerPool_Then when requested and released with udWorkerPool_ReleaseTask
 
-udResult udWorkerPool_Create(udWorkerPool **ppPool, uint8_t totalThreads, const char *pThreadNamePrefix = "udWorkerPool");
+enum udWorkerPoolPriority
+{
+  udWPP_Critical, // Latency sensitive work, taken before anything else
+  udWPP_Normal,
+  udWPP_Background, // Taken when there's nothing else to do, though never starved completely
+
+  udWPP_Count
+};
+
+// Describes a task for the extended udWorkerPool_AddTask
+struct udWorkerPoolTaskDesc
+{
+  udWorkerPoolCallback function;
+  void *pUserData = nullptr;
+  bool clearMemory = true; // Calls udFree on pUserData once the task is finished with
+  udWorkerPoolCallback postFunction; // Runs on the thread calling udWorkerPool_DoPostWork
+  udWorkerPoolPriority priority = udWPP_Normal;
+  uint32_t delayMs = 0; // The task won't start until at least this long after it's added
+};
+
+enum udWorkerPoolTaskState
+{
+  udWPTS_Queued, // Waiting for a worker, or for the task it continues from to complete
+  udWPTS_Running,
+  udWPTS_Complete, // The function has run, a postFunction may still be waiting for udWorkerPool_DoPostWork
+  udWPTS_Cancelled,
+};
+
+udResult udWorkerPool_Create(udWorkerPool **ppPool, uint32_t totalThreads, const char *pThreadNamePrefix = "udWorkerPool");
+
+// Creates a pool that starts workers, up to maxThreads, while queued tasks outnumber the workers free to run them
+// Workers above minThreads retire once they've had nothing to do for idleTimeoutMs
+udResult udWorkerPool_CreateElastic(udWorkerPool **ppPool, uint32_t minThreads, uint32_t maxThreads, uint32_t idleTimeoutMs = 5000, const char *pThreadNamePrefix = "udWorkerPool");
 void udWorkerPool_Destroy(udWorkerPool **ppPool);
 
 // Adds a function to run on a background thread, optionally with userdata. If clearMemory is true, it will call udFree on pUserData after running
-udResult udWorkerPool_AddTask(udWorkerPool *pPool, udWorkerPoolCallback func, void *pUserData = nullptr, bool clearMemory = true, udWorkerPoolCallback postFunction = nullptr);
+// Tasks added from one of the pool's own workers are queued on that worker (most recent first), idle workers steal the oldest tasks from busy ones
+// If ppTask is provided it receives a handle to the task, which must be released with udWorkerPool_ReleaseTask
+udResult udWorkerPool_AddTask(udWorkerPool *pPool, udWorkerPoolCallback func, void *pUserData = nullptr, bool clearMemory = true, udWorkerPoolCallback postFunction = nullptr, udWorkerPoolTask **ppTask = nullptr);
+
+// Adds a task with a priority and optional delay. Normal tasks are scheduled as above, critical and background tasks are shared by all workers
+// Continuations (udWorkerPool_Then) inherit the priority of the task they follow
+udResult udWorkerPool_AddTask(udWorkerPool *pPool, const udWorkerPoolTaskDesc *pDesc, udWorkerPoolTask **ppTask = nullptr);
+
+// Adds count tasks, locking each queue once and waking only as many sleeping workers as there are tasks to start
+// If ppTasks is provided it must hold count handles, which are all returned (even for tasks cancelled because queueing failed part way)
+udResult udWorkerPool_AddTasks(udWorkerPool *pPool, const udWorkerPoolTaskDesc *pTasks, size_t count, udWorkerPoolTask **ppTasks = nullptr);
+
+// Runs func on a worker once pTask completes, or cancels it along with pTask. If ppContinuation is provided it receives a handle to the new task
+udResult udWorkerPool_Then(udWorkerPoolTask *pTask, udWorkerPoolCallback func, void *pUserData = nullptr, bool clearMemory = true, udWorkerPoolTask **ppContinuation = nullptr);
+
+// Blocks until the task completes (udR_Success), is cancelled (udR_Cancelled) or waitMs passes (udR_Timeout)
+// When called from one of the pool's own workers, other tasks are run while waiting
+udResult udWorkerPool_WaitTask(udWorkerPoolTask *pTask, int waitMs = UDTHREAD_WAIT_INFINITE);
+
+// Cancels a task that hasn't started yet, freeing its data if requested and cancelling its continuations. Returns udR_NotAllowed if it already started
+udResult udWorkerPool_CancelTask(udWorkerPoolTask *pTask);
+
+udWorkerPoolTaskState udWorkerPool_GetTaskState(udWorkerPoolTask *pTask);
+
+// Releases a task handle, this doesn't cancel the task. Handles can be released after the pool is destroyed
+void udWorkerPool_ReleaseTask(udWorkerPoolTask **ppTask);
 
 // This must be run on the main thread, handles marshalling work back from worker threads if required
 // The parameter can be used to limit how much work is done each time this is called
@@ -29,4 +89,72 @@ udResult udWorkerPool_DoPostWork(udWorkerPool *pPool, int processLimit = 0);
 // Returns true if there are workers currently processing tasks or if workers should be processing tasks
 bool udWorkerPool_HasActiveWorkers(udWorkerPool *pPool, size_t *pActiveThreads = nullptr, size_t *pQueuedTasks = nullptr);
 
+// Returns the number of worker threads in the pool, which changes over time for elastic pools
+uint32_t udWorkerPool_GetThreadCount(udWorkerPool *pPool);
+
+// Wrap calls in a task that may block for a while (file or socket IO, waiting on other threads) so the pool can start another worker in its place
+// Blocked workers don't count towards the pool's maximum, any extra workers retire once the blocking ends and they run out of work
+// Calls can be nested, returns udR_NothingToDo when not called from one of the pool's workers
+udResult udWorkerPool_BeginBlocking(udWorkerPool *pPool);
+udResult udWorkerPool_EndBlocking(udWorkerPool *pPool);
+
+enum { udWorkerPool_LatencyBucketCount = 20 };
+
+// Counters for one worker, or for every worker the pool has had
+struct udWorkerPoolThreadStats
+{
+  bool isLive; // Workers that retired from an elastic pool keep their slot's counters
+  uint64_t tasksRun; // Including tasks run while waiting in udWorkerPool_WaitTask
+  uint64_t tasksStolen; // Taken from another worker's queue
+  double runTimeMs;
+  double idleTimeMs; // Looking for tasks or sleeping
+  uint64_t latencyHistogram[udWorkerPool_LatencyBucketCount]; // Time from queued to started. Bucket 0 counts under 1us, bucket i counts [2^(i-1), 2^i)us and the last bucket counts anything longer
+};
+
+struct udWorkerPoolStats
+{
+  udWorkerPoolThreadStats total;
+  uint32_t liveThreads;
+  uint32_t blockedThreads; // Inside udWorkerPool_BeginBlocking
+  uint32_t activeThreads;
+  uint32_t threadSlots; // Workers that have had statistics, udWorkerPool_GetStats fills this many entries of pThreadStats if there's room
+  uint64_t queuedTasks;
+  uint64_t delayedTasks;
+  uint64_t postTaskBacklog; // Waiting for udWorkerPool_DoPostWork
+};
+
+// Counters are updated as tasks run without locking, so a snapshot taken while the pool is busy can be slightly inconsistent
+udResult udWorkerPool_GetStats(udWorkerPool *pPool, udWorkerPoolStats *pStats, udWorkerPoolThreadStats *pThreadStats = nullptr, uint32_t threadStatsCount = 0);
+
+// Sets pJSON to an object with the pool's statistics and an array of per worker statistics
+udResult udWorkerPool_ExportStats(udWorkerPool *pPool, udJSON *pJSON);
+
+// Every intervalMs one of the workers exports the statistics as JSON and passes them to callback (or udDebugPrintf if it's null)
+// An interval of 0 stops dumping, the callback won't be called once this has returned
+using udWorkerPoolStatsCallback = udCallback<void(const char *pJSON)>;
+udResult udWorkerPool_SetStatsDump(udWorkerPool *pPool, uint32_t intervalMs, udWorkerPoolStatsCallback callback = nullptr);
+
+// A graph of tasks where each node is queued once the nodes it depends on have finished, including any post work
+// Graphs are templates that can be submitted again once finished, only changing the nodes or dependencies allocates
+struct udWorkerPoolGraph;
+
+udResult udWorkerPoolGraph_Create(udWorkerPoolGraph **ppGraph);
+void udWorkerPoolGraph_Destroy(udWorkerPoolGraph **ppGraph); // Waits for the graph to finish first
+
+// Removes every node and dependency, keeping the memory for the next time the graph is built
+udResult udWorkerPoolGraph_Clear(udWorkerPoolGraph *pGraph);
+
+// The node's data is never freed by the pool, use udWorkerPoolGraph_SetNodeUserData to point it at new data before each submit
+udResult udWorkerPoolGraph_AddNode(udWorkerPoolGraph *pGraph, udWorkerPoolCallback func, void *pUserData = nullptr, udWorkerPoolCallback postFunction = nullptr, uint32_t *pNodeIndex = nullptr);
+udResult udWorkerPoolGraph_AddDependency(udWorkerPoolGraph *pGraph, uint32_t nodeIndex, uint32_t dependsOnIndex);
+udResult udWorkerPoolGraph_SetNodeUserData(udWorkerPoolGraph *pGraph, uint32_t nodeIndex, void *pUserData);
+
+// Queues the nodes without dependencies, returns udR_InvalidConfiguration if the dependencies contain a cycle and udR_NotAllowed if the graph is still running
+// If a node is cancelled (for example by the pool being destroyed) the nodes that haven't started are cancelled too
+udResult udWorkerPoolGraph_Submit(udWorkerPool *pPool, udWorkerPoolGraph *pGraph);
+
+// Blocks until every node has finished (udR_Success), the graph was cancelled (udR_Cancelled) or waitMs passes (udR_Timeout)
+// A graph must be waited on before it's changed or submitted again
+udResult udWorkerPoolGraph_Wait(udWorkerPoolGraph *pGraph, int waitMs = UDTHREAD_WAIT_INFINITE);
+
 #endif // udWorkerPool_h__
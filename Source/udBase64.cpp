@@ -0,0 +1,512 @@
+#include "udPlatformUtil.h"
+#include "udStringUtil.h"
+
+// Base64 encoding and decoding (RFC 4648 alphabet). Runs of valid text are handled by SIMD kernels
+// (AVX2 or SSSE3 chosen at runtime, NEON on ARM64), anything else (whitespace, padding, short tails) by the scalar loops.
+// The SIMD decoder validates and translates 16 characters at a time using the nibble lookups described by Wojciech Mula
+// and Daniel Lemire in "Faster Base64 Encoding and Decoding using AVX2 Instructions" (https://arxiv.org/abs/1704.00605)
+
+#if defined(__x86_64__) || defined(_M_X64)
+# define UDBASE64_X64 1
+# include <immintrin.h>
+# if defined(__GNUC__)
+#  define UDBASE64_TARGET(features) __attribute__((target(features)))
+# else
+#  define UDBASE64_TARGET(features)
+# endif
+#else
+# define UDBASE64_X64 0
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+# define UDBASE64_NEON 1
+# if defined(_M_ARM64)
+#  include <arm64_neon.h>
+# else
+#  include <arm_neon.h>
+# endif
+#else
+# define UDBASE64_NEON 0
+#endif
+
+enum
+{
+  udBase64_MaxKernelChars = 64, // The most characters a kernel looks at in one step, smaller runs are left to the scalar loops
+};
+
+static const char s_udBase64Encode[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Value of each character, 0xFF for characters not in the alphabet
+static const uint8_t s_udBase64Decode[256] =
+{
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+  0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+#if UDBASE64_X64
+// ---------------------------------------------------------------------------------------
+// Convert 6-bit values to their characters, by adding an offset chosen by which range of the alphabet each value is in
+UDBASE64_TARGET("ssse3")
+static inline __m128i udBase64_ToCharsSSSE3(__m128i indices)
+{
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51)); // 1-12 for digits, '+' and '/', zero for letters
+  range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+  return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+}
+
+// ---------------------------------------------------------------------------------------
+// Spread 12 bytes (in the low 12 of 16) to sixteen 6-bit values, one per byte
+UDBASE64_TARGET("ssse3")
+static inline __m128i udBase64_SplitSSSE3(__m128i input)
+{
+  input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  __m128i high = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+  __m128i low = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(high, low);
+}
+
+// ---------------------------------------------------------------------------------------
+// Encode 12 bytes at a time, each step reads 16 bytes and writes 16 characters
+UDBASE64_TARGET("ssse3")
+static size_t udBase64_EncodeSSSE3(const uint8_t *pInput, size_t inputLength, char *pOutput, size_t outputLength, size_t *pInputUsed)
+{
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  while (inputLength - inputIndex >= 16 && outputLength - outputIndex >= 16)
+  {
+    __m128i input = _mm_loadu_si128((const __m128i*)(pInput + inputIndex));
+    _mm_storeu_si128((__m128i*)(pOutput + outputIndex), udBase64_ToCharsSSSE3(udBase64_SplitSSSE3(input)));
+    inputIndex += 12;
+    outputIndex += 16;
+  }
+  *pInputUsed = inputIndex;
+  return outputIndex;
+}
+
+// ---------------------------------------------------------------------------------------
+// Encode 24 bytes at a time, each step reads 28 bytes and writes 32 characters
+UDBASE64_TARGET("avx2")
+static size_t udBase64_EncodeAVX2(const uint8_t *pInput, size_t inputLength, char *pOutput, size_t outputLength, size_t *pInputUsed)
+{
+  const __m256i split = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1, 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  while (inputLength - inputIndex >= 28 && outputLength - outputIndex >= 32)
+  {
+    __m256i input = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(pInput + inputIndex))), _mm_loadu_si128((const __m128i*)(pInput + inputIndex + 12)), 1);
+    input = _mm256_shuffle_epi8(input, split);
+    __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+    __m256i low = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(high, low);
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+    _mm256_storeu_si256((__m256i*)(pOutput + outputIndex), _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range)));
+    inputIndex += 24;
+    outputIndex += 32;
+  }
+  *pInputUsed = inputIndex;
+  return outputIndex;
+}
+
+// ---------------------------------------------------------------------------------------
+// Decode 16 characters at a time until one isn't in the alphabet, each step writes 16 bytes of which 12 are kept
+// pOutput may be null to only validate and count
+UDBASE64_TARGET("ssse3")
+static size_t udBase64_DecodeSSSE3(const char *pInput, size_t inputLength, uint8_t *pOutput, size_t outputLength, size_t *pInputUsed)
+{
+  // Each character's low nibble selects a set of bits that must not intersect the set selected by its high nibble
+  const __m128i validLow = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i validHigh = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i offsets = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  while (inputLength - inputIndex >= 16 && (!pOutput || outputLength - outputIndex >= 16))
+  {
+    __m128i input = _mm_loadu_si128((const __m128i*)(pInput + inputIndex));
+    __m128i highNibbles = _mm_and_si128(_mm_srli_epi32(input, 4), nibbleMask);
+    __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(validLow, _mm_and_si128(input, nibbleMask)), _mm_shuffle_epi8(validHigh, highNibbles));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(invalid, _mm_setzero_si128())))
+      break;
+    if (pOutput)
+    {
+      // '/' shares its high nibble with '+', so is offset by the entry before
+      __m128i values = _mm_add_epi8(input, _mm_shuffle_epi8(offsets, _mm_add_epi8(_mm_cmpeq_epi8(input, _mm_set1_epi8('/')), highNibbles)));
+      __m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+      _mm_storeu_si128((__m128i*)(pOutput + outputIndex), _mm_shuffle_epi8(merged, pack));
+    }
+    inputIndex += 16;
+    outputIndex += 12;
+  }
+  *pInputUsed = inputIndex;
+  return outputIndex;
+}
+
+// ---------------------------------------------------------------------------------------
+// Decode 32 characters at a time until one isn't in the alphabet, each step writes 32 bytes of which 24 are kept
+UDBASE64_TARGET("avx2")
+static size_t udBase64_DecodeAVX2(const char *pInput, size_t inputLength, uint8_t *pOutput, size_t outputLength, size_t *pInputUsed)
+{
+  const __m256i validLow = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i validHigh = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                             0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i offsets = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  while (inputLength - inputIndex >= 32 && (!pOutput || outputLength - outputIndex >= 32))
+  {
+    __m256i input = _mm256_loadu_si256((const __m256i*)(pInput + inputIndex));
+    __m256i highNibbles = _mm256_and_si256(_mm256_srli_epi32(input, 4), nibbleMask);
+    if (!_mm256_testz_si256(_mm256_shuffle_epi8(validLow, _mm256_and_si256(input, nibbleMask)), _mm256_shuffle_epi8(validHigh, highNibbles)))
+      break;
+    if (pOutput)
+    {
+      __m256i values = _mm256_add_epi8(input, _mm256_shuffle_epi8(offsets, _mm256_add_epi8(_mm256_cmpeq_epi8(input, _mm256_set1_epi8('/')), highNibbles)));
+      __m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+      merged = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7)); // Close the gap between the lanes
+      _mm256_storeu_si256((__m256i*)(pOutput + outputIndex), merged);
+    }
+    inputIndex += 32;
+    outputIndex += 24;
+  }
+  *pInputUsed = inputIndex;
+  return outputIndex;
+}
+#endif // UDBASE64_X64
+
+#if UDBASE64_NEON
+// ---------------------------------------------------------------------------------------
+// Encode 48 bytes to 64 characters at a time, the loads and stores de-interleave and interleave the bytes
+static size_t udBase64_EncodeNEON(const uint8_t *pInput, size_t inputLength, char *pOutput, size_t outputLength, size_t *pInputUsed)
+{
+  const uint8_t *pTable = (const uint8_t*)s_udBase64Encode;
+  uint8x16x4_t table = { { vld1q_u8(pTable), vld1q_u8(pTable + 16), vld1q_u8(pTable + 32), vld1q_u8(pTable + 48) } };
+  const uint8x16_t mask = vdupq_n_u8(0x3F);
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  while (inputLength - inputIndex >= 48 && outputLength - outputIndex >= 64)
+  {
+    uint8x16x3_t input = vld3q_u8(pInput + inputIndex);
+    uint8x16x4_t output;
+    output.val[0] = vqtbl4q_u8(table, vshrq_n_u8(input.val[0], 2));
+    output.val[1] = vqtbl4q_u8(table, vandq_u8(vorrq_u8(vshrq_n_u8(input.val[1], 4), vshlq_n_u8(input.val[0], 4)), mask));
+    output.val[2] = vqtbl4q_u8(table, vandq_u8(vorrq_u8(vshrq_n_u8(input.val[2], 6), vshlq_n_u8(input.val[1], 2)), mask));
+    output.val[3] = vqtbl4q_u8(table, vandq_u8(input.val[2], mask));
+    vst4q_u8((uint8_t*)pOutput + outputIndex, output);
+    inputIndex += 48;
+    outputIndex += 64;
+  }
+  *pInputUsed = inputIndex;
+  return outputIndex;
+}
+
+// ---------------------------------------------------------------------------------------
+// Decode 64 characters to 48 bytes at a time until one isn't in the alphabet, the lookups use the first half of the scalar table
+static size_t udBase64_DecodeNEON(const char *pInput, size_t inputLength, uint8_t *pOutput, size_t outputLength, size_t *pInputUsed)
+{
+  uint8x16x4_t tableLow = { { vld1q_u8(s_udBase64Decode), vld1q_u8(s_udBase64Decode + 16), vld1q_u8(s_udBase64Decode + 32), vld1q_u8(s_udBase64Decode + 48) } };
+  uint8x16x4_t tableHigh = { { vld1q_u8(s_udBase64Decode + 64), vld1q_u8(s_udBase64Decode + 80), vld1q_u8(s_udBase64Decode + 96), vld1q_u8(s_udBase64Decode + 112) } };
+  const uint8x16_t offset = vdupq_n_u8(64);
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  while (inputLength - inputIndex >= 64 && (!pOutput || outputLength - outputIndex >= 48))
+  {
+    uint8x16x4_t input = vld4q_u8((const uint8_t*)pInput + inputIndex);
+    uint8x16x4_t values;
+    uint8x16_t invalid = vdupq_n_u8(0);
+    for (int i = 0; i < 4; ++i)
+    {
+      // Characters above 127 are out of range of both lookups so are marked invalid separately
+      values.val[i] = vqtbx4q_u8(vqtbl4q_u8(tableLow, input.val[i]), tableHigh, vsubq_u8(input.val[i], offset));
+      invalid = vorrq_u8(invalid, vorrq_u8(values.val[i], vcgeq_u8(input.val[i], vdupq_n_u8(128))));
+    }
+    if (vmaxvq_u8(invalid) >= 64)
+      break;
+    if (pOutput)
+    {
+      uint8x16x3_t output;
+      output.val[0] = vorrq_u8(vshlq_n_u8(values.val[0], 2), vshrq_n_u8(values.val[1], 4));
+      output.val[1] = vorrq_u8(vshlq_n_u8(values.val[1], 4), vshrq_n_u8(values.val[2], 2));
+      output.val[2] = vorrq_u8(vshlq_n_u8(values.val[2], 6), values.val[3]);
+      vst3q_u8(pOutput + outputIndex, output);
+    }
+    inputIndex += 64;
+    outputIndex += 48;
+  }
+  *pInputUsed = inputIndex;
+  return outputIndex;
+}
+#endif // UDBASE64_NEON
+
+// ---------------------------------------------------------------------------------------
+// Encode whole groups of 3 bytes with the best kernel available, returns the characters written
+static size_t udBase64_EncodeBlocks(const uint8_t *pInput, size_t inputLength, char *pOutput, size_t outputLength, size_t *pInputUsed)
+{
+#if UDBASE64_X64
+  if (udCPUSupportsAVX2())
+    return udBase64_EncodeAVX2(pInput, inputLength, pOutput, outputLength, pInputUsed);
+  if (udCPUSupportsSSSE3())
+    return udBase64_EncodeSSSE3(pInput, inputLength, pOutput, outputLength, pInputUsed);
+#elif UDBASE64_NEON
+  return udBase64_EncodeNEON(pInput, inputLength, pOutput, outputLength, pInputUsed);
+#else
+  udUnused(pInput);
+  udUnused(inputLength);
+  udUnused(pOutput);
+  udUnused(outputLength);
+#endif
+  *pInputUsed = 0;
+  return 0;
+}
+
+// ---------------------------------------------------------------------------------------
+// Decode whole groups of 4 characters with the best kernel available until one isn't in the alphabet, returns the bytes written
+// The kernels write at most as far as they have read, so in-place decoding is safe
+static size_t udBase64_DecodeBlocks(const char *pInput, size_t inputLength, uint8_t *pOutput, size_t outputLength, size_t *pInputUsed)
+{
+#if UDBASE64_X64
+  if (udCPUSupportsAVX2())
+    return udBase64_DecodeAVX2(pInput, inputLength, pOutput, outputLength, pInputUsed);
+  if (udCPUSupportsSSSE3())
+    return udBase64_DecodeSSSE3(pInput, inputLength, pOutput, outputLength, pInputUsed);
+#elif UDBASE64_NEON
+  return udBase64_DecodeNEON(pInput, inputLength, pOutput, outputLength, pInputUsed);
+#else
+  udUnused(pInput);
+  udUnused(inputLength);
+  udUnused(pOutput);
+  udUnused(outputLength);
+#endif
+  *pInputUsed = 0;
+  return 0;
+}
+
+// *********************************************************************
+void udBase64Decoder_Init(udBase64Decoder *pDecoder)
+{
+  if (pDecoder)
+    memset(pDecoder, 0, sizeof(*pDecoder));
+}
+
+// *********************************************************************
+udResult udBase64Decoder_Update(udBase64Decoder *pDecoder, const char *pString, size_t length, uint8_t *pOutput, size_t outputLength, size_t *pInputUsed /*= nullptr*/, size_t *pOutputWritten /*= nullptr*/)
+{
+  udResult result;
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  size_t scalarUntil = 0; // Characters before this are known to be unsuitable for the kernels
+
+  UD_ERROR_NULL(pDecoder, udR_InvalidParameter);
+  UD_ERROR_IF(!pString && length, udR_InvalidParameter);
+  if (!pOutput)
+    outputLength = SIZE_MAX;
+
+  while (inputIndex < length)
+  {
+    if (pDecoder->accumBits == 0 && inputIndex >= scalarUntil)
+    {
+      size_t inputUsed;
+      outputIndex += udBase64_DecodeBlocks(pString + inputIndex, length - inputIndex, pOutput ? pOutput + outputIndex : nullptr, outputLength - outputIndex, &inputUsed);
+      inputIndex += inputUsed;
+      scalarUntil = inputIndex + udBase64_MaxKernelChars;
+      if (inputIndex == length)
+        break;
+    }
+
+    uint32_t value = s_udBase64Decode[(uint8_t)pString[inputIndex]];
+    if (value > 63)
+    {
+      ++pDecoder->skippedCount;
+      ++inputIndex;
+      continue;
+    }
+    if (pDecoder->accumBits >= 2 && outputIndex >= outputLength)
+      break; // This character completes a byte there is no room for
+    ++inputIndex;
+    pDecoder->accum = (pDecoder->accum << 6) | value;
+    pDecoder->accumBits += 6;
+    if (pDecoder->accumBits >= 8)
+    {
+      pDecoder->accumBits -= 8;
+      if (pOutput)
+        pOutput[outputIndex] = uint8_t(pDecoder->accum >> pDecoder->accumBits);
+      ++outputIndex;
+      pDecoder->accum &= (1 << pDecoder->accumBits) - 1;
+    }
+  }
+  result = udR_Success;
+
+epilogue:
+  if (pInputUsed)
+    *pInputUsed = inputIndex;
+  if (pOutputWritten)
+    *pOutputWritten = outputIndex;
+  return result;
+}
+
+// *********************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udBase64Decode(const char *pString, size_t length, uint8_t *pOutput, size_t outputLength, size_t *pOutputLengthWritten /*= nullptr*/)
+{
+  udResult result;
+  udBase64Decoder decoder;
+  size_t inputUsed = 0;
+  size_t outputIndex = 0;
+
+  if (!length && pString)
+    length = udStrlen(pString);
+
+  if (!pOutput && pOutputLengthWritten)
+  {
+    outputIndex = length / 4 * 3;
+    UD_ERROR_SET(udR_Success);
+  }
+
+  UD_ERROR_NULL(pString, udR_InvalidParameter);
+  UD_ERROR_NULL(pOutput, udR_InvalidParameter);
+
+  udBase64Decoder_Init(&decoder);
+  UD_ERROR_CHECK(udBase64Decoder_Update(&decoder, pString, length, pOutput, outputLength, &inputUsed, &outputIndex));
+  UD_ERROR_IF(inputUsed < length, udR_BufferTooSmall);
+  result = udR_Success;
+
+epilogue:
+  if (pOutputLengthWritten)
+    *pOutputLengthWritten = outputIndex;
+
+  return result;
+}
+
+// *********************************************************************
+// Author: Dave Pevreal, September 2017
+udResult udBase64Decode(uint8_t **ppOutput, size_t *pOutputLength, const char *pString)
+{
+  udResult result;
+  uint8_t *pOutput = nullptr;
+
+  UD_ERROR_NULL(ppOutput, udR_InvalidParameter);
+  UD_ERROR_NULL(pOutputLength, udR_InvalidParameter);
+  UD_ERROR_NULL(pString, udR_InvalidParameter);
+
+  result = udBase64Decode(pString, 0, nullptr, 0, pOutputLength);
+  UD_ERROR_HANDLE();
+  pOutput = udAllocType(uint8_t, *pOutputLength, udAF_None);
+  UD_ERROR_NULL(pOutput, udR_MemoryAllocationFailure);
+  result = udBase64Decode(pString, 0, pOutput, *pOutputLength, pOutputLength);
+  UD_ERROR_HANDLE();
+
+  *ppOutput = pOutput;
+  pOutput = nullptr;
+  result = udR_Success;
+
+epilogue:
+  udFree(pOutput);
+  return result;
+}
+
+// *********************************************************************
+// Author: Paul Fox, March 2016
+udResult udBase64Encode(const void *pBinary, size_t binaryLength, char *pString, size_t strLength, size_t *pOutputLengthWritten /*= nullptr*/)
+{
+  udResult result;
+  uint32_t accum = 0; // Accumulator for data (read 8 bits at a time but only consume 6)
+  int accumBits = 0;
+  size_t inputIndex = 0;
+  size_t outputIndex = 0;
+  size_t expectedOutputLength = (binaryLength + 2) / 3 * 4 + 1; // +1 for nul terminator
+
+  if (!pString && pOutputLengthWritten)
+  {
+    outputIndex = expectedOutputLength;
+    UD_ERROR_SET(udR_Success);
+  }
+
+  UD_ERROR_NULL(pString, udR_InvalidParameter);
+  UD_ERROR_IF(!pBinary && binaryLength, udR_InvalidParameter);
+
+  if (binaryLength)
+    outputIndex = udBase64_EncodeBlocks((const uint8_t*)pBinary, binaryLength, pString, strLength, &inputIndex);
+
+  for (; inputIndex < binaryLength; ++inputIndex)
+  {
+    accum = (accum << 8) | ((uint8_t*)pBinary)[inputIndex];
+    accumBits += 8;
+    while (accumBits >= 6)
+    {
+      UD_ERROR_IF(outputIndex >= strLength, udR_BufferTooSmall);
+      pString[outputIndex] = s_udBase64Encode[((accum >> (accumBits - 6)) & 0x3F)];
+      ++outputIndex;
+      accumBits -= 6;
+    }
+  }
+
+  if (accumBits == 2)
+  {
+    UD_ERROR_IF(outputIndex >= strLength + 3, udR_BufferTooSmall);
+    pString[outputIndex] = s_udBase64Encode[(accum & 0x3) << 4];
+    pString[outputIndex+1] = '='; //Pad chars
+    pString[outputIndex+2] = '=';
+    outputIndex += 3;
+  }
+  else if (accumBits == 4)
+  {
+    UD_ERROR_IF(outputIndex + 2 >= strLength, udR_BufferTooSmall);
+    pString[outputIndex] = s_udBase64Encode[(accum & 0xF) << 2];
+    pString[outputIndex+1] = '='; //Pad chars
+    outputIndex += 2;
+  }
+  pString[outputIndex++] = 0; // Null terminate if room in the string
+
+  UD_ERROR_IF(outputIndex != expectedOutputLength, udR_InternalError); // Okay, the horse may have bolted at this point.
+
+  result = udR_Success;
+
+epilogue:
+  if (pOutputLengthWritten)
+    *pOutputLengthWritten = outputIndex;
+
+  return result;
+}
+
+// *********************************************************************
+// Author: Dave Pevreal, May 2017
+udResult udBase64Encode(const char **ppDestStr, const void *pBinary, size_t binaryLength)
+{
+  udResult result;
+  size_t expectedOutputLength = (binaryLength + 2) / 3 * 4 + 1; // +1 for nul terminator
+  char *pStr = nullptr;
+
+  UD_ERROR_NULL(ppDestStr, udR_InvalidParameter);
+  pStr = udAllocType(char, expectedOutputLength, udAF_None);
+  UD_ERROR_NULL(pStr, udR_MemoryAllocationFailure);
+  result = udBase64Encode(pBinary, binaryLength, pStr, expectedOutputLength);
+  UD_ERROR_HANDLE();
+  *ppDestStr = pStr;
+  pStr = nullptr;
+  result = udR_Success;
+
+epilogue:
+  udFree(pStr);
+  return result;
+}
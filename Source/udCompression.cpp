@@ -1,10 +1,20 @@
 #include "udStringUtil.h"
 #include "udCompression.h"
 #include "udFileHandler.h"
+#include "udChunkedArray.h"
+#include "udPlatformUtil.h"
+#include "udWorkerPool.h"
 #include "libdeflate.h"
-#include <atomic>
 #include <algorithm>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define UD_FASTLZ_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+# include <arm_neon.h>
+# define UD_FASTLZ_NEON 1
+#endif
+
 // ****************************************************************************
 // Author: Dave Pevreal, August 2018
 const char *udCompressionTypeAsString(udCompressionType type)
@@ -15,13 +25,287 @@ const char *udCompressionTypeAsString(udCompressionType type)
     case udCT_RawDeflate:   return "RawDeflate";
     case udCT_ZlibDeflate:  return "ZlibDeflate";
     case udCT_GzipDeflate:  return "GzipDeflate";
+    case udCT_FastLZ:       return "FastLZ";
     default:                return nullptr;
   }
 }
 
+// The FastLZ codec emits the LZ4 block format: a sequence of tokens, each being a literal run
+// followed by a back reference of at least 4 bytes within the previous 64KB of output
+enum
+{
+  udFastLZ_HashLog = 12,      // 4096 entry hash table, 16KB, fits comfortably in L1
+  udFastLZ_MinMatch = 4,      // Minimum match length encodable
+  udFastLZ_LastLiterals = 5,  // The last 5 bytes are always literals
+  udFastLZ_MFLimit = 12,      // The last match must start at least 12 bytes before the end of the block
+  udFastLZ_MaxOffset = 65535, // Offsets are encoded in 16 bits
+  udFastLZ_RunMask = 15,      // Mask of the literal length / match length nibbles of the token
+};
+
+// ----------------------------------------------------------------------------
+// Unaligned little-endian loads used by the FastLZ codec
+static UDFORCE_INLINE uint32_t udFastLZ_Read32(const uint8_t *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+static UDFORCE_INLINE uint64_t udFastLZ_Read64(const uint8_t *p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+static UDFORCE_INLINE uint32_t udFastLZ_Hash(uint32_t sequence) { return (sequence * 2654435761U) >> (32 - udFastLZ_HashLog); }
+
+// ----------------------------------------------------------------------------
+// Copy 16 bytes with a single vector load/store where available
+static UDFORCE_INLINE void udFastLZ_Copy16(uint8_t *pDest, const uint8_t *pSource)
+{
+#if UD_FASTLZ_SSE2
+  _mm_storeu_si128((__m128i*)pDest, _mm_loadu_si128((const __m128i*)pSource));
+#elif UD_FASTLZ_NEON
+  vst1q_u8(pDest, vld1q_u8(pSource));
+#else
+  memcpy(pDest, pSource, 16);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Count the number of matching bytes between two pointers, 8 bytes at a time
+static UDFORCE_INLINE size_t udFastLZ_MatchLength(const uint8_t *pIn, const uint8_t *pMatch, const uint8_t *pInLimit)
+{
+  const uint8_t *pStart = pIn;
+  while (pIn + 8 <= pInLimit)
+  {
+    uint64_t diff = udFastLZ_Read64(pIn) ^ udFastLZ_Read64(pMatch);
+    if (diff)
+    {
+#if defined(_MSC_VER)
+      unsigned long index;
+      _BitScanForward64(&index, diff);
+      return (size_t)(pIn - pStart) + (index >> 3);
+#else
+      return (size_t)(pIn - pStart) + ((size_t)__builtin_ctzll(diff) >> 3);
+#endif
+    }
+    pIn += 8;
+    pMatch += 8;
+  }
+  while (pIn < pInLimit && *pIn == *pMatch)
+  {
+    ++pIn;
+    ++pMatch;
+  }
+  return (size_t)(pIn - pStart);
+}
+
+// ----------------------------------------------------------------------------
+// Write an LZ4 style length extension (a run of 255s followed by the remainder)
+static UDFORCE_INLINE uint8_t *udFastLZ_WriteLength(uint8_t *pOut, size_t length)
+{
+  while (length >= 255)
+  {
+    *pOut++ = 255;
+    length -= 255;
+  }
+  *pOut++ = (uint8_t)length;
+  return pOut;
+}
+
+// ----------------------------------------------------------------------------
+// Worst case compressed size, incompressible input expands by a length byte per 255 literals
+static size_t udFastLZ_CompressBound(size_t sourceSize)
+{
+  return sourceSize + (sourceSize / 255) + 16;
+}
+
+// ----------------------------------------------------------------------------
+// Emit a single sequence (literals and an optional match), returns nullptr if destination space exhausted
+static uint8_t *udFastLZ_EmitSequence(uint8_t *pOut, const uint8_t *pOutEnd, const uint8_t *pLiterals, size_t literalLength, size_t offset, size_t matchLength)
+{
+  // Worst case is token + literal length run + literals + offset + match length run
+  if ((size_t)(pOutEnd - pOut) < 1 + (literalLength / 255) + 1 + literalLength + 2 + (matchLength / 255) + 1)
+    return nullptr;
+
+  uint8_t *pToken = pOut++;
+  if (literalLength >= udFastLZ_RunMask)
+  {
+    *pToken = udFastLZ_RunMask << 4;
+    pOut = udFastLZ_WriteLength(pOut, literalLength - udFastLZ_RunMask);
+  }
+  else
+  {
+    *pToken = (uint8_t)(literalLength << 4);
+  }
+  memcpy(pOut, pLiterals, literalLength);
+  pOut += literalLength;
+
+  if (matchLength)
+  {
+    pOut[0] = (uint8_t)offset;
+    pOut[1] = (uint8_t)(offset >> 8);
+    pOut += 2;
+    matchLength -= udFastLZ_MinMatch;
+    if (matchLength >= udFastLZ_RunMask)
+    {
+      *pToken |= udFastLZ_RunMask;
+      pOut = udFastLZ_WriteLength(pOut, matchLength - udFastLZ_RunMask);
+    }
+    else
+    {
+      *pToken |= (uint8_t)matchLength;
+    }
+  }
+  return pOut;
+}
+
+// ----------------------------------------------------------------------------
+// Compress to the LZ4 block format using a single-probe hash table, returns compressed size or zero on failure
+static size_t udFastLZ_Compress(const uint8_t *pSource, size_t sourceSize, uint8_t *pDest, size_t destSize)
+{
+  uint32_t hashTable[1 << udFastLZ_HashLog];
+  const uint8_t *pIn = pSource;
+  const uint8_t *pAnchor = pSource;
+  const uint8_t *pInEnd = pSource + sourceSize;
+  uint8_t *pOut = pDest;
+  uint8_t *pOutEnd = pDest + destSize;
+
+  memset(hashTable, 0, sizeof(hashTable));
+  if (sourceSize > udFastLZ_MFLimit)
+  {
+    const uint8_t *pMatchFindLimit = pInEnd - udFastLZ_MFLimit;
+    const uint8_t *pMatchLimit = pInEnd - udFastLZ_LastLiterals;
+
+    while (pIn < pMatchFindLimit)
+    {
+      uint32_t sequence = udFastLZ_Read32(pIn);
+      uint32_t hash = udFastLZ_Hash(sequence);
+      // Positions are stored truncated to 32 bits, a stale or wrapped entry is rejected by the distance and content checks
+      const uint8_t *pMatch = pSource + hashTable[hash];
+      hashTable[hash] = (uint32_t)(pIn - pSource);
+
+      if (pMatch >= pIn || (size_t)(pIn - pMatch) > udFastLZ_MaxOffset || udFastLZ_Read32(pMatch) != sequence)
+      {
+        // Step faster through incompressible data, the further from the last match the bigger the step
+        pIn += 1 + ((size_t)(pIn - pAnchor) >> 6);
+        continue;
+      }
+
+      // Extend the match backwards into the pending literals
+      while (pIn > pAnchor && pMatch > pSource && pIn[-1] == pMatch[-1])
+      {
+        --pIn;
+        --pMatch;
+      }
+
+      size_t matchLength = udFastLZ_MinMatch + udFastLZ_MatchLength(pIn + udFastLZ_MinMatch, pMatch + udFastLZ_MinMatch, pMatchLimit);
+      pOut = udFastLZ_EmitSequence(pOut, pOutEnd, pAnchor, (size_t)(pIn - pAnchor), (size_t)(pIn - pMatch), matchLength);
+      if (!pOut)
+        return 0;
+
+      pIn += matchLength;
+      pAnchor = pIn;
+      // Seed the table with a position inside the match to improve the chance of finding the next one
+      if (pIn < pMatchFindLimit)
+        hashTable[udFastLZ_Hash(udFastLZ_Read32(pIn - 2))] = (uint32_t)(pIn - 2 - pSource);
+    }
+  }
+
+  // Remaining bytes are emitted as a final literal-only sequence
+  pOut = udFastLZ_EmitSequence(pOut, pOutEnd, pAnchor, (size_t)(pInEnd - pAnchor), 0, 0);
+  if (!pOut)
+    return 0;
+  return (size_t)(pOut - pDest);
+}
+
+// ----------------------------------------------------------------------------
+// Decompress an LZ4 block, bounds checking both input and output
+static udResult udFastLZ_Decompress(const uint8_t *pSource, size_t sourceSize, uint8_t *pDest, size_t destSize, size_t *pInflatedSize)
+{
+  const uint8_t *pIn = pSource;
+  const uint8_t *pInEnd = pSource + sourceSize;
+  uint8_t *pOut = pDest;
+  uint8_t *pOutEnd = pDest + destSize;
+
+  while (pIn < pInEnd)
+  {
+    uint8_t token = *pIn++;
+
+    // Literals
+    size_t length = token >> 4;
+    if (length == udFastLZ_RunMask)
+    {
+      uint8_t extra;
+      do
+      {
+        if (pIn >= pInEnd)
+          return udR_CorruptData;
+        extra = *pIn++;
+        length += extra;
+      } while (extra == 255);
+    }
+    if (length > (size_t)(pInEnd - pIn))
+      return udR_CorruptData;
+    if (length > (size_t)(pOutEnd - pOut))
+      return udR_BufferTooSmall;
+    memcpy(pOut, pIn, length);
+    pIn += length;
+    pOut += length;
+
+    // The final sequence has no match
+    if (pIn == pInEnd)
+      break;
+
+    // Match
+    if (pInEnd - pIn < 2)
+      return udR_CorruptData;
+    size_t offset = (size_t)pIn[0] | ((size_t)pIn[1] << 8);
+    pIn += 2;
+    if (offset == 0 || offset > (size_t)(pOut - pDest))
+      return udR_CorruptData;
+
+    length = token & udFastLZ_RunMask;
+    if (length == udFastLZ_RunMask)
+    {
+      uint8_t extra;
+      do
+      {
+        if (pIn >= pInEnd)
+          return udR_CorruptData;
+        extra = *pIn++;
+        length += extra;
+      } while (extra == 255);
+    }
+    length += udFastLZ_MinMatch;
+    if (length > (size_t)(pOutEnd - pOut))
+      return udR_BufferTooSmall;
+
+    const uint8_t *pMatch = pOut - offset;
+    uint8_t *pMatchEnd = pOut + length;
+    if (offset < 16)
+    {
+      // Overlapping match; copy the first bytes singly to replicate the pattern, after which the pattern
+      // repeats at a multiple of offset that is at least 16 bytes back, allowing vector copies
+      size_t count = std::min(length, (size_t)16);
+      for (size_t i = 0; i < count; ++i)
+        pOut[i] = pMatch[i];
+      pOut += count;
+      if (pOut < pMatchEnd)
+        pMatch = pOut - offset * ((16 + offset - 1) / offset);
+    }
+    while ((size_t)(pMatchEnd - pOut) >= 16)
+    {
+      udFastLZ_Copy16(pOut, pMatch);
+      pOut += 16;
+      pMatch += 16;
+    }
+    // The source is at least 16 bytes behind so the tail never overlaps
+    memcpy(pOut, pMatch, (size_t)(pMatchEnd - pOut));
+    pOut = pMatchEnd;
+  }
+
+  *pInflatedSize = (size_t)(pOut - pDest);
+  return udR_Success;
+}
+
+// Preset dictionary compression is implemented with miniz, which is included further below
+static udResult udCompression_DeflateWithDictionary(void **ppDest, size_t *pDestSize, const void *pSource, size_t sourceSize, udCompressionType type, const udCompressionDictionary *pDictionary);
+static udResult udCompression_InflateWithDictionary(void *pDest, size_t destSize, const void *pSource, size_t sourceSize, size_t *pInflatedSize, udCompressionType type, const udCompressionDictionary *pDictionary);
+
 // ****************************************************************************
 // Author: Dave Pevreal, November 2017
-udResult udCompression_Deflate(void **ppDest, size_t *pDestSize, const void *pSource, size_t sourceSize, udCompressionType type)
+udResult udCompression_Deflate(void **ppDest, size_t *pDestSize, const void *pSource, size_t sourceSize, udCompressionType type, const udCompressionDictionary *pDictionary)
 {
   udResult result;
   size_t destSize;
@@ -36,6 +320,11 @@ udResult udCompression_Deflate(void **ppDest, size_t *pDestSize, const void *pSo
     *pDestSize = 0;
     UD_ERROR_SET(udR_Success);
   }
+  if (pDictionary)
+  {
+    UD_ERROR_CHECK(udCompression_DeflateWithDictionary(ppDest, pDestSize, pSource, sourceSize, type, pDictionary));
+    UD_ERROR_SET(udR_Success);
+  }
   switch (type)
   {
     case udCT_None:
@@ -102,6 +391,21 @@ udResult udCompression_Deflate(void **ppDest, size_t *pDestSize, const void *pSo
       pTemp = nullptr; // Prevent freeing on successful realloc
       break;
 
+    case udCT_FastLZ:
+      destSize = udFastLZ_CompressBound(sourceSize);
+      pTemp = udAlloc(destSize);
+      UD_ERROR_NULL(pTemp, udR_MemoryAllocationFailure);
+
+      destSize = udFastLZ_Compress((const uint8_t*)pSource, sourceSize, (uint8_t*)pTemp, destSize);
+      UD_ERROR_IF(destSize == 0, udR_CompressionError);
+
+      // Size the allocation as required
+      *pDestSize = destSize;
+      *ppDest = udRealloc(pTemp, destSize);
+      UD_ERROR_NULL(*ppDest, udR_MemoryAllocationFailure);
+      pTemp = nullptr; // Prevent freeing on successful realloc
+      break;
+
     default:
       UD_ERROR_SET(udR_InvalidParameter);
   }
@@ -109,6 +413,7 @@ udResult udCompression_Deflate(void **ppDest, size_t *pDestSize, const void *pSo
   result = udR_Success;
 
 epilogue:
+  udFree(pTemp);
   if (ldComp)
     libdeflate_free_compressor(ldComp);
 
@@ -117,7 +422,7 @@ epilogue:
 
 // ****************************************************************************
 // Author: Dave Pevreal, November 2017
-udResult udCompression_Inflate(void *pDest, size_t destSize, const void *pSource, size_t sourceSize, size_t *pInflatedSize, udCompressionType type)
+udResult udCompression_Inflate(void *pDest, size_t destSize, const void *pSource, size_t sourceSize, size_t *pInflatedSize, udCompressionType type, const udCompressionDictionary *pDictionary)
 {
   udResult result;
   size_t inflatedSize;
@@ -133,6 +438,14 @@ udResult udCompression_Inflate(void *pDest, size_t destSize, const void *pSource
       *pInflatedSize = 0;
     UD_ERROR_SET(udR_Success);
   }
+  if (pDictionary)
+  {
+    result = udCompression_InflateWithDictionary(pDest, destSize, pSource, sourceSize, pInflatedSize, type, pDictionary);
+    if (result == udR_BufferTooSmall)
+      UD_ERROR_SET_NO_BREAK(udR_BufferTooSmall);
+    UD_ERROR_HANDLE();
+    UD_ERROR_SET(udR_Success);
+  }
   switch (type)
   {
   case udCT_None:
@@ -196,6 +509,21 @@ udResult udCompression_Inflate(void *pDest, size_t destSize, const void *pSource
       memcpy(pDest, pTemp, inflatedSize);
     break;
 
+  case udCT_FastLZ:
+    pTemp = (pDest == pSource) ? udAlloc(destSize) : pDest;
+    UD_ERROR_NULL(pTemp, udR_MemoryAllocationFailure);
+
+    result = udFastLZ_Decompress((const uint8_t*)pSource, sourceSize, (uint8_t*)pTemp, destSize, &inflatedSize);
+    if (result == udR_BufferTooSmall)
+      UD_ERROR_SET_NO_BREAK(udR_BufferTooSmall);
+    UD_ERROR_IF(result != udR_Success, udR_CompressionError);
+
+    if (pInflatedSize)
+      *pInflatedSize = inflatedSize;
+    if (pTemp != pDest)
+      memcpy(pDest, pTemp, inflatedSize);
+    break;
+
   default:
     UD_ERROR_SET(udR_InvalidParameter);
   }
@@ -273,245 +601,1015 @@ epilogue:
 # pragma GCC diagnostic pop
 #endif
 
-struct udFile_Zip : public udFile
+struct udCompressionDictionary
 {
-  mz_zip_archive mz;
-  udFile * volatile pZipFile;
-  uint8_t *pFileData;
-  int index; // Index within the zip of the current file
-  std::atomic<int32_t> lengthRead;
-  std::atomic<bool> readComplete;
-  std::atomic<bool> abortRead; // Set to true and wait for readComplete
-  udRWLock *pRWLock;
+  uint8_t *pData;
+  size_t length;
+  uint32_t adler32; // The zlib DICTID
 };
 
-// ----------------------------------------------------------------------------
-// Author: Dave Pevreal, November 2019
-// Helper to wait for reads to abort
-static void AbortRead(udFile_Zip *pZip)
+enum
 {
-  while (pZip->pFileData && !pZip->readComplete)
-  {
-    udDebugPrintf("Waiting for read of zip to abort\n");
-    pZip->abortRead = true;
-    udSleep(1);
-  }
-  if (pZip->pFileData)
+  // The dictionary must leave room in the compressor's window for the lookahead
+  udCD_MaxDictionaryLength = TDEFL_LZ_DICT_SIZE - TDEFL_MAX_MATCH_LEN,
+  udCD_TrainKmerLength = 6,     // Length of the substrings scored during training
+  udCD_TrainSegmentLength = 48, // Length of the segments selected into the dictionary
+  udCD_TrainHashBits = 18,
+};
+
+// ****************************************************************************
+// Create a dictionary, keeping a copy of the data
+udResult udCompressionDictionary_Create(udCompressionDictionary **ppDictionary, const void *pData, size_t dataLength)
+{
+  udResult result;
+  udCompressionDictionary *pDictionary = nullptr;
+
+  UD_ERROR_IF(!ppDictionary || !pData || !dataLength, udR_InvalidParameter);
+  if (dataLength > udCD_MaxDictionaryLength)
   {
-    udReadLockRWLock(pZip->pRWLock);
-    udFree(pZip->pFileData);
-    udReadUnlockRWLock(pZip->pRWLock);
+    // The end of the dictionary is closest to the data and therefore the most valuable
+    pData = (const uint8_t*)pData + (dataLength - udCD_MaxDictionaryLength);
+    dataLength = udCD_MaxDictionaryLength;
   }
+
+  pDictionary = udAllocType(udCompressionDictionary, 1, udAF_Zero);
+  UD_ERROR_NULL(pDictionary, udR_MemoryAllocationFailure);
+  pDictionary->pData = (uint8_t*)udMemDup(pData, dataLength, 0, udAF_None);
+  UD_ERROR_NULL(pDictionary->pData, udR_MemoryAllocationFailure);
+  pDictionary->length = dataLength;
+  pDictionary->adler32 = libdeflate_adler32(1, pDictionary->pData, dataLength);
+
+  *ppDictionary = pDictionary;
+  pDictionary = nullptr;
+  result = udR_Success;
+
+epilogue:
+  udCompressionDictionary_Destroy(&pDictionary);
+  return result;
 }
 
 // ----------------------------------------------------------------------------
-// Author: Dave Pevreal, October 2014
-// Implementation of SeekReadHandler to access a file in the registered zip
-static udResult udFileHandler_MiniZSeekRead(udFile *pFile, void *pBuffer, size_t bufferLength, int64_t seekOffset, size_t *pActualRead, udFilePipelinedRequest * /*pPipelinedRequest*/)
+// Hash of a k-mer used to count substring frequency during training
+static UDFORCE_INLINE uint32_t udCompressionDictionary_KmerHash(const uint8_t *p)
+{
+  uint64_t v = 0;
+  memcpy(&v, p, udCD_TrainKmerLength);
+  return (uint32_t)((v * 0x9E3779B185EBCA87ULL) >> (64 - udCD_TrainHashBits));
+}
+
+// ****************************************************************************
+// Greedy segment selection: each k-mer is scored by the number of samples it appears in, then the
+// highest scoring segments are chosen, zeroing the score of their k-mers so the next pick adds new content
+udResult udCompressionDictionary_Train(udCompressionDictionary **ppDictionary, const void * const *ppSamples, const size_t *pSampleLengths, size_t sampleCount, size_t maxDictionaryLength)
 {
-  UDTRACE();
   udResult result;
-  udFile_Zip *pZip = static_cast<udFile_Zip *>(pFile);
-  size_t actualRead = 0;
-  bool locked = false;
+  uint32_t *pCounts = nullptr;
+  uint32_t *pLastSample = nullptr;
+  uint8_t *pDictData = nullptr;
+  size_t dictStart;
+
+  UD_ERROR_IF(!ppDictionary || !ppSamples || !pSampleLengths || !sampleCount || !maxDictionaryLength, udR_InvalidParameter);
+  maxDictionaryLength = std::min(maxDictionaryLength, (size_t)udCD_MaxDictionaryLength);
+
+  pCounts = udAllocType(uint32_t, 1 << udCD_TrainHashBits, udAF_Zero);
+  UD_ERROR_NULL(pCounts, udR_MemoryAllocationFailure);
+  pLastSample = udAllocType(uint32_t, 1 << udCD_TrainHashBits, udAF_Zero);
+  UD_ERROR_NULL(pLastSample, udR_MemoryAllocationFailure);
+  pDictData = udAllocType(uint8_t, maxDictionaryLength, udAF_None);
+  UD_ERROR_NULL(pDictData, udR_MemoryAllocationFailure);
+
+  // Count the number of samples each k-mer occurs in, so repetition within one sample doesn't dominate
+  for (size_t s = 0; s < sampleCount; ++s)
+  {
+    const uint8_t *pSample = (const uint8_t*)ppSamples[s];
+    UD_ERROR_IF(!pSample && pSampleLengths[s], udR_InvalidParameter);
+    for (size_t i = 0; i + udCD_TrainKmerLength <= pSampleLengths[s]; ++i)
+    {
+      uint32_t hash = udCompressionDictionary_KmerHash(pSample + i);
+      if (pLastSample[hash] != (uint32_t)(s + 1))
+      {
+        pLastSample[hash] = (uint32_t)(s + 1);
+        ++pCounts[hash];
+      }
+    }
+  }
 
-  UD_ERROR_NULL(pZip->pZipFile, udR_InvalidConfiguration);
-  if (pZip->pFileData)
+  // Fill the dictionary from the end, the best segments are closest to the data being compressed
+  dictStart = maxDictionaryLength;
+  while (dictStart > 0)
   {
-    UD_ERROR_IF(seekOffset < 0 || seekOffset >= pZip->fileLength, udR_InvalidParameter);
-    bufferLength = std::min(bufferLength, (size_t)pZip->fileLength - (size_t)seekOffset);
+    const uint8_t *pBest = nullptr;
+    size_t bestLength = 0;
+    uint64_t bestScore = 0;
 
-    // Passive wait for the read to complete
-    while (!pZip->readComplete && pZip->lengthRead < int32_t(seekOffset + bufferLength))
+    for (size_t s = 0; s < sampleCount; ++s)
     {
-      if (pZip->abortRead)
-        UD_ERROR_SET_NO_BREAK(udR_ReadFailure);
-      udSleep(1);
+      const uint8_t *pSample = (const uint8_t*)ppSamples[s];
+      size_t sampleLength = pSampleLengths[s];
+      if (sampleLength < udCD_TrainKmerLength)
+        continue;
+
+      // Slide a window of k-mers across the sample, scoring each segment
+      size_t segmentLength = std::min(sampleLength, (size_t)udCD_TrainSegmentLength);
+      size_t kmersPerSegment = segmentLength - udCD_TrainKmerLength + 1;
+      uint64_t score = 0;
+      for (size_t i = 0; i < kmersPerSegment; ++i)
+        score += pCounts[udCompressionDictionary_KmerHash(pSample + i)];
+      for (size_t start = 0;; ++start)
+      {
+        if (score > bestScore)
+        {
+          bestScore = score;
+          pBest = pSample + start;
+          bestLength = segmentLength;
+        }
+        if (start + segmentLength >= sampleLength)
+          break;
+        score -= pCounts[udCompressionDictionary_KmerHash(pSample + start)];
+        score += pCounts[udCompressionDictionary_KmerHash(pSample + start + kmersPerSegment)];
+      }
     }
-    UD_ERROR_IF(int64_t(pZip->lengthRead) <= seekOffset, udR_ReadFailure);
 
-    actualRead = std::min(bufferLength, pZip->lengthRead - (size_t)seekOffset);
-    udReadLockRWLock(pZip->pRWLock);
-    locked = true;
-    UD_ERROR_NULL(pZip->pFileData, udR_ReadFailure);
-    memcpy(pBuffer, pZip->pFileData + seekOffset, actualRead);
+    // Stop when nothing occurs in more than one sample
+    if (!pBest || bestScore <= (uint64_t)(bestLength - udCD_TrainKmerLength + 1))
+      break;
 
-    result = udR_Success;
-  }
-  else
-  {
-    result = udFile_Read(pZip->pZipFile, pBuffer, bufferLength, seekOffset, udFSW_SeekSet, &actualRead);
+    for (size_t i = 0; i + udCD_TrainKmerLength <= bestLength; ++i)
+      pCounts[udCompressionDictionary_KmerHash(pBest + i)] = 0;
+
+    bestLength = std::min(bestLength, dictStart);
+    dictStart -= bestLength;
+    memcpy(pDictData + dictStart, pBest, bestLength);
   }
+  UD_ERROR_IF(dictStart == maxDictionaryLength, udR_NotFound); // No common content in the samples
 
-epilogue:
-  if (locked)
-    udReadUnlockRWLock(pZip->pRWLock);
+  UD_ERROR_CHECK(udCompressionDictionary_Create(ppDictionary, pDictData + dictStart, maxDictionaryLength - dictStart));
+  result = udR_Success;
 
-  if (pActualRead)
-    *pActualRead = actualRead;
+epilogue:
+  udFree(pDictData);
+  udFree(pLastSample);
+  udFree(pCounts);
   return result;
 }
 
-// ----------------------------------------------------------------------------
-// Author: Dave Pevreal, October 2014
-// Implementation of CloseHandler to access a file in the registered zip
-static udResult udFileHandler_MiniZClose(udFile **ppFile)
+// ****************************************************************************
+// Expose the dictionary bytes
+udResult udCompressionDictionary_GetData(const udCompressionDictionary *pDictionary, const void **ppData, size_t *pDataLength)
 {
-  if (ppFile == nullptr)
+  if (!pDictionary || !ppData || !pDataLength)
     return udR_InvalidParameter;
-  udFile_Zip *pZip = static_cast<udFile_Zip *>(*ppFile);
-  if (pZip)
+  *ppData = pDictionary->pData;
+  *pDataLength = pDictionary->length;
+  return udR_Success;
+}
+
+// ****************************************************************************
+// Free a dictionary and its data
+void udCompressionDictionary_Destroy(udCompressionDictionary **ppDictionary)
+{
+  if (ppDictionary && *ppDictionary)
   {
-    AbortRead(pZip);
-    udFile *pZipFile = pZip->pZipFile;
-    if (pZipFile && udInterlockedCompareExchangePointer((void**)&pZip->pZipFile, nullptr, pZipFile) == pZipFile)
-      udFile_Close(&pZipFile);
-    udDestroyRWLock(&pZip->pRWLock);
-    mz_zip_reader_end(&pZip->mz);
-    udFree(pZip);
+    udFree((*ppDictionary)->pData);
+    udFree(*ppDictionary);
   }
-  return udR_Success;
 }
 
 // ----------------------------------------------------------------------------
-// Author: Dave Pevreal, October 2014
-static void *udMiniZ_Alloc(void * /*pOpaque*/, size_t items, size_t size) { return udAlloc(items * size); }
-static void *udMiniZ_Realloc(void * /*pOpaque*/, void *address, size_t items, size_t size) { return udRealloc(address, items * size); }
-static void udMiniZ_Free(void * /*pOpaque*/, void *address) { udFree(address); }
-static size_t udMiniZ_Read(void *pOpaque, mz_uint64 fileOffset, void *pBuf, size_t n) { udFile_Read(((udFile_Zip*)pOpaque)->pZipFile, pBuf, n, fileOffset, udFSW_SeekSet, &n); return n; }
+// Load the dictionary into a freshly initialised compressor's history, equivalent to zlib's deflateSetDictionary
+static void udCompression_PrimeDictionary(tdefl_compressor *pComp, const udCompressionDictionary *pDictionary)
+{
+  mz_uint length = (mz_uint)pDictionary->length;
+  memcpy(pComp->m_dict, pDictionary->pData, length);
+  memcpy(pComp->m_dict + TDEFL_LZ_DICT_SIZE, pComp->m_dict, TDEFL_MAX_MATCH_LEN - 1);
+  // Insert every position whose 3 bytes lie within the dictionary, the compressor inserts the last 2 itself
+  for (mz_uint pos = 0; pos + TDEFL_MIN_MATCH_LEN <= length; ++pos)
+  {
+    mz_uint hash = ((pComp->m_dict[pos] << (TDEFL_LZ_HASH_SHIFT * 2)) ^ (pComp->m_dict[pos + 1] << TDEFL_LZ_HASH_SHIFT) ^ pComp->m_dict[pos + 2]) & (TDEFL_LZ_HASH_SIZE - 1);
+    pComp->m_next[pos] = pComp->m_hash[hash];
+    pComp->m_hash[hash] = (mz_uint16)pos;
+  }
+  pComp->m_lookahead_pos = length;
+  pComp->m_dict_size = length;
+  pComp->m_lz_code_buf_dict_pos = length;
+}
 
 // ----------------------------------------------------------------------------
-// Author: Dave Pevreal, October 2018
-static size_t udMiniZ_ReadFileFromZipCallback(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n)
+// Compress with miniz's tdefl, which unlike libdeflate allows its history to be primed
+static udResult udCompression_DeflateWithDictionary(void **ppDest, size_t *pDestSize, const void *pSource, size_t sourceSize, udCompressionType type, const udCompressionDictionary *pDictionary)
 {
-  udFile_Zip *pFile = (udFile_Zip *)pOpaque;
-  if (pFile->abortRead)
-    return 0;
-  // Only handling the case of sequential feeding of data
-  if (file_ofs != (mz_uint64)pFile->lengthRead)
-    return 0;
-  // Detect an overrun
-  if ((file_ofs + n) > (mz_uint64)pFile->fileLength)
-    return 0;
-  udWriteLockRWLock(pFile->pRWLock);
-  if (pFile->pFileData)
-    memcpy(pFile->pFileData + file_ofs, pBuf, n);
-  udWriteUnlockRWLock(pFile->pRWLock);
-  pFile->lengthRead += (int32_t)n;
-  return n;
+  udResult result;
+  tdefl_compressor *pComp = nullptr;
+  uint8_t *pTemp = nullptr;
+  size_t headerSize = (type == udCT_ZlibDeflate) ? 6 : 0; // CMF, FLG, DICTID
+  size_t footerSize = (type == udCT_ZlibDeflate) ? 4 : 0; // Adler32
+  size_t destSize = headerSize + sourceSize + (sourceSize / 10) + 128 + footerSize;
+  size_t inSize = sourceSize;
+  size_t outSize = destSize - headerSize - footerSize;
+
+  UD_ERROR_IF(type != udCT_RawDeflate && type != udCT_ZlibDeflate, udR_Unsupported);
+
+  pComp = udAllocType(tdefl_compressor, 1, udAF_None);
+  UD_ERROR_NULL(pComp, udR_MemoryAllocationFailure);
+  pTemp = udAllocType(uint8_t, destSize, udAF_None);
+  UD_ERROR_NULL(pTemp, udR_MemoryAllocationFailure);
+
+  // Raw deflate at level 6, the zlib wrapper is written here as miniz doesn't support FDICT
+  UD_ERROR_IF(tdefl_init(pComp, nullptr, nullptr, (int)tdefl_create_comp_flags_from_zip_params(6, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY)) != TDEFL_STATUS_OKAY, udR_CompressionError);
+  udCompression_PrimeDictionary(pComp, pDictionary);
+  UD_ERROR_IF(tdefl_compress(pComp, pSource, &inSize, pTemp + headerSize, &outSize, TDEFL_FINISH) != TDEFL_STATUS_DONE, udR_CompressionError);
+  UD_ERROR_IF(inSize != sourceSize, udR_CompressionError);
+
+  if (type == udCT_ZlibDeflate)
+  {
+    uint32_t adler = libdeflate_adler32(1, pSource, sourceSize);
+    pTemp[0] = 0x78; // Deflate, 32KB window
+    pTemp[1] = 0x80 | 0x20; // Default level, FDICT
+    pTemp[1] |= 31 - (((pTemp[0] << 8) | pTemp[1]) % 31);
+    for (int i = 0; i < 4; ++i)
+    {
+      pTemp[2 + i] = (uint8_t)(pDictionary->adler32 >> (24 - i * 8));
+      pTemp[headerSize + outSize + i] = (uint8_t)(adler >> (24 - i * 8));
+    }
+  }
+
+  // Size the allocation as required
+  *pDestSize = headerSize + outSize + footerSize;
+  *ppDest = udRealloc(pTemp, *pDestSize);
+  UD_ERROR_NULL(*ppDest, udR_MemoryAllocationFailure);
+  pTemp = nullptr; // Prevent freeing on successful realloc
+  result = udR_Success;
+
+epilogue:
+  udFree(pTemp);
+  udFree(pComp);
+  return result;
 }
 
 // ----------------------------------------------------------------------------
-// Author: Dave Pevreal, November 2019
-// Special API to access individual subfiles of a zip without re-opening
-udResult udFileHandler_MiniZSetSubFilename(udFile *pFile, const char *pSubFilename)
+// Decompress with miniz's tinfl, which can resolve back references into a dictionary preceding the output
+static udResult udCompression_InflateWithDictionary(void *pDest, size_t destSize, const void *pSource, size_t sourceSize, size_t *pInflatedSize, udCompressionType type, const udCompressionDictionary *pDictionary)
 {
   udResult result;
-  udFile_Zip *pZip = (udFile_Zip *)pFile;
-  mz_zip_archive_file_stat stat;
+  tinfl_decompressor inflator;
+  tinfl_status status;
+  const uint8_t *pIn = (const uint8_t*)pSource;
+  uint8_t *pHistory = nullptr;
+  size_t inSize = sourceSize;
+  size_t outSize = destSize;
 
-  UD_ERROR_IF(pZip->fpRead != udFileHandler_MiniZSeekRead, udR_ObjectTypeMismatch);
-  // First tidy up any existing sub file data, waiting for pending read if necessary
-  AbortRead(pZip);
-  pZip->fileLength = 0;
-  UD_ERROR_NULL(pSubFilename, udR_Success); // Legal to "unset" the sub filename
+  UD_ERROR_IF(type != udCT_RawDeflate && type != udCT_ZlibDeflate, udR_Unsupported);
 
-  pZip->index = mz_zip_reader_locate_file(&pZip->mz, pSubFilename, nullptr, 0);
-  if (pZip->index < 0 && udStrchr(pSubFilename, "/\\"))
+  if (type == udCT_ZlibDeflate)
   {
-    // Sometimes the zip can be created on a different platform that uses different separators,
-    // so before giving up attempt to locate using both kinds of separators
-    // We assume the file in the zip uses separators consistently, but not necessarily in pSubFilename
-    udStrcpy(stat.m_filename, pSubFilename); // Borrow stat.filename memory as it's the right size
-    size_t sepIndex;
-    // Try linux separators
-    while (udStrchr(stat.m_filename, "\\", &sepIndex))
-      stat.m_filename[sepIndex] = '/';
-    pZip->index = mz_zip_reader_locate_file(&pZip->mz, stat.m_filename, nullptr, 0);
-    if (pZip->index < 0)
+    UD_ERROR_IF(sourceSize < 6, udR_CompressionError);
+    UD_ERROR_IF((pIn[0] & 0xf) != 8 || (((pIn[0] << 8) | pIn[1]) % 31) != 0, udR_CompressionError);
+    if (pIn[1] & 0x20)
     {
-      // Try windows separators
-      while (udStrchr(stat.m_filename, "/", &sepIndex))
-        stat.m_filename[sepIndex] = '\\';
-      pZip->index = mz_zip_reader_locate_file(&pZip->mz, stat.m_filename, nullptr, 0);
+      uint32_t dictId = ((uint32_t)pIn[2] << 24) | ((uint32_t)pIn[3] << 16) | ((uint32_t)pIn[4] << 8) | pIn[5];
+      UD_ERROR_IF(dictId != pDictionary->adler32, udR_CompressionError);
+      inSize -= 4;
+      pIn += 4;
     }
+    UD_ERROR_IF(inSize < 6, udR_CompressionError);
+    inSize -= 2 + 4; // Header, footer
+    pIn += 2;
   }
-  UD_ERROR_IF(pZip->index < 0, udR_OpenFailure);
-  UD_ERROR_IF(!mz_zip_reader_file_stat(&pZip->mz, pZip->index, &stat), udR_OpenFailure);
-  pZip->fileLength = (int64_t)stat.m_uncomp_size;
 
-  if (stat.m_method == 0)
+  // The dictionary is placed immediately before the output in a linear buffer so back references can reach it
+  pHistory = udAllocType(uint8_t, pDictionary->length + destSize, udAF_None);
+  UD_ERROR_NULL(pHistory, udR_MemoryAllocationFailure);
+  memcpy(pHistory, pDictionary->pData, pDictionary->length);
+
+  tinfl_init(&inflator);
+  status = tinfl_decompress(&inflator, pIn, &inSize, pHistory, pHistory + pDictionary->length, &outSize, TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+  if (status == TINFL_STATUS_HAS_MORE_OUTPUT)
+    UD_ERROR_SET_NO_BREAK(udR_BufferTooSmall);
+  UD_ERROR_IF(status != TINFL_STATUS_DONE, udR_CompressionError);
+
+  if (type == udCT_ZlibDeflate)
   {
-    // The file in the zip is just stored, so instead of going through the extraction
-    // machinery, we can use the SeekBase machinery of udFile to auto-offset
-    int64_t seekBase = (int64_t)stat.m_local_header_ofs;
-    uint8_t localDirHeader[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
-    UD_ERROR_CHECK(udFile_Read(pZip->pZipFile, localDirHeader, sizeof(localDirHeader), seekBase, udFSW_SeekSet));
-    uint32_t sig;
-    uint16_t filenameLen;
-    uint16_t extraLen;
-    memcpy(&sig, localDirHeader + 0, sizeof(sig));
-    memcpy(&filenameLen, localDirHeader + MZ_ZIP_LDH_FILENAME_LEN_OFS, sizeof(filenameLen));
-    memcpy(&extraLen, localDirHeader + MZ_ZIP_LDH_EXTRA_LEN_OFS, sizeof(extraLen));
-    UD_ERROR_IF(sig != MZ_ZIP_LOCAL_DIR_HEADER_SIG, udR_CorruptData);
-    seekBase += MZ_ZIP_LOCAL_DIR_HEADER_SIZE + filenameLen + extraLen;
-
-    pZip->filePos = pZip->seekBase = seekBase;
-    pZip->readComplete = true;
+    const uint8_t *pFooter = pIn + inSize;
+    uint32_t adler = ((uint32_t)pFooter[0] << 24) | ((uint32_t)pFooter[1] << 16) | ((uint32_t)pFooter[2] << 8) | pFooter[3];
+    UD_ERROR_IF(adler != libdeflate_adler32(1, pHistory + pDictionary->length, outSize), udR_CompressionError);
   }
-  else
-  {
-    // File is compressed, so allocate memory and begin the decompression on a thread
-    pZip->pFileData = udAllocType(uint8_t, (size_t)stat.m_uncomp_size, udAF_None);
-    UD_ERROR_NULL(pZip->pFileData, udR_MemoryAllocationFailure);
-    pZip->filePos = 0;
-    pZip->lengthRead = 0;
-    pZip->readComplete = false;
 
-    udThreadStart startFunc = [](void *pOpaque) -> unsigned int
-    {
-      udFile_Zip *pZip = (udFile_Zip *)pOpaque;
-      mz_zip_reader_extract_to_callback(&pZip->mz, pZip->index, udMiniZ_ReadFileFromZipCallback, pOpaque, 0);
-      pZip->readComplete = true; // If an error occured, lengthRead won't equal fileLength
-      return 0;
-    };
-    udThread_Create(nullptr, startFunc, pZip);
-  }
+  memcpy(pDest, pHistory + pDictionary->length, outSize);
+  if (pInflatedSize)
+    *pInflatedSize = outSize;
   result = udR_Success;
 
 epilogue:
+  udFree(pHistory);
   return result;
 }
 
-// ----------------------------------------------------------------------------
-// Author: Dave Pevreal, October 2014
-// Implementation of OpenHandler to access a file in the registered zip
-udResult udFileHandler_MiniZOpen(udFile **ppFile, const char *pFilename, udFileOpenFlags flags)
+enum
 {
-  udResult result;
-  udFile_Zip *pFile = nullptr;
-  char *pSubFilename = nullptr;
-  char *pZipName = nullptr;
-  const char *pFolderDelim = nullptr;
-  int64_t zipLen;
-
-  UD_ERROR_IF(flags & udFOF_Write, udR_OpenFailure);
+  udZip_ReadBufferSize = 64 * 1024,         // Compressed data is read from the underlying zip in blocks of this size
+  udZip_CheckpointSpacing = 1024 * 1024,    // Initial number of uncompressed bytes between inflate access points
+  udZip_MaxCheckpoints = 128,               // When exceeded, every second access point is discarded and the spacing doubled
+};
 
-  pFile = udAllocType(udFile_Zip, 1, udAF_Zero);
-  UD_ERROR_NULL(pFile, udR_MemoryAllocationFailure);
-  pFile->pRWLock = udCreateRWLock();
-  UD_ERROR_NULL(pFile->pRWLock, udR_MemoryAllocationFailure);
+// An access point within a compressed entry, from which inflation can be restarted
+struct udFile_ZipCheckpoint
+{
+  int64_t uncompressedPos;  // Number of bytes the inflator had output at this point
+  int64_t compressedPos;    // Offset within the zip of the next compressed byte to be consumed
+  tinfl_decompressor inflator;
+  uint8_t *pWindow;         // Copy of the sliding window (dictSize bytes)
+};
+
+// A member of a zip, taken from the central directory
+struct udZipArchiveEntry
+{
+  uint64_t compressedSize;
+  uint64_t uncompressedSize;
+  uint64_t localHeaderOffset;
+  uint32_t crc;
+  uint32_t nameOffset;      // Offset of the null terminated name within udZipArchive::pNames
+  uint16_t method;
+  bool isDirectory;
+};
+
+// The parsed central directory of a zip, shared by all udFile_Zip handles opened on the same archive
+struct udZipArchive
+{
+  udZipArchive *pNext;
+  char *pKey;               // Filename the archive was opened with
+  int64_t zipLength;
+  int64_t modifiedTime;     // Zero if the file system can't report it
+  int32_t refCount;         // Protected by s_zipArchiveLock
+
+  udZipArchiveEntry *pEntries;
+  uint32_t entryCount;
+  char *pNames;
+  uint32_t *pHashTable;     // Open addressed, each slot is an entry index plus one, or zero if empty
+  uint32_t hashMask;
+  uint8_t *pTOC;            // Newline separated list of files, returned when no sub filename is given
+  size_t tocLength;
+};
+
+static udZipArchive *s_pZipArchives;
+static udSpinLock s_zipArchiveLock; // A spin lock is used as it's only held for list manipulation
+
+// ----------------------------------------------------------------------------
+// Names are matched case insensitively as mz_zip_reader_locate_file did, and either separator
+// matches the other as zips created on a different platform may use different separators
+static inline uint8_t udZipArchive_FoldNameChar(char c)
+{
+  if (c == '\\')
+    return '/';
+  if (c >= 'A' && c <= 'Z')
+    return (uint8_t)(c + ('a' - 'A'));
+  return (uint8_t)c;
+}
+
+// ----------------------------------------------------------------------------
+static uint32_t udZipArchive_HashName(const char *pName)
+{
+  uint32_t hash = 2166136261U; // FNV-1a
+  for (; *pName; ++pName)
+    hash = (hash ^ udZipArchive_FoldNameChar(*pName)) * 16777619U;
+  return hash;
+}
+
+// ----------------------------------------------------------------------------
+static bool udZipArchive_NamesMatch(const char *pA, const char *pB)
+{
+  for (; *pA && *pB; ++pA, ++pB)
+  {
+    if (udZipArchive_FoldNameChar(*pA) != udZipArchive_FoldNameChar(*pB))
+      return false;
+  }
+  return *pA == *pB;
+}
+
+// ----------------------------------------------------------------------------
+// Find an entry by name, returning nullptr if it doesn't exist
+static const udZipArchiveEntry *udZipArchive_Find(const udZipArchive *pArchive, const char *pName)
+{
+  for (uint32_t slot = udZipArchive_HashName(pName) & pArchive->hashMask; pArchive->pHashTable[slot]; slot = (slot + 1) & pArchive->hashMask)
+  {
+    const udZipArchiveEntry *pEntry = &pArchive->pEntries[pArchive->pHashTable[slot] - 1];
+    if (udZipArchive_NamesMatch(pArchive->pNames + pEntry->nameOffset, pName))
+      return pEntry;
+  }
+  return nullptr;
+}
+
+// ----------------------------------------------------------------------------
+// Author: Dave Pevreal, October 2014
+static void *udMiniZ_Alloc(void * /*pOpaque*/, size_t items, size_t size) { return udAlloc(items * size); }
+static void *udMiniZ_Realloc(void * /*pOpaque*/, void *address, size_t items, size_t size) { return udRealloc(address, items * size); }
+static void udMiniZ_Free(void * /*pOpaque*/, void *address) { udFree(address); }
+static size_t udMiniZ_Read(void *pOpaque, mz_uint64 fileOffset, void *pBuf, size_t n) { udFile_Read((udFile*)pOpaque, pBuf, n, fileOffset, udFSW_SeekSet, &n); return n; }
+
+// ----------------------------------------------------------------------------
+static void udZipArchive_Destroy(udZipArchive **ppArchive)
+{
+  udZipArchive *pArchive = *ppArchive;
+  if (pArchive)
+  {
+    udFree(pArchive->pKey);
+    udFree(pArchive->pEntries);
+    udFree(pArchive->pNames);
+    udFree(pArchive->pHashTable);
+    udFree(pArchive->pTOC);
+    udFree(*ppArchive);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Parse the central directory of a zip into a name index and table of contents
+static udResult udZipArchive_Create(udZipArchive **ppArchive, udFile *pZipFile, const char *pKey, int64_t zipLength)
+{
+  udResult result;
+  udZipArchive *pArchive = nullptr;
+  mz_zip_archive mz;
+  mz_zip_archive_file_stat stat;
+  size_t namesLength = 0;
+  size_t namesCapacity = 0;
+  size_t tocLength = 1; // final null terminator
+  uint32_t hashSize = 16;
+
+  memset(&mz, 0, sizeof(mz));
+  mz.m_pIO_opaque = pZipFile;
+  mz.m_pAlloc = udMiniZ_Alloc;
+  mz.m_pRealloc = udMiniZ_Realloc;
+  mz.m_pFree = udMiniZ_Free;
+  mz.m_pRead = udMiniZ_Read;
+  UD_ERROR_IF(!mz_zip_reader_init(&mz, (mz_uint64)zipLength, MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY), udR_OpenFailure);
+
+  pArchive = udAllocType(udZipArchive, 1, udAF_Zero);
+  UD_ERROR_NULL(pArchive, udR_MemoryAllocationFailure);
+  pArchive->pKey = udStrdup(pKey);
+  UD_ERROR_NULL(pArchive->pKey, udR_MemoryAllocationFailure);
+  pArchive->zipLength = zipLength;
+  pArchive->entryCount = mz_zip_reader_get_num_files(&mz);
+  if (pArchive->entryCount)
+  {
+    pArchive->pEntries = udAllocType(udZipArchiveEntry, pArchive->entryCount, udAF_Zero);
+    UD_ERROR_NULL(pArchive->pEntries, udR_MemoryAllocationFailure);
+  }
+
+  for (uint32_t i = 0; i < pArchive->entryCount; ++i)
+  {
+    udZipArchiveEntry *pEntry = &pArchive->pEntries[i];
+    UD_ERROR_IF(!mz_zip_reader_file_stat(&mz, i, &stat), udR_CorruptData);
+    size_t nameLength = udStrlen(stat.m_filename);
+    if (namesLength + nameLength + 1 > namesCapacity)
+    {
+      namesCapacity = std::max(namesCapacity * 2, namesLength + nameLength + 1 + 4096);
+      char *pNames = (char*)udRealloc(pArchive->pNames, namesCapacity);
+      UD_ERROR_NULL(pNames, udR_MemoryAllocationFailure);
+      pArchive->pNames = pNames;
+    }
+    memcpy(pArchive->pNames + namesLength, stat.m_filename, nameLength + 1);
+    pEntry->nameOffset = (uint32_t)namesLength;
+    namesLength += nameLength + 1;
+    pEntry->compressedSize = stat.m_comp_size;
+    pEntry->uncompressedSize = stat.m_uncomp_size;
+    pEntry->localHeaderOffset = stat.m_local_header_ofs;
+    pEntry->crc = stat.m_crc32;
+    pEntry->method = stat.m_method;
+    pEntry->isDirectory = mz_zip_reader_is_file_a_directory(&mz, i) != MZ_FALSE;
+    if (!pEntry->isDirectory)
+      tocLength += nameLength + 1; // Add 1 for newline
+  }
+
+  // Build the name index, at most half full to keep probe sequences short
+  while (hashSize < pArchive->entryCount * 2)
+    hashSize *= 2;
+  pArchive->hashMask = hashSize - 1;
+  pArchive->pHashTable = udAllocType(uint32_t, hashSize, udAF_Zero);
+  UD_ERROR_NULL(pArchive->pHashTable, udR_MemoryAllocationFailure);
+  for (uint32_t i = 0; i < pArchive->entryCount; ++i)
+  {
+    uint32_t slot = udZipArchive_HashName(pArchive->pNames + pArchive->pEntries[i].nameOffset) & pArchive->hashMask;
+    while (pArchive->pHashTable[slot])
+      slot = (slot + 1) & pArchive->hashMask;
+    pArchive->pHashTable[slot] = i + 1;
+  }
+
+  pArchive->tocLength = tocLength;
+  pArchive->pTOC = udAllocType(uint8_t, tocLength, udAF_None);
+  UD_ERROR_NULL(pArchive->pTOC, udR_MemoryAllocationFailure);
+  tocLength = 0;
+  for (uint32_t i = 0; i < pArchive->entryCount; ++i)
+  {
+    if (!pArchive->pEntries[i].isDirectory)
+    {
+      const char *pName = pArchive->pNames + pArchive->pEntries[i].nameOffset;
+      size_t len = udStrlen(pName);
+      memcpy(pArchive->pTOC + tocLength, pName, len);
+      tocLength += len;
+      pArchive->pTOC[tocLength++] = '\n';
+    }
+  }
+  pArchive->pTOC[tocLength++] = '\0';
+
+  *ppArchive = pArchive;
+  pArchive = nullptr;
+  result = udR_Success;
+
+epilogue:
+  mz_zip_reader_end(&mz);
+  udZipArchive_Destroy(&pArchive);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Get the shared central directory for a zip, parsing it if no other handle has the archive open
+static udResult udZipArchive_Acquire(udZipArchive **ppArchive, udFile *pZipFile, const char *pKey, int64_t zipLength, int64_t modifiedTime)
+{
+  udResult result;
+  udZipArchive *pArchive = nullptr;
+  udZipArchive *pCreated = nullptr;
+
+  for (int pass = 0; pass < 2 && !pArchive; ++pass)
+  {
+    if (pass == 1)
+    {
+      UD_ERROR_CHECK(udZipArchive_Create(&pCreated, pZipFile, pKey, zipLength)); // Parsed outside the lock as it requires reading the zip
+      pCreated->modifiedTime = modifiedTime;
+    }
+
+    udLockSpinLock(&s_zipArchiveLock);
+    for (udZipArchive *pExisting = s_pZipArchives; pExisting && !pArchive; pExisting = pExisting->pNext)
+    {
+      if (pExisting->zipLength == zipLength && pExisting->modifiedTime == modifiedTime && udStrEqual(pExisting->pKey, pKey))
+        pArchive = pExisting;
+    }
+    if (!pArchive && pCreated)
+    {
+      pCreated->pNext = s_pZipArchives;
+      s_pZipArchives = pCreated;
+      pArchive = pCreated;
+      pCreated = nullptr;
+    }
+    if (pArchive)
+      ++pArchive->refCount;
+    udReleaseSpinLock(&s_zipArchiveLock);
+  }
+
+  *ppArchive = pArchive;
+  result = udR_Success;
+
+epilogue:
+  udZipArchive_Destroy(&pCreated); // Another thread won the race to add the same archive
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Release a reference to a shared central directory, destroying it when no longer used
+static void udZipArchive_Release(udZipArchive **ppArchive)
+{
+  udZipArchive *pArchive = *ppArchive;
+  if (!pArchive)
+    return;
+  *ppArchive = nullptr;
+
+  bool destroy = false;
+  udLockSpinLock(&s_zipArchiveLock);
+  if (--pArchive->refCount == 0)
+  {
+    for (udZipArchive **ppLink = &s_pZipArchives; *ppLink; ppLink = &(*ppLink)->pNext)
+    {
+      if (*ppLink == pArchive)
+      {
+        *ppLink = pArchive->pNext;
+        break;
+      }
+    }
+    destroy = true;
+  }
+  udReleaseSpinLock(&s_zipArchiveLock);
+
+  if (destroy)
+    udZipArchive_Destroy(&pArchive);
+}
+
+// ----------------------------------------------------------------------------
+// Stop sharing the central directory of a zip that has been opened for writing. Handles already
+// holding it keep their reference, it's destroyed on their release as it's no longer in the list
+void udFileHandler_MiniZInvalidate(const char *pFilename)
+{
+  udLockSpinLock(&s_zipArchiveLock);
+  for (udZipArchive **ppLink = &s_pZipArchives; *ppLink;)
+  {
+    if (udStrEqual((*ppLink)->pKey, pFilename))
+      *ppLink = (*ppLink)->pNext;
+    else
+      ppLink = &(*ppLink)->pNext;
+  }
+  udReleaseSpinLock(&s_zipArchiveLock);
+}
+
+struct udFile_Zip : public udFile
+{
+  udZipArchive *pArchive;
+  udFile * volatile pZipFile;
+  const uint8_t *pFileData; // Table of contents (owned by pArchive), when no sub filename is set
+  const udZipArchiveEntry *pEntry; // The current sub file
+  udMutex *pMutex; // Serialises access to the inflate state
+
+  // Streaming inflate of a compressed sub file, memory use is bounded by the window and access points
+  bool compressed;
+  int inflateFlags;
+  size_t dictSize;            // 32KB for deflate, 64KB for deflate64
+  int64_t compressedStart;    // Offset within the zip of the compressed data
+  int64_t compressedEnd;
+  tinfl_decompressor inflator;
+  tinfl_status status;
+  uint8_t *pWindow;           // Circular window the inflator outputs to, holding the most recently inflated bytes
+  int64_t uncompressedPos;    // Number of bytes output by the inflator
+  int64_t compressedPos;      // Offset within the zip of the next compressed byte to be read into pReadBuffer
+  uint8_t *pReadBuffer;
+  size_t readBufferOffset;
+  size_t readBufferAvailable;
+  uint32_t crc;               // Running crc of the output, only valid when inflated sequentially from the start
+  uint32_t expectedCrc;
+  bool crcValid;
+
+  udFile_ZipCheckpoint *pCheckpoints;
+  int checkpointCount;
+  int64_t checkpointSpacing;
+};
+
+// ----------------------------------------------------------------------------
+// Helper to free any state associated with the current sub file
+static void udFileHandler_MiniZFreeSubFile(udFile_Zip *pZip)
+{
+  for (int i = 0; i < pZip->checkpointCount; ++i)
+    udFree(pZip->pCheckpoints[i].pWindow);
+  udFree(pZip->pCheckpoints);
+  pZip->checkpointCount = 0;
+  udFree(pZip->pWindow);
+  udFree(pZip->pReadBuffer);
+  pZip->pFileData = nullptr;
+  pZip->pEntry = nullptr;
+  pZip->compressed = false;
+}
+
+// ----------------------------------------------------------------------------
+// Restart inflation of the current sub file from the beginning
+static void udFileHandler_MiniZRestartInflate(udFile_Zip *pZip)
+{
+  tinfl_init(&pZip->inflator);
+  pZip->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+  pZip->uncompressedPos = 0;
+  pZip->compressedPos = pZip->compressedStart;
+  pZip->readBufferOffset = 0;
+  pZip->readBufferAvailable = 0;
+  pZip->crc = 0;
+  pZip->crcValid = true;
+}
+
+// ----------------------------------------------------------------------------
+// Restore the inflate state saved at an access point
+static void udFileHandler_MiniZRestoreCheckpoint(udFile_Zip *pZip, const udFile_ZipCheckpoint *pCheckpoint)
+{
+  memcpy(&pZip->inflator, &pCheckpoint->inflator, sizeof(pZip->inflator));
+  memcpy(pZip->pWindow, pCheckpoint->pWindow, pZip->dictSize);
+  pZip->status = TINFL_STATUS_HAS_MORE_OUTPUT;
+  pZip->uncompressedPos = pCheckpoint->uncompressedPos;
+  pZip->compressedPos = pCheckpoint->compressedPos;
+  pZip->readBufferOffset = 0;
+  pZip->readBufferAvailable = 0;
+  pZip->crcValid = false; // Output before the access point isn't included
+}
+
+// ----------------------------------------------------------------------------
+// Save an access point if far enough past the previous one, thinning the set if at capacity
+static void udFileHandler_MiniZAddCheckpoint(udFile_Zip *pZip)
+{
+  int64_t lastPos = pZip->checkpointCount ? pZip->pCheckpoints[pZip->checkpointCount - 1].uncompressedPos : 0;
+  if (pZip->uncompressedPos < lastPos + pZip->checkpointSpacing)
+    return;
+
+  if (pZip->checkpointCount == udZip_MaxCheckpoints)
+  {
+    // Keep every second access point, reusing the discarded window for the new one
+    uint8_t *pSpareWindow = pZip->pCheckpoints[0].pWindow;
+    for (int i = 1; i < pZip->checkpointCount; ++i)
+    {
+      if (i & 1)
+        pZip->pCheckpoints[i / 2] = pZip->pCheckpoints[i];
+      else
+        udFree(pZip->pCheckpoints[i].pWindow);
+    }
+    pZip->checkpointCount /= 2;
+    pZip->checkpointSpacing *= 2;
+    pZip->pCheckpoints[pZip->checkpointCount].pWindow = pSpareWindow;
+  }
+  else
+  {
+    if (!pZip->pCheckpoints)
+    {
+      pZip->pCheckpoints = udAllocType(udFile_ZipCheckpoint, udZip_MaxCheckpoints, udAF_Zero);
+      if (!pZip->pCheckpoints)
+        return; // Access points are an optimisation, failure to allocate isn't an error
+    }
+    udFile_ZipCheckpoint *pNew = &pZip->pCheckpoints[pZip->checkpointCount];
+    pNew->pWindow = udAllocType(uint8_t, pZip->dictSize, udAF_None);
+    if (!pNew->pWindow)
+      return;
+  }
+
+  udFile_ZipCheckpoint *pCheckpoint = &pZip->pCheckpoints[pZip->checkpointCount++];
+  pCheckpoint->uncompressedPos = pZip->uncompressedPos;
+  pCheckpoint->compressedPos = pZip->compressedPos - (int64_t)pZip->readBufferAvailable;
+  memcpy(&pCheckpoint->inflator, &pZip->inflator, sizeof(pZip->inflator));
+  memcpy(pCheckpoint->pWindow, pZip->pWindow, pZip->dictSize);
+}
+
+// ----------------------------------------------------------------------------
+// Copy any part of the requested range still present in the window, advancing *pOffset
+static void udFileHandler_MiniZCopyFromWindow(udFile_Zip *pZip, uint8_t *pDest, int64_t startOffset, int64_t *pOffset, int64_t endOffset)
+{
+  int64_t windowStart = std::max((int64_t)0, pZip->uncompressedPos - (int64_t)pZip->dictSize);
+  while (*pOffset < endOffset && *pOffset >= windowStart && *pOffset < pZip->uncompressedPos)
+  {
+    size_t windowOffset = (size_t)*pOffset & (pZip->dictSize - 1);
+    size_t length = (size_t)(std::min(endOffset, pZip->uncompressedPos) - *pOffset);
+    length = std::min(length, pZip->dictSize - windowOffset);
+    memcpy(pDest + (*pOffset - startOffset), pZip->pWindow + windowOffset, length);
+    *pOffset += length;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Read an uncompressed range of the current sub file, inflating from the nearest access point as required
+static udResult udFileHandler_MiniZInflateRange(udFile_Zip *pZip, uint8_t *pDest, int64_t startOffset, size_t length, size_t *pActualRead)
+{
+  udResult result;
+  int64_t offset = startOffset;
+  int64_t endOffset = startOffset + (int64_t)length;
+
+  udFileHandler_MiniZCopyFromWindow(pZip, pDest, startOffset, &offset, endOffset);
+  if (offset < endOffset)
+  {
+    // Find the closest access point at or before the offset, restoring it if it saves going backwards or inflating data that isn't needed
+    const udFile_ZipCheckpoint *pBest = nullptr;
+    for (int i = 0; i < pZip->checkpointCount && pZip->pCheckpoints[i].uncompressedPos <= offset; ++i)
+      pBest = &pZip->pCheckpoints[i];
+    if (offset < pZip->uncompressedPos)
+    {
+      if (pBest)
+        udFileHandler_MiniZRestoreCheckpoint(pZip, pBest);
+      else
+        udFileHandler_MiniZRestartInflate(pZip);
+    }
+    else if (pBest && pBest->uncompressedPos > pZip->uncompressedPos)
+    {
+      udFileHandler_MiniZRestoreCheckpoint(pZip, pBest);
+    }
+  }
+
+  while (offset < endOffset)
+  {
+    UD_ERROR_IF(pZip->status == TINFL_STATUS_DONE, udR_CorruptData); // The stream ended before the stated uncompressed size
+
+    if (!pZip->readBufferAvailable && pZip->compressedPos < pZip->compressedEnd)
+    {
+      size_t readLength = (size_t)std::min((int64_t)udZip_ReadBufferSize, pZip->compressedEnd - pZip->compressedPos);
+      UD_ERROR_CHECK(udFile_Read(pZip->pZipFile, pZip->pReadBuffer, readLength, pZip->compressedPos, udFSW_SeekSet));
+      pZip->compressedPos += readLength;
+      pZip->readBufferOffset = 0;
+      pZip->readBufferAvailable = readLength;
+    }
+
+    size_t windowOffset = (size_t)pZip->uncompressedPos & (pZip->dictSize - 1);
+    size_t inSize = pZip->readBufferAvailable;
+    size_t outSize = pZip->dictSize - windowOffset;
+    pZip->status = tinfl_decompress(&pZip->inflator, pZip->pReadBuffer + pZip->readBufferOffset, &inSize, pZip->pWindow, pZip->pWindow + windowOffset, &outSize,
+                                    pZip->inflateFlags | (pZip->compressedPos < pZip->compressedEnd ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+    pZip->readBufferOffset += inSize;
+    pZip->readBufferAvailable -= inSize;
+    UD_ERROR_IF(pZip->status < 0, udR_CorruptData);
+
+    if (pZip->crcValid)
+      pZip->crc = libdeflate_crc32(pZip->crc, pZip->pWindow + windowOffset, outSize);
+    pZip->uncompressedPos += outSize;
+    UD_ERROR_IF(pZip->uncompressedPos > pZip->fileLength, udR_CorruptData);
+    udFileHandler_MiniZCopyFromWindow(pZip, pDest, startOffset, &offset, endOffset);
+
+    if (pZip->status == TINFL_STATUS_DONE)
+    {
+      UD_ERROR_IF(pZip->uncompressedPos != pZip->fileLength, udR_CorruptData);
+      UD_ERROR_IF(pZip->crcValid && pZip->crc != pZip->expectedCrc, udR_CorruptData);
+    }
+    else
+    {
+      udFileHandler_MiniZAddCheckpoint(pZip);
+    }
+  }
+  result = udR_Success;
+
+epilogue:
+  if (result != udR_Success)
+    pZip->status = TINFL_STATUS_FAILED; // Force a restart on the next read
+  *pActualRead = (size_t)(offset - startOffset);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Author: Dave Pevreal, October 2014
+// Implementation of SeekReadHandler to access a file in the registered zip
+static udResult udFileHandler_MiniZSeekRead(udFile *pFile, void *pBuffer, size_t bufferLength, int64_t seekOffset, size_t *pActualRead, udFilePipelinedRequest *pPipelinedRequest)
+{
+  UDTRACE();
+  udResult result;
+  udFile_Zip *pZip = static_cast<udFile_Zip *>(pFile);
+  size_t actualRead = 0;
+  bool locked = false;
+
+  UD_ERROR_NULL(pZip->pZipFile, udR_InvalidConfiguration);
+  if (pZip->pFileData)
+  {
+    UD_ERROR_IF(seekOffset < 0 || seekOffset >= pZip->fileLength, udR_InvalidParameter);
+    actualRead = std::min(bufferLength, (size_t)pZip->fileLength - (size_t)seekOffset);
+    memcpy(pBuffer, pZip->pFileData + seekOffset, actualRead);
+    result = udR_Success;
+  }
+  else if (pZip->compressed)
+  {
+    UD_ERROR_IF(seekOffset < 0 || seekOffset >= pZip->fileLength, udR_InvalidParameter);
+    bufferLength = std::min(bufferLength, (size_t)pZip->fileLength - (size_t)seekOffset);
+
+    udLockMutex(pZip->pMutex);
+    locked = true;
+    if (pZip->status < 0)
+      udFileHandler_MiniZRestartInflate(pZip); // Previous read failed, retry from the start rather than a stale state
+    UD_ERROR_CHECK(udFileHandler_MiniZInflateRange(pZip, (uint8_t*)pBuffer, seekOffset, bufferLength, &actualRead));
+  }
+  else
+  {
+    // Stored data is read directly from the zip into the caller's buffer, passing through pipelined requests
+    int64_t entryOffset = seekOffset - pZip->seekBase;
+    UD_ERROR_IF(entryOffset < 0 || entryOffset > pZip->fileLength, udR_InvalidParameter);
+    bufferLength = std::min(bufferLength, (size_t)(pZip->fileLength - entryOffset)); // Don't read beyond the entry into the next
+    result = udFile_Read(pZip->pZipFile, pBuffer, bufferLength, seekOffset, udFSW_SeekSet, &actualRead, nullptr, pPipelinedRequest);
+    pPipelinedRequest = nullptr;
+  }
+
+epilogue:
+  if (locked)
+    udReleaseMutex(pZip->pMutex);
+
+  if (pPipelinedRequest)
+    pPipelinedRequest->reserved[0] = (uint64_t)actualRead; // Already complete, udFileHandler_MiniZBlockForPipelinedRequest will return this
+  if (pActualRead)
+    *pActualRead = actualRead;
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Implementation of BlockForPipelinedRequestHandler, forwarding to the zip for stored data
+static udResult udFileHandler_MiniZBlockForPipelinedRequest(udFile *pFile, udFilePipelinedRequest *pPipelinedRequest, size_t *pActualRead)
+{
+  udFile_Zip *pZip = static_cast<udFile_Zip *>(pFile);
+  if (pZip->pEntry && !pZip->compressed)
+    return udFile_BlockForPipelinedRequest(pZip->pZipFile, pPipelinedRequest, pActualRead);
+
+  if (pActualRead)
+    *pActualRead = (size_t)pPipelinedRequest->reserved[0];
+  return udR_Success;
+}
+
+// ----------------------------------------------------------------------------
+// Implementation of ReleaseHandler, allowing many sub files to be open without holding as many o/s handles
+static udResult udFileHandler_MiniZRelease(udFile *pFile)
+{
+  udFile_Zip *pZip = static_cast<udFile_Zip *>(pFile);
+  return udFile_Release(pZip->pZipFile);
+}
+
+// ----------------------------------------------------------------------------
+// Author: Dave Pevreal, October 2014
+// Implementation of CloseHandler to access a file in the registered zip
+static udResult udFileHandler_MiniZClose(udFile **ppFile)
+{
+  if (ppFile == nullptr)
+    return udR_InvalidParameter;
+  udFile_Zip *pZip = static_cast<udFile_Zip *>(*ppFile);
+  if (pZip)
+  {
+    udFileHandler_MiniZFreeSubFile(pZip);
+    udFile *pZipFile = pZip->pZipFile;
+    if (pZipFile && udInterlockedCompareExchangePointer((void**)&pZip->pZipFile, nullptr, pZipFile) == pZipFile)
+      udFile_Close(&pZipFile);
+    udDestroyMutex(&pZip->pMutex);
+    udZipArchive_Release(&pZip->pArchive);
+    udFree(pZip);
+  }
+  return udR_Success;
+}
+
+// ----------------------------------------------------------------------------
+// Skip the local directory header of an entry to find the offset of its data within the zip
+static udResult udFileHandler_MiniZGetDataOffset(udFile_Zip *pZip, const udZipArchiveEntry *pEntry, int64_t *pDataOffset)
+{
+  udResult result;
+  int64_t offset = (int64_t)pEntry->localHeaderOffset;
+  uint8_t localDirHeader[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
+  uint32_t sig;
+  uint16_t filenameLen;
+  uint16_t extraLen;
+
+  UD_ERROR_CHECK(udFile_Read(pZip->pZipFile, localDirHeader, sizeof(localDirHeader), offset, udFSW_SeekSet));
+  memcpy(&sig, localDirHeader + 0, sizeof(sig));
+  memcpy(&filenameLen, localDirHeader + MZ_ZIP_LDH_FILENAME_LEN_OFS, sizeof(filenameLen));
+  memcpy(&extraLen, localDirHeader + MZ_ZIP_LDH_EXTRA_LEN_OFS, sizeof(extraLen));
+  UD_ERROR_IF(sig != MZ_ZIP_LOCAL_DIR_HEADER_SIG, udR_CorruptData);
+  *pDataOffset = offset + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + filenameLen + extraLen;
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Author: Dave Pevreal, November 2019
+// Special API to access individual subfiles of a zip without re-opening
+udResult udFileHandler_MiniZSetSubFilename(udFile *pFile, const char *pSubFilename)
+{
+  udResult result;
+  udFile_Zip *pZip = (udFile_Zip *)pFile;
+  const udZipArchiveEntry *pEntry;
+  int64_t dataOffset;
+
+  UD_ERROR_IF(pZip->fpRead != udFileHandler_MiniZSeekRead, udR_ObjectTypeMismatch);
+  // First tidy up any existing sub file data
+  udLockMutex(pZip->pMutex);
+  udFileHandler_MiniZFreeSubFile(pZip);
+  udReleaseMutex(pZip->pMutex);
+  pZip->fileLength = 0;
+  UD_ERROR_NULL(pSubFilename, udR_Success); // Legal to "unset" the sub filename
+
+  // The archive's index matches names regardless of separator, as zips created on a different platform may use different separators
+  pEntry = udZipArchive_Find(pZip->pArchive, pSubFilename);
+  UD_ERROR_NULL(pEntry, udR_OpenFailure);
+  UD_ERROR_IF(pEntry->method != 0 && pEntry->method != MZ_DEFLATED && pEntry->method != MZ_DEFLATED64, udR_Unsupported);
+  UD_ERROR_CHECK(udFileHandler_MiniZGetDataOffset(pZip, pEntry, &dataOffset));
+  pZip->fileLength = (int64_t)pEntry->uncompressedSize;
+
+  if (pEntry->method == 0)
+  {
+    // The file in the zip is just stored, so instead of going through the extraction
+    // machinery, we can use the SeekBase machinery of udFile to auto-offset
+    pZip->filePos = pZip->seekBase = dataOffset;
+  }
+  else
+  {
+    // File is compressed, inflate on demand as reads are made
+    pZip->dictSize = (pEntry->method == MZ_DEFLATED64) ? TINFL_LZ_DICT_SIZE * 2 : TINFL_LZ_DICT_SIZE;
+    pZip->inflateFlags = (pEntry->method == MZ_DEFLATED64) ? TINFL_FLAG_DEFLATE64 : 0;
+    pZip->compressedStart = dataOffset;
+    pZip->compressedEnd = dataOffset + (int64_t)pEntry->compressedSize;
+    pZip->expectedCrc = pEntry->crc;
+    pZip->checkpointSpacing = udZip_CheckpointSpacing;
+    pZip->pWindow = udAllocType(uint8_t, pZip->dictSize, udAF_None);
+    UD_ERROR_NULL(pZip->pWindow, udR_MemoryAllocationFailure);
+    pZip->pReadBuffer = udAllocType(uint8_t, udZip_ReadBufferSize, udAF_None);
+    UD_ERROR_NULL(pZip->pReadBuffer, udR_MemoryAllocationFailure);
+    udFileHandler_MiniZRestartInflate(pZip);
+    pZip->compressed = true;
+    pZip->filePos = pZip->seekBase = 0;
+  }
+  pZip->pEntry = pEntry;
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Author: Dave Pevreal, October 2014
+// Implementation of OpenHandler to access a file in the registered zip
+udResult udFileHandler_MiniZOpen(udFile **ppFile, const char *pFilename, udFileOpenFlags flags)
+{
+  udResult result;
+  udFile_Zip *pFile = nullptr;
+  char *pSubFilename = nullptr;
+  char *pZipName = nullptr;
+  const char *pFolderDelim = nullptr;
+  int64_t zipLen;
+  int64_t zipModifiedTime = 0;
+
+  UD_ERROR_IF(flags & udFOF_Write, udR_OpenFailure);
+
+  pFile = udAllocType(udFile_Zip, 1, udAF_Zero);
+  UD_ERROR_NULL(pFile, udR_MemoryAllocationFailure);
+  pFile->pMutex = udCreateMutex();
+  UD_ERROR_NULL(pFile->pMutex, udR_MemoryAllocationFailure);
 
   pFile->fpSetSubFilename = udFileHandler_MiniZSetSubFilename;
   pFile->fpRead = udFileHandler_MiniZSeekRead;
+  pFile->fpBlockPipedRequest = udFileHandler_MiniZBlockForPipelinedRequest;
+  pFile->fpRelease = udFileHandler_MiniZRelease;
   pFile->fpClose = udFileHandler_MiniZClose;
-  pFile->readComplete = true;
-
-  pFile->mz.m_pIO_opaque = pFile;
-  pFile->mz.m_pAlloc = udMiniZ_Alloc;
-  pFile->mz.m_pRealloc = udMiniZ_Realloc;
-  pFile->mz.m_pFree = udMiniZ_Free;
-  pFile->mz.m_pRead = udMiniZ_Read;
 
   // Need to extract just the zip filename
   pZipName = udStrdup(pFilename + 6); // Skip zip://
@@ -524,41 +1622,15 @@ udResult udFileHandler_MiniZOpen(udFile **ppFile, const char *pFilename, udFileO
   // Now open the underlying zip file
   UD_ERROR_CHECK(udFile_Open((udFile**)&pFile->pZipFile, pZipName, udFOF_Read, &zipLen));
 
-  // Initialise the zip reader
-  UD_ERROR_IF(!mz_zip_reader_init(&pFile->mz, (mz_uint64)zipLen, 0), udR_OpenFailure);
+  // Use the already parsed central directory if another handle has this zip open, and it hasn't been modified since
+  udFileExists(pZipName, nullptr, &zipModifiedTime); // Only local files report it, the key is length alone otherwise
+  UD_ERROR_CHECK(udZipArchive_Acquire(&pFile->pArchive, pFile->pZipFile, pZipName, zipLen, zipModifiedTime));
 
   if (!pSubFilename)
   {
-    // No sub-filename was specified, so read the TOC and return that as the file
-    mz_zip_archive_file_stat stat;
-    int fileCount = mz_zip_reader_get_num_files(&pFile->mz);
-    size_t tocSize = 1; // final null terminator
-
-    for (int i = 0; i < fileCount; ++i)
-    {
-      if (!mz_zip_reader_is_file_a_directory(&pFile->mz, i))
-      {
-        mz_zip_reader_file_stat(&pFile->mz, i, &stat);
-        tocSize += udStrlen(stat.m_filename) + 1; // Add 1 for newline
-      }
-    }
-    pFile->fileLength = (int64_t)tocSize;
-    pFile->pFileData = udAllocType(uint8_t, tocSize, udAF_None);
-    UD_ERROR_NULL(pFile->pFileData, udR_MemoryAllocationFailure);
-    tocSize = 0;
-    for (int i = 0; i < fileCount; ++i)
-    {
-      if (!mz_zip_reader_is_file_a_directory(&pFile->mz, i))
-      {
-        mz_zip_reader_file_stat(&pFile->mz, i, &stat);
-        size_t len = udStrlen(stat.m_filename);
-        memcpy(pFile->pFileData + tocSize, stat.m_filename, len);
-        tocSize += len;
-        pFile->pFileData[tocSize++] = '\n';
-      }
-    }
-    pFile->pFileData[tocSize++] = '\0';
-    pFile->lengthRead = (int32_t)pFile->fileLength;
+    // No sub-filename was specified, so return the TOC as the file
+    pFile->pFileData = pFile->pArchive->pTOC;
+    pFile->fileLength = (int64_t)pFile->pArchive->tocLength;
   }
   else if (*pSubFilename) // If the sub filename is not an empty string, assign it
   {
@@ -571,39 +1643,641 @@ udResult udFileHandler_MiniZOpen(udFile **ppFile, const char *pFilename, udFileO
 
 epilogue:
   if (pFile)
-  {
-    mz_zip_reader_end(&pFile->mz);
     udFileHandler_MiniZClose((udFile**)&pFile);
-  }
   udFree(pZipName);
   return result;
 }
 
+enum
+{
+  udZipWriter_InFlightPerThread = 4,    // Entries that may be queued or awaiting write per thread before udZipWriter_AddFile blocks
+  udZipWriter_Zip64Version = 45,        // Version needed to extract when ZIP64 extra fields are used
+  udZipWriter_DefaultVersion = 20,
+  udZipWriter_UTF8Flag = 1 << 11,       // General purpose flag indicating filenames are UTF-8
+  udZipWriter_DosDate = (1 << 5) | 1,   // 1980-01-01, entries have a fixed timestamp so output is reproducible
+};
+
+struct udZipWriterEntry
+{
+  struct udZipWriter *pWriter;
+  char *pName;
+  uint8_t *pData;             // Uncompressed data, freed once written
+  size_t dataLength;
+  void *pCompressed;          // Deflated data, or null if stored
+  size_t compressedLength;
+  uint64_t localHeaderOffset;
+  uint32_t crc;
+  uint16_t method;
+  bool compress;
+  bool complete;              // Compression has finished and the entry is ready to write
+};
+
+struct udZipWriter
+{
+  udFile *pFile;
+  udWorkerPool *pPool;
+  udMutex *pMutex;
+  udConditionVariable *pWritten;  // Signalled each time entries are written
+  udChunkedArray<udZipWriterEntry> entries;
+  size_t nextToWrite;
+  uint64_t writeOffset;
+  int maxInFlight;
+  udResult result;                // First error encountered
+};
+
+// ----------------------------------------------------------------------------
+// Append little endian values to a header being assembled
+static inline uint8_t *udZipWriter_Put16(uint8_t *p, uint32_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); return p + 2; }
+static inline uint8_t *udZipWriter_Put32(uint8_t *p, uint32_t v) { return udZipWriter_Put16(udZipWriter_Put16(p, v & 0xffff), v >> 16); }
+static inline uint8_t *udZipWriter_Put64(uint8_t *p, uint64_t v) { return udZipWriter_Put32(udZipWriter_Put32(p, (uint32_t)v), (uint32_t)(v >> 32)); }
+
+// ----------------------------------------------------------------------------
+// Write the local header and data of an entry, must be called with the mutex held and in entry order
+static udResult udZipWriter_WriteEntry(udZipWriter *pWriter, udZipWriterEntry *pEntry)
+{
+  udResult result;
+  size_t nameLength = udStrlen(pEntry->pName);
+  bool zip64 = pEntry->dataLength >= UINT32_MAX || pEntry->compressedLength >= UINT32_MAX;
+  uint8_t *pHeader = udAllocType(uint8_t, MZ_ZIP_LOCAL_DIR_HEADER_SIZE + nameLength + 20, udAF_None);
+  uint8_t *p = pHeader;
+
+  UD_ERROR_NULL(pHeader, udR_MemoryAllocationFailure);
+
+  pEntry->localHeaderOffset = pWriter->writeOffset;
+  p = udZipWriter_Put32(p, MZ_ZIP_LOCAL_DIR_HEADER_SIG);
+  p = udZipWriter_Put16(p, zip64 ? udZipWriter_Zip64Version : udZipWriter_DefaultVersion);
+  p = udZipWriter_Put16(p, udZipWriter_UTF8Flag);
+  p = udZipWriter_Put16(p, pEntry->method);
+  p = udZipWriter_Put16(p, 0); // Time
+  p = udZipWriter_Put16(p, udZipWriter_DosDate);
+  p = udZipWriter_Put32(p, pEntry->crc);
+  p = udZipWriter_Put32(p, zip64 ? UINT32_MAX : (uint32_t)pEntry->compressedLength);
+  p = udZipWriter_Put32(p, zip64 ? UINT32_MAX : (uint32_t)pEntry->dataLength);
+  p = udZipWriter_Put16(p, (uint32_t)nameLength);
+  p = udZipWriter_Put16(p, zip64 ? 20 : 0);
+  memcpy(p, pEntry->pName, nameLength);
+  p += nameLength;
+  if (zip64)
+  {
+    p = udZipWriter_Put16(p, MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID);
+    p = udZipWriter_Put16(p, 16);
+    p = udZipWriter_Put64(p, pEntry->dataLength);
+    p = udZipWriter_Put64(p, pEntry->compressedLength);
+  }
+  UD_ERROR_CHECK(udFile_Write(pWriter->pFile, pHeader, (size_t)(p - pHeader), (int64_t)pWriter->writeOffset, udFSW_SeekSet));
+  if (pEntry->compressedLength)
+    UD_ERROR_CHECK(udFile_Write(pWriter->pFile, pEntry->pCompressed ? pEntry->pCompressed : pEntry->pData, pEntry->compressedLength));
+  pWriter->writeOffset += (p - pHeader) + pEntry->compressedLength;
+  result = udR_Success;
+
+epilogue:
+  udFree(pHeader);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Worker pool task, compresses an entry then writes all consecutive completed entries
+static void udZipWriter_CompressEntry(void *pEntryPtr)
+{
+  udZipWriterEntry *pEntry = (udZipWriterEntry*)pEntryPtr;
+  udZipWriter *pWriter = pEntry->pWriter;
+  udResult result = udR_Success;
+
+  pEntry->crc = libdeflate_crc32(0, pEntry->pData, pEntry->dataLength);
+  pEntry->method = 0;
+  pEntry->compressedLength = pEntry->dataLength;
+  if (pEntry->compress && pEntry->dataLength)
+  {
+    size_t compressedLength;
+    result = udCompression_Deflate(&pEntry->pCompressed, &compressedLength, pEntry->pData, pEntry->dataLength, udCT_RawDeflate);
+    if (result == udR_Success && compressedLength < pEntry->dataLength)
+    {
+      pEntry->method = MZ_DEFLATED;
+      pEntry->compressedLength = compressedLength;
+    }
+    else
+    {
+      udFree(pEntry->pCompressed); // Store entries that don't compress
+    }
+  }
+
+  udLockMutex(pWriter->pMutex);
+  if (result != udR_Success && pWriter->result == udR_Success)
+    pWriter->result = result;
+  pEntry->complete = true;
+  bool wrote = false;
+  while (pWriter->nextToWrite < pWriter->entries.length)
+  {
+    udZipWriterEntry *pNext = pWriter->entries.GetElement(pWriter->nextToWrite);
+    if (!pNext->complete)
+      break;
+    if (pWriter->result == udR_Success)
+      pWriter->result = udZipWriter_WriteEntry(pWriter, pNext);
+    udFree(pNext->pData);
+    udFree(pNext->pCompressed);
+    ++pWriter->nextToWrite;
+    wrote = true;
+  }
+  udReleaseMutex(pWriter->pMutex);
+  if (wrote)
+    udSignalConditionVariable(pWriter->pWritten, pWriter->maxInFlight);
+}
+
+// ****************************************************************************
+// Create a zip archive writer
+udResult udZipWriter_Create(udZipWriter **ppWriter, const char *pFilename, int threadCount)
+{
+  udResult result;
+  udZipWriter *pWriter = nullptr;
+
+  UD_ERROR_NULL(ppWriter, udR_InvalidParameter);
+  UD_ERROR_NULL(pFilename, udR_InvalidParameter);
+  if (threadCount <= 0)
+    threadCount = udGetHardwareThreadCount();
+  threadCount = std::max(threadCount, 1);
+
+  pWriter = udAllocType(udZipWriter, 1, udAF_Zero);
+  UD_ERROR_NULL(pWriter, udR_MemoryAllocationFailure);
+  UD_ERROR_CHECK(pWriter->entries.Init(256));
+  pWriter->pMutex = udCreateMutex();
+  UD_ERROR_NULL(pWriter->pMutex, udR_MemoryAllocationFailure);
+  pWriter->pWritten = udCreateConditionVariable();
+  UD_ERROR_NULL(pWriter->pWritten, udR_MemoryAllocationFailure);
+  pWriter->maxInFlight = threadCount * udZipWriter_InFlightPerThread;
+  UD_ERROR_CHECK(udWorkerPool_Create(&pWriter->pPool, (uint32_t)threadCount, "udZipWriter"));
+  UD_ERROR_CHECK(udFile_Open(&pWriter->pFile, pFilename, udFOF_Write | udFOF_Create));
+
+  *ppWriter = pWriter;
+  pWriter = nullptr;
+  result = udR_Success;
+
+epilogue:
+  if (pWriter)
+    udZipWriter_Close(&pWriter);
+  return result;
+}
+
+// ****************************************************************************
+// Queue a file to be compressed and written to the archive
+udResult udZipWriter_AddFile(udZipWriter *pWriter, const char *pSubFilename, const void *pData, size_t dataLength, udCompressionType type)
+{
+  udResult result;
+  udZipWriterEntry *pEntry = nullptr;
+  char *pName = nullptr;
+  uint8_t *pCopy = nullptr;
+  bool locked = false;
+
+  UD_ERROR_IF(!pWriter || !pSubFilename || (!pData && dataLength), udR_InvalidParameter);
+  UD_ERROR_IF(type != udCT_None && type != udCT_RawDeflate, udR_Unsupported);
+  UD_ERROR_IF(udStrlen(pSubFilename) > UINT16_MAX, udR_InvalidParameter);
+  pName = udStrdup(pSubFilename);
+  UD_ERROR_NULL(pName, udR_MemoryAllocationFailure);
+  if (dataLength)
+  {
+    pCopy = (uint8_t*)udMemDup(pData, dataLength, 0, udAF_None);
+    UD_ERROR_NULL(pCopy, udR_MemoryAllocationFailure);
+  }
+
+  udLockMutex(pWriter->pMutex);
+  locked = true;
+  // Bound memory use by waiting for earlier entries to be written
+  while (pWriter->result == udR_Success && pWriter->entries.length - pWriter->nextToWrite >= (size_t)pWriter->maxInFlight)
+    udWaitConditionVariable(pWriter->pWritten, pWriter->pMutex);
+  UD_ERROR_CHECK(pWriter->result);
+  UD_ERROR_CHECK(pWriter->entries.PushBack(&pEntry));
+  pEntry->pWriter = pWriter;
+  pEntry->pName = pName;
+  pEntry->pData = pCopy;
+  pEntry->dataLength = dataLength;
+  pEntry->compress = (type == udCT_RawDeflate);
+  pName = nullptr;
+  pCopy = nullptr;
+  udReleaseMutex(pWriter->pMutex);
+  locked = false;
+
+  if (udWorkerPool_AddTask(pWriter->pPool, udZipWriter_CompressEntry, pEntry, false) != udR_Success)
+    udZipWriter_CompressEntry(pEntry); // Every entry must complete for those after it to be written, so do it on this thread
+  result = udR_Success;
+
+epilogue:
+  if (locked)
+    udReleaseMutex(pWriter->pMutex);
+  udFree(pName);
+  udFree(pCopy);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Write the central directory and end of central directory records
+static udResult udZipWriter_WriteCentralDirectory(udZipWriter *pWriter)
+{
+  udResult result;
+  uint64_t centralDirOffset = pWriter->writeOffset;
+  uint64_t entryCount = pWriter->entries.length;
+  size_t bufferLength = MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE;
+  uint8_t *pBuffer = nullptr;
+  uint8_t *p;
+
+  // Assembled in memory to be written at once, as there are typically many small entries
+  for (size_t i = 0; i < pWriter->entries.length; ++i)
+    bufferLength += MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + udStrlen(pWriter->entries.GetElement(i)->pName) + 28;
+  pBuffer = udAllocType(uint8_t, bufferLength, udAF_None);
+  UD_ERROR_NULL(pBuffer, udR_MemoryAllocationFailure);
+  p = pBuffer;
+
+  for (size_t i = 0; i < pWriter->entries.length; ++i)
+  {
+    const udZipWriterEntry *pEntry = pWriter->entries.GetElement(i);
+    size_t nameLength = udStrlen(pEntry->pName);
+    bool largeData = pEntry->dataLength >= UINT32_MAX;
+    bool largeCompressed = pEntry->compressedLength >= UINT32_MAX;
+    bool largeOffset = pEntry->localHeaderOffset >= UINT32_MAX;
+    uint16_t extraLength = (largeData || largeCompressed || largeOffset) ? (uint16_t)(4 + (largeData ? 8 : 0) + (largeCompressed ? 8 : 0) + (largeOffset ? 8 : 0)) : 0;
+
+    p = udZipWriter_Put32(p, MZ_ZIP_CENTRAL_DIR_HEADER_SIG);
+    p = udZipWriter_Put16(p, udZipWriter_Zip64Version); // Version made by
+    p = udZipWriter_Put16(p, extraLength ? udZipWriter_Zip64Version : udZipWriter_DefaultVersion);
+    p = udZipWriter_Put16(p, udZipWriter_UTF8Flag);
+    p = udZipWriter_Put16(p, pEntry->method);
+    p = udZipWriter_Put16(p, 0); // Time
+    p = udZipWriter_Put16(p, udZipWriter_DosDate);
+    p = udZipWriter_Put32(p, pEntry->crc);
+    p = udZipWriter_Put32(p, largeCompressed ? UINT32_MAX : (uint32_t)pEntry->compressedLength);
+    p = udZipWriter_Put32(p, largeData ? UINT32_MAX : (uint32_t)pEntry->dataLength);
+    p = udZipWriter_Put16(p, (uint32_t)nameLength);
+    p = udZipWriter_Put16(p, extraLength);
+    p = udZipWriter_Put16(p, 0); // Comment length
+    p = udZipWriter_Put16(p, 0); // Disk number
+    p = udZipWriter_Put16(p, 0); // Internal attributes
+    p = udZipWriter_Put32(p, 0); // External attributes
+    p = udZipWriter_Put32(p, largeOffset ? UINT32_MAX : (uint32_t)pEntry->localHeaderOffset);
+    memcpy(p, pEntry->pName, nameLength);
+    p += nameLength;
+    if (extraLength)
+    {
+      // Only fields that overflowed are present, in this order
+      p = udZipWriter_Put16(p, MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID);
+      p = udZipWriter_Put16(p, extraLength - 4U);
+      if (largeData)
+        p = udZipWriter_Put64(p, pEntry->dataLength);
+      if (largeCompressed)
+        p = udZipWriter_Put64(p, pEntry->compressedLength);
+      if (largeOffset)
+        p = udZipWriter_Put64(p, pEntry->localHeaderOffset);
+    }
+  }
+
+  {
+    uint64_t centralDirSize = (uint64_t)(p - pBuffer);
+    uint64_t zip64EndOffset = centralDirOffset + centralDirSize;
+    bool zip64 = entryCount >= UINT16_MAX || centralDirSize >= UINT32_MAX || centralDirOffset >= UINT32_MAX;
+
+    if (zip64)
+    {
+      p = udZipWriter_Put32(p, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG);
+      p = udZipWriter_Put64(p, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE - 12); // Size of the remaining record
+      p = udZipWriter_Put16(p, udZipWriter_Zip64Version);
+      p = udZipWriter_Put16(p, udZipWriter_Zip64Version);
+      p = udZipWriter_Put32(p, 0); // This disk
+      p = udZipWriter_Put32(p, 0); // Disk with the central directory
+      p = udZipWriter_Put64(p, entryCount);
+      p = udZipWriter_Put64(p, entryCount);
+      p = udZipWriter_Put64(p, centralDirSize);
+      p = udZipWriter_Put64(p, centralDirOffset);
+
+      p = udZipWriter_Put32(p, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG);
+      p = udZipWriter_Put32(p, 0); // Disk with the zip64 end of central directory
+      p = udZipWriter_Put64(p, zip64EndOffset);
+      p = udZipWriter_Put32(p, 1); // Total disks
+    }
+    p = udZipWriter_Put32(p, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG);
+    p = udZipWriter_Put16(p, 0); // This disk
+    p = udZipWriter_Put16(p, 0); // Disk with the central directory
+    p = udZipWriter_Put16(p, zip64 ? UINT16_MAX : (uint32_t)entryCount);
+    p = udZipWriter_Put16(p, zip64 ? UINT16_MAX : (uint32_t)entryCount);
+    p = udZipWriter_Put32(p, zip64 ? UINT32_MAX : (uint32_t)centralDirSize);
+    p = udZipWriter_Put32(p, zip64 ? UINT32_MAX : (uint32_t)centralDirOffset);
+    p = udZipWriter_Put16(p, 0); // Comment length
+  }
+  UD_ERROR_CHECK(udFile_Write(pWriter->pFile, pBuffer, (size_t)(p - pBuffer), (int64_t)centralDirOffset, udFSW_SeekSet));
+  pWriter->writeOffset += (uint64_t)(p - pBuffer);
+  result = udR_Success;
+
+epilogue:
+  udFree(pBuffer);
+  return result;
+}
+
+// ****************************************************************************
+// Finish writing the archive and destroy the writer
+udResult udZipWriter_Close(udZipWriter **ppWriter)
+{
+  udResult result;
+  udZipWriter *pWriter;
+
+  UD_ERROR_NULL(ppWriter, udR_InvalidParameter);
+  pWriter = *ppWriter;
+  *ppWriter = nullptr;
+  UD_ERROR_NULL(pWriter, udR_InvalidParameter);
+
+  if (pWriter->pMutex && pWriter->pWritten)
+  {
+    udLockMutex(pWriter->pMutex);
+    while (pWriter->nextToWrite < pWriter->entries.length)
+      udWaitConditionVariable(pWriter->pWritten, pWriter->pMutex);
+    udReleaseMutex(pWriter->pMutex);
+  }
+  udWorkerPool_Destroy(&pWriter->pPool);
+
+  result = pWriter->result;
+  if (result == udR_Success && pWriter->pFile)
+    result = udZipWriter_WriteCentralDirectory(pWriter);
+  if (pWriter->pFile)
+  {
+    udResult closeResult = udFile_Close(&pWriter->pFile);
+    if (result == udR_Success)
+      result = closeResult;
+  }
+
+  for (size_t i = 0; i < pWriter->entries.length; ++i)
+    udFree(pWriter->entries.GetElement(i)->pName);
+  pWriter->entries.Deinit();
+  udDestroyConditionVariable(&pWriter->pWritten);
+  udDestroyMutex(&pWriter->pMutex);
+  udFree(pWriter);
+
+epilogue:
+  return result;
+}
+
+// Rows of a PNG being filtered, a band of rows is processed by each thread
+struct udCompression_PNGFilterBand
+{
+  const uint8_t *pImage;
+  uint8_t *pFiltered;     // Each row is prefixed with its filter type
+  size_t stride;          // Bytes per unfiltered row
+  int channels;
+  int startRow;
+  int endRow;
+  bool adaptive;          // Choose the best filter per row, otherwise rows are unfiltered
+  udSemaphore *pDone;     // Incremented when the band finishes, for bands filtered on their own thread
+  udResult result;
+};
+
+enum
+{
+  udCompression_PNGParallelThreshold = 256 * 1024, // Images smaller than this many bytes are filtered on the calling thread
+  udCompression_PNGMaxThreads = 16,
+};
+
+// ----------------------------------------------------------------------------
+static inline uint8_t udCompression_PNGPaeth(uint8_t a, uint8_t b, uint8_t c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return (pb <= pc) ? b : c;
+}
+
+// ----------------------------------------------------------------------------
+// Filter a band of rows, choosing for each row the filter with the lowest sum of absolute differences (the heuristic libpng uses)
+static uint32_t udCompression_PNGFilterRows(void *pBandPtr)
+{
+  udCompression_PNGFilterBand *pBand = (udCompression_PNGFilterBand*)pBandPtr;
+  const size_t stride = pBand->stride;
+  const size_t bpp = (size_t)pBand->channels;
+  uint8_t *pCandidates = nullptr; // Sub, Up, Average and Paeth
+
+  if (pBand->adaptive)
+  {
+    pCandidates = udAllocType(uint8_t, stride * 4, udAF_None);
+    if (!pCandidates)
+    {
+      pBand->result = udR_MemoryAllocationFailure;
+      return 0;
+    }
+  }
+
+  for (int y = pBand->startRow; y < pBand->endRow; ++y)
+  {
+    const uint8_t *pRow = pBand->pImage + y * stride;
+    uint8_t *pOut = pBand->pFiltered + y * (stride + 1);
+
+    if (!pCandidates)
+    {
+      pOut[0] = 0;
+      memcpy(pOut + 1, pRow, stride);
+      continue;
+    }
+
+    const uint8_t *pPrior = (y > 0) ? pRow - stride : nullptr;
+    uint32_t sums[5] = {};
+    for (size_t x = 0; x < stride; ++x)
+    {
+      uint8_t a = (x >= bpp) ? pRow[x - bpp] : 0;
+      uint8_t b = pPrior ? pPrior[x] : 0;
+      uint8_t c = (pPrior && x >= bpp) ? pPrior[x - bpp] : 0;
+      uint8_t filtered[5];
+      filtered[0] = pRow[x];
+      filtered[1] = (uint8_t)(pRow[x] - a);
+      filtered[2] = (uint8_t)(pRow[x] - b);
+      filtered[3] = (uint8_t)(pRow[x] - ((a + b) >> 1));
+      filtered[4] = (uint8_t)(pRow[x] - udCompression_PNGPaeth(a, b, c));
+      for (int f = 0; f < 5; ++f)
+      {
+        sums[f] += (uint32_t)abs((int8_t)filtered[f]);
+        if (f)
+          pCandidates[(f - 1) * stride + x] = filtered[f];
+      }
+    }
+
+    int best = 0;
+    for (int f = 1; f < 5; ++f)
+    {
+      if (sums[f] < sums[best])
+        best = f;
+    }
+    pOut[0] = (uint8_t)best;
+    memcpy(pOut + 1, best ? pCandidates + (best - 1) * stride : pRow, stride);
+  }
+
+  udFree(pCandidates);
+  pBand->result = udR_Success;
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+// Completion is signalled with a semaphore rather than joining, as a band that finishes before udThread_Create
+// takes a reference parks its thread in the udThread cache, where a join would wait out the cache timeout
+static uint32_t udCompression_PNGFilterBandThread(void *pBandPtr)
+{
+  udCompression_PNGFilterBand *pBand = (udCompression_PNGFilterBand*)pBandPtr;
+  udCompression_PNGFilterRows(pBand);
+  udIncrementSemaphore(pBand->pDone);
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+// Write a PNG chunk header at p, the caller writes length bytes of data after it then calls udCompression_PNGEndChunk
+static inline uint8_t *udCompression_PNGBeginChunk(uint8_t *p, const char type[4], uint32_t length)
+{
+  p[0] = (uint8_t)(length >> 24); p[1] = (uint8_t)(length >> 16); p[2] = (uint8_t)(length >> 8); p[3] = (uint8_t)length;
+  memcpy(p + 4, type, 4);
+  return p + 8;
+}
+
+// ----------------------------------------------------------------------------
+// Append the crc of a chunk (type and data), pChunkType points to the chunk type written by udCompression_PNGBeginChunk
+static inline uint8_t *udCompression_PNGEndChunk(uint8_t *pChunkType, uint32_t length)
+{
+  uint32_t crc = libdeflate_crc32(0, pChunkType, length + 4);
+  uint8_t *p = pChunkType + 4 + length;
+  p[0] = (uint8_t)(crc >> 24); p[1] = (uint8_t)(crc >> 16); p[2] = (uint8_t)(crc >> 8); p[3] = (uint8_t)crc;
+  return p + 4;
+}
+
+// ----------------------------------------------------------------------------
+// Write a zlib stream of stored blocks, as the vendored libdeflate has no level 0. Returns the bytes written
+static size_t udCompression_PNGStore(const uint8_t *pSource, size_t sourceSize, uint8_t *pDest)
+{
+  uint8_t *p = pDest;
+  uint32_t adler = libdeflate_adler32(1, pSource, sourceSize);
+  *p++ = 0x78; // 32KB window, deflate
+  *p++ = 0x01; // Fastest, with check bits
+  do
+  {
+    size_t blockSize = std::min(sourceSize, (size_t)UINT16_MAX);
+    *p++ = (blockSize == sourceSize) ? 1 : 0; // BFINAL, stored
+    p[0] = (uint8_t)blockSize; p[1] = (uint8_t)(blockSize >> 8);
+    p[2] = (uint8_t)~blockSize; p[3] = (uint8_t)(~blockSize >> 8);
+    memcpy(p + 4, pSource, blockSize);
+    p += 4 + blockSize;
+    pSource += blockSize;
+    sourceSize -= blockSize;
+  } while (sourceSize);
+  p[0] = (uint8_t)(adler >> 24); p[1] = (uint8_t)(adler >> 16); p[2] = (uint8_t)(adler >> 8); p[3] = (uint8_t)adler;
+  return (size_t)(p + 4 - pDest);
+}
+
 // ****************************************************************************
 // Author: Dave Pevreal, August 2018
-udResult udCompression_CreatePNG(void **ppPNG, size_t *pPNGLen, const uint8_t *pImage, int width, int height, int channels)
+udResult udCompression_CreatePNG(void **ppPNG, size_t *pPNGLen, const uint8_t *pImage, int width, int height, int channels, int compressionLevel)
 {
+  static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  static const uint8_t colorTypes[5] = { 0, 0, 4, 2, 6 }; // Greyscale, greyscale with alpha, RGB, RGBA
   udResult result;
-  void *pPNG = nullptr;
+  uint8_t *pFiltered = nullptr;
+  uint8_t *pPNG = nullptr;
+  struct libdeflate_compressor *pCompressor = nullptr;
+  udCompression_PNGFilterBand bands[udCompression_PNGMaxThreads];
+  udSemaphore *pDone = nullptr;
+  int bandCount = 1;
+  int launched = 0;
+  size_t stride, filteredSize, idatBound, idatSize;
+  uint8_t *p, *pChunk;
 
   UD_ERROR_NULL(ppPNG, udR_InvalidParameter);
   UD_ERROR_NULL(pPNGLen, udR_InvalidParameter);
   UD_ERROR_NULL(pImage, udR_InvalidParameter);
   UD_ERROR_IF(width <= 0 || height <= 0, udR_InvalidParameter);
-  UD_ERROR_IF(channels < 3 || channels > 4, udR_InvalidParameter);
-
-  pPNG = tdefl_write_image_to_png_file_in_memory((const void *)pImage, width, height, channels, pPNGLen);
-  UD_ERROR_NULL(pPNG, udR_InvalidConfiguration); // Something went wrong, but we don't know what
-
-  // Unfortunately the PNG writer doesn't support custom memory allocators, so to allow
-  // the caller to free with regular udFree we must duplicate the allocation.
-  *ppPNG = udMemDup(pPNG, *pPNGLen, 0, udAF_None);
-  UD_ERROR_NULL(*ppPNG, udR_MemoryAllocationFailure);
+  UD_ERROR_IF(channels < 1 || channels > 4, udR_InvalidParameter);
+  UD_ERROR_IF(compressionLevel < 0 || compressionLevel > 12, udR_InvalidParameter);
+
+  stride = (size_t)width * channels;
+  filteredSize = (stride + 1) * height;
+  pFiltered = udAllocType(uint8_t, filteredSize, udAF_None);
+  UD_ERROR_NULL(pFiltered, udR_MemoryAllocationFailure);
+
+  // Rows are filtered independently (each only reads the unfiltered row above), so large images are split into bands across threads
+  if (filteredSize >= udCompression_PNGParallelThreshold)
+    bandCount = std::min(std::min(udGetHardwareThreadCount(), (int)udCompression_PNGMaxThreads), height);
+  bandCount = std::max(bandCount, 1);
+  if (bandCount > 1)
+    pDone = udCreateSemaphore();
+  for (int i = 0; i < bandCount; ++i)
+  {
+    bands[i].pImage = pImage;
+    bands[i].pFiltered = pFiltered;
+    bands[i].stride = stride;
+    bands[i].channels = channels;
+    bands[i].startRow = (int)((int64_t)height * i / bandCount);
+    bands[i].endRow = (int)((int64_t)height * (i + 1) / bandCount);
+    bands[i].adaptive = (compressionLevel > 0); // Filtering only helps when compressing
+    bands[i].pDone = pDone;
+    bands[i].result = udR_Failure;
+    if (i > 0 && pDone && udThread_Create(nullptr, udCompression_PNGFilterBandThread, &bands[i], udTCF_None, "udPNGFilter") == udR_Success)
+      ++launched;
+    else
+      bands[i].pDone = nullptr; // Filter this band on the calling thread instead
+  }
+  udCompression_PNGFilterRows(&bands[0]);
+  for (int i = 1; i < bandCount; ++i)
+  {
+    if (!bands[i].pDone)
+      udCompression_PNGFilterRows(&bands[i]);
+  }
+  while (launched--)
+    udWaitSemaphore(pDone);
+  udDestroySemaphore(&pDone);
+  for (int i = 0; i < bandCount; ++i)
+    UD_ERROR_CHECK(bands[i].result);
 
+  if (compressionLevel > 0)
+  {
+    pCompressor = libdeflate_alloc_compressor(compressionLevel);
+    UD_ERROR_NULL(pCompressor, udR_MemoryAllocationFailure);
+    idatBound = libdeflate_zlib_compress_bound(pCompressor, filteredSize);
+  }
+  else
+  {
+    idatBound = 2 + filteredSize + 5 * (filteredSize / UINT16_MAX + 1) + 4;
+  }
+  UD_ERROR_IF(idatBound > INT32_MAX, udR_InvalidParameter); // Image too large for a single IDAT chunk
+
+  // Signature, IHDR, IDAT and IEND, each chunk adding 12 bytes of length, type and crc
+  pPNG = udAllocType(uint8_t, sizeof(signature) + (12 + 13) + (12 + idatBound) + 12, udAF_None);
+  UD_ERROR_NULL(pPNG, udR_MemoryAllocationFailure);
+  p = pPNG;
+  memcpy(p, signature, sizeof(signature));
+  p += sizeof(signature);
+
+  pChunk = p + 4;
+  p = udCompression_PNGBeginChunk(p, "IHDR", 13);
+  p[0] = (uint8_t)(width >> 24); p[1] = (uint8_t)(width >> 16); p[2] = (uint8_t)(width >> 8); p[3] = (uint8_t)width;
+  p[4] = (uint8_t)(height >> 24); p[5] = (uint8_t)(height >> 16); p[6] = (uint8_t)(height >> 8); p[7] = (uint8_t)height;
+  p[8] = 8; // Bit depth
+  p[9] = colorTypes[channels];
+  p[10] = 0; // Deflate
+  p[11] = 0; // Adaptive filtering
+  p[12] = 0; // Not interlaced
+  p = udCompression_PNGEndChunk(pChunk, 13);
+
+  pChunk = p + 4;
+  p = udCompression_PNGBeginChunk(p, "IDAT", 0);
+  if (pCompressor)
+    idatSize = libdeflate_zlib_compress(pCompressor, pFiltered, filteredSize, p, idatBound);
+  else
+    idatSize = udCompression_PNGStore(pFiltered, filteredSize, p);
+  UD_ERROR_IF(idatSize == 0, udR_CompressionError);
+  udCompression_PNGBeginChunk(pChunk - 4, "IDAT", (uint32_t)idatSize); // Now the length is known
+  p = udCompression_PNGEndChunk(pChunk, (uint32_t)idatSize);
+
+  pChunk = p + 4;
+  p = udCompression_PNGBeginChunk(p, "IEND", 0);
+  p = udCompression_PNGEndChunk(pChunk, 0);
+
+  *pPNGLen = (size_t)(p - pPNG);
+  *ppPNG = pPNG;
+  pPNG = nullptr;
   result = udR_Success;
 
 epilogue:
-  if (pPNG)
-    MZ_FREE(pPNG);
+  if (pCompressor)
+    libdeflate_free_compressor(pCompressor);
+  udFree(pFiltered);
+  udFree(pPNG);
   return result;
 }
@@ -1,5 +1,24 @@
 #include "udPlatformUtil.h"
 
+#if defined(__x86_64__) || defined(_M_X64)
+# define UDCRC_X64 1
+# include <immintrin.h>
+# if defined(__GNUC__)
+#  define UDCRC_TARGET(features) __attribute__((target(features)))
+# else
+#  define UDCRC_TARGET(features)
+# endif
+#else
+# define UDCRC_X64 0
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+# define UDCRC_ARM_CRC32 1
+# include <arm_acle.h>
+#else
+# define UDCRC_ARM_CRC32 0
+#endif
+
 static uint32_t crc32_table[] =
 { /* CRC polynomial 0xedb88320 */
   0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
@@ -94,28 +113,243 @@ uint32_t crc32s_table[256] = {
 };
 
 
+// Slicing tables, slice[0] is the standard byte table and slice[n] advances an entry of slice[n - 1] by one more zero byte
+struct udCrcTables
+{
+  uint32_t slice[16][256];
+  uint32_t powers[67]; // x^(2^n) modulo the polynomial, one for each bit of a 64-bit length in bits. Not a fixed period, as the powers of CRC-32C cycle every 31
+  uint32_t polynomial;
+
+  udCrcTables(const uint32_t *pByteTable, uint32_t reflectedPolynomial);
+};
+
+// Constants for folding with carry-less multiplies, see Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+struct udCrcFoldConstants
+{
+  uint64_t fold512Low;  // x^(512+32) mod P
+  uint64_t fold512High; // x^(512-32) mod P
+  uint64_t fold128Low;  // x^(128+32) mod P
+  uint64_t fold128High; // x^(128-32) mod P
+  uint64_t fold64;      // x^64 mod P
+  uint64_t polynomial;  // P
+  uint64_t mu;          // x^64 / P
+};
+
+static const udCrcFoldConstants s_crc32FoldConstants = { 0x154442bd4, 0x1c6e41596, 0x1751997d0, 0x0ccaa009e, 0x163cd6124, 0x1db710641, 0x1f7011641 };
+static const udCrcFoldConstants s_crc32cFoldConstants = { 0x0740eef02, 0x09e4addf8, 0x0f20c0dfe, 0x14cd00bd6, 0x0dd45aab8, 0x105ec76f1, 0x0dea713f1 };
+
+enum
+{
+  udCrc_FoldMinimum = 256, // Buffers smaller than this don't amortise the folding setup
+};
+
+// ----------------------------------------------------------------------------
+// Multiply two polynomials modulo the CRC polynomial, all in the reflected domain
+static uint32_t udCrc_MultiplyModP(uint32_t a, uint32_t b, uint32_t polynomial)
+{
+  uint32_t product = 0;
+  for (uint32_t m = 1U << 31; m; m >>= 1)
+  {
+    if (a & m)
+      product ^= b;
+    b = (b & 1) ? (b >> 1) ^ polynomial : b >> 1;
+  }
+  return product;
+}
+
+// ----------------------------------------------------------------------------
+udCrcTables::udCrcTables(const uint32_t *pByteTable, uint32_t reflectedPolynomial)
+{
+  polynomial = reflectedPolynomial;
+  memcpy(slice[0], pByteTable, sizeof(slice[0]));
+  for (int n = 1; n < 16; ++n)
+  {
+    for (int i = 0; i < 256; ++i)
+      slice[n][i] = (slice[n - 1][i] >> 8) ^ slice[0][slice[n - 1][i] & 0xff];
+  }
+
+  powers[0] = 1U << 30; // x^1
+  for (int n = 1; n < (int)udLengthOf(powers); ++n)
+    powers[n] = udCrc_MultiplyModP(powers[n - 1], powers[n - 1], polynomial);
+}
+
+// ----------------------------------------------------------------------------
+static const udCrcTables &udCrc_Crc32Tables()
+{
+  static const udCrcTables tables(crc32_table, 0xedb88320);
+  return tables;
+}
+
+// ----------------------------------------------------------------------------
+static const udCrcTables &udCrc_Crc32cTables()
+{
+  static const udCrcTables tables(crc32s_table, 0x82f63b78);
+  return tables;
+}
+
+// ----------------------------------------------------------------------------
+// Slicing-by-16, the tables are indexed little-endian
+static uint32_t udCrc_Slice16(const udCrcTables &tables, uint32_t crc, const uint8_t *pBuffer, size_t length)
+{
+  for (; length >= 16; pBuffer += 16, length -= 16)
+  {
+    uint32_t words[4];
+    memcpy(words, pBuffer, sizeof(words));
+    words[0] ^= crc;
+    crc = 0;
+    for (int w = 0; w < 4; ++w)
+    {
+      const uint32_t (*pSlice)[256] = tables.slice + 15 - w * 4;
+      crc ^= pSlice[0][words[w] & 0xff] ^ pSlice[-1][(words[w] >> 8) & 0xff] ^ pSlice[-2][(words[w] >> 16) & 0xff] ^ pSlice[-3][words[w] >> 24];
+    }
+  }
+  for (; length; --length)
+    crc = tables.slice[0][(crc ^ *pBuffer++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if UDCRC_X64
+// ----------------------------------------------------------------------------
+UDCRC_TARGET("pclmul")
+static inline __m128i udCrc_Fold128(__m128i x, __m128i constants, __m128i next)
+{
+  return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, constants, 0x00), _mm_clmulepi64_si128(x, constants, 0x11)), next);
+}
+
+// ----------------------------------------------------------------------------
+// Folds 64 bytes at a time with carry-less multiplies then reduces to 32 bits, length must be at least 64 and a multiple of 16
+UDCRC_TARGET("pclmul")
+static uint32_t udCrc_FoldPCLMUL(const udCrcFoldConstants &k, uint32_t crc, const uint8_t *pBuffer, size_t length)
+{
+  const __m128i *pBlocks = (const __m128i*)pBuffer;
+  __m128i x0 = _mm_xor_si128(_mm_loadu_si128(pBlocks + 0), _mm_cvtsi32_si128((int)crc));
+  __m128i x1 = _mm_loadu_si128(pBlocks + 1);
+  __m128i x2 = _mm_loadu_si128(pBlocks + 2);
+  __m128i x3 = _mm_loadu_si128(pBlocks + 3);
+  pBlocks += 4;
+  length -= 64;
+
+  const __m128i fold512 = _mm_set_epi64x((int64_t)k.fold512High, (int64_t)k.fold512Low);
+  for (; length >= 64; pBlocks += 4, length -= 64)
+  {
+    x0 = udCrc_Fold128(x0, fold512, _mm_loadu_si128(pBlocks + 0));
+    x1 = udCrc_Fold128(x1, fold512, _mm_loadu_si128(pBlocks + 1));
+    x2 = udCrc_Fold128(x2, fold512, _mm_loadu_si128(pBlocks + 2));
+    x3 = udCrc_Fold128(x3, fold512, _mm_loadu_si128(pBlocks + 3));
+  }
+
+  const __m128i fold128 = _mm_set_epi64x((int64_t)k.fold128High, (int64_t)k.fold128Low);
+  x0 = udCrc_Fold128(x0, fold128, x1);
+  x0 = udCrc_Fold128(x0, fold128, x2);
+  x0 = udCrc_Fold128(x0, fold128, x3);
+  for (; length >= 16; ++pBlocks, length -= 16)
+    x0 = udCrc_Fold128(x0, fold128, _mm_loadu_si128(pBlocks));
+
+  // 128 bits down to 64, then to 32
+  const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+  x0 = _mm_xor_si128(_mm_clmulepi64_si128(x0, fold128, 0x10), _mm_srli_si128(x0, 8));
+  x0 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x0, mask32), _mm_set_epi64x(0, (int64_t)k.fold64), 0x00), _mm_srli_si128(x0, 4));
+
+  // Barrett reduction
+  const __m128i polynomialMu = _mm_set_epi64x((int64_t)k.mu, (int64_t)k.polynomial);
+  __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), polynomialMu, 0x10);
+  t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), polynomialMu, 0x00);
+  return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(_mm_xor_si128(x0, t), 4));
+}
+
+// ----------------------------------------------------------------------------
+UDCRC_TARGET("sse4.2")
+static uint32_t udCrc_Crc32cSSE42(uint32_t crc, const uint8_t *pBuffer, size_t length)
+{
+  uint64_t crc64 = crc;
+  for (; length >= 8; pBuffer += 8, length -= 8)
+  {
+    uint64_t word;
+    memcpy(&word, pBuffer, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint32_t)crc64;
+  for (; length; --length)
+    crc = _mm_crc32_u8(crc, *pBuffer++);
+  return crc;
+}
+#endif // UDCRC_X64
+
+// ----------------------------------------------------------------------------
+// Combine via crc1 * x^(8 * length2) + crc2, the power is built from the table of x^(2^n)
+static uint32_t udCrc_Combine(const udCrcTables &tables, uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+  uint32_t power = 1U << 31; // x^0
+  for (int n = 3; length2; length2 >>= 1, ++n)
+  {
+    if (length2 & 1)
+      power = udCrc_MultiplyModP(tables.powers[n], power, tables.polynomial);
+  }
+  return udCrc_MultiplyModP(power, crc1, tables.polynomial) ^ crc2;
+}
+
 // ****************************************************************************
 // Author: Dave Pevreal, July 2018
 uint32_t udCrc(const void *pBuffer, size_t length, uint32_t updateCrc)
 {
+  const uint8_t *pBytes = (const uint8_t*)pBuffer;
   updateCrc = ~updateCrc;
-  for (size_t i = 0; i < length; ++i)
+#if UDCRC_X64
+  if (length >= udCrc_FoldMinimum && udCPUSupportsPCLMUL())
   {
-    uint8_t octet = ((const uint8_t*)pBuffer)[i];
-    updateCrc = crc32_table[(updateCrc ^ octet) & 0xff] ^ (updateCrc >> 8);
+    size_t foldLength = length & ~(size_t)15;
+    updateCrc = udCrc_FoldPCLMUL(s_crc32FoldConstants, updateCrc, pBytes, foldLength);
+    pBytes += foldLength;
+    length -= foldLength;
   }
-  return ~updateCrc;
+#elif UDCRC_ARM_CRC32
+  for (; length >= 8; pBytes += 8, length -= 8)
+  {
+    uint64_t word;
+    memcpy(&word, pBytes, sizeof(word));
+    updateCrc = __crc32d(updateCrc, word);
+  }
+#endif
+  return ~udCrc_Slice16(udCrc_Crc32Tables(), updateCrc, pBytes, length);
 }
 
 // ****************************************************************************
 // Author: Dave Pevreal, July 2018
 uint32_t udCrc32c(const void *pBuffer, size_t length, uint32_t updateCrc)
 {
+  const uint8_t *pBytes = (const uint8_t*)pBuffer;
   updateCrc = ~updateCrc;
-  for (size_t i = 0; i < length; ++i)
+#if UDCRC_X64
+  if (length >= udCrc_FoldMinimum && udCPUSupportsPCLMUL())
+  {
+    size_t foldLength = length & ~(size_t)15;
+    updateCrc = udCrc_FoldPCLMUL(s_crc32cFoldConstants, updateCrc, pBytes, foldLength);
+    pBytes += foldLength;
+    length -= foldLength;
+  }
+  if (udCPUSupportsSSE42())
+    return ~udCrc_Crc32cSSE42(updateCrc, pBytes, length);
+#elif UDCRC_ARM_CRC32
+  for (; length >= 8; pBytes += 8, length -= 8)
   {
-    uint8_t octet = ((const uint8_t*)pBuffer)[i];
-    updateCrc = crc32s_table[(updateCrc ^ octet) & 0xff] ^ (updateCrc >> 8);
+    uint64_t word;
+    memcpy(&word, pBytes, sizeof(word));
+    updateCrc = __crc32cd(updateCrc, word);
   }
-  return ~updateCrc;
+#endif
+  return ~udCrc_Slice16(udCrc_Crc32cTables(), updateCrc, pBytes, length);
+}
+
+// ****************************************************************************
+// Combine the CRCs of two adjacent buffers into the CRC of their concatenation
+uint32_t udCrcCombine(uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+  return udCrc_Combine(udCrc_Crc32Tables(), crc1, crc2, length2);
+}
+
+// ****************************************************************************
+// Combine the CRC32Cs of two adjacent buffers into the CRC32C of their concatenation
+uint32_t udCrc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+  return udCrc_Combine(udCrc_Crc32cTables(), crc1, crc2, length2);
 }
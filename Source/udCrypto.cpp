@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <atomic>
+#include <algorithm>
 #include "udCrypto.h"
 #include "udJSON.h"
 #include "udThread.h"
@@ -17,6 +18,21 @@
 #include <fcntl.h>
 #include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+# define UDCRYPTO_X86 1
+# include <immintrin.h>
+# if defined(__GNUC__)
+#  define UDCRYPTO_TARGET(features) __attribute__((target(features)))
+#  define udCrypto_ByteSwap64 __builtin_bswap64
+# else
+#  define UDCRYPTO_TARGET(features)
+#  define udCrypto_ByteSwap64 _byteswap_uint64
+# endif
+#else
+# define UDCRYPTO_X86 0
 #endif
 
 #define MBEDTLS_ALLOW_PRIVATE_ACCESS
@@ -51,17 +67,58 @@ enum
 const mbedtls_md_type_t udc_to_mbed_hashfunctions[] = { MBEDTLS_MD_SHA1, MBEDTLS_MD_SHA256, MBEDTLS_MD_SHA512, MBEDTLS_MD_MD5, MBEDTLS_MD_NONE };
 UDCOMPILEASSERT(UDARRAYSIZE(udc_to_mbed_hashfunctions) == udCH_Count+1, "Hash methods array not updated as well!");
 
+// The key dependent state of GHASH, computed once per key
+struct udCryptoGHASHKey
+{
+  uint64_t tableHigh[16];   // 4-bit multiplication tables for the portable path
+  uint64_t tableLow[16];
+  uint8_t powers[4][16];    // H, H^2, H^3 and H^4 byte reflected, for the PCLMUL path
+};
+
+// State carried between udCryptoCipher_Update calls
+struct udCryptoCipherStream
+{
+  uint8_t counter[AES_BLOCK_SIZE];     // Counter block of the first block of the stream
+  uint8_t tagCounter[AES_BLOCK_SIZE];  // GCM only, counter block used to encrypt the tag
+  uint8_t keystream[AES_BLOCK_SIZE];   // Keystream of the block containing position, when position isn't block aligned
+  uint8_t ghashState[AES_BLOCK_SIZE];  // GCM only
+  uint8_t ghashPending[AES_BLOCK_SIZE]; // GCM only, ciphertext not yet hashed because it doesn't fill a block
+  uint64_t position;                   // Bytes processed since udCryptoCipher_Begin
+  uint64_t aadLength;
+  udCryptoStreamDirection direction;
+  bool active;
+};
+
 struct udCryptoCipherContext
 {
-  mbedtls_aes_context ctx;
+  mbedtls_aes_context ctx;     // Encryption key schedule, expanded when the context is created
+  mbedtls_aes_context decCtx;  // Decryption key schedule, only expanded for CBC mode
   uint8_t key[32];
-  uint8_t iv[AES_BLOCK_SIZE];
   size_t blockSize;
   int keyLengthInBits;
   udCryptoCiphers cipher;
   udCryptoChainMode chainMode;
   udCryptoPaddingMode padMode;
-  bool ctxInit;
+  udCryptoGHASHKey ghashKey; // Only initialised for GCM mode
+  udCryptoCipherStream stream;
+};
+
+static void udCrypto_GHASHInit(udCryptoGHASHKey *pKey, mbedtls_aes_context *pAES);
+
+enum
+{
+  udCrypto_SHABlockSize = 64, // SHA-1 and SHA-256 share the block size and padding, only the compression differs
+  udCrypto_HMACBlockSize = 64, // Used for every hash (including SHA-512) to remain compatible with existing HMACs
+};
+
+typedef void udCryptoSHABlockFunc(uint32_t *pState, const uint8_t *pBlocks, size_t blockCount);
+
+struct udCryptoSHAContext
+{
+  udCryptoSHABlockFunc *pBlockFunc; // Chosen at creation for the hash and the CPU
+  uint32_t state[8];
+  uint64_t length;
+  uint8_t buffer[udCrypto_SHABlockSize];
 };
 
 struct udCryptoHashContext
@@ -70,8 +127,7 @@ struct udCryptoHashContext
   size_t hashLengthInBytes;
   union
   {
-    mbedtls_sha1_context sha1;
-    mbedtls_sha256_context sha256;
+    udCryptoSHAContext sha; // udCH_SHA1 and udCH_SHA256
     mbedtls_sha512_context sha512;
     mbedtls_md5_context md5;
   };
@@ -85,8 +141,18 @@ struct udCryptoSigContext
     mbedtls_rsa_context rsa;
     mbedtls_ecdsa_context ecdsa;
   };
+
+  // Only used by contexts shared through udCryptoSig_ImportVerifyKey, guarded by s_udCryptoKeyCacheLock
+  const char *pCachedKeyText;
+  uint64_t cachedKeyHash;
+  int32_t cachedRefCount;
+  udCryptoSigContext *pNextCached;
 };
 
+// Verification keys are rarely imported so a spin lock is enough, and unlike a udMutex it needs no creation
+static udSpinLock s_udCryptoKeyCacheLock;
+static udCryptoSigContext *s_pCachedKeys = nullptr;
+
 struct udCryptoSharedData
 {
   static std::atomic<int32_t> loadCount;
@@ -96,6 +162,33 @@ struct udCryptoSharedData
 std::atomic<int32_t> udCryptoSharedData::loadCount(0);
 std::atomic<int32_t> udCryptoSharedData::initialised(0);
 
+enum
+{
+  udCR_ReseedInterval = 4096,  // Requests (each of up to MBEDTLS_CTR_DRBG_MAX_REQUEST bytes) between reseeds from system entropy
+};
+
+// Each thread has its own DRBG so generating random data doesn't contend or require an entropy gather per call
+struct udCryptoRandomState
+{
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context drbg;
+  uint32_t forkGeneration;
+  bool seeded;
+
+  ~udCryptoRandomState()
+  {
+    if (seeded)
+    {
+      mbedtls_ctr_drbg_free(&drbg);
+      mbedtls_entropy_free(&entropy);
+    }
+  }
+};
+static thread_local udCryptoRandomState t_udCryptoRandom;
+
+// Incremented in a forked child so DRBGs inherited from the parent are reseeded rather than repeating its output
+static std::atomic<uint32_t> s_udCryptoForkGeneration(0);
+
 // ***************************************************************************************
 // Author: Dave Pevreal, September 2017
 // Helper to convert write an mpi to a udJSON key as a base64 string
@@ -180,26 +273,65 @@ void udCrypto_Obscure(const char *pBase64String)
 udResult udCrypto_Random(void *pMem, size_t len)
 {
   udResult result;
-  mbedtls_entropy_context entropy;
-  mbedtls_ctr_drbg_context ctr_drbg;
+  udCryptoRandomState &state = t_udCryptoRandom;
+  uint32_t forkGeneration = s_udCryptoForkGeneration.load(std::memory_order_relaxed);
 
-  mbedtls_ctr_drbg_init(&ctr_drbg);
-  mbedtls_entropy_init(&entropy);
   UD_ERROR_IF(!udCryptoSharedData::initialised, udR_NotInitialized);
+  UD_ERROR_IF(pMem == nullptr && len, udR_InvalidParameter);
+
+  if (state.seeded && state.forkGeneration != forkGeneration)
+  {
+    // Mix fresh entropy in before generating anything in a forked child
+    UD_ERROR_IF(mbedtls_ctr_drbg_reseed(&state.drbg, nullptr, 0) != 0, udR_InternalCryptoError);
+    state.forkGeneration = forkGeneration;
+  }
+  if (!state.seeded)
+  {
+    mbedtls_entropy_init(&state.entropy);
+    mbedtls_ctr_drbg_init(&state.drbg);
+    state.seeded = true;
+    state.forkGeneration = forkGeneration;
+    // Seed the random number generator, the state's address is a personalisation string distinguishing threads
+    const void *pPersonalisation = &state;
+    UD_ERROR_IF(mbedtls_ctr_drbg_seed(&state.drbg, mbedtls_entropy_func, &state.entropy, (const unsigned char*)&pPersonalisation, sizeof(pPersonalisation)) != 0, udR_InternalCryptoError);
+    mbedtls_ctr_drbg_set_reseed_interval(&state.drbg, udCR_ReseedInterval);
+  }
 
-  // Seed the random number generator
-  UD_ERROR_IF(mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)__FUNCTION__, sizeof(__FUNCTION__)) != 0, udR_InternalCryptoError);
-  // Generate some random data
-  UD_ERROR_IF(mbedtls_ctr_drbg_random(&ctr_drbg, (unsigned char*)pMem, len) != 0, udR_InternalCryptoError);
+  // The DRBG is only used by this thread, so the unlocked variant avoids a mutex per call. Large requests are split to the DRBG's maximum
+  for (size_t offset = 0; offset < len; offset += MBEDTLS_CTR_DRBG_MAX_REQUEST)
+  {
+    size_t requestLength = std::min(len - offset, (size_t)MBEDTLS_CTR_DRBG_MAX_REQUEST);
+    UD_ERROR_IF(mbedtls_ctr_drbg_random_with_add(&state.drbg, (unsigned char*)pMem + offset, requestLength, nullptr, 0) != 0, udR_InternalCryptoError);
+  }
 
   result = udR_Success;
 
 epilogue:
-  mbedtls_ctr_drbg_free(&ctr_drbg);
-  mbedtls_entropy_free(&entropy);
+  if (result == udR_InternalCryptoError && state.seeded)
+  {
+    // Discard the state so the next call starts afresh
+    mbedtls_ctr_drbg_free(&state.drbg);
+    mbedtls_entropy_free(&state.entropy);
+    state.seeded = false;
+  }
   return result;
 }
 
+// ---------------------------------------------------------------------------------------
+// Random number callback for mbedtls, so key generation and signing use the thread's DRBG rather than seeding their own
+static int udCrypto_RandomCallback(void * /*pUnused*/, unsigned char *pOutput, size_t outputLength)
+{
+  return (udCrypto_Random(pOutput, outputLength) == udR_Success) ? 0 : MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+}
+
+#if !UDPLATFORM_WINDOWS
+// ---------------------------------------------------------------------------------------
+static void udCrypto_AtForkChild()
+{
+  ++s_udCryptoForkGeneration;
+}
+#endif
+
 // ***************************************************************************************
 // Author: Paul Fox, October 2018
 void udCrypto_ThreadingMutexInit(mbedtls_threading_mutex_t *pMutexCtx)
@@ -244,6 +376,11 @@ udResult udCrypto_Init()
   if (loadCount == 0)
   {
     mbedtls_threading_set_alt(udCrypto_ThreadingMutexInit, udCrypto_ThreadingMutexFree, udCrypto_ThreadingMutexLock, udCrypto_ThreadingMutexUnlock);
+#if !UDPLATFORM_WINDOWS
+    static std::atomic<bool> forkHandlerRegistered(false);
+    if (!forkHandlerRegistered.exchange(true))
+      pthread_atfork(nullptr, nullptr, udCrypto_AtForkChild);
+#endif
     udCryptoSharedData::initialised = 1;
   }
   else
@@ -282,6 +419,7 @@ udResult udCryptoCipher_Create(udCryptoCipherContext **ppCtx, udCryptoCiphers ci
   UD_ERROR_NULL(pCtx, udR_MemoryAllocationFailure);
 
   mbedtls_aes_init(&pCtx->ctx);
+  mbedtls_aes_init(&pCtx->decCtx);
   pCtx->cipher = cipher;
   pCtx->padMode = padMode;
   pCtx->chainMode = chainMode;
@@ -301,7 +439,13 @@ udResult udCryptoCipher_Create(udCryptoCipherContext **ppCtx, udCryptoCiphers ci
   }
   UD_ERROR_CHECK(udBase64Decode(pKey, 0, pCtx->key, sizeof(pCtx->key), &keyLen));
   UD_ERROR_IF((int)keyLen != pCtx->keyLengthInBits / 8, udR_InvalidConfiguration);
-  pCtx->ctxInit = false;
+
+  // Expand the key schedules once up front, CTR and GCM only use the forward cipher
+  UD_ERROR_IF(mbedtls_aes_setkey_enc(&pCtx->ctx, pCtx->key, pCtx->keyLengthInBits) != 0, udR_InternalCryptoError);
+  if (chainMode == udCCM_CBC)
+    UD_ERROR_IF(mbedtls_aes_setkey_dec(&pCtx->decCtx, pCtx->key, pCtx->keyLengthInBits) != 0, udR_InternalCryptoError);
+  else if (chainMode == udCCM_GCM)
+    udCrypto_GHASHInit(&pCtx->ghashKey, &pCtx->ctx);
 
   // Give ownership of the context to the caller
   *ppCtx = pCtx;
@@ -312,6 +456,7 @@ epilogue:
   if (pCtx)
   {
     mbedtls_aes_free(&pCtx->ctx);
+    mbedtls_aes_free(&pCtx->decCtx);
     udFreeSecure(pCtx, sizeof(*pCtx));
   }
   return result;
@@ -334,209 +479,1063 @@ udResult udCrypto_CreateIVForCTRMode(udCryptoCipherContext *pCtx, udCryptoIV *pI
   return udR_Success;
 }
 
-// ***************************************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udCryptoCipher_Encrypt(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pPlainText, size_t plainTextLen, void *pCipherText, size_t cipherTextLen, size_t *pPaddedCipherTextLen, udCryptoIV *pOutIV)
+enum
 {
-  udResult result;
-  size_t paddedCliperTextLen = 0;
-  const void *pPaddedPlainText = nullptr;
+  udCrypto_CTRMinBandSize = 1024 * 1024, // Bulk CTR requests are split into bands of at least this many bytes, one per thread
+  udCrypto_CTRMaxThreads = 64,
+  udCrypto_CTRBatchBlocks = 32,          // Keystream blocks generated at a time by the portable path
+};
 
-  UD_ERROR_IF(!pCtx || !pPlainText || !pCipherText, udR_InvalidParameter);
+// A contiguous range of a CTR mode request, processed by one thread
+struct udCryptoCTRBand
+{
+  const mbedtls_aes_context *pAES;  // Encryption key schedule, read only so shared between bands
+  uint8_t counter[AES_BLOCK_SIZE];  // Counter block for the first block of the band
+  const uint8_t *pInput;
+  uint8_t *pOutput;                 // May be the same as pInput
+  size_t length;
+};
 
-  if (!pCtx->ctxInit)
+// ---------------------------------------------------------------------------------------
+// Add to the 128-bit big endian counter block, matching the wrap behaviour of mbedtls_aes_crypt_ctr
+static void udCrypto_CTRAdvance(uint8_t counter[AES_BLOCK_SIZE], uint64_t blocks)
+{
+  for (int i = AES_BLOCK_SIZE - 1; i >= 0 && blocks; --i)
   {
-    mbedtls_aes_setkey_enc(&pCtx->ctx, pCtx->key, pCtx->keyLengthInBits);
-    pCtx->ctxInit = true;
+    blocks += counter[i];
+    counter[i] = (uint8_t)blocks;
+    blocks >>= 8;
   }
+}
 
-  if (pCtx->padMode == udCPM_None)
-    paddedCliperTextLen = plainTextLen;
-  else
-    paddedCliperTextLen = (plainTextLen + pCtx->blockSize) & ~(pCtx->blockSize - 1);
+// ---------------------------------------------------------------------------------------
+// Generate keystream a batch of blocks at a time with whichever AES implementation mbedtls selected
+static void udCrypto_CTRPortable(udCryptoCTRBand *pBand)
+{
+  uint8_t counters[udCrypto_CTRBatchBlocks * AES_BLOCK_SIZE];
+  uint8_t keystream[udCrypto_CTRBatchBlocks * AES_BLOCK_SIZE];
+  uint8_t counter[AES_BLOCK_SIZE];
 
-  UD_ERROR_IF((paddedCliperTextLen  & (pCtx->blockSize - 1)) != 0, udR_AlignmentRequired);
-  UD_ERROR_IF(paddedCliperTextLen > cipherTextLen, udR_BufferTooSmall);
+  memcpy(counter, pBand->counter, sizeof(counter));
+  for (size_t offset = 0; offset < pBand->length; offset += sizeof(keystream))
+  {
+    size_t batchLength = std::min(pBand->length - offset, sizeof(keystream));
+    size_t batchBlocks = (batchLength + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+    for (size_t i = 0; i < batchBlocks; ++i)
+    {
+      memcpy(&counters[i * AES_BLOCK_SIZE], counter, AES_BLOCK_SIZE);
+      udCrypto_CTRAdvance(counter, 1);
+    }
+    for (size_t i = 0; i < batchBlocks; ++i)
+      mbedtls_aes_crypt_ecb((mbedtls_aes_context*)pBand->pAES, MBEDTLS_AES_ENCRYPT, &counters[i * AES_BLOCK_SIZE], &keystream[i * AES_BLOCK_SIZE]);
+    for (size_t i = 0; i < batchLength; ++i)
+      pBand->pOutput[offset + i] = pBand->pInput[offset + i] ^ keystream[i];
+  }
 
-  // Trading efficiency for simplicity, just duplicate the source and add the padding bytes
-  if (paddedCliperTextLen != plainTextLen)
+  mbedtls_platform_zeroize(keystream, sizeof(keystream));
+}
+
+#if UDCRYPTO_X86
+// ---------------------------------------------------------------------------------------
+// Load the counter as two host order halves so it can be incremented cheaply
+static inline void udCrypto_CTRLoadCounter(const uint8_t counter[AES_BLOCK_SIZE], uint64_t *pHigh, uint64_t *pLow)
+{
+  *pHigh = 0;
+  *pLow = 0;
+  for (int i = 0; i < 8; ++i)
   {
-    size_t padBytes = paddedCliperTextLen - plainTextLen;
-    pPaddedPlainText = udMemDup(pPlainText, plainTextLen, padBytes, udAF_None);
-    memset(udAddBytes((void*)pPaddedPlainText, plainTextLen), (int)padBytes, padBytes);
+    *pHigh = (*pHigh << 8) | counter[i];
+    *pLow = (*pLow << 8) | counter[8 + i];
   }
-  else
+}
+
+// ---------------------------------------------------------------------------------------
+UDCRYPTO_TARGET("sse2") static inline __m128i udCrypto_CTRNextBlock(uint64_t *pHigh, uint64_t *pLow)
+{
+  __m128i block = _mm_set_epi64x((long long)udCrypto_ByteSwap64(*pLow), (long long)udCrypto_ByteSwap64(*pHigh));
+  if (++*pLow == 0)
+    ++*pHigh;
+  return block;
+}
+
+// ---------------------------------------------------------------------------------------
+// AES-NI keystream, 8 blocks in flight to hide the latency of aesenc
+UDCRYPTO_TARGET("aes,sse2") static void udCrypto_CTRAESNI(udCryptoCTRBand *pBand)
+{
+  const __m128i *pRoundKeys = (const __m128i*)pBand->pAES->rk;
+  const int rounds = pBand->pAES->nr;
+  __m128i roundKeys[15];
+  uint64_t high, low;
+  const uint8_t *pInput = pBand->pInput;
+  uint8_t *pOutput = pBand->pOutput;
+  size_t length = pBand->length;
+
+  for (int r = 0; r <= rounds; ++r)
+    roundKeys[r] = _mm_loadu_si128(&pRoundKeys[r]);
+  udCrypto_CTRLoadCounter(pBand->counter, &high, &low);
+
+  for (; length >= 8 * AES_BLOCK_SIZE; length -= 8 * AES_BLOCK_SIZE, pInput += 8 * AES_BLOCK_SIZE, pOutput += 8 * AES_BLOCK_SIZE)
   {
-    pPaddedPlainText = pPlainText;
+    __m128i blocks[8];
+    for (int i = 0; i < 8; ++i)
+      blocks[i] = _mm_xor_si128(udCrypto_CTRNextBlock(&high, &low), roundKeys[0]);
+    for (int r = 1; r < rounds; ++r)
+    {
+      for (int i = 0; i < 8; ++i)
+        blocks[i] = _mm_aesenc_si128(blocks[i], roundKeys[r]);
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+      blocks[i] = _mm_aesenclast_si128(blocks[i], roundKeys[rounds]);
+      _mm_storeu_si128((__m128i*)pOutput + i, _mm_xor_si128(blocks[i], _mm_loadu_si128((const __m128i*)pInput + i)));
+    }
   }
 
-  switch (pCtx->cipher)
+  while (length > 0)
   {
-    case udCC_AES128:
-    case udCC_AES256:
-      {
-        switch (pCtx->chainMode)
-        {
-          case udCCM_CBC:
-            UD_ERROR_NULL(pIV, udR_InvalidParameter);
-            memcpy(pCtx->iv, pIV, sizeof(pCtx->iv));
-            UD_ERROR_IF(mbedtls_aes_crypt_cbc(&pCtx->ctx, MBEDTLS_AES_ENCRYPT, paddedCliperTextLen, pCtx->iv, (const unsigned char*)pPaddedPlainText, (unsigned char*)pCipherText) != 0, udR_InternalCryptoError);
+    __m128i block = _mm_xor_si128(udCrypto_CTRNextBlock(&high, &low), roundKeys[0]);
+    for (int r = 1; r < rounds; ++r)
+      block = _mm_aesenc_si128(block, roundKeys[r]);
+    block = _mm_aesenclast_si128(block, roundKeys[rounds]);
 
-            // For CBC, the output IV is the last encrypted block
-            if (pOutIV)
-              memcpy(pOutIV, (char*)pCipherText + paddedCliperTextLen - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
-            break;
+    size_t blockLength = std::min(length, (size_t)AES_BLOCK_SIZE);
+    if (blockLength == AES_BLOCK_SIZE)
+    {
+      _mm_storeu_si128((__m128i*)pOutput, _mm_xor_si128(block, _mm_loadu_si128((const __m128i*)pInput)));
+    }
+    else
+    {
+      uint8_t keystream[AES_BLOCK_SIZE];
+      _mm_storeu_si128((__m128i*)keystream, block);
+      for (size_t i = 0; i < blockLength; ++i)
+        pOutput[i] = pInput[i] ^ keystream[i];
+      mbedtls_platform_zeroize(keystream, sizeof(keystream));
+    }
+    length -= blockLength;
+    pInput += blockLength;
+    pOutput += blockLength;
+  }
+}
 
-          case udCCM_CTR:
-            UD_ERROR_IF(pIV == nullptr || pOutIV != nullptr, udR_InvalidParameter); // Don't allow output IV in CTR mode (yet)
-            memcpy(pCtx->iv, pIV, sizeof(pCtx->iv));
-            {
-              size_t ncoff = 0;
-              unsigned char stream_block[16];
-              UD_ERROR_IF(mbedtls_aes_crypt_ctr(&pCtx->ctx, paddedCliperTextLen, &ncoff, pCtx->iv, stream_block, (const unsigned char*)pPaddedPlainText, (unsigned char *)pCipherText) != 0, udR_InternalCryptoError);
-            }
-            break;
+// ---------------------------------------------------------------------------------------
+// VAES keystream, two blocks per instruction with 16 blocks in flight, the tail is left to the AES-NI path
+UDCRYPTO_TARGET("vaes,aes,avx2") static void udCrypto_CTRVAES(udCryptoCTRBand *pBand)
+{
+  const __m128i *pRoundKeys = (const __m128i*)pBand->pAES->rk;
+  const int rounds = pBand->pAES->nr;
+  __m256i roundKeys[15];
+  uint64_t high, low;
+  size_t bulkLength = pBand->length & ~(size_t)(16 * AES_BLOCK_SIZE - 1);
 
-          default:
-            UD_ERROR_SET(udR_InvalidConfiguration);
-        }
-      }
-      break;
-    default:
-      UD_ERROR_SET(udR_InvalidConfiguration);
+  for (int r = 0; r <= rounds; ++r)
+    roundKeys[r] = _mm256_broadcastsi128_si256(_mm_loadu_si128(&pRoundKeys[r]));
+  udCrypto_CTRLoadCounter(pBand->counter, &high, &low);
+
+  for (size_t offset = 0; offset < bulkLength; offset += 16 * AES_BLOCK_SIZE)
+  {
+    const __m256i *pInput = (const __m256i*)(pBand->pInput + offset);
+    __m256i *pOutput = (__m256i*)(pBand->pOutput + offset);
+    __m256i blocks[8];
+    for (int i = 0; i < 8; ++i)
+    {
+      __m128i first = udCrypto_CTRNextBlock(&high, &low);
+      __m128i second = udCrypto_CTRNextBlock(&high, &low);
+      blocks[i] = _mm256_xor_si256(_mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1), roundKeys[0]);
+    }
+    for (int r = 1; r < rounds; ++r)
+    {
+      for (int i = 0; i < 8; ++i)
+        blocks[i] = _mm256_aesenc_epi128(blocks[i], roundKeys[r]);
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+      blocks[i] = _mm256_aesenclast_epi128(blocks[i], roundKeys[rounds]);
+      _mm256_storeu_si256(pOutput + i, _mm256_xor_si256(blocks[i], _mm256_loadu_si256(pInput + i)));
+    }
   }
+  _mm256_zeroupper();
 
-  if (pPaddedCipherTextLen)
-    *pPaddedCipherTextLen = paddedCliperTextLen;
-  result = udR_Success;
+  if (bulkLength < pBand->length)
+  {
+    udCryptoCTRBand tail = *pBand;
+    udCrypto_CTRAdvance(tail.counter, bulkLength / AES_BLOCK_SIZE);
+    tail.pInput += bulkLength;
+    tail.pOutput += bulkLength;
+    tail.length -= bulkLength;
+    udCrypto_CTRAESNI(&tail);
+  }
+}
+#endif // UDCRYPTO_X86
 
-epilogue:
-  if (pPaddedPlainText != pPlainText)
-    udFreeSecure(pPaddedPlainText, paddedCliperTextLen);
+// ---------------------------------------------------------------------------------------
+static uint32_t udCrypto_CTRBandThread(void *pBandPtr)
+{
+  udCryptoCTRBand *pBand = (udCryptoCTRBand*)pBandPtr;
+#if UDCRYPTO_X86
+  // mbedtls expands round keys in standard byte order whichever implementation it uses, so they can be loaded directly
+  if (udCPUSupportsVAES())
+    udCrypto_CTRVAES(pBand);
+  else if (udCPUSupportsAES())
+    udCrypto_CTRAESNI(pBand);
+  else
+#endif
+    udCrypto_CTRPortable(pBand);
+  return 0;
+}
 
+struct udCryptoBandLaunch
+{
+  uint32_t (*pBandFunc)(void *);
+  void *pBand;
+  udSemaphore *pDone;
+};
+
+// ---------------------------------------------------------------------------------------
+static uint32_t udCrypto_BandLaunchThread(void *pData)
+{
+  udCryptoBandLaunch *pLaunch = (udCryptoBandLaunch*)pData;
+  uint32_t result = pLaunch->pBandFunc(pLaunch->pBand);
+  udIncrementSemaphore(pLaunch->pDone);
   return result;
 }
 
-// ***************************************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udCryptoCipher_Decrypt(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pCipherText, size_t cipherTextLen, void *pPlainText, size_t plainTextLen, size_t *pActualPlainTextLen, udCryptoIV *pOutIV)
+// ---------------------------------------------------------------------------------------
+// Run pBandFunc on each of bandCount bands of bandStride bytes, the first on the calling thread and the rest on their own threads
+// Completion is signalled with a semaphore rather than joining, as a band that finishes quickly
+// can park its thread in the udThread cache, where a join would wait out the cache timeout
+static void udCrypto_RunBands(uint32_t (*pBandFunc)(void *), void *pBands, size_t bandStride, size_t bandCount)
 {
-  udResult result;
-  size_t actualPlainTextLen;
-  void *pPaddedPlainText = nullptr;
-
-  UD_ERROR_IF(!pCtx || !pPlainText || !pCipherText, udR_InvalidParameter);
-  UD_ERROR_IF((cipherTextLen % pCtx->blockSize) != 0, udR_AlignmentRequired);
+  udCryptoBandLaunch launches[udCrypto_CTRMaxThreads];
+  udSemaphore *pDone = (bandCount > 1) ? udCreateSemaphore() : nullptr;
+  int launched = 0;
 
-  if (cipherTextLen > plainTextLen)
+  for (size_t i = 1; i < bandCount; ++i)
   {
-    UD_ERROR_IF(pCtx->padMode == udCPM_None, udR_BufferTooSmall);
-    pPaddedPlainText = udAlloc(cipherTextLen);
+    launches[i].pBandFunc = pBandFunc;
+    launches[i].pBand = udAddBytes(pBands, i * bandStride);
+    launches[i].pDone = pDone;
+    if (pDone && udThread_Create(nullptr, udCrypto_BandLaunchThread, &launches[i], udTCF_None, "udCryptoBand") == udR_Success)
+      ++launched;
+    else
+      launches[i].pDone = nullptr; // Process this band on the calling thread instead
   }
-  else
+  pBandFunc(pBands);
+  for (size_t i = 1; i < bandCount; ++i)
   {
-    pPaddedPlainText = pPlainText;
+    if (!launches[i].pDone)
+      pBandFunc(launches[i].pBand);
   }
+  while (launched--)
+    udWaitSemaphore(pDone);
+  udDestroySemaphore(&pDone);
+}
 
-  switch (pCtx->cipher)
-  {
-    case udCC_AES128:
-    case udCC_AES256:
-    {
-      switch (pCtx->chainMode)
-      {
-        case udCCM_CBC:
-          UD_ERROR_NULL(pIV, udR_InvalidParameter);
-          if (!pCtx->ctxInit)
-          {
-            mbedtls_aes_setkey_dec(&pCtx->ctx, pCtx->key, pCtx->keyLengthInBits);
-            pCtx->ctxInit = true;
-          }
-          memcpy(pCtx->iv, pIV, sizeof(pCtx->iv));
-          UD_ERROR_IF(mbedtls_aes_crypt_cbc(&pCtx->ctx, MBEDTLS_AES_DECRYPT, cipherTextLen, pCtx->iv, (const unsigned char*)pCipherText, (unsigned char *)pPaddedPlainText) != 0, udR_InternalCryptoError);
-          if (pOutIV)
-            memcpy(pOutIV, pCtx->iv, sizeof(pCtx->iv));
-          break;
-
-        case udCCM_CTR:
-          UD_ERROR_IF(pIV == nullptr || pOutIV != nullptr, udR_InvalidParameter); // Don't allow output IV in CTR mode (yet)
-          if (!pCtx->ctxInit)
-          {
-            mbedtls_aes_setkey_enc(&pCtx->ctx, pCtx->key, pCtx->keyLengthInBits); // NOTE: Using ENCRYPT key schedule for CTR mode
-            pCtx->ctxInit = true;
-          }
-          memcpy(pCtx->iv, pIV, sizeof(pCtx->iv));
-          {
-            size_t ncoff = 0;
-            unsigned char stream_block[16];
-            if (mbedtls_aes_crypt_ctr(&pCtx->ctx, cipherTextLen, &ncoff, pCtx->iv, stream_block, (const unsigned char*)pCipherText, (unsigned char *)pPaddedPlainText) != 0)
-            {
-              UD_ERROR_SET(udR_Failure);
-            }
-          }
-          break;
+// ---------------------------------------------------------------------------------------
+// Apply the keystream starting blockOffset blocks after pCounter, splitting the range into bands across up to threadCount threads
+static void udCrypto_CTRCrypt(const mbedtls_aes_context *pAES, const uint8_t *pCounter, uint64_t blockOffset, const void *pInput, void *pOutput, size_t length, uint32_t threadCount)
+{
+  udCryptoCTRBand bands[udCrypto_CTRMaxThreads];
+  size_t totalBlocks = (length + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+  size_t bandCount = std::min((size_t)std::min(threadCount, (uint32_t)udCrypto_CTRMaxThreads), length / udCrypto_CTRMinBandSize);
+  bandCount = std::max(bandCount, (size_t)1);
 
-        default:
-          UD_ERROR_SET(udR_InvalidConfiguration);
-      }
-    }
-    break;
-  default:
-    UD_ERROR_SET(udR_InvalidConfiguration);
-  }
-  if (pCtx->padMode == udCPM_None)
-  {
-    actualPlainTextLen = cipherTextLen;
-  }
-  else
+  // Bands start on block boundaries so each can seek the counter independently
+  for (size_t i = 0; i < bandCount; ++i)
   {
-    uint8_t padBytes = ((uint8_t*)pPaddedPlainText)[cipherTextLen - 1];
-    actualPlainTextLen = cipherTextLen - padBytes;
-    // Part of PKCS#7 is the padding must be verified
-    for (uint8_t i = 0; i < padBytes; ++i)
-      UD_ERROR_IF(((uint8_t*)pPaddedPlainText)[actualPlainTextLen + i] != padBytes, udR_CorruptData);
-    if (pPaddedPlainText != pPlainText)
-      memcpy(pPlainText, pPaddedPlainText, actualPlainTextLen);
+    size_t startBlock = totalBlocks * i / bandCount;
+    size_t endBlock = totalBlocks * (i + 1) / bandCount;
+    bands[i].pAES = pAES;
+    memcpy(bands[i].counter, pCounter, AES_BLOCK_SIZE);
+    udCrypto_CTRAdvance(bands[i].counter, blockOffset + startBlock);
+    bands[i].pInput = (const uint8_t*)pInput + startBlock * AES_BLOCK_SIZE;
+    bands[i].pOutput = (uint8_t*)pOutput + startBlock * AES_BLOCK_SIZE;
+    bands[i].length = std::min(endBlock * AES_BLOCK_SIZE, length) - startBlock * AES_BLOCK_SIZE;
   }
+  udCrypto_RunBands(udCrypto_CTRBandThread, bands, sizeof(bands[0]), bandCount);
+  mbedtls_platform_zeroize(bands, sizeof(bands));
+}
 
-  if (pActualPlainTextLen)
-    *pActualPlainTextLen = actualPlainTextLen;
-  result = udR_Success;
-
-epilogue:
-  if (pPaddedPlainText != pPlainText)
-    udFreeSecure(pPaddedPlainText, cipherTextLen);
+enum
+{
+  udCrypto_GCMIVLength = 12,           // Bytes of the IV used by GCM, the remaining 4 bytes of the counter block count blocks
+  udCrypto_GCMChunkSize = 16 * 1024,   // Bytes encrypted then hashed at a time, so the data is still in cache when hashed
+};
+static const uint64_t udCrypto_GCMMaxLength = ((1ULL << 32) - 2) * AES_BLOCK_SIZE; // The 32-bit block counter must not wrap
 
-  return result;
+// ---------------------------------------------------------------------------------------
+static inline uint64_t udCrypto_LoadBigEndian64(const uint8_t *pBytes)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i)
+    value = (value << 8) | pBytes[i];
+  return value;
 }
 
-// ***************************************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udCryptoCipher_Destroy(udCryptoCipherContext **ppCtx)
+// ---------------------------------------------------------------------------------------
+static inline void udCrypto_StoreBigEndian64(uint8_t *pBytes, uint64_t value)
 {
-  if (!ppCtx || !*ppCtx)
-    return udR_InvalidParameter;
-  mbedtls_aes_free(&(*ppCtx)->ctx);
-  udFreeSecure(*ppCtx, sizeof(**ppCtx));
-  return udR_Success;
+  for (int i = 0; i < 8; ++i)
+    pBytes[i] = (uint8_t)(value >> ((7 - i) * 8));
 }
 
-// ***************************************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udCryptoCipher_SelfTest(udCryptoCiphers cipher)
+// ---------------------------------------------------------------------------------------
+// Multiply the state by H in GF(2^128), a nibble at a time using the precomputed tables
+static void udCrypto_GHASHMultiplyPortable(const udCryptoGHASHKey *pKey, uint8_t state[AES_BLOCK_SIZE])
 {
-  udResult result = udR_Failure;
-  udCryptoCipherContext *pCtx = nullptr;
-  const char *pKey = nullptr;
-  static const size_t keyLengths[udCC_Count] = { udCCKL_AES128KeyLength, udCCKL_AES256KeyLength };
-  static const char *pPlainText = "There are two great days in every person's life; the day we are born and the day we discover why"; // Multiple of 16 characters
-  static const udCryptoIV iv = { { 0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f } };
-  static const uint64_t nonce = 0xf7f6f5f4f3f2f1f0ULL; // Note the nonce is little endian for udCrypto
-  static const uint64_t counter = 0xf8f9fafbfcfdfeffULL; // The counter is big endian, because standards dictate that it is
-  static const uint8_t cipherTextCBC[udCC_Count][96] =
+  static const uint64_t remainders[16] =
   {
-    // AES128-CBC
-    {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+  };
+  uint8_t nibble = state[15] & 0xf;
+  uint64_t high = pKey->tableHigh[nibble];
+  uint64_t low = pKey->tableLow[nibble];
+
+  for (int i = 15; i >= 0; --i)
+  {
+    uint8_t lowNibble = state[i] & 0xf;
+    uint8_t highNibble = state[i] >> 4;
+    uint8_t remainder;
+
+    if (i != 15)
+    {
+      remainder = (uint8_t)(low & 0xf);
+      low = (high << 60) | (low >> 4);
+      high = (high >> 4) ^ (remainders[remainder] << 48) ^ pKey->tableHigh[lowNibble];
+      low ^= pKey->tableLow[lowNibble];
+    }
+    remainder = (uint8_t)(low & 0xf);
+    low = (high << 60) | (low >> 4);
+    high = (high >> 4) ^ (remainders[remainder] << 48) ^ pKey->tableHigh[highNibble];
+    low ^= pKey->tableLow[highNibble];
+  }
+
+  udCrypto_StoreBigEndian64(state, high);
+  udCrypto_StoreBigEndian64(state + 8, low);
+}
+
+// ---------------------------------------------------------------------------------------
+static void udCrypto_GHASHUpdatePortable(const udCryptoGHASHKey *pKey, uint8_t state[AES_BLOCK_SIZE], const uint8_t *pData, size_t length)
+{
+  for (size_t offset = 0; offset < length; offset += AES_BLOCK_SIZE)
+  {
+    size_t blockLength = std::min(length - offset, (size_t)AES_BLOCK_SIZE);
+    for (size_t i = 0; i < blockLength; ++i)
+      state[i] ^= pData[offset + i];
+    udCrypto_GHASHMultiplyPortable(pKey, state);
+  }
+}
+
+#if UDCRYPTO_X86
+// ---------------------------------------------------------------------------------------
+// Carry-less multiply of two byte reflected values, accumulating the unreduced 256-bit product
+UDCRYPTO_TARGET("pclmul,sse2") static inline void udCrypto_GHASHMultiplyAccumulate(__m128i a, __m128i b, __m128i *pLow, __m128i *pHigh)
+{
+  __m128i low = _mm_clmulepi64_si128(a, b, 0x00);
+  __m128i high = _mm_clmulepi64_si128(a, b, 0x11);
+  __m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+  *pLow = _mm_xor_si128(*pLow, _mm_xor_si128(low, _mm_slli_si128(middle, 8)));
+  *pHigh = _mm_xor_si128(*pHigh, _mm_xor_si128(high, _mm_srli_si128(middle, 8)));
+}
+
+// ---------------------------------------------------------------------------------------
+// Reduce a 256-bit product modulo the GCM polynomial, accounting for the bit reflection (Gueron & Kounavis)
+UDCRYPTO_TARGET("sse2") static inline __m128i udCrypto_GHASHReduce(__m128i low, __m128i high)
+{
+  // Shift the product left by one bit
+  __m128i lowCarry = _mm_srli_epi32(low, 31);
+  __m128i highCarry = _mm_srli_epi32(high, 31);
+  low = _mm_slli_epi32(low, 1);
+  high = _mm_slli_epi32(high, 1);
+  __m128i crossCarry = _mm_srli_si128(lowCarry, 12);
+  highCarry = _mm_slli_si128(highCarry, 4);
+  lowCarry = _mm_slli_si128(lowCarry, 4);
+  low = _mm_or_si128(low, lowCarry);
+  high = _mm_or_si128(_mm_or_si128(high, highCarry), crossCarry);
+
+  // First phase of the reduction
+  __m128i a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+  __m128i b = _mm_srli_si128(a, 4);
+  low = _mm_xor_si128(low, _mm_slli_si128(a, 12));
+
+  // Second phase of the reduction
+  __m128i c = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+  c = _mm_xor_si128(c, b);
+  low = _mm_xor_si128(low, c);
+  return _mm_xor_si128(high, low);
+}
+
+// ---------------------------------------------------------------------------------------
+UDCRYPTO_TARGET("pclmul,sse2") static inline __m128i udCrypto_GHASHMultiplyPCLMUL(__m128i a, __m128i b)
+{
+  __m128i low = _mm_setzero_si128();
+  __m128i high = _mm_setzero_si128();
+  udCrypto_GHASHMultiplyAccumulate(a, b, &low, &high);
+  return udCrypto_GHASHReduce(low, high);
+}
+
+// ---------------------------------------------------------------------------------------
+// GHASH four blocks per reduction using the precomputed powers of H
+UDCRYPTO_TARGET("pclmul,ssse3") static void udCrypto_GHASHUpdatePCLMUL(const udCryptoGHASHKey *pKey, uint8_t state[AES_BLOCK_SIZE], const uint8_t *pData, size_t length)
+{
+  const __m128i reflect = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m128i h1 = _mm_loadu_si128((const __m128i*)pKey->powers[0]);
+  const __m128i h2 = _mm_loadu_si128((const __m128i*)pKey->powers[1]);
+  const __m128i h3 = _mm_loadu_si128((const __m128i*)pKey->powers[2]);
+  const __m128i h4 = _mm_loadu_si128((const __m128i*)pKey->powers[3]);
+  __m128i y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)state), reflect);
+
+  for (; length >= 4 * AES_BLOCK_SIZE; length -= 4 * AES_BLOCK_SIZE, pData += 4 * AES_BLOCK_SIZE)
+  {
+    __m128i low = _mm_setzero_si128();
+    __m128i high = _mm_setzero_si128();
+    udCrypto_GHASHMultiplyAccumulate(_mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)pData + 0), reflect)), h4, &low, &high);
+    udCrypto_GHASHMultiplyAccumulate(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)pData + 1), reflect), h3, &low, &high);
+    udCrypto_GHASHMultiplyAccumulate(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)pData + 2), reflect), h2, &low, &high);
+    udCrypto_GHASHMultiplyAccumulate(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)pData + 3), reflect), h1, &low, &high);
+    y = udCrypto_GHASHReduce(low, high);
+  }
+
+  while (length > 0)
+  {
+    uint8_t block[AES_BLOCK_SIZE] = {};
+    size_t blockLength = std::min(length, (size_t)AES_BLOCK_SIZE);
+    memcpy(block, pData, blockLength);
+    y = udCrypto_GHASHMultiplyPCLMUL(_mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)block), reflect)), h1);
+    length -= blockLength;
+    pData += blockLength;
+  }
+
+  _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi8(y, reflect));
+}
+
+// ---------------------------------------------------------------------------------------
+UDCRYPTO_TARGET("pclmul,ssse3") static void udCrypto_GHASHPowersPCLMUL(udCryptoGHASHKey *pKey, const uint8_t h[AES_BLOCK_SIZE])
+{
+  const __m128i reflect = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i h1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)h), reflect);
+  __m128i power = h1;
+
+  _mm_storeu_si128((__m128i*)pKey->powers[0], h1);
+  for (int i = 1; i < 4; ++i)
+  {
+    power = udCrypto_GHASHMultiplyPCLMUL(power, h1);
+    _mm_storeu_si128((__m128i*)pKey->powers[i], power);
+  }
+}
+#endif // UDCRYPTO_X86
+
+// ---------------------------------------------------------------------------------------
+// Fold length bytes into the GHASH state, a final partial block is zero padded
+static void udCrypto_GHASHUpdate(const udCryptoGHASHKey *pKey, uint8_t state[AES_BLOCK_SIZE], const void *pData, size_t length)
+{
+#if UDCRYPTO_X86
+  if (udCPUSupportsPCLMUL())
+    udCrypto_GHASHUpdatePCLMUL(pKey, state, (const uint8_t*)pData, length);
+  else
+#endif
+    udCrypto_GHASHUpdatePortable(pKey, state, (const uint8_t*)pData, length);
+}
+
+// ---------------------------------------------------------------------------------------
+// Derive the hash key H by encrypting a zero block, and precompute the tables for it
+static void udCrypto_GHASHInit(udCryptoGHASHKey *pKey, mbedtls_aes_context *pAES)
+{
+  uint8_t h[AES_BLOCK_SIZE] = {};
+  mbedtls_aes_crypt_ecb(pAES, MBEDTLS_AES_ENCRYPT, h, h);
+
+  uint64_t high = udCrypto_LoadBigEndian64(h);
+  uint64_t low = udCrypto_LoadBigEndian64(h + 8);
+  pKey->tableHigh[0] = 0;
+  pKey->tableLow[0] = 0;
+  pKey->tableHigh[8] = high;
+  pKey->tableLow[8] = low;
+  for (int i = 4; i > 0; i >>= 1)
+  {
+    uint64_t reduce = (low & 1) ? 0xe100000000000000ULL : 0;
+    low = (high << 63) | (low >> 1);
+    high = (high >> 1) ^ reduce;
+    pKey->tableHigh[i] = high;
+    pKey->tableLow[i] = low;
+  }
+  for (int i = 2; i <= 8; i *= 2)
+  {
+    for (int j = 1; j < i; ++j)
+    {
+      pKey->tableHigh[i + j] = pKey->tableHigh[i] ^ pKey->tableHigh[j];
+      pKey->tableLow[i + j] = pKey->tableLow[i] ^ pKey->tableLow[j];
+    }
+  }
+
+#if UDCRYPTO_X86
+  if (udCPUSupportsPCLMUL())
+    udCrypto_GHASHPowersPCLMUL(pKey, h);
+#endif
+  mbedtls_platform_zeroize(h, sizeof(h));
+}
+
+// ---------------------------------------------------------------------------------------
+// Encrypt or decrypt one message in GCM mode on the calling thread, writing the computed tag to pTag
+static void udCrypto_GCMCrypt(const mbedtls_aes_context *pAES, const udCryptoGHASHKey *pKey, const uint8_t iv[udCrypto_GCMIVLength], bool encrypt, const void *pInput, void *pOutput, size_t length, const void *pAAD, size_t aadLength, uint8_t pTag[AES_BLOCK_SIZE])
+{
+  uint8_t counter[AES_BLOCK_SIZE];
+  uint8_t state[AES_BLOCK_SIZE] = {};
+  uint8_t lengths[AES_BLOCK_SIZE];
+
+  // The first counter block is reserved for encrypting the tag, the message starts at the second
+  memcpy(counter, iv, udCrypto_GCMIVLength);
+  memcpy(counter + udCrypto_GCMIVLength, "\0\0\0\1", 4); // Big endian block count of 1
+
+  udCrypto_GHASHUpdate(pKey, state, pAAD, aadLength);
+  for (size_t offset = 0; offset < length; offset += udCrypto_GCMChunkSize)
+  {
+    size_t chunkLength = std::min(length - offset, (size_t)udCrypto_GCMChunkSize);
+    if (!encrypt)
+      udCrypto_GHASHUpdate(pKey, state, udAddBytes(pInput, offset), chunkLength);
+    udCrypto_CTRCrypt(pAES, counter, 1 + offset / AES_BLOCK_SIZE, udAddBytes(pInput, offset), udAddBytes(pOutput, offset), chunkLength, 1);
+    if (encrypt)
+      udCrypto_GHASHUpdate(pKey, state, udAddBytes(pOutput, offset), chunkLength);
+  }
+
+  udCrypto_StoreBigEndian64(lengths, (uint64_t)aadLength * 8);
+  udCrypto_StoreBigEndian64(lengths + 8, (uint64_t)length * 8);
+  udCrypto_GHASHUpdate(pKey, state, lengths, sizeof(lengths));
+  udCrypto_CTRCrypt(pAES, counter, 0, state, pTag, AES_BLOCK_SIZE, 1);
+}
+
+// ---------------------------------------------------------------------------------------
+// Compare tags in constant time
+static bool udCrypto_TagsMatch(const uint8_t *pTagA, const uint8_t *pTagB)
+{
+  uint8_t difference = 0;
+  for (int i = 0; i < udCTL_GCMTagLength; ++i)
+    difference |= pTagA[i] ^ pTagB[i];
+  return difference == 0;
+}
+
+// A contiguous range of blocks of a per-block GCM request, processed by one thread
+struct udCryptoGCMBand
+{
+  udCryptoCipherContext *pCtx;
+  uint64_t nonce;
+  uint64_t firstBlockIndex;
+  const uint8_t *pInput;
+  uint8_t *pOutput;
+  size_t length;
+  size_t blockSize;
+  udCryptoTag *pTags;     // Written when encrypting, verified against when decrypting
+  bool encrypt;
+  bool tagMismatch;       // Set if any block failed verification
+};
+
+// ---------------------------------------------------------------------------------------
+// The IV for a block is the nonce (little endian, matching CTR mode) followed by the big endian block index
+static void udCrypto_GCMBlockIV(uint8_t iv[udCrypto_GCMIVLength], uint64_t nonce, uint32_t blockIndex)
+{
+  for (int i = 0; i < 8; ++i)
+    iv[i] = (uint8_t)(nonce >> (i * 8));
+  for (int i = 0; i < 4; ++i)
+    iv[8 + i] = (uint8_t)(blockIndex >> ((3 - i) * 8));
+}
+
+// ---------------------------------------------------------------------------------------
+static uint32_t udCrypto_GCMBandThread(void *pBandPtr)
+{
+  udCryptoGCMBand *pBand = (udCryptoGCMBand*)pBandPtr;
+  for (size_t offset = 0, block = 0; offset < pBand->length; offset += pBand->blockSize, ++block)
+  {
+    uint8_t iv[udCrypto_GCMIVLength];
+    uint8_t tag[AES_BLOCK_SIZE];
+    size_t blockLength = std::min(pBand->length - offset, pBand->blockSize);
+
+    udCrypto_GCMBlockIV(iv, pBand->nonce, (uint32_t)(pBand->firstBlockIndex + block));
+    udCrypto_GCMCrypt(&pBand->pCtx->ctx, &pBand->pCtx->ghashKey, iv, pBand->encrypt, pBand->pInput + offset, pBand->pOutput + offset, blockLength, nullptr, 0, tag);
+    if (pBand->encrypt)
+    {
+      memcpy(pBand->pTags[block].tag, tag, sizeof(tag));
+    }
+    else if (!udCrypto_TagsMatch(tag, pBand->pTags[block].tag))
+    {
+      memset(pBand->pOutput + offset, 0, blockLength); // Never release unauthenticated plaintext
+      pBand->tagMismatch = true;
+    }
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------------------
+// Validate the context is usable for GCM
+static udResult udCrypto_GCMPrepare(udCryptoCipherContext *pCtx)
+{
+  if (pCtx == nullptr)
+    return udR_InvalidParameter;
+  if (pCtx->chainMode != udCCM_GCM || (pCtx->cipher != udCC_AES128 && pCtx->cipher != udCC_AES256))
+    return udR_InvalidConfiguration;
+  return udR_Success;
+}
+
+// ---------------------------------------------------------------------------------------
+// Shared implementation of the per-block GCM functions
+static udResult udCrypto_GCMCryptBlocks(udCryptoCipherContext *pCtx, uint64_t nonce, uint64_t firstBlockIndex, bool encrypt, const void *pInput, void *pOutput, size_t length, size_t blockSize, udCryptoTag *pTags, uint32_t threadCount)
+{
+  udResult result;
+  udCryptoGCMBand bands[udCrypto_CTRMaxThreads];
+  size_t blockCount, bandCount;
+
+  UD_ERROR_CHECK(udCrypto_GCMPrepare(pCtx));
+  UD_ERROR_IF((length && (!pInput || !pOutput || !pTags)) || blockSize == 0, udR_InvalidParameter);
+  blockCount = (length + blockSize - 1) / blockSize;
+  UD_ERROR_IF((uint64_t)blockSize > udCrypto_GCMMaxLength || firstBlockIndex + blockCount > UINT32_MAX + 1ULL, udR_OutOfRange);
+
+  if (threadCount == 0)
+    threadCount = (uint32_t)udGetHardwareThreadCount();
+  bandCount = std::min((size_t)std::min(threadCount, (uint32_t)udCrypto_CTRMaxThreads), std::min(blockCount, length / udCrypto_CTRMinBandSize));
+  bandCount = std::max(bandCount, (size_t)1);
+  for (size_t i = 0; i < bandCount; ++i)
+  {
+    size_t startBlock = blockCount * i / bandCount;
+    size_t endBlock = blockCount * (i + 1) / bandCount;
+    bands[i].pCtx = pCtx;
+    bands[i].nonce = nonce;
+    bands[i].firstBlockIndex = firstBlockIndex + startBlock;
+    bands[i].pInput = (const uint8_t*)pInput + startBlock * blockSize;
+    bands[i].pOutput = (uint8_t*)pOutput + startBlock * blockSize;
+    bands[i].length = std::min(endBlock * blockSize, length) - startBlock * blockSize;
+    bands[i].blockSize = blockSize;
+    bands[i].pTags = pTags + startBlock;
+    bands[i].encrypt = encrypt;
+    bands[i].tagMismatch = false;
+  }
+  udCrypto_RunBands(udCrypto_GCMBandThread, bands, sizeof(bands[0]), bandCount);
+
+  result = udR_Success;
+  for (size_t i = 0; i < bandCount; ++i)
+  {
+    if (bands[i].tagMismatch)
+      result = udR_SignatureMismatch;
+  }
+
+epilogue:
+  return result;
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udCryptoCipher_Encrypt(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pPlainText, size_t plainTextLen, void *pCipherText, size_t cipherTextLen, size_t *pPaddedCipherTextLen, udCryptoIV *pOutIV)
+{
+  udResult result;
+  size_t paddedCliperTextLen = 0;
+  size_t directLen = 0;
+  uint8_t finalBlock[AES_BLOCK_SIZE];
+  uint8_t iv[AES_BLOCK_SIZE];
+
+  UD_ERROR_IF(!pCtx || !pPlainText || !pCipherText, udR_InvalidParameter);
+
+  if (pCtx->padMode == udCPM_None)
+    paddedCliperTextLen = plainTextLen;
+  else
+    paddedCliperTextLen = (plainTextLen + pCtx->blockSize) & ~(pCtx->blockSize - 1);
+
+  UD_ERROR_IF((paddedCliperTextLen  & (pCtx->blockSize - 1)) != 0, udR_AlignmentRequired);
+  UD_ERROR_IF(paddedCliperTextLen > cipherTextLen, udR_BufferTooSmall);
+
+  // Whole blocks are encrypted directly from the source, the trailing partial block and padding are assembled in finalBlock
+  directLen = plainTextLen & ~(pCtx->blockSize - 1);
+  if (paddedCliperTextLen != plainTextLen)
+  {
+    size_t padBytes = paddedCliperTextLen - plainTextLen;
+    memcpy(finalBlock, udAddBytes(pPlainText, directLen), plainTextLen - directLen);
+    memset(finalBlock + (plainTextLen - directLen), (int)padBytes, padBytes);
+  }
+
+  switch (pCtx->cipher)
+  {
+    case udCC_AES128:
+    case udCC_AES256:
+      {
+        switch (pCtx->chainMode)
+        {
+          case udCCM_CBC:
+            UD_ERROR_NULL(pIV, udR_InvalidParameter);
+            memcpy(iv, pIV, sizeof(iv));
+            UD_ERROR_IF(mbedtls_aes_crypt_cbc(&pCtx->ctx, MBEDTLS_AES_ENCRYPT, directLen, iv, (const unsigned char*)pPlainText, (unsigned char*)pCipherText) != 0, udR_InternalCryptoError);
+            if (paddedCliperTextLen != directLen)
+              UD_ERROR_IF(mbedtls_aes_crypt_cbc(&pCtx->ctx, MBEDTLS_AES_ENCRYPT, AES_BLOCK_SIZE, iv, finalBlock, (unsigned char*)pCipherText + directLen) != 0, udR_InternalCryptoError);
+
+            // For CBC, the output IV is the last encrypted block
+            if (pOutIV)
+              memcpy(pOutIV, (char*)pCipherText + paddedCliperTextLen - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+            break;
+
+          case udCCM_CTR:
+            UD_ERROR_IF(pIV == nullptr || pOutIV != nullptr, udR_InvalidParameter); // Don't allow output IV in CTR mode (yet)
+            udCrypto_CTRCrypt(&pCtx->ctx, pIV->iv, 0, pPlainText, pCipherText, directLen, 1);
+            if (paddedCliperTextLen != directLen)
+              udCrypto_CTRCrypt(&pCtx->ctx, pIV->iv, directLen / AES_BLOCK_SIZE, finalBlock, udAddBytes(pCipherText, directLen), AES_BLOCK_SIZE, 1);
+            break;
+
+          default:
+            UD_ERROR_SET(udR_InvalidConfiguration);
+        }
+      }
+      break;
+    default:
+      UD_ERROR_SET(udR_InvalidConfiguration);
+  }
+
+  if (pPaddedCipherTextLen)
+    *pPaddedCipherTextLen = paddedCliperTextLen;
+  result = udR_Success;
+
+epilogue:
+  mbedtls_platform_zeroize(finalBlock, sizeof(finalBlock));
+  return result;
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udCryptoCipher_Decrypt(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pCipherText, size_t cipherTextLen, void *pPlainText, size_t plainTextLen, size_t *pActualPlainTextLen, udCryptoIV *pOutIV)
+{
+  udResult result;
+  size_t actualPlainTextLen;
+  size_t directLen = cipherTextLen;
+  uint8_t finalBlock[AES_BLOCK_SIZE];
+  uint8_t iv[AES_BLOCK_SIZE];
+
+  UD_ERROR_IF(!pCtx || !pPlainText || !pCipherText, udR_InvalidParameter);
+  UD_ERROR_IF((cipherTextLen % pCtx->blockSize) != 0, udR_AlignmentRequired);
+
+  // When padded, all but the final block are decrypted directly to the output, the final block is decrypted to finalBlock to strip the padding
+  if (pCtx->padMode != udCPM_None)
+  {
+    UD_ERROR_IF(cipherTextLen == 0, udR_CorruptData);
+    directLen = cipherTextLen - AES_BLOCK_SIZE;
+  }
+  UD_ERROR_IF(directLen > plainTextLen, udR_BufferTooSmall);
+
+  switch (pCtx->cipher)
+  {
+    case udCC_AES128:
+    case udCC_AES256:
+    {
+      switch (pCtx->chainMode)
+      {
+        case udCCM_CBC:
+          UD_ERROR_NULL(pIV, udR_InvalidParameter);
+          memcpy(iv, pIV, sizeof(iv));
+          UD_ERROR_IF(mbedtls_aes_crypt_cbc(&pCtx->decCtx, MBEDTLS_AES_DECRYPT, directLen, iv, (const unsigned char*)pCipherText, (unsigned char *)pPlainText) != 0, udR_InternalCryptoError);
+          if (directLen != cipherTextLen)
+            UD_ERROR_IF(mbedtls_aes_crypt_cbc(&pCtx->decCtx, MBEDTLS_AES_DECRYPT, AES_BLOCK_SIZE, iv, (const unsigned char*)pCipherText + directLen, finalBlock) != 0, udR_InternalCryptoError);
+          if (pOutIV)
+            memcpy(pOutIV, iv, sizeof(iv));
+          break;
+
+        case udCCM_CTR:
+          UD_ERROR_IF(pIV == nullptr || pOutIV != nullptr, udR_InvalidParameter); // Don't allow output IV in CTR mode (yet)
+          udCrypto_CTRCrypt(&pCtx->ctx, pIV->iv, 0, pCipherText, pPlainText, directLen, 1);
+          if (directLen != cipherTextLen)
+            udCrypto_CTRCrypt(&pCtx->ctx, pIV->iv, directLen / AES_BLOCK_SIZE, udAddBytes(pCipherText, directLen), finalBlock, AES_BLOCK_SIZE, 1);
+          break;
+
+        default:
+          UD_ERROR_SET(udR_InvalidConfiguration);
+      }
+    }
+    break;
+  default:
+    UD_ERROR_SET(udR_InvalidConfiguration);
+  }
+  if (pCtx->padMode == udCPM_None)
+  {
+    actualPlainTextLen = cipherTextLen;
+  }
+  else
+  {
+    uint8_t padBytes = finalBlock[AES_BLOCK_SIZE - 1];
+    UD_ERROR_IF(padBytes == 0 || padBytes > AES_BLOCK_SIZE, udR_CorruptData);
+    actualPlainTextLen = cipherTextLen - padBytes;
+    // Part of PKCS#7 is the padding must be verified
+    for (uint8_t i = 0; i < padBytes; ++i)
+      UD_ERROR_IF(finalBlock[AES_BLOCK_SIZE - padBytes + i] != padBytes, udR_CorruptData);
+    UD_ERROR_IF(actualPlainTextLen > plainTextLen, udR_BufferTooSmall);
+    memcpy(udAddBytes(pPlainText, directLen), finalBlock, actualPlainTextLen - directLen);
+  }
+
+  if (pActualPlainTextLen)
+    *pActualPlainTextLen = actualPlainTextLen;
+  result = udR_Success;
+
+epilogue:
+  mbedtls_platform_zeroize(finalBlock, sizeof(finalBlock));
+  return result;
+}
+
+// ***************************************************************************************
+// Apply the CTR mode keystream to a buffer of any length, splitting large buffers across threads
+udResult udCryptoCipher_CryptCTR(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pInput, void *pOutput, size_t length, uint64_t blockOffset, uint32_t threadCount)
+{
+  udResult result;
+
+  UD_ERROR_IF(!pCtx || !pIV || (length && (!pInput || !pOutput)), udR_InvalidParameter);
+  UD_ERROR_IF(pCtx->chainMode != udCCM_CTR, udR_InvalidConfiguration);
+  UD_ERROR_IF(pCtx->cipher != udCC_AES128 && pCtx->cipher != udCC_AES256, udR_InvalidConfiguration);
+
+  if (threadCount == 0)
+    threadCount = (uint32_t)udGetHardwareThreadCount();
+  udCrypto_CTRCrypt(&pCtx->ctx, pIV->iv, blockOffset, pInput, pOutput, length, threadCount);
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ***************************************************************************************
+// Encrypt and authenticate a buffer in GCM mode, hashing each chunk while it is still in cache
+udResult udCryptoCipher_EncryptGCM(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pPlainText, void *pCipherText, size_t length, udCryptoTag *pTag, const void *pAAD, size_t aadLength)
+{
+  udResult result;
+
+  UD_ERROR_CHECK(udCrypto_GCMPrepare(pCtx));
+  UD_ERROR_IF(!pIV || !pTag || (length && (!pPlainText || !pCipherText)) || (aadLength && !pAAD), udR_InvalidParameter);
+  UD_ERROR_IF((uint64_t)length > udCrypto_GCMMaxLength, udR_OutOfRange);
+
+  udCrypto_GCMCrypt(&pCtx->ctx, &pCtx->ghashKey, pIV->iv, true, pPlainText, pCipherText, length, pAAD, aadLength, pTag->tag);
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ***************************************************************************************
+// Decrypt and verify a buffer in GCM mode, the output is zeroed if verification fails
+udResult udCryptoCipher_DecryptGCM(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, const void *pCipherText, void *pPlainText, size_t length, const udCryptoTag *pTag, const void *pAAD, size_t aadLength)
+{
+  udResult result;
+  uint8_t tag[AES_BLOCK_SIZE];
+
+  UD_ERROR_CHECK(udCrypto_GCMPrepare(pCtx));
+  UD_ERROR_IF(!pIV || !pTag || (length && (!pPlainText || !pCipherText)) || (aadLength && !pAAD), udR_InvalidParameter);
+  UD_ERROR_IF((uint64_t)length > udCrypto_GCMMaxLength, udR_OutOfRange);
+
+  udCrypto_GCMCrypt(&pCtx->ctx, &pCtx->ghashKey, pIV->iv, false, pCipherText, pPlainText, length, pAAD, aadLength, tag);
+  if (!udCrypto_TagsMatch(tag, pTag->tag))
+  {
+    if (length)
+      memset(pPlainText, 0, length);
+    UD_ERROR_SET(udR_SignatureMismatch);
+  }
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ***************************************************************************************
+// GCM encrypt a buffer as independently authenticated blocks, in parallel across blocks
+udResult udCryptoCipher_EncryptBlocksGCM(udCryptoCipherContext *pCtx, uint64_t nonce, uint64_t firstBlockIndex, const void *pPlainText, void *pCipherText, size_t length, size_t blockSize, udCryptoTag *pTags, uint32_t threadCount)
+{
+  return udCrypto_GCMCryptBlocks(pCtx, nonce, firstBlockIndex, true, pPlainText, pCipherText, length, blockSize, pTags, threadCount);
+}
+
+// ***************************************************************************************
+// GCM decrypt and verify a buffer of independently authenticated blocks, in parallel across blocks
+udResult udCryptoCipher_DecryptBlocksGCM(udCryptoCipherContext *pCtx, uint64_t nonce, uint64_t firstBlockIndex, const void *pCipherText, void *pPlainText, size_t length, size_t blockSize, const udCryptoTag *pTags, uint32_t threadCount)
+{
+  return udCrypto_GCMCryptBlocks(pCtx, nonce, firstBlockIndex, false, pCipherText, pPlainText, length, blockSize, const_cast<udCryptoTag*>(pTags), threadCount);
+}
+
+// ---------------------------------------------------------------------------------------
+// Apply the stream's keystream to length bytes, continuing from the current position
+static void udCrypto_StreamCTR(udCryptoCipherContext *pCtx, const uint8_t *pInput, uint8_t *pOutput, size_t length)
+{
+  udCryptoCipherStream *pStream = &pCtx->stream;
+  size_t inset = (size_t)(pStream->position & (AES_BLOCK_SIZE - 1));
+
+  // Finish a block started by the previous call from the saved keystream
+  if (inset)
+  {
+    size_t count = std::min(length, AES_BLOCK_SIZE - inset);
+    for (size_t i = 0; i < count; ++i)
+      pOutput[i] = pInput[i] ^ pStream->keystream[inset + i];
+    pInput += count;
+    pOutput += count;
+    length -= count;
+    pStream->position += count;
+  }
+
+  size_t wholeLength = length & ~(size_t)(AES_BLOCK_SIZE - 1);
+  udCrypto_CTRCrypt(&pCtx->ctx, pStream->counter, pStream->position / AES_BLOCK_SIZE, pInput, pOutput, wholeLength, 1);
+  pStream->position += wholeLength;
+
+  // Save the keystream of a partial final block for the next call
+  if (length > wholeLength)
+  {
+    memset(pStream->keystream, 0, sizeof(pStream->keystream));
+    udCrypto_CTRCrypt(&pCtx->ctx, pStream->counter, pStream->position / AES_BLOCK_SIZE, pStream->keystream, pStream->keystream, AES_BLOCK_SIZE, 1);
+    for (size_t i = 0; i < length - wholeLength; ++i)
+      pOutput[wholeLength + i] = pInput[wholeLength + i] ^ pStream->keystream[i];
+    pStream->position += length - wholeLength;
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+// Hash GCM ciphertext of any length, holding back a partial block until it is filled or the stream finishes
+static void udCrypto_StreamGHASH(udCryptoCipherContext *pCtx, const uint8_t *pData, size_t length, uint64_t position)
+{
+  udCryptoCipherStream *pStream = &pCtx->stream;
+  size_t pending = (size_t)(position & (AES_BLOCK_SIZE - 1));
+
+  if (pending)
+  {
+    size_t count = std::min(length, AES_BLOCK_SIZE - pending);
+    memcpy(pStream->ghashPending + pending, pData, count);
+    pData += count;
+    length -= count;
+    if (pending + count < AES_BLOCK_SIZE)
+      return;
+    udCrypto_GHASHUpdate(&pCtx->ghashKey, pStream->ghashState, pStream->ghashPending, AES_BLOCK_SIZE);
+  }
+
+  size_t wholeLength = length & ~(size_t)(AES_BLOCK_SIZE - 1);
+  udCrypto_GHASHUpdate(&pCtx->ghashKey, pStream->ghashState, pData, wholeLength);
+  memcpy(pStream->ghashPending, pData + wholeLength, length - wholeLength);
+}
+
+// ***************************************************************************************
+// Start a CTR or GCM stream
+udResult udCryptoCipher_Begin(udCryptoCipherContext *pCtx, const udCryptoIV *pIV, udCryptoStreamDirection direction, const void *pAAD, size_t aadLength)
+{
+  udResult result;
+  udCryptoCipherStream *pStream = nullptr;
+
+  UD_ERROR_IF(!pCtx || !pIV || (aadLength && !pAAD), udR_InvalidParameter);
+  UD_ERROR_IF(direction != udCSD_Encrypt && direction != udCSD_Decrypt, udR_InvalidParameter);
+  UD_ERROR_IF(pCtx->chainMode != udCCM_CTR && pCtx->chainMode != udCCM_GCM, udR_InvalidConfiguration);
+  UD_ERROR_IF(pCtx->chainMode == udCCM_CTR && aadLength, udR_InvalidConfiguration);
+
+  pStream = &pCtx->stream;
+  mbedtls_platform_zeroize(pStream, sizeof(*pStream));
+  pStream->direction = direction;
+  if (pCtx->chainMode == udCCM_GCM)
+  {
+    memcpy(pStream->tagCounter, pIV->iv, udCrypto_GCMIVLength);
+    memcpy(pStream->tagCounter + udCrypto_GCMIVLength, "\0\0\0\1", 4);
+    memcpy(pStream->counter, pStream->tagCounter, AES_BLOCK_SIZE);
+    udCrypto_CTRAdvance(pStream->counter, 1);
+    udCrypto_GHASHUpdate(&pCtx->ghashKey, pStream->ghashState, pAAD, aadLength);
+    pStream->aadLength = aadLength;
+  }
+  else
+  {
+    memcpy(pStream->counter, pIV->iv, AES_BLOCK_SIZE);
+  }
+  pStream->active = true;
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ***************************************************************************************
+// Continue the stream with the next chunk
+udResult udCryptoCipher_Update(udCryptoCipherContext *pCtx, const void *pInput, void *pOutput, size_t length)
+{
+  udResult result;
+  const uint8_t *pIn = (const uint8_t*)pInput;
+  uint8_t *pOut = (uint8_t*)pOutput;
+
+  UD_ERROR_IF(!pCtx || (length && (!pInput || !pOutput)), udR_InvalidParameter);
+  UD_ERROR_IF(!pCtx->stream.active, udR_NotInitialized);
+
+  if (pCtx->chainMode == udCCM_GCM)
+  {
+    bool encrypt = (pCtx->stream.direction == udCSD_Encrypt);
+    UD_ERROR_IF(pCtx->stream.position + length > udCrypto_GCMMaxLength, udR_OutOfRange);
+
+    // Hash a chunk at a time so the data is still in cache
+    for (size_t offset = 0; offset < length; offset += udCrypto_GCMChunkSize)
+    {
+      size_t chunkLength = std::min(length - offset, (size_t)udCrypto_GCMChunkSize);
+      uint64_t position = pCtx->stream.position;
+      if (!encrypt)
+        udCrypto_StreamGHASH(pCtx, pIn + offset, chunkLength, position);
+      udCrypto_StreamCTR(pCtx, pIn + offset, pOut + offset, chunkLength);
+      if (encrypt)
+        udCrypto_StreamGHASH(pCtx, pOut + offset, chunkLength, position);
+    }
+  }
+  else
+  {
+    udCrypto_StreamCTR(pCtx, pIn, pOut, length);
+  }
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ***************************************************************************************
+// End the stream, producing or verifying the GCM tag
+udResult udCryptoCipher_Finish(udCryptoCipherContext *pCtx, udCryptoTag *pTag)
+{
+  udResult result;
+  udCryptoCipherStream *pStream = nullptr;
+  uint8_t lengths[AES_BLOCK_SIZE];
+  uint8_t tag[AES_BLOCK_SIZE];
+
+  UD_ERROR_NULL(pCtx, udR_InvalidParameter);
+  pStream = &pCtx->stream;
+  UD_ERROR_IF(!pStream->active, udR_NotInitialized);
+
+  if (pCtx->chainMode == udCCM_GCM)
+  {
+    UD_ERROR_NULL(pTag, udR_InvalidParameter);
+    udCrypto_GHASHUpdate(&pCtx->ghashKey, pStream->ghashState, pStream->ghashPending, (size_t)(pStream->position & (AES_BLOCK_SIZE - 1)));
+    udCrypto_StoreBigEndian64(lengths, pStream->aadLength * 8);
+    udCrypto_StoreBigEndian64(lengths + 8, pStream->position * 8);
+    udCrypto_GHASHUpdate(&pCtx->ghashKey, pStream->ghashState, lengths, sizeof(lengths));
+    udCrypto_CTRCrypt(&pCtx->ctx, pStream->tagCounter, 0, pStream->ghashState, tag, AES_BLOCK_SIZE, 1);
+    if (pStream->direction == udCSD_Encrypt)
+      memcpy(pTag->tag, tag, sizeof(tag));
+    else
+      UD_ERROR_IF(!udCrypto_TagsMatch(tag, pTag->tag), udR_SignatureMismatch);
+  }
+  result = udR_Success;
+
+epilogue:
+  if (pStream)
+    mbedtls_platform_zeroize(pStream, sizeof(*pStream));
+  return result;
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udCryptoCipher_Destroy(udCryptoCipherContext **ppCtx)
+{
+  if (!ppCtx || !*ppCtx)
+    return udR_InvalidParameter;
+  mbedtls_aes_free(&(*ppCtx)->ctx);
+  mbedtls_aes_free(&(*ppCtx)->decCtx);
+  udFreeSecure(*ppCtx, sizeof(**ppCtx));
+  return udR_Success;
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udCryptoCipher_SelfTest(udCryptoCiphers cipher)
+{
+  udResult result = udR_Failure;
+  udCryptoCipherContext *pCtx = nullptr;
+  const char *pKey = nullptr;
+  static const size_t keyLengths[udCC_Count] = { udCCKL_AES128KeyLength, udCCKL_AES256KeyLength };
+  static const char *pPlainText = "There are two great days in every person's life; the day we are born and the day we discover why"; // Multiple of 16 characters
+  static const udCryptoIV iv = { { 0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f } };
+  static const uint64_t nonce = 0xf7f6f5f4f3f2f1f0ULL; // Note the nonce is little endian for udCrypto
+  static const uint64_t counter = 0xf8f9fafbfcfdfeffULL; // The counter is big endian, because standards dictate that it is
+  static const uint8_t cipherTextCBC[udCC_Count][96] =
+  {
+    // AES128-CBC
+    {
       0xe6,0x57,0x9a,0x39,0x2a,0x37,0xc7,0xed,0x29,0x27,0x25,0xfb,0xff,0xae,0x2d,0x58,
       0xcd,0xef,0x10,0xc2,0x56,0x95,0xe8,0x22,0xa0,0xc4,0x05,0xd8,0x2c,0x26,0x30,0x83,
       0xec,0x31,0xca,0x81,0x2a,0xe8,0xde,0x51,0x16,0xce,0xeb,0x48,0x78,0x3e,0x69,0x2c,
@@ -556,96 +1555,449 @@ udResult udCryptoCipher_SelfTest(udCryptoCiphers cipher)
   };
   static const uint8_t cipherTextCTR[udCC_Count][96] =
   {
-    // AES128-CTR
-    {
-      0x44,0x90,0x81,0x06,0x60,0xf7,0x81,0x74,0x3c,0x1f,0x63,0x77,0x6b,0x7e,0xe5,0xd5,
-      0x2c,0x73,0x60,0x99,0x4a,0xbe,0xa8,0xc5,0xa2,0xe4,0xb5,0xc7,0x61,0x43,0x6d,0x86,
-      0x6e,0x07,0xa0,0x98,0xfa,0xa9,0x51,0x09,0xf7,0x21,0x78,0x35,0xb6,0x6b,0x7c,0x02,
-      0xac,0x70,0x76,0x82,0xdc,0x39,0x1a,0x49,0x72,0xfb,0x0c,0x40,0x76,0x2d,0xac,0xeb,
-      0xf9,0x27,0x99,0x9a,0x9c,0x9f,0x51,0xa2,0x3e,0x94,0x53,0xb5,0xf9,0x8d,0xa4,0x87,
-      0x0d,0x5d,0x8b,0x67,0xe4,0x81,0xc4,0xed,0x53,0xa1,0x5c,0x92,0x0a,0x46,0xce,0x1d
-    },
-    // AES256-CTR
+    // AES128-CTR
+    {
+      0x44,0x90,0x81,0x06,0x60,0xf7,0x81,0x74,0x3c,0x1f,0x63,0x77,0x6b,0x7e,0xe5,0xd5,
+      0x2c,0x73,0x60,0x99,0x4a,0xbe,0xa8,0xc5,0xa2,0xe4,0xb5,0xc7,0x61,0x43,0x6d,0x86,
+      0x6e,0x07,0xa0,0x98,0xfa,0xa9,0x51,0x09,0xf7,0x21,0x78,0x35,0xb6,0x6b,0x7c,0x02,
+      0xac,0x70,0x76,0x82,0xdc,0x39,0x1a,0x49,0x72,0xfb,0x0c,0x40,0x76,0x2d,0xac,0xeb,
+      0xf9,0x27,0x99,0x9a,0x9c,0x9f,0x51,0xa2,0x3e,0x94,0x53,0xb5,0xf9,0x8d,0xa4,0x87,
+      0x0d,0x5d,0x8b,0x67,0xe4,0x81,0xc4,0xed,0x53,0xa1,0x5c,0x92,0x0a,0x46,0xce,0x1d
+    },
+    // AES256-CTR
+    {
+      0x29,0xd6,0xac,0x22,0x6c,0x2d,0xba,0x7f,0x6a,0xd3,0x94,0x45,0x7a,0x24,0xe9,0x17,
+      0x0d,0x4a,0x3d,0xf9,0x5f,0xd9,0xe0,0xd3,0x3a,0x36,0x77,0xb8,0xe2,0x3d,0x84,0xf0,
+      0x8a,0x89,0x7c,0x53,0x7b,0x05,0x80,0xf7,0x6f,0x0c,0xbb,0x52,0x9d,0x14,0xba,0x69,
+      0xa9,0xf4,0xc2,0xd4,0x72,0x96,0x4a,0x04,0x91,0x35,0x5f,0xa0,0xd6,0x6a,0xcd,0x5c,
+      0xf9,0x82,0xb7,0xa4,0x6b,0x02,0xc1,0xbf,0x52,0xb9,0x68,0xe1,0x3f,0xae,0x81,0xac,
+      0x36,0x2e,0xc0,0x0e,0x62,0x04,0xe4,0x0e,0x3b,0x1a,0x5f,0x06,0x7b,0x28,0xa4,0x99
+    }
+  };
+  udCryptoIV ctrIV;
+  uint8_t cipherText[128];
+  uint8_t decryptedText[128];
+  size_t actualCipherTextLen, actualDecryptedTextLen;
+
+  UD_ERROR_IF(cipher < 0 || cipher >= udCC_Count, udR_InvalidParameter);
+  // Use a KDF to populate the key
+  UD_ERROR_CHECK(udCryptoKey_DeriveFromPassword(&pKey, keyLengths[cipher], "password"));
+
+  memset(cipherText, 0, sizeof(cipherText));
+  memset(decryptedText, 0, sizeof(decryptedText));
+  UD_ERROR_CHECK(udCryptoCipher_Create(&pCtx, cipher, udCPM_None, pKey, udCCM_CBC));
+  UD_ERROR_CHECK(udCryptoCipher_Encrypt(pCtx, &iv, pPlainText, udStrlen(pPlainText), cipherText, sizeof(cipherText), &actualCipherTextLen));
+  UD_ERROR_CHECK(udCryptoCipher_Destroy(&pCtx));
+  UD_ERROR_IF(actualCipherTextLen != 96, udR_InternalCryptoError);
+  UD_ERROR_IF(memcmp(cipherText, cipherTextCBC[cipher], actualCipherTextLen) != 0, udR_InternalCryptoError);
+
+  UD_ERROR_CHECK(udCryptoCipher_Create(&pCtx, cipher, udCPM_None, pKey, udCCM_CBC));
+  UD_ERROR_CHECK(udCryptoCipher_Decrypt(pCtx, &iv, cipherText, actualCipherTextLen, decryptedText, sizeof(decryptedText), &actualDecryptedTextLen));
+  UD_ERROR_CHECK(udCryptoCipher_Destroy(&pCtx));
+  UD_ERROR_IF(actualDecryptedTextLen != 96, udR_InternalCryptoError);
+  UD_ERROR_IF(memcmp(pPlainText, decryptedText, actualDecryptedTextLen) != 0, udR_InternalCryptoError);
+
+  actualCipherTextLen = actualDecryptedTextLen = 0;
+  memset(cipherText, 0, sizeof(cipherText));
+  memset(decryptedText, 0, sizeof(decryptedText));
+  UD_ERROR_CHECK(udCryptoCipher_Create(&pCtx, cipher, udCPM_None, pKey, udCCM_CTR));
+  UD_ERROR_CHECK(udCrypto_CreateIVForCTRMode(pCtx, &ctrIV, nonce, counter));
+  UD_ERROR_CHECK(udCryptoCipher_Encrypt(pCtx, &ctrIV, pPlainText, udStrlen(pPlainText), cipherText, sizeof(cipherText), &actualCipherTextLen));
+  UD_ERROR_CHECK(udCryptoCipher_Destroy(&pCtx));
+  UD_ERROR_IF(actualCipherTextLen != 96, udR_InternalCryptoError);
+  UD_ERROR_IF(memcmp(cipherText, cipherTextCTR[cipher], actualCipherTextLen) != 0, udR_InternalCryptoError);
+
+  UD_ERROR_CHECK(udCryptoCipher_Create(&pCtx, cipher, udCPM_None, pKey, udCCM_CTR));
+  UD_ERROR_CHECK(udCrypto_CreateIVForCTRMode(pCtx, &ctrIV, nonce, counter));
+  UD_ERROR_CHECK(udCryptoCipher_Decrypt(pCtx, &ctrIV, cipherText, actualCipherTextLen, decryptedText, sizeof(decryptedText), &actualDecryptedTextLen));
+  UD_ERROR_CHECK(udCryptoCipher_Destroy(&pCtx));
+  UD_ERROR_IF(actualDecryptedTextLen != 96, udR_InternalCryptoError);
+  UD_ERROR_IF(memcmp(pPlainText, decryptedText, actualDecryptedTextLen) != 0, udR_InternalCryptoError);
+
+epilogue:
+  udCryptoCipher_Destroy(&pCtx); // In case anything failed
+  udFree(pKey);
+
+  return result;
+}
+
+static const uint32_t udCrypto_SHA1IV[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+static const uint32_t udCrypto_SHA1K[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+static const uint32_t udCrypto_SHA256IV[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+static const uint32_t udCrypto_SHA256K[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// ---------------------------------------------------------------------------------------
+// Portable fallback, runs the mbedtls block function against our chaining state
+static void udCrypto_SHA1BlocksPortable(uint32_t *pState, const uint8_t *pBlocks, size_t blockCount)
+{
+  mbedtls_sha1_context ctx;
+  mbedtls_sha1_init(&ctx);
+  memcpy(ctx.state, pState, sizeof(ctx.state));
+  for (; blockCount; --blockCount, pBlocks += udCrypto_SHABlockSize)
+    mbedtls_internal_sha1_process(&ctx, pBlocks);
+  memcpy(pState, ctx.state, sizeof(ctx.state));
+  mbedtls_sha1_free(&ctx);
+}
+
+// ---------------------------------------------------------------------------------------
+static void udCrypto_SHA256BlocksPortable(uint32_t *pState, const uint8_t *pBlocks, size_t blockCount)
+{
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  memcpy(ctx.state, pState, sizeof(ctx.state));
+  for (; blockCount; --blockCount, pBlocks += udCrypto_SHABlockSize)
+    mbedtls_internal_sha256_process(&ctx, pBlocks);
+  memcpy(pState, ctx.state, sizeof(ctx.state));
+  mbedtls_sha256_free(&ctx);
+}
+
+#if UDCRYPTO_X86
+// ---------------------------------------------------------------------------------------
+// Four SHA-1 rounds with the SHA-NI instructions, F selects the round function. The schedule words
+// are passed rotated so msg holds the words from 4 groups earlier and is replaced with this group's
+template <int F>
+UDCRYPTO_TARGET("sha,sse4.1,ssse3")
+static inline void udCrypto_SHA1GroupSHANI(__m128i &abcd, __m128i &e, __m128i &msg, __m128i msg1, __m128i msg2, __m128i msg3, int group)
+{
+  if (group >= 4)
+    msg = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(msg, msg1), msg2), msg3);
+
+  __m128i wk = (group == 0) ? _mm_add_epi32(e, msg) : _mm_sha1nexte_epu32(e, msg);
+  e = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, wk, F);
+}
+
+// ---------------------------------------------------------------------------------------
+UDCRYPTO_TARGET("sha,sse4.1,ssse3")
+static void udCrypto_SHA1BlocksSHANI(uint32_t *pState, const uint8_t *pBlocks, size_t blockCount)
+{
+  const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)pState), 0x1b);
+  __m128i e = _mm_set_epi32((int)pState[4], 0, 0, 0);
+
+  for (; blockCount; --blockCount, pBlocks += udCrypto_SHABlockSize)
+  {
+    __m128i abcdSave = abcd;
+    __m128i eSave = e;
+    __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 0)), byteSwap);
+    __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 16)), byteSwap);
+    __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 32)), byteSwap);
+    __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 48)), byteSwap);
+
+    // After each group e holds abcd from before it, from which the next group derives its e
+    udCrypto_SHA1GroupSHANI<0>(abcd, e, m0, m1, m2, m3, 0);
+    udCrypto_SHA1GroupSHANI<0>(abcd, e, m1, m2, m3, m0, 1);
+    udCrypto_SHA1GroupSHANI<0>(abcd, e, m2, m3, m0, m1, 2);
+    udCrypto_SHA1GroupSHANI<0>(abcd, e, m3, m0, m1, m2, 3);
+    udCrypto_SHA1GroupSHANI<0>(abcd, e, m0, m1, m2, m3, 4);
+    udCrypto_SHA1GroupSHANI<1>(abcd, e, m1, m2, m3, m0, 5);
+    udCrypto_SHA1GroupSHANI<1>(abcd, e, m2, m3, m0, m1, 6);
+    udCrypto_SHA1GroupSHANI<1>(abcd, e, m3, m0, m1, m2, 7);
+    udCrypto_SHA1GroupSHANI<1>(abcd, e, m0, m1, m2, m3, 8);
+    udCrypto_SHA1GroupSHANI<1>(abcd, e, m1, m2, m3, m0, 9);
+    udCrypto_SHA1GroupSHANI<2>(abcd, e, m2, m3, m0, m1, 10);
+    udCrypto_SHA1GroupSHANI<2>(abcd, e, m3, m0, m1, m2, 11);
+    udCrypto_SHA1GroupSHANI<2>(abcd, e, m0, m1, m2, m3, 12);
+    udCrypto_SHA1GroupSHANI<2>(abcd, e, m1, m2, m3, m0, 13);
+    udCrypto_SHA1GroupSHANI<2>(abcd, e, m2, m3, m0, m1, 14);
+    udCrypto_SHA1GroupSHANI<3>(abcd, e, m3, m0, m1, m2, 15);
+    udCrypto_SHA1GroupSHANI<3>(abcd, e, m0, m1, m2, m3, 16);
+    udCrypto_SHA1GroupSHANI<3>(abcd, e, m1, m2, m3, m0, 17);
+    udCrypto_SHA1GroupSHANI<3>(abcd, e, m2, m3, m0, m1, 18);
+    udCrypto_SHA1GroupSHANI<3>(abcd, e, m3, m0, m1, m2, 19);
+
+    e = _mm_sha1nexte_epu32(e, eSave);
+    abcd = _mm_add_epi32(abcd, abcdSave);
+  }
+
+  _mm_storeu_si128((__m128i*)pState, _mm_shuffle_epi32(abcd, 0x1b));
+  pState[4] = (uint32_t)_mm_extract_epi32(e, 3);
+}
+
+// ---------------------------------------------------------------------------------------
+// Four SHA-256 rounds with the SHA-NI instructions, the schedule words are rotated as for SHA-1
+UDCRYPTO_TARGET("sha,sse4.1,ssse3")
+static inline void udCrypto_SHA256GroupSHANI(__m128i &abef, __m128i &cdgh, __m128i &msg, __m128i msg1, __m128i msg2, __m128i msg3, int group)
+{
+  if (group >= 4)
+    msg = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(msg, msg1), _mm_alignr_epi8(msg3, msg2, 4)), msg3);
+
+  __m128i wk = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&udCrypto_SHA256K[group * 4]));
+  cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+  abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));
+}
+
+// ---------------------------------------------------------------------------------------
+UDCRYPTO_TARGET("sha,sse4.1,ssse3")
+static void udCrypto_SHA256BlocksSHANI(uint32_t *pState, const uint8_t *pBlocks, size_t blockCount)
+{
+  const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  // The instructions want the state as ABEF and CDGH
+  __m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&pState[0]), 0xb1);
+  __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&pState[4]), 0x1b);
+  __m128i abef = _mm_alignr_epi8(dcba, efgh, 8);
+  __m128i cdgh = _mm_blend_epi16(efgh, dcba, 0xf0);
+
+  for (; blockCount; --blockCount, pBlocks += udCrypto_SHABlockSize)
+  {
+    __m128i abefSave = abef;
+    __m128i cdghSave = cdgh;
+    __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 0)), byteSwap);
+    __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 16)), byteSwap);
+    __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 32)), byteSwap);
+    __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 48)), byteSwap);
+
+    for (int group = 0; group < 16; group += 4)
+    {
+      udCrypto_SHA256GroupSHANI(abef, cdgh, m0, m1, m2, m3, group + 0);
+      udCrypto_SHA256GroupSHANI(abef, cdgh, m1, m2, m3, m0, group + 1);
+      udCrypto_SHA256GroupSHANI(abef, cdgh, m2, m3, m0, m1, group + 2);
+      udCrypto_SHA256GroupSHANI(abef, cdgh, m3, m0, m1, m2, group + 3);
+    }
+
+    abef = _mm_add_epi32(abef, abefSave);
+    cdgh = _mm_add_epi32(cdgh, cdghSave);
+  }
+
+  __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+  __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+  _mm_storeu_si128((__m128i*)&pState[0], _mm_blend_epi16(feba, dchg, 0xf0));
+  _mm_storeu_si128((__m128i*)&pState[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+
+// ---------------------------------------------------------------------------------------
+UDCRYPTO_TARGET("avx2")
+static inline __m256i udCrypto_Rotr32x8(__m256i x, int bits)
+{
+  return _mm256_or_si256(_mm256_srli_epi32(x, bits), _mm256_slli_epi32(x, 32 - bits));
+}
+
+// ---------------------------------------------------------------------------------------
+// One SHA-256 block for each of 8 independent messages, state is stored word-major (state[word][lane])
+UDCRYPTO_TARGET("avx2")
+static void udCrypto_SHA256BlockAVX2x8(uint32_t state[8][8], const uint8_t *ppBlocks[8])
+{
+  const __m256i byteSwap = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL, 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m256i w[16];
+  for (int t = 0; t < 16; ++t)
+  {
+    uint32_t words[8];
+    for (int lane = 0; lane < 8; ++lane)
+      memcpy(&words[lane], ppBlocks[lane] + t * 4, 4);
+    w[t] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)words), byteSwap);
+  }
+
+  __m256i s[8];
+  for (int i = 0; i < 8; ++i)
+    s[i] = _mm256_loadu_si256((const __m256i*)state[i]);
+  __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+  for (int t = 0; t < 64; ++t)
+  {
+    __m256i &wt = w[t & 15];
+    if (t >= 16)
     {
-      0x29,0xd6,0xac,0x22,0x6c,0x2d,0xba,0x7f,0x6a,0xd3,0x94,0x45,0x7a,0x24,0xe9,0x17,
-      0x0d,0x4a,0x3d,0xf9,0x5f,0xd9,0xe0,0xd3,0x3a,0x36,0x77,0xb8,0xe2,0x3d,0x84,0xf0,
-      0x8a,0x89,0x7c,0x53,0x7b,0x05,0x80,0xf7,0x6f,0x0c,0xbb,0x52,0x9d,0x14,0xba,0x69,
-      0xa9,0xf4,0xc2,0xd4,0x72,0x96,0x4a,0x04,0x91,0x35,0x5f,0xa0,0xd6,0x6a,0xcd,0x5c,
-      0xf9,0x82,0xb7,0xa4,0x6b,0x02,0xc1,0xbf,0x52,0xb9,0x68,0xe1,0x3f,0xae,0x81,0xac,
-      0x36,0x2e,0xc0,0x0e,0x62,0x04,0xe4,0x0e,0x3b,0x1a,0x5f,0x06,0x7b,0x28,0xa4,0x99
+      __m256i w15 = w[(t - 15) & 15];
+      __m256i w2 = w[(t - 2) & 15];
+      __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(udCrypto_Rotr32x8(w15, 7), udCrypto_Rotr32x8(w15, 18)), _mm256_srli_epi32(w15, 3));
+      __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(udCrypto_Rotr32x8(w2, 17), udCrypto_Rotr32x8(w2, 19)), _mm256_srli_epi32(w2, 10));
+      wt = _mm256_add_epi32(_mm256_add_epi32(wt, s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
     }
-  };
-  udCryptoIV ctrIV;
-  uint8_t cipherText[128];
-  uint8_t decryptedText[128];
-  size_t actualCipherTextLen, actualDecryptedTextLen;
+    __m256i bigSigma1 = _mm256_xor_si256(_mm256_xor_si256(udCrypto_Rotr32x8(e, 6), udCrypto_Rotr32x8(e, 11)), udCrypto_Rotr32x8(e, 25));
+    __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+    __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, bigSigma1), _mm256_add_epi32(ch, _mm256_add_epi32(wt, _mm256_set1_epi32((int)udCrypto_SHA256K[t]))));
+    __m256i bigSigma0 = _mm256_xor_si256(_mm256_xor_si256(udCrypto_Rotr32x8(a, 2), udCrypto_Rotr32x8(a, 13)), udCrypto_Rotr32x8(a, 22));
+    __m256i maj = _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(a, b), c), _mm256_and_si256(a, b));
+    h = g;
+    g = f;
+    f = e;
+    e = _mm256_add_epi32(d, t1);
+    d = c;
+    c = b;
+    b = a;
+    a = _mm256_add_epi32(t1, _mm256_add_epi32(bigSigma0, maj));
+  }
 
-  UD_ERROR_IF(cipher < 0 || cipher >= udCC_Count, udR_InvalidParameter);
-  // Use a KDF to populate the key
-  UD_ERROR_CHECK(udCryptoKey_DeriveFromPassword(&pKey, keyLengths[cipher], "password"));
+  __m256i result[8] = { a, b, c, d, e, f, g, h };
+  for (int i = 0; i < 8; ++i)
+    _mm256_storeu_si256((__m256i*)state[i], _mm256_add_epi32(s[i], result[i]));
+}
+#endif // UDCRYPTO_X86
 
-  memset(cipherText, 0, sizeof(cipherText));
-  memset(decryptedText, 0, sizeof(decryptedText));
-  UD_ERROR_CHECK(udCryptoCipher_Create(&pCtx, cipher, udCPM_None, pKey, udCCM_CBC));
-  UD_ERROR_CHECK(udCryptoCipher_Encrypt(pCtx, &iv, pPlainText, udStrlen(pPlainText), cipherText, sizeof(cipherText), &actualCipherTextLen));
-  UD_ERROR_CHECK(udCryptoCipher_Destroy(&pCtx));
-  UD_ERROR_IF(actualCipherTextLen != 96, udR_InternalCryptoError);
-  UD_ERROR_IF(memcmp(cipherText, cipherTextCBC[cipher], actualCipherTextLen) != 0, udR_InternalCryptoError);
+// ---------------------------------------------------------------------------------------
+// Choose the fastest block function the CPU supports
+static udCryptoSHABlockFunc *udCrypto_SHABlockFunc(udCryptoHashes hash)
+{
+#if UDCRYPTO_X86
+  if (udCPUSupportsSHA())
+    return (hash == udCH_SHA1) ? udCrypto_SHA1BlocksSHANI : udCrypto_SHA256BlocksSHANI;
+#endif
+  return (hash == udCH_SHA1) ? udCrypto_SHA1BlocksPortable : udCrypto_SHA256BlocksPortable;
+}
 
-  UD_ERROR_CHECK(udCryptoCipher_Create(&pCtx, cipher, udCPM_None, pKey, udCCM_CBC));
-  UD_ERROR_CHECK(udCryptoCipher_Decrypt(pCtx, &iv, cipherText, actualCipherTextLen, decryptedText, sizeof(decryptedText), &actualDecryptedTextLen));
-  UD_ERROR_CHECK(udCryptoCipher_Destroy(&pCtx));
-  UD_ERROR_IF(actualDecryptedTextLen != 96, udR_InternalCryptoError);
-  UD_ERROR_IF(memcmp(pPlainText, decryptedText, actualDecryptedTextLen) != 0, udR_InternalCryptoError);
+// ---------------------------------------------------------------------------------------
+static void udCrypto_SHAInit(udCryptoSHAContext *pCtx, udCryptoHashes hash)
+{
+  pCtx->pBlockFunc = udCrypto_SHABlockFunc(hash);
+  if (hash == udCH_SHA1)
+    memcpy(pCtx->state, udCrypto_SHA1IV, sizeof(udCrypto_SHA1IV));
+  else
+    memcpy(pCtx->state, udCrypto_SHA256IV, sizeof(udCrypto_SHA256IV));
+  pCtx->length = 0;
+}
 
-  actualCipherTextLen = actualDecryptedTextLen = 0;
-  memset(cipherText, 0, sizeof(cipherText));
-  memset(decryptedText, 0, sizeof(decryptedText));
-  UD_ERROR_CHECK(udCryptoCipher_Create(&pCtx, cipher, udCPM_None, pKey, udCCM_CTR));
-  UD_ERROR_CHECK(udCrypto_CreateIVForCTRMode(pCtx, &ctrIV, nonce, counter));
-  UD_ERROR_CHECK(udCryptoCipher_Encrypt(pCtx, &ctrIV, pPlainText, udStrlen(pPlainText), cipherText, sizeof(cipherText), &actualCipherTextLen));
-  UD_ERROR_CHECK(udCryptoCipher_Destroy(&pCtx));
-  UD_ERROR_IF(actualCipherTextLen != 96, udR_InternalCryptoError);
-  UD_ERROR_IF(memcmp(cipherText, cipherTextCTR[cipher], actualCipherTextLen) != 0, udR_InternalCryptoError);
+// ---------------------------------------------------------------------------------------
+static void udCrypto_SHAUpdate(udCryptoSHAContext *pCtx, const uint8_t *pBytes, size_t length)
+{
+  size_t buffered = (size_t)(pCtx->length % udCrypto_SHABlockSize);
+  pCtx->length += length;
 
-  UD_ERROR_CHECK(udCryptoCipher_Create(&pCtx, cipher, udCPM_None, pKey, udCCM_CTR));
-  UD_ERROR_CHECK(udCrypto_CreateIVForCTRMode(pCtx, &ctrIV, nonce, counter));
-  UD_ERROR_CHECK(udCryptoCipher_Decrypt(pCtx, &ctrIV, cipherText, actualCipherTextLen, decryptedText, sizeof(decryptedText), &actualDecryptedTextLen));
-  UD_ERROR_CHECK(udCryptoCipher_Destroy(&pCtx));
-  UD_ERROR_IF(actualDecryptedTextLen != 96, udR_InternalCryptoError);
-  UD_ERROR_IF(memcmp(pPlainText, decryptedText, actualDecryptedTextLen) != 0, udR_InternalCryptoError);
+  if (buffered)
+  {
+    size_t fill = std::min(length, udCrypto_SHABlockSize - buffered);
+    memcpy(pCtx->buffer + buffered, pBytes, fill);
+    pBytes += fill;
+    length -= fill;
+    if (buffered + fill < udCrypto_SHABlockSize)
+      return;
+    pCtx->pBlockFunc(pCtx->state, pCtx->buffer, 1);
+  }
 
-epilogue:
-  udCryptoCipher_Destroy(&pCtx); // In case anything failed
-  udFree(pKey);
+  size_t blockCount = length / udCrypto_SHABlockSize;
+  if (blockCount)
+  {
+    pCtx->pBlockFunc(pCtx->state, pBytes, blockCount);
+    pBytes += blockCount * udCrypto_SHABlockSize;
+    length -= blockCount * udCrypto_SHABlockSize;
+  }
 
-  return result;
+  if (length)
+    memcpy(pCtx->buffer, pBytes, length);
 }
 
-// ***************************************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udCryptoHash_Create(udCryptoHashContext **ppCtx, udCryptoHashes hashMethod)
+// ---------------------------------------------------------------------------------------
+// Builds the final one or two padded blocks from the trailing partial block, returns the length of the tail
+static size_t udCrypto_SHAPadTail(uint8_t pTail[udCrypto_SHABlockSize * 2], const uint8_t *pRemainder, size_t remainderLength, uint64_t totalLength)
 {
-  udResult result;
-  udCryptoHashContext *pCtx = nullptr;
+  size_t tailLength = (remainderLength + 9 <= udCrypto_SHABlockSize) ? udCrypto_SHABlockSize : udCrypto_SHABlockSize * 2;
+  memcpy(pTail, pRemainder, remainderLength);
+  pTail[remainderLength] = 0x80;
+  memset(pTail + remainderLength + 1, 0, tailLength - remainderLength - 9);
+  udCrypto_StoreBigEndian64(pTail + tailLength - 8, totalLength * 8);
+  return tailLength;
+}
 
-  UD_ERROR_IF(hashMethod >= udCH_Count, udR_InvalidParameter);
-  UD_ERROR_NULL(ppCtx, udR_InvalidParameter);
+// ---------------------------------------------------------------------------------------
+static void udCrypto_SHAStoreDigest(uint8_t *pDigest, const uint32_t *pState, size_t digestLength)
+{
+  for (size_t i = 0; i < digestLength; ++i)
+    pDigest[i] = (uint8_t)(pState[i / 4] >> (24 - (i & 3) * 8));
+}
 
-  pCtx = udAllocType(udCryptoHashContext, 1, udAF_Zero);
-  UD_ERROR_NULL(pCtx, udR_MemoryAllocationFailure);
+// ---------------------------------------------------------------------------------------
+static void udCrypto_SHAFinish(udCryptoSHAContext *pCtx, uint8_t *pDigest, size_t digestLength)
+{
+  uint8_t tail[udCrypto_SHABlockSize * 2];
+  size_t tailLength = udCrypto_SHAPadTail(tail, pCtx->buffer, (size_t)(pCtx->length % udCrypto_SHABlockSize), pCtx->length);
+  pCtx->pBlockFunc(pCtx->state, tail, tailLength / udCrypto_SHABlockSize);
+  udCrypto_SHAStoreDigest(pDigest, pCtx->state, digestLength);
+  mbedtls_platform_zeroize(tail, sizeof(tail));
+}
 
+#if UDCRYPTO_X86
+// ---------------------------------------------------------------------------------------
+// Hash messages in the 8 lanes of the AVX2 kernel, each lane takes the next message when its current one completes
+static void udCrypto_SHA256ManyAVX2(size_t count, const void * const *ppMessages, const size_t *pLengths, uint8_t *pDigests)
+{
+  enum { LaneCount = 8 };
+  struct Lane
+  {
+    size_t message;     // Index of the message in this lane, or count when idle
+    size_t block;       // Next block to compress
+    size_t fullBlocks;  // Blocks read directly from the message
+    size_t blockCount;  // Total blocks, including the padded tail
+    uint8_t tail[udCrypto_SHABlockSize * 2];
+  };
+  static const uint8_t idleBlock[udCrypto_SHABlockSize] = {};
+
+  Lane lanes[LaneCount];
+  uint32_t state[8][LaneCount];
+  const uint8_t *ppBlocks[LaneCount];
+  size_t nextMessage = 0;
+  size_t activeLanes = 0;
+
+  for (int lane = 0; lane < LaneCount; ++lane)
+    lanes[lane].message = count;
+
+  do
+  {
+    for (int lane = 0; lane < LaneCount; ++lane)
+    {
+      Lane &l = lanes[lane];
+      if (l.message == count && nextMessage < count)
+      {
+        const uint8_t *pMessage = (const uint8_t*)ppMessages[nextMessage];
+        size_t length = pLengths[nextMessage];
+        l.message = nextMessage++;
+        l.block = 0;
+        l.fullBlocks = length / udCrypto_SHABlockSize;
+        l.blockCount = l.fullBlocks + udCrypto_SHAPadTail(l.tail, pMessage + l.fullBlocks * udCrypto_SHABlockSize, length % udCrypto_SHABlockSize, length) / udCrypto_SHABlockSize;
+        for (int i = 0; i < 8; ++i)
+          state[i][lane] = udCrypto_SHA256IV[i];
+        ++activeLanes;
+      }
+
+      if (l.message == count)
+        ppBlocks[lane] = idleBlock;
+      else if (l.block < l.fullBlocks)
+        ppBlocks[lane] = (const uint8_t*)ppMessages[l.message] + l.block * udCrypto_SHABlockSize;
+      else
+        ppBlocks[lane] = l.tail + (l.block - l.fullBlocks) * udCrypto_SHABlockSize;
+    }
+
+    udCrypto_SHA256BlockAVX2x8(state, ppBlocks);
+
+    for (int lane = 0; lane < LaneCount; ++lane)
+    {
+      Lane &l = lanes[lane];
+      if (l.message != count && ++l.block == l.blockCount)
+      {
+        uint32_t laneState[8];
+        for (int i = 0; i < 8; ++i)
+          laneState[i] = state[i][lane];
+        udCrypto_SHAStoreDigest(pDigests + l.message * udCHL_SHA256Length, laneState, udCHL_SHA256Length);
+        l.message = count;
+        --activeLanes;
+      }
+    }
+  } while (activeLanes || nextMessage < count);
+}
+#endif // UDCRYPTO_X86
+
+// ---------------------------------------------------------------------------------------
+// Initialise a hash context in place, allowing contexts to live on the stack
+static udResult udCrypto_HashInit(udCryptoHashContext *pCtx, udCryptoHashes hashMethod)
+{
   pCtx->hashMethod = hashMethod;
   switch (hashMethod)
   {
     case udCH_SHA1:
-      mbedtls_sha1_init(&pCtx->sha1);
-      mbedtls_sha1_starts(&pCtx->sha1);
+      udCrypto_SHAInit(&pCtx->sha, hashMethod);
       pCtx->hashLengthInBytes = udCHL_SHA1Length;
       break;
     case udCH_SHA256:
-      mbedtls_sha256_init(&pCtx->sha256);
-      mbedtls_sha256_starts(&pCtx->sha256, 0);
+      udCrypto_SHAInit(&pCtx->sha, hashMethod);
       pCtx->hashLengthInBytes = udCHL_SHA256Length;
       break;
     case udCH_SHA512:
@@ -659,8 +2011,43 @@ udResult udCryptoHash_Create(udCryptoHashContext **ppCtx, udCryptoHashes hashMet
       pCtx->hashLengthInBytes = udCHL_MD5Length;
       break;
     default:
-      UD_ERROR_SET(udR_InvalidParameter);
+      return udR_InvalidParameter;
+  }
+  return udR_Success;
+}
+
+// ---------------------------------------------------------------------------------------
+// Release anything held by a hash context and scrub the state, without freeing the context itself
+static void udCrypto_HashCleanup(udCryptoHashContext *pCtx)
+{
+  switch (pCtx->hashMethod)
+  {
+    case udCH_SHA1:
+    case udCH_SHA256:
+      mbedtls_platform_zeroize(&pCtx->sha, sizeof(pCtx->sha));
+      break;
+    case udCH_SHA512:
+      mbedtls_sha512_free(&pCtx->sha512);
+      break;
+    default:
+      break;
   }
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udCryptoHash_Create(udCryptoHashContext **ppCtx, udCryptoHashes hashMethod)
+{
+  udResult result;
+  udCryptoHashContext *pCtx = nullptr;
+
+  UD_ERROR_IF(hashMethod >= udCH_Count, udR_InvalidParameter);
+  UD_ERROR_NULL(ppCtx, udR_InvalidParameter);
+
+  pCtx = udAllocType(udCryptoHashContext, 1, udAF_Zero);
+  UD_ERROR_NULL(pCtx, udR_MemoryAllocationFailure);
+
+  UD_ERROR_CHECK(udCrypto_HashInit(pCtx, hashMethod));
 
   // Give ownership of the context to the caller
   *ppCtx = pCtx;
@@ -668,112 +2055,309 @@ udResult udCryptoHash_Create(udCryptoHashContext **ppCtx, udCryptoHashes hashMet
   result = udR_Success;
 
 epilogue:
-  udFree(pCtx);
+  udFree(pCtx);
+  return result;
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udCryptoHash_Digest(udCryptoHashContext *pCtx, const void *pBytes, size_t length)
+{
+  if (!pCtx)
+    return udR_InvalidParameter;
+  if (length && !pBytes)
+    return udR_InvalidParameter;
+
+  switch (pCtx->hashMethod)
+  {
+    case udCH_SHA1:
+    case udCH_SHA256:
+      udCrypto_SHAUpdate(&pCtx->sha, (const uint8_t*)pBytes, length);
+      break;
+    case udCH_SHA512:
+      mbedtls_sha512_update(&pCtx->sha512, (const uint8_t*)pBytes, length);
+      break;
+    case udCH_MD5:
+      mbedtls_md5_update(&pCtx->md5, (const uint8_t*)pBytes, length);
+      break;
+    default:
+      return udR_InvalidParameter;
+  }
+  return udR_Success;
+}
+
+// ---------------------------------------------------------------------------------------
+// Write the raw digest to pHash (hashLengthInBytes bytes)
+static udResult udCrypto_HashFinish(udCryptoHashContext *pCtx, uint8_t *pHash)
+{
+  switch (pCtx->hashMethod)
+  {
+    case udCH_SHA1:
+    case udCH_SHA256:
+      udCrypto_SHAFinish(&pCtx->sha, pHash, pCtx->hashLengthInBytes);
+      break;
+    case udCH_SHA512:
+      mbedtls_sha512_finish(&pCtx->sha512, pHash);
+      break;
+    case udCH_MD5:
+      mbedtls_md5_finish(&pCtx->md5, pHash);
+      break;
+    default:
+      return udR_InvalidConfiguration;
+  }
+  return udR_Success;
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udCryptoHash_Finalise(udCryptoHashContext *pCtx, const char **ppHashBase64)
+{
+  uint8_t hash[udCHL_MaxHashLength];
+  if (!pCtx || !ppHashBase64)
+    return udR_InvalidParameter;
+
+  udResult result = udCrypto_HashFinish(pCtx, hash);
+  if (result != udR_Success)
+    return result;
+
+  return udBase64Encode(ppHashBase64, hash, pCtx->hashLengthInBytes);
+}
+
+// ***************************************************************************************
+// Write the raw digest to a caller supplied buffer
+udResult udCryptoHash_FinaliseRaw(udCryptoHashContext *pCtx, uint8_t *pDigest, size_t digestLength, size_t *pDigestLengthWritten)
+{
+  if (!pCtx || !pDigest)
+    return udR_InvalidParameter;
+  if (digestLength < pCtx->hashLengthInBytes)
+    return udR_BufferTooSmall;
+
+  udResult result = udCrypto_HashFinish(pCtx, pDigest);
+  if (result == udR_Success && pDigestLengthWritten)
+    *pDigestLengthWritten = pCtx->hashLengthInBytes;
+  return result;
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, December 2014
+udResult udCryptoHash_Destroy(udCryptoHashContext **ppCtx)
+{
+  if (!ppCtx || !*ppCtx)
+    return udR_InvalidParameter;
+  udCrypto_HashCleanup(*ppCtx);
+  udFree(*ppCtx);
+  return udR_Success;
+}
+
+// ***************************************************************************************
+// Author: Dave Pevreal, May 2017
+udResult udCryptoHash_Hash(udCryptoHashes hash, const void *pMessage, size_t messageLength, const char **ppHashBase64,
+                           const void *pMessage2, size_t message2Length)
+{
+  udResult result;
+  udCryptoHashContext *pCtx = nullptr;
+
+  UD_ERROR_CHECK(udCryptoHash_Create(&pCtx, hash));
+  UD_ERROR_CHECK(udCryptoHash_Digest(pCtx, pMessage, messageLength));
+  if (pMessage2 && message2Length)
+  {
+    // Include the optional 2nd part of the message.
+    // Digesting 2 concatenated message parts is very common in various crypto functions
+    UD_ERROR_CHECK(udCryptoHash_Digest(pCtx, pMessage2, message2Length));
+  }
+  UD_ERROR_CHECK(udCryptoHash_Finalise(pCtx, ppHashBase64));
+
+epilogue:
+  udCryptoHash_Destroy(&pCtx);
+  return result;
+}
+
+// ***************************************************************************************
+// Hash one block (or two) of data to a raw digest using a context on the stack
+udResult udCryptoHash_HashRaw(udCryptoHashes hash, const void *pMessage, size_t messageLength, uint8_t *pDigest, size_t digestLength,
+                              const void *pMessage2, size_t message2Length)
+{
+  udResult result;
+  udCryptoHashContext ctx;
+
+  UD_ERROR_IF(hash >= udCH_Count, udR_InvalidParameter);
+  UD_ERROR_CHECK(udCrypto_HashInit(&ctx, hash));
+  result = udCryptoHash_Digest(&ctx, pMessage, messageLength);
+  if (result == udR_Success && pMessage2 && message2Length)
+    result = udCryptoHash_Digest(&ctx, pMessage2, message2Length);
+  if (result == udR_Success)
+    result = udCryptoHash_FinaliseRaw(&ctx, pDigest, digestLength);
+  udCrypto_HashCleanup(&ctx);
+
+epilogue:
   return result;
 }
 
 // ***************************************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udCryptoHash_Digest(udCryptoHashContext *pCtx, const void *pBytes, size_t length)
+// Length in bytes of the raw digest of a hash
+size_t udCryptoHash_GetLength(udCryptoHashes hash)
 {
-  if (!pCtx)
-    return udR_InvalidParameter;
-  if (length && !pBytes)
-    return udR_InvalidParameter;
+  static const size_t hashLengths[] = { udCHL_SHA1Length, udCHL_SHA256Length, udCHL_SHA512Length, udCHL_MD5Length };
+  UDCOMPILEASSERT(UDARRAYSIZE(hashLengths) == udCH_Count, "Updated hash list without updating lengths!");
 
-  switch (pCtx->hashMethod)
+  return (hash < udCH_Count) ? hashLengths[hash] : 0;
+}
+
+static std::atomic<int> s_udCryptoHashManyKernel(udCHMK_Auto);
+
+// ***************************************************************************************
+// Pin udCryptoHash_HashMany to a kernel, for tests
+udResult udCryptoHash_SetHashManyKernel(udCryptoHashManyKernel kernel)
+{
+  switch (kernel)
   {
-    case udCH_SHA1:
-      mbedtls_sha1_update(&pCtx->sha1, (const uint8_t*)pBytes, length);
-      break;
-    case udCH_SHA256:
-      mbedtls_sha256_update(&pCtx->sha256, (const uint8_t*)pBytes, length);
+    case udCHMK_Auto:
+    case udCHMK_Portable:
       break;
-    case udCH_SHA512:
-      mbedtls_sha512_update(&pCtx->sha512, (const uint8_t*)pBytes, length);
+#if UDCRYPTO_X86
+    case udCHMK_SHA:
+      if (!udCPUSupportsSHA())
+        return udR_Unsupported;
       break;
-    case udCH_MD5:
-      mbedtls_md5_update(&pCtx->md5, (const uint8_t*)pBytes, length);
+    case udCHMK_AVX2Lanes:
+      if (!udCPUSupportsAVX2())
+        return udR_Unsupported;
       break;
+#else
+    case udCHMK_SHA:
+    case udCHMK_AVX2Lanes:
+      return udR_Unsupported;
+#endif
     default:
       return udR_InvalidParameter;
   }
+
+  s_udCryptoHashManyKernel = kernel;
   return udR_Success;
 }
 
 // ***************************************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udCryptoHash_Finalise(udCryptoHashContext *pCtx, const char **ppHashBase64)
+// Hash many independent messages, writing the raw digests consecutively
+udResult udCryptoHash_HashMany(udCryptoHashes hash, size_t count, const void * const *ppMessages, const size_t *pLengths, uint8_t *pDigests)
 {
-  uint8_t hash[udCHL_MaxHashLength];
-  if (!pCtx || !ppHashBase64)
+  size_t hashLength = udCryptoHash_GetLength(hash);
+  if (hash >= udCH_Count || (count && (!ppMessages || !pLengths || !pDigests)))
     return udR_InvalidParameter;
-
-  switch (pCtx->hashMethod)
+  for (size_t i = 0; i < count; ++i)
   {
-    case udCH_SHA1:
-      mbedtls_sha1_finish(&pCtx->sha1, hash);
-      break;
-    case udCH_SHA256:
-      mbedtls_sha256_finish(&pCtx->sha256, hash);
-      break;
-    case udCH_SHA512:
-      mbedtls_sha512_finish(&pCtx->sha512, hash);
-      break;
-    case udCH_MD5:
-      mbedtls_md5_finish(&pCtx->md5, hash);
-      break;
-    default:
-      return udR_InvalidConfiguration;
+    if (pLengths[i] && !ppMessages[i])
+      return udR_InvalidParameter;
   }
+  if (!count)
+    return udR_Success;
 
-  return udBase64Encode(ppHashBase64, hash, pCtx->hashLengthInBytes);
-}
+  udCryptoHashManyKernel kernel = (udCryptoHashManyKernel)s_udCryptoHashManyKernel.load();
+#if UDCRYPTO_X86
+  // A single stream with the SHA instructions outruns all 8 AVX2 lanes, so the lanes are only used without them
+  if (hash == udCH_SHA256 && (kernel == udCHMK_AVX2Lanes || (kernel == udCHMK_Auto && !udCPUSupportsSHA() && udCPUSupportsAVX2())))
+  {
+    udCrypto_SHA256ManyAVX2(count, ppMessages, pLengths, pDigests);
+    return udR_Success;
+  }
+#endif
 
-// ***************************************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udCryptoHash_Destroy(udCryptoHashContext **ppCtx)
-{
-  if (!ppCtx || !*ppCtx)
-    return udR_InvalidParameter;
-  switch ((*ppCtx)->hashMethod)
+  for (size_t i = 0; i < count; ++i)
   {
-    case udCH_SHA1:
-      mbedtls_sha1_free(&(*ppCtx)->sha1);
-      break;
-    case udCH_SHA256:
-      mbedtls_sha256_free(&(*ppCtx)->sha256);
-      break;
-    case udCH_SHA512:
-      mbedtls_sha512_free(&(*ppCtx)->sha512);
-      break;
-    default:
-      break;
+    const uint8_t *pMessage = (const uint8_t*)ppMessages[i];
+    uint8_t *pDigest = pDigests + i * hashLength;
+    switch (hash)
+    {
+      case udCH_SHA1:
+      case udCH_SHA256:
+      {
+        udCryptoSHAContext ctx;
+        udCrypto_SHAInit(&ctx, hash);
+        if (kernel == udCHMK_Portable)
+          ctx.pBlockFunc = (hash == udCH_SHA1) ? udCrypto_SHA1BlocksPortable : udCrypto_SHA256BlocksPortable;
+        udCrypto_SHAUpdate(&ctx, pMessage, pLengths[i]);
+        udCrypto_SHAFinish(&ctx, pDigest, hashLength);
+        break;
+      }
+      case udCH_SHA512:
+        if (mbedtls_sha512(pMessage, pLengths[i], pDigest, 0) != 0)
+          return udR_InternalCryptoError;
+        break;
+      case udCH_MD5:
+        if (mbedtls_md5(pMessage, pLengths[i], pDigest) != 0)
+          return udR_InternalCryptoError;
+        break;
+      default:
+        return udR_InvalidParameter;
+    }
   }
-  udFree(*ppCtx);
+
   return udR_Success;
 }
 
 // ***************************************************************************************
-// Author: Dave Pevreal, May 2017
-udResult udCryptoHash_Hash(udCryptoHashes hash, const void *pMessage, size_t messageLength, const char **ppHashBase64,
-                           const void *pMessage2, size_t message2Length)
+// Hash a leaf of a hash tree, prefixed with 0x00 so a leaf can never be mistaken for a parent
+udResult udCryptoHash_TreeLeaf(udCryptoHashes hash, const void *pData, size_t length, uint8_t *pLeafDigest)
 {
   udResult result;
   udCryptoHashContext *pCtx = nullptr;
+  static const uint8_t leafPrefix = 0x00;
 
+  UD_ERROR_NULL(pLeafDigest, udR_InvalidParameter);
   UD_ERROR_CHECK(udCryptoHash_Create(&pCtx, hash));
-  UD_ERROR_CHECK(udCryptoHash_Digest(pCtx, pMessage, messageLength));
-  if (pMessage2 && message2Length)
+  UD_ERROR_CHECK(udCryptoHash_Digest(pCtx, &leafPrefix, 1));
+  UD_ERROR_CHECK(udCryptoHash_Digest(pCtx, pData, length));
+  UD_ERROR_CHECK(udCrypto_HashFinish(pCtx, pLeafDigest));
+
+epilogue:
+  udCryptoHash_Destroy(&pCtx);
+  return result;
+}
+
+// ***************************************************************************************
+// Combine leaf digests level by level into the root, parents are H(0x01 || left || right)
+udResult udCryptoHash_TreeRoot(udCryptoHashes hash, const uint8_t *pLeafDigests, size_t leafCount, uint8_t *pRootDigest)
+{
+  udResult result;
+  size_t hashLength = udCryptoHash_GetLength(hash);
+  size_t parentLength = 1 + 2 * hashLength;
+  uint8_t *pLevel = nullptr;
+  uint8_t *pParents = nullptr;
+  const void **ppParents = nullptr;
+  size_t *pParentLengths = nullptr;
+
+  UD_ERROR_IF(!hashLength || !pLeafDigests || !leafCount || !pRootDigest, udR_InvalidParameter);
+
+  pLevel = (uint8_t*)udMemDup(pLeafDigests, leafCount * hashLength, 0, udAF_None);
+  pParents = udAllocType(uint8_t, (leafCount / 2 + 1) * parentLength, udAF_None);
+  ppParents = udAllocType(const void*, leafCount / 2 + 1, udAF_None);
+  pParentLengths = udAllocType(size_t, leafCount / 2 + 1, udAF_None);
+  UD_ERROR_IF(!pLevel || !pParents || !ppParents || !pParentLengths, udR_MemoryAllocationFailure);
+
+  while (leafCount > 1)
   {
-    // Include the optional 2nd part of the message.
-    // Digesting 2 concatenated message parts is very common in various crypto functions
-    UD_ERROR_CHECK(udCryptoHash_Digest(pCtx, pMessage2, message2Length));
+    // Pairs are hashed together in parallel, an odd node at the end of a level is promoted unchanged
+    size_t pairCount = leafCount / 2;
+    for (size_t i = 0; i < pairCount; ++i)
+    {
+      uint8_t *pParent = pParents + i * parentLength;
+      pParent[0] = 0x01;
+      memcpy(pParent + 1, pLevel + i * 2 * hashLength, 2 * hashLength);
+      ppParents[i] = pParent;
+      pParentLengths[i] = parentLength;
+    }
+    UD_ERROR_CHECK(udCryptoHash_HashMany(hash, pairCount, ppParents, pParentLengths, pLevel));
+    if (leafCount & 1)
+      memmove(pLevel + pairCount * hashLength, pLevel + (leafCount - 1) * hashLength, hashLength);
+    leafCount = pairCount + (leafCount & 1);
   }
-  UD_ERROR_CHECK(udCryptoHash_Finalise(pCtx, ppHashBase64));
+  memcpy(pRootDigest, pLevel, hashLength);
+  result = udR_Success;
 
 epilogue:
-  udCryptoHash_Destroy(&pCtx);
+  udFree(pLevel);
+  udFree(pParents);
+  udFree(ppParents);
+  udFree(pParentLengths);
   return result;
 }
 
@@ -781,46 +2365,71 @@ epilogue:
 // Author: Dave Pevreal, May 2017
 udResult udCryptoHash_HMAC(udCryptoHashes hash, const char *pKeyBase64, const void *pMessage, size_t messageLength, const char **ppHMACBase64)
 {
-  // See https://en.wikipedia.org/wiki/Hash-based_message_authentication_code
   udResult result;
   uint8_t *pLongKeyData = nullptr;
-  const char *pLongKeyHashBase64 = nullptr;
-  const char *pIpadHashBase64 = nullptr;
-  enum { blockSize = 64 };
-  uint8_t key[blockSize];
-  uint8_t opad[blockSize];
-  uint8_t ipad[blockSize];
-  uint8_t ipadHash[blockSize];
-  size_t ipadHashLen;
+  uint8_t key[udCrypto_HMACBlockSize];
+  size_t keyLength = 0;
+  uint8_t hmac[udCHL_MaxHashLength];
+  size_t hmacLength = 0;
 
-  memset(key, 0, blockSize);
-  if (udBase64Decode(pKeyBase64, 0, key, sizeof(key)) != udR_Success)
+  UD_ERROR_NULL(ppHMACBase64, udR_InvalidParameter);
+  if (udBase64Decode(pKeyBase64, 0, key, sizeof(key), &keyLength) != udR_Success)
   {
-    // Key is longer than a block, so we need to hash it down
-    size_t longKeyDataLen = 0;
-    UD_ERROR_CHECK(udBase64Decode(&pLongKeyData, &longKeyDataLen, pKeyBase64));
-    UD_ERROR_CHECK(udCryptoHash_Hash(hash, pLongKeyData, longKeyDataLen, &pLongKeyHashBase64));
-    UD_ERROR_CHECK(udBase64Decode(pLongKeyHashBase64, 0, key, sizeof(key)));
+    // Key is longer than a block, udCryptoHash_HMACRaw will hash it down
+    UD_ERROR_CHECK(udBase64Decode(&pLongKeyData, &keyLength, pKeyBase64));
   }
 
-  for (int i = 0; i < blockSize; ++i)
+  UD_ERROR_CHECK(udCryptoHash_HMACRaw(hash, pLongKeyData ? pLongKeyData : key, keyLength, pMessage, messageLength, hmac, sizeof(hmac), &hmacLength));
+  UD_ERROR_CHECK(udBase64Encode(ppHMACBase64, hmac, hmacLength));
+
+epilogue:
+  mbedtls_platform_zeroize(key, sizeof(key));
+  if (pLongKeyData)
+    mbedtls_platform_zeroize(pLongKeyData, keyLength);
+  udFree(pLongKeyData);
+  return result;
+}
+
+// ***************************************************************************************
+// Generate a keyed hash from a raw key, writing the raw result to a caller supplied buffer
+udResult udCryptoHash_HMACRaw(udCryptoHashes hash, const void *pKey, size_t keyLength, const void *pMessage, size_t messageLength,
+                              uint8_t *pHMAC, size_t hmacLength, size_t *pHMACLengthWritten)
+{
+  // See https://en.wikipedia.org/wiki/Hash-based_message_authentication_code
+  udResult result;
+  uint8_t key[udCrypto_HMACBlockSize];
+  uint8_t opad[udCrypto_HMACBlockSize];
+  uint8_t ipad[udCrypto_HMACBlockSize];
+  uint8_t ipadHash[udCHL_MaxHashLength];
+  size_t hashLength = udCryptoHash_GetLength(hash);
+
+  memset(key, 0, sizeof(key));
+  UD_ERROR_IF(hashLength == 0, udR_InvalidParameter);
+  UD_ERROR_IF(keyLength && !pKey, udR_InvalidParameter);
+  UD_ERROR_NULL(pHMAC, udR_InvalidParameter);
+  UD_ERROR_IF(hmacLength < hashLength, udR_BufferTooSmall);
+
+  if (keyLength > sizeof(key))
+    UD_ERROR_CHECK(udCryptoHash_HashRaw(hash, pKey, keyLength, key, sizeof(key))); // Key is longer than a block, so we need to hash it down
+  else if (keyLength)
+    memcpy(key, pKey, keyLength);
+
+  for (int i = 0; i < udCrypto_HMACBlockSize; ++i)
   {
     opad[i] = 0x5c ^ key[i];
     ipad[i] = 0x36 ^ key[i];
   }
 
-  // First hash the concat of ipad and the message
-  UD_ERROR_CHECK(udCryptoHash_Hash(hash, ipad, blockSize, &pIpadHashBase64, pMessage, messageLength));
-  // Need to decode it from base64
-  UD_ERROR_CHECK(udBase64Decode(pIpadHashBase64, 0, ipadHash, sizeof(ipadHash), &ipadHashLen));
-  // Then hash the concat of the opad and the result of first hash
-  UD_ERROR_CHECK(udCryptoHash_Hash(hash, opad, blockSize, ppHMACBase64, ipadHash, ipadHashLen));
+  // First hash the concat of ipad and the message, then hash the concat of the opad and the result of first hash
+  UD_ERROR_CHECK(udCryptoHash_HashRaw(hash, ipad, sizeof(ipad), ipadHash, sizeof(ipadHash), pMessage, messageLength));
+  UD_ERROR_CHECK(udCryptoHash_HashRaw(hash, opad, sizeof(opad), pHMAC, hmacLength, ipadHash, hashLength));
+  if (pHMACLengthWritten)
+    *pHMACLengthWritten = hashLength;
 
 epilogue:
-  memset(key, 0, sizeof(key));
-  udFree(pIpadHashBase64);
-  udFree(pLongKeyHashBase64);
-  udFree(pLongKeyData);
+  mbedtls_platform_zeroize(key, sizeof(key));
+  mbedtls_platform_zeroize(ipad, sizeof(ipad));
+  mbedtls_platform_zeroize(opad, sizeof(opad));
   return result;
 }
 
@@ -1300,6 +2909,47 @@ void udCryptoKeyECDH_Destroy(udCryptoECDHContext **ppECDHCtx)
   }
 }
 
+// ---------------------------------------------------------------------------------------
+// Deterministic padding is the mbedtls_rsa_init default, so it's only written when it differs and shared contexts aren't modified
+static void udCrypto_SigSetPadding(udCryptoSigContext *pSigCtx, udCryptoSigPadScheme pad)
+{
+  if (pad == udCSPS_Deterministic && (pSigCtx->rsa.padding != MBEDTLS_RSA_PKCS_V15 || pSigCtx->rsa.hash_id != MBEDTLS_MD_NONE))
+    mbedtls_rsa_set_padding(&pSigCtx->rsa, MBEDTLS_RSA_PKCS_V15, MBEDTLS_MD_NONE);
+}
+
+// ---------------------------------------------------------------------------------------
+// Fill in the values mbedtls otherwise computes lazily on first use, so verification only reads the context and it can be shared
+static udResult udCrypto_SigPrecompute(udCryptoSigContext *pSigCtx)
+{
+  udResult result = udR_Success;
+  mbedtls_mpi one;
+  mbedtls_ecp_point point;
+
+  mbedtls_mpi_init(&one);
+  mbedtls_ecp_point_init(&point);
+  UD_ERROR_IF(mbedtls_mpi_lset(&one, 1) != 0, udR_InternalCryptoError);
+  switch (pSigCtx->type)
+  {
+    case udCST_RSA1024:
+    case udCST_RSA2048:
+    case udCST_RSA4096:
+      if (pSigCtx->rsa.RN.p == nullptr) // Montgomery constant for the public exponentiation
+        UD_ERROR_IF(mbedtls_mpi_exp_mod(&one, &one, &pSigCtx->rsa.E, &pSigCtx->rsa.N, &pSigCtx->rsa.RN) != 0, udR_InternalCryptoError);
+      break;
+    case udCST_ECPBP384:
+      if (pSigCtx->ecdsa.grp.T == nullptr) // Comb table for the base point, most curves have a static one
+        UD_ERROR_IF(mbedtls_ecp_mul(&pSigCtx->ecdsa.grp, &point, &one, &pSigCtx->ecdsa.grp.G, udCrypto_RandomCallback, nullptr) != 0, udR_InternalCryptoError);
+      break;
+    default:
+      UD_ERROR_SET(udR_InvalidConfiguration);
+  }
+
+epilogue:
+  mbedtls_mpi_free(&one);
+  mbedtls_ecp_point_free(&point);
+  return result;
+}
+
 // ***************************************************************************************
 // Author: Dave Pevreal, September 2017
 udResult udCryptoSig_CreateKeyPair(udCryptoSigContext **ppSigCtx, udCryptoSigType type)
@@ -1307,46 +2957,37 @@ udResult udCryptoSig_CreateKeyPair(udCryptoSigContext **ppSigCtx, udCryptoSigTyp
   udResult result = udR_Failure;
   int mbErr;
   udCryptoSigContext *pSigCtx = nullptr;
-  mbedtls_entropy_context entropy;
-  mbedtls_ctr_drbg_context ctr_drbg;
 
-  mbedtls_ctr_drbg_init(&ctr_drbg);
-  mbedtls_entropy_init(&entropy);
   UD_ERROR_IF(!udCryptoSharedData::initialised, udR_NotInitialized);
 
   pSigCtx = udAllocType(udCryptoSigContext, 1, udAF_Zero);
   UD_ERROR_NULL(pSigCtx, udR_MemoryAllocationFailure);
   pSigCtx->type = type;
 
-  // Seed the DRGB and add this function name as an optional personalisation string
-  mbErr = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)__FUNCTION__, sizeof(__FUNCTION__));
-  UD_ERROR_IF(mbErr, udR_InternalCryptoError);
-
   switch (type)
   {
     case udCST_RSA1024:
     case udCST_RSA2048:
     case udCST_RSA4096:
       mbedtls_rsa_init(&pSigCtx->rsa);
-      mbErr = mbedtls_rsa_gen_key(&pSigCtx->rsa, mbedtls_ctr_drbg_random, &ctr_drbg, type, 65537);
+      mbErr = mbedtls_rsa_gen_key(&pSigCtx->rsa, udCrypto_RandomCallback, nullptr, type, 65537);
       UD_ERROR_IF(mbErr, udR_InternalCryptoError);
       break;
     case udCST_ECPBP384:
       mbedtls_ecdsa_init(&pSigCtx->ecdsa);
-      mbErr = mbedtls_ecdsa_genkey(&pSigCtx->ecdsa, MBEDTLS_ECP_DP_BP384R1, mbedtls_ctr_drbg_random, &ctr_drbg);
+      mbErr = mbedtls_ecdsa_genkey(&pSigCtx->ecdsa, MBEDTLS_ECP_DP_BP384R1, udCrypto_RandomCallback, nullptr);
       UD_ERROR_IF(mbErr, udR_InternalCryptoError);
       break;
     default:
       UD_ERROR_SET(udR_InvalidParameter);
   }
+  UD_ERROR_CHECK(udCrypto_SigPrecompute(pSigCtx));
 
   *ppSigCtx = pSigCtx;
   pSigCtx = nullptr;
   result = udR_Success;
 
 epilogue:
-  mbedtls_entropy_free(&entropy);
-  mbedtls_ctr_drbg_free(&ctr_drbg);
   udCryptoSig_Destroy(&pSigCtx);
 
   return result;
@@ -1473,6 +3114,7 @@ udResult udCryptoSig_ImportKeyPair(udCryptoSigContext **ppSigCtx, const char *pK
     default:
       UD_ERROR_SET(udR_InvalidConfiguration);
   }
+  UD_ERROR_CHECK(udCrypto_SigPrecompute(pSigCtx));
 
   *ppSigCtx = pSigCtx;
   pSigCtx = nullptr;
@@ -1483,6 +3125,79 @@ epilogue:
   return result;
 }
 
+// ---------------------------------------------------------------------------------------
+// Find a cached context for the key text and add a reference to it, must be called with the cache locked
+static udCryptoSigContext *udCrypto_FindCachedKey(const char *pKeyText, uint64_t keyHash)
+{
+  for (udCryptoSigContext *pSigCtx = s_pCachedKeys; pSigCtx; pSigCtx = pSigCtx->pNextCached)
+  {
+    if (pSigCtx->cachedKeyHash == keyHash && udStrEqual(pSigCtx->pCachedKeyText, pKeyText))
+    {
+      ++pSigCtx->cachedRefCount;
+      return pSigCtx;
+    }
+  }
+  return nullptr;
+}
+
+// ***************************************************************************************
+// Import a key once and share the context between every importer of the same key text
+udResult udCryptoSig_ImportVerifyKey(udCryptoSigContext **ppSigCtx, const char *pKeyText)
+{
+  udResult result;
+  udCryptoSigContext *pSigCtx = nullptr;
+  udCryptoSigContext *pExisting = nullptr;
+  uint64_t keyHash;
+
+  UD_ERROR_NULL(ppSigCtx, udR_InvalidParameter);
+  UD_ERROR_NULL(pKeyText, udR_InvalidParameter);
+  keyHash = udHash64(pKeyText, udStrlen(pKeyText));
+
+  udLockSpinLock(&s_udCryptoKeyCacheLock);
+  pExisting = udCrypto_FindCachedKey(pKeyText, keyHash);
+  udReleaseSpinLock(&s_udCryptoKeyCacheLock);
+  if (pExisting)
+  {
+    *ppSigCtx = pExisting;
+    return udR_Success;
+  }
+
+  // Parse outside the lock, then check again in case another thread imported the same key meanwhile
+  UD_ERROR_CHECK(udCryptoSig_ImportKeyPair(&pSigCtx, pKeyText));
+  pSigCtx->pCachedKeyText = udStrdup(pKeyText);
+  UD_ERROR_NULL(pSigCtx->pCachedKeyText, udR_MemoryAllocationFailure);
+  pSigCtx->cachedKeyHash = keyHash;
+  pSigCtx->cachedRefCount = 1;
+
+  udLockSpinLock(&s_udCryptoKeyCacheLock);
+  pExisting = udCrypto_FindCachedKey(pKeyText, keyHash);
+  if (!pExisting)
+  {
+    pSigCtx->pNextCached = s_pCachedKeys;
+    s_pCachedKeys = pSigCtx;
+  }
+  udReleaseSpinLock(&s_udCryptoKeyCacheLock);
+
+  if (pExisting)
+  {
+    *ppSigCtx = pExisting;
+  }
+  else
+  {
+    *ppSigCtx = pSigCtx;
+    pSigCtx = nullptr;
+  }
+  result = udR_Success;
+
+epilogue:
+  if (pSigCtx)
+  {
+    udFree(pSigCtx->pCachedKeyText); // Never made it into the cache, so destroy it as an ordinary context
+    udCryptoSig_Destroy(&pSigCtx);
+  }
+  return result;
+}
+
 // ***************************************************************************************
 // Author: Dave Pevreal, March 2018
 udResult udCryptoSig_ImportMSBlob(udCryptoSigContext **ppSigCtx, void *pBlob, size_t blobLen)
@@ -1528,6 +3243,7 @@ udResult udCryptoSig_ImportMSBlob(udCryptoSigContext **ppSigCtx, void *pBlob, si
     UD_ERROR_CHECK(FromLittleEndianBinary(&pSigCtx->rsa.D,  p, blobLen, pPriv->bitLen / 8));
     UD_ERROR_IF(mbedtls_rsa_check_privkey(&pSigCtx->rsa) != 0, udR_InternalCryptoError);
   }
+  UD_ERROR_CHECK(udCrypto_SigPrecompute(pSigCtx));
 
   *ppSigCtx = pSigCtx;
   pSigCtx = nullptr;
@@ -1543,53 +3259,58 @@ epilogue:
 udResult udCryptoSig_Sign(udCryptoSigContext *pSigCtx, const char *pHashBase64, const char **ppSignatureBase64, udCryptoHashes hashMethod, udCryptoSigPadScheme pad)
 {
   udResult result = udR_Failure;
-  unsigned char signature[udCST_RSA4096/8];
-  unsigned char hash[udCHL_MaxHashLength];
+  uint8_t signature[udCSL_MaxSignatureLength];
+  uint8_t hash[udCHL_MaxHashLength];
   size_t hashLen;
-  size_t sigLen = sizeof(signature);
-
-  mbedtls_entropy_context entropy = {};
-  mbedtls_ctr_drbg_context ctr_drbg = {};
+  size_t sigLen;
 
-  UD_ERROR_IF(hashMethod > udCH_Count, udR_InvalidParameter);
-  UD_ERROR_NULL(pSigCtx, udR_InvalidParameter);
   UD_ERROR_NULL(pHashBase64, udR_InvalidParameter);
   UD_ERROR_NULL(ppSignatureBase64, udR_InvalidParameter);
-  UD_ERROR_IF(!udCryptoSharedData::initialised, udR_NotInitialized);
 
-  mbedtls_ctr_drbg_init(&ctr_drbg);
-  mbedtls_entropy_init(&entropy);
+  UD_ERROR_CHECK(udBase64Decode(pHashBase64, 0, hash, sizeof(hash), &hashLen));
+  UD_ERROR_CHECK(udCryptoSig_SignRaw(pSigCtx, hash, hashLen, signature, sizeof(signature), &sigLen, hashMethod, pad));
+  UD_ERROR_CHECK(udBase64Encode(ppSignatureBase64, signature, sigLen));
 
-  // Seed the random number generator
-  UD_ERROR_IF(mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)__FUNCTION__, sizeof(__FUNCTION__)) != 0, udR_InternalCryptoError);
+epilogue:
+  return result;
+}
 
-  UD_ERROR_CHECK(udBase64Decode(pHashBase64, 0, hash, sizeof(hash), &hashLen));
+// ***************************************************************************************
+// Sign a raw digest, writing the raw signature to a caller supplied buffer
+udResult udCryptoSig_SignRaw(udCryptoSigContext *pSigCtx, const uint8_t *pHash, size_t hashLength, uint8_t *pSignature, size_t signatureLength, size_t *pSignatureLengthWritten, udCryptoHashes hashMethod, udCryptoSigPadScheme pad)
+{
+  udResult result = udR_Failure;
+  size_t sigLen = 0;
+
+  UD_ERROR_IF(hashMethod > udCH_Count, udR_InvalidParameter);
+  UD_ERROR_NULL(pSigCtx, udR_InvalidParameter);
+  UD_ERROR_NULL(pHash, udR_InvalidParameter);
+  UD_ERROR_NULL(pSignature, udR_InvalidParameter);
+  UD_ERROR_IF(!udCryptoSharedData::initialised, udR_NotInitialized);
 
   switch (pSigCtx->type)
   {
     case udCST_RSA1024:
     case udCST_RSA2048:
     case udCST_RSA4096:
-      if (pad == udCSPS_Deterministic)
-        mbedtls_rsa_set_padding(&pSigCtx->rsa, MBEDTLS_RSA_PKCS_V15, MBEDTLS_MD_NONE);
-      UD_ERROR_IF(sizeof(signature) < (size_t)(pSigCtx->type / 8), udR_InternalCryptoError);
-      UD_ERROR_IF(mbedtls_rsa_rsassa_pkcs1_v15_sign(&pSigCtx->rsa, mbedtls_ctr_drbg_random, &ctr_drbg, udc_to_mbed_hashfunctions[hashMethod], hashLen, hash, signature) != 0, udR_InternalCryptoError);
-      result = udBase64Encode(ppSignatureBase64, signature, pSigCtx->type / 8);
-      UD_ERROR_HANDLE();
+      udCrypto_SigSetPadding(pSigCtx, pad);
+      sigLen = pSigCtx->type / 8;
+      UD_ERROR_IF(signatureLength < sigLen, udR_BufferTooSmall);
+      UD_ERROR_IF(mbedtls_rsa_rsassa_pkcs1_v15_sign(&pSigCtx->rsa, udCrypto_RandomCallback, nullptr, udc_to_mbed_hashfunctions[hashMethod], (unsigned int)hashLength, pHash, pSignature) != 0, udR_InternalCryptoError);
       break;
     case udCST_ECPBP384:
-      UD_ERROR_IF(mbedtls_ecdsa_write_signature(&pSigCtx->ecdsa, udc_to_mbed_hashfunctions[hashMethod], hash, hashLen, signature, udLengthOf(signature), &sigLen, mbedtls_ctr_drbg_random, &ctr_drbg) != 0, udR_InternalCryptoError);
-      result = udBase64Encode(ppSignatureBase64, signature, sigLen);
-      UD_ERROR_HANDLE();
+      UD_ERROR_IF(signatureLength < MBEDTLS_ECDSA_MAX_SIG_LEN(udCST_ECPBP384), udR_BufferTooSmall);
+      UD_ERROR_IF(mbedtls_ecdsa_write_signature(&pSigCtx->ecdsa, udc_to_mbed_hashfunctions[hashMethod], pHash, hashLength, pSignature, signatureLength, &sigLen, udCrypto_RandomCallback, nullptr) != 0, udR_InternalCryptoError);
       break;
     default:
       UD_ERROR_SET(udR_InvalidConfiguration);
   }
 
-epilogue:
-  mbedtls_ctr_drbg_free(&ctr_drbg);
-  mbedtls_entropy_free(&entropy);
+  if (pSignatureLengthWritten)
+    *pSignatureLengthWritten = sigLen;
+  result = udR_Success;
 
+epilogue:
   return result;
 }
 
@@ -1598,38 +3319,148 @@ epilogue:
 udResult udCryptoSig_Verify(udCryptoSigContext *pSigCtx, const char *pHashBase64, const char *pSignatureBase64, udCryptoHashes hashMethod, udCryptoSigPadScheme pad)
 {
   udResult result = udR_Failure;
-  unsigned char signature[udCST_RSA4096 / 8];
-  unsigned char hash[udCHL_MaxHashLength];
+  uint8_t signature[udCSL_MaxSignatureLength];
+  uint8_t hash[udCHL_MaxHashLength];
   size_t hashLen;
   size_t sigLen;
 
-  UD_ERROR_IF(hashMethod > udCH_Count, udR_InvalidParameter);
-  UD_ERROR_NULL(pSigCtx, udR_InvalidParameter);
   UD_ERROR_NULL(pHashBase64, udR_InvalidParameter);
   UD_ERROR_NULL(pSignatureBase64, udR_InvalidParameter);
-  UD_ERROR_IF(!udCryptoSharedData::initialised, udR_NotInitialized);
 
   UD_ERROR_CHECK(udBase64Decode(pHashBase64, 0, hash, sizeof(hash), &hashLen));
+  UD_ERROR_CHECK(udBase64Decode(pSignatureBase64, 0, signature, sizeof(signature), &sigLen));
+  UD_ERROR_CHECK(udCryptoSig_VerifyRaw(pSigCtx, hash, hashLen, signature, sigLen, hashMethod, pad));
+
+epilogue:
+  return result;
+}
+
+// ***************************************************************************************
+// Verify a raw signature of a raw digest
+udResult udCryptoSig_VerifyRaw(udCryptoSigContext *pSigCtx, const uint8_t *pHash, size_t hashLength, const uint8_t *pSignature, size_t signatureLength, udCryptoHashes hashMethod, udCryptoSigPadScheme pad)
+{
+  udResult result = udR_Failure;
+
+  UD_ERROR_IF(hashMethod > udCH_Count, udR_InvalidParameter);
+  UD_ERROR_NULL(pSigCtx, udR_InvalidParameter);
+  UD_ERROR_NULL(pHash, udR_InvalidParameter);
+  UD_ERROR_NULL(pSignature, udR_InvalidParameter);
+  UD_ERROR_IF(!udCryptoSharedData::initialised, udR_NotInitialized);
 
   switch (pSigCtx->type)
   {
     case udCST_RSA1024:
     case udCST_RSA2048:
     case udCST_RSA4096:
-      if (pad == udCSPS_Deterministic)
-        mbedtls_rsa_set_padding(&pSigCtx->rsa, MBEDTLS_RSA_PKCS_V15, MBEDTLS_MD_NONE);
-      UD_ERROR_IF(sizeof(signature) < (size_t)(pSigCtx->type / 8), udR_InternalCryptoError);
-      UD_ERROR_CHECK(udBase64Decode(pSignatureBase64, 0, signature, sizeof(signature), &sigLen));
-      UD_ERROR_IF(mbedtls_rsa_rsassa_pkcs1_v15_verify(&pSigCtx->rsa, udc_to_mbed_hashfunctions[hashMethod], hashLen, hash, signature) != 0, udR_SignatureMismatch);
-      UD_ERROR_IF(sigLen != (size_t)(pSigCtx->type / 8), udR_InternalCryptoError);
+      udCrypto_SigSetPadding(pSigCtx, pad);
+      UD_ERROR_IF(signatureLength != (size_t)(pSigCtx->type / 8), udR_SignatureMismatch);
+      UD_ERROR_IF(mbedtls_rsa_rsassa_pkcs1_v15_verify(&pSigCtx->rsa, udc_to_mbed_hashfunctions[hashMethod], (unsigned int)hashLength, pHash, pSignature) != 0, udR_SignatureMismatch);
       break;
     case udCST_ECPBP384:
-      UD_ERROR_CHECK(udBase64Decode(pSignatureBase64, 0, signature, sizeof(signature), &sigLen));
-      UD_ERROR_IF(mbedtls_ecdsa_read_signature(&pSigCtx->ecdsa, hash, hashLen, signature, sigLen) != 0, udR_SignatureMismatch);
+      UD_ERROR_IF(mbedtls_ecdsa_read_signature(&pSigCtx->ecdsa, pHash, hashLength, pSignature, signatureLength) != 0, udR_SignatureMismatch);
       break;
     default:
       UD_ERROR_SET(udR_InvalidConfiguration);
   }
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+enum
+{
+  udCrypto_VerifyMinBandSize = 16, // Signatures verified by each thread of a batch at minimum
+};
+
+// A contiguous range of a batch verification, processed by one thread
+struct udCryptoVerifyBand
+{
+  udCryptoSigContext *pSigCtx;
+  bool copyKey; // RSA public operations lock the context, so bands on other threads verify with their own copy
+  udCryptoHashes hashMethod;
+  udCryptoSigPadScheme pad;
+  size_t hashLength;
+  const uint8_t *pHashes;
+  const uint8_t * const *ppSignatures;
+  const size_t *pSignatureLengths;
+  udResult *pResults;
+  size_t count;
+  size_t failures;
+};
+
+// ---------------------------------------------------------------------------------------
+static uint32_t udCrypto_VerifyBandThread(void *pData)
+{
+  udCryptoVerifyBand *pBand = (udCryptoVerifyBand*)pData;
+  udCryptoSigContext *pSigCtx = pBand->pSigCtx;
+  udCryptoSigContext copy;
+
+  if (pBand->copyKey)
+  {
+    memset(&copy, 0, sizeof(copy));
+    copy.type = pSigCtx->type;
+    mbedtls_rsa_init(&copy.rsa);
+    if (mbedtls_rsa_copy(&copy.rsa, &pSigCtx->rsa) == 0)
+      pSigCtx = &copy; // Otherwise fall back to sharing the original
+  }
+
+  for (size_t i = 0; i < pBand->count; ++i)
+  {
+    udResult result = udCryptoSig_VerifyRaw(pSigCtx, pBand->pHashes + i * pBand->hashLength, pBand->hashLength, pBand->ppSignatures[i], pBand->pSignatureLengths[i], pBand->hashMethod, pBand->pad);
+    if (pBand->pResults)
+      pBand->pResults[i] = result;
+    if (result != udR_Success)
+      ++pBand->failures;
+  }
+
+  if (pBand->copyKey)
+    mbedtls_rsa_free(&copy.rsa);
+  return 0;
+}
+
+// ***************************************************************************************
+// Verify many raw signatures against one key, spread across threads
+udResult udCryptoSig_VerifyMany(udCryptoSigContext *pSigCtx, udCryptoHashes hashMethod, size_t count, const uint8_t *pHashes, const uint8_t * const *ppSignatures,
+                                const size_t *pSignatureLengths, udResult *pResults, uint32_t threadCount, udCryptoSigPadScheme pad)
+{
+  udResult result;
+  udCryptoVerifyBand bands[udCrypto_CTRMaxThreads];
+  size_t hashLength = udCryptoHash_GetLength(hashMethod);
+  size_t bandCount;
+  size_t failures = 0;
+
+  UD_ERROR_NULL(pSigCtx, udR_InvalidParameter);
+  UD_ERROR_IF(hashLength == 0, udR_InvalidParameter);
+  UD_ERROR_IF(count && (!pHashes || !ppSignatures || !pSignatureLengths), udR_InvalidParameter);
+  UD_ERROR_IF(!udCryptoSharedData::initialised, udR_NotInitialized);
+  UD_ERROR_IF(count == 0, udR_Success);
+
+  if (threadCount == 0)
+    threadCount = (uint32_t)udGetHardwareThreadCount();
+  bandCount = std::min((size_t)std::min(threadCount, (uint32_t)udCrypto_CTRMaxThreads), count / udCrypto_VerifyMinBandSize);
+  bandCount = std::max(bandCount, (size_t)1);
+
+  for (size_t i = 0; i < bandCount; ++i)
+  {
+    size_t start = count * i / bandCount;
+    bands[i].pSigCtx = pSigCtx;
+    bands[i].copyKey = (i > 0 && pSigCtx->type != udCST_ECPBP384);
+    bands[i].hashMethod = hashMethod;
+    bands[i].pad = pad;
+    bands[i].hashLength = hashLength;
+    bands[i].pHashes = pHashes + start * hashLength;
+    bands[i].ppSignatures = ppSignatures + start;
+    bands[i].pSignatureLengths = pSignatureLengths + start;
+    bands[i].pResults = pResults ? pResults + start : nullptr;
+    bands[i].count = count * (i + 1) / bandCount - start;
+    bands[i].failures = 0;
+  }
+  udCrypto_RunBands(udCrypto_VerifyBandThread, bands, sizeof(bands[0]), bandCount);
+
+  for (size_t i = 0; i < bandCount; ++i)
+    failures += bands[i].failures;
+  result = failures ? udR_SignatureMismatch : udR_Success;
 
 epilogue:
   return result;
@@ -1645,6 +3476,28 @@ void udCryptoSig_Destroy(udCryptoSigContext **ppSigCtx)
     if (pSigCtx)
     {
       *ppSigCtx = nullptr;
+      if (pSigCtx->pCachedKeyText)
+      {
+        // Shared through the key cache, only destroyed when the last reference is released
+        bool lastReference = false;
+        udLockSpinLock(&s_udCryptoKeyCacheLock);
+        if (--pSigCtx->cachedRefCount == 0)
+        {
+          lastReference = true;
+          for (udCryptoSigContext **ppLink = &s_pCachedKeys; *ppLink; ppLink = &(*ppLink)->pNextCached)
+          {
+            if (*ppLink == pSigCtx)
+            {
+              *ppLink = pSigCtx->pNextCached;
+              break;
+            }
+          }
+        }
+        udReleaseSpinLock(&s_udCryptoKeyCacheLock);
+        if (!lastReference)
+          return;
+        udFree(pSigCtx->pCachedKeyText);
+      }
       switch (pSigCtx->type)
       {
         case udCST_RSA1024:
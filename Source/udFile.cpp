@@ -8,6 +8,7 @@
 #include "udPlatformUtil.h"
 #include "udStringUtil.h"
 #include "udCrypto.h"
+#include "udThread.h"
 
 #if UDPLATFORM_UWP
 # include <winrt/Windows.Storage.h>
@@ -17,14 +18,17 @@
 # include <pwd.h>
 #endif
 #include <algorithm>
+#include <atomic>
 
 #define MAX_HANDLERS 16
 #define CONTENT_LOAD_CHUNK_SIZE 65536 // When loading an entire file of unknown size, read in chunks of this many bytes
+#define TREEHASH_MAX_THREADS 64       // Maximum threads udFile_TreeHash will read and hash leaves with
 
 udFile_OpenHandlerFunc udFileHandler_FILEOpen;     // Default crt FILE based handler
 udFile_OpenHandlerFunc udFileHandler_RawOpen;      // Default raw handler
 udFile_OpenHandlerFunc udFileHandler_MiniZOpen;    // Default zip handler
 udFile_OpenHandlerFunc udFileHandler_DataOpen;     // Default data handler
+void udFileHandler_MiniZInvalidate(const char *pFilename); // Stop sharing a zip's cached central directory once it's written
 
 struct udFileHandler
 {
@@ -167,6 +171,8 @@ udResult udFile_Open(udFile **ppFile, const char *pFilename, udFileOpenFlags fla
       (*ppFile)->flagsCopy = flags;
       if (pFileLengthInBytes)
         *pFileLengthInBytes = (*ppFile)->fileLength;
+      if (flags & udFOF_Write)
+        udFileHandler_MiniZInvalidate(pFilename);
 
       // Successfully opened
       UD_ERROR_SET(udR_Success);
@@ -220,6 +226,9 @@ udResult udFile_SetEncryption(udFile *pFile, uint8_t *pKey, int keylen, uint64_t
 
   UD_ERROR_CHECK(udBase64Encode(&pKeyBase64, pKey, keylen));
   udCryptoCipher_Destroy(&pFile->pCipherCtx); // Just in case a key is already set
+  udFree(pFile->pAuthTags);
+  pFile->authTagCount = 0;
+  pFile->authBlockSize = 0;
   result = udCryptoCipher_Create(&pFile->pCipherCtx, keylen >= 32 ? udCC_AES256 : udCC_AES128, udCPM_None, pKeyBase64, udCCM_CTR);
   UD_ERROR_HANDLE();
   pFile->nonce = nonce;
@@ -232,6 +241,40 @@ epilogue:
   return result;
 }
 
+// ****************************************************************************
+// Set up GCM decryption with per-block tags
+udResult udFile_SetAuthenticatedEncryption(udFile *pFile, uint8_t *pKey, int keylen, uint64_t nonce, uint32_t blockSize, const udCryptoTag *pTags, size_t tagCount)
+{
+  udResult result;
+  const char *pKeyBase64 = nullptr;
+
+  UD_ERROR_IF(!pFile || !pKey || !pTags || !tagCount || !blockSize, udR_InvalidParameter);
+  UD_ERROR_IF(pFile->flagsCopy & udFOF_Write, udR_InvalidConfiguration);
+
+  UD_ERROR_CHECK(udBase64Encode(&pKeyBase64, pKey, keylen));
+  udCryptoCipher_Destroy(&pFile->pCipherCtx); // Just in case a key is already set
+  udFree(pFile->pAuthTags);
+  result = udCryptoCipher_Create(&pFile->pCipherCtx, keylen >= 32 ? udCC_AES256 : udCC_AES128, udCPM_None, pKeyBase64, udCCM_GCM);
+  UD_ERROR_HANDLE();
+  pFile->pAuthTags = (udCryptoTag*)udMemDup(pTags, sizeof(udCryptoTag) * tagCount, 0, udAF_None);
+  UD_ERROR_NULL(pFile->pAuthTags, udR_MemoryAllocationFailure);
+  pFile->authTagCount = tagCount;
+  pFile->authBlockSize = blockSize;
+  pFile->nonce = nonce;
+  pFile->counterOffset = 0;
+
+epilogue:
+  if (result)
+  {
+    udCryptoCipher_Destroy(&pFile->pCipherCtx); // Destroy if there were any errors
+    udFree(pFile->pAuthTags);
+    pFile->authTagCount = 0;
+    pFile->authBlockSize = 0;
+  }
+  udFree(pKeyBase64);
+  return result;
+}
+
 // ****************************************************************************
 // Author: Dave Pevreal, November 2014
 const char *udFile_GetFilename(udFile *pFile)
@@ -294,7 +337,32 @@ udResult udFile_Read(udFile *pFile, void *pBuffer, size_t bufferLength, int64_t
 
   ++pFile->requestsInFlight;
   pFile->msAccumulator -= udGetTimeMs();
-  if (pFile->pCipherCtx)
+  if (pFile->pCipherCtx && pFile->authBlockSize)
+  {
+    // Handle reading authenticated encrypted data, whole blocks are read so their tags can be verified
+    int64_t relativeOffset = offset - pFile->seekBase;
+    uint64_t firstBlock = (uint64_t)relativeOffset / pFile->authBlockSize;
+    uint64_t endBlock = std::min((uint64_t)(relativeOffset + bufferLength + pFile->authBlockSize - 1) / pFile->authBlockSize, (uint64_t)pFile->authTagCount);
+    size_t inset = (size_t)(relativeOffset - (int64_t)(firstBlock * pFile->authBlockSize));
+    size_t alignedLength = (endBlock > firstBlock) ? (size_t)(endBlock - firstBlock) * pFile->authBlockSize : 0;
+    size_t alignedActual = 0;
+    if (alignedLength)
+    {
+      if (inset || alignedLength != bufferLength)
+        pCipherText = udAlloc(alignedLength);
+      else
+        pCipherText = pBuffer;
+      UD_ERROR_NULL(pCipherText, udR_MemoryAllocationFailure);
+      result = pFile->fpRead(pFile, pCipherText, alignedLength, offset - inset, &alignedActual, nullptr); // Don't handle pipelined requests with encryption
+      UD_ERROR_HANDLE();
+      result = udCryptoCipher_DecryptBlocksGCM(pFile->pCipherCtx, pFile->nonce, firstBlock, pCipherText, pCipherText, alignedActual, pFile->authBlockSize, pFile->pAuthTags + firstBlock, 1);
+      UD_ERROR_HANDLE();
+    }
+    actualRead = std::min(bufferLength, (alignedActual > inset) ? alignedActual - inset : 0);
+    if (pCipherText != pBuffer && actualRead)
+      memcpy(pBuffer, udAddBytes(pCipherText, inset), actualRead);
+  }
+  else if (pFile->pCipherCtx)
   {
     // Handle reading encrypted data
     int inset = (int)offset & 15;
@@ -418,6 +486,121 @@ udResult udFile_BlockForPipelinedRequest(udFile *pFile, udFilePipelinedRequest *
   return result;
 }
 
+// ----------------------------------------------------------------------------
+// Shared by the threads of udFile_TreeHash, each thread claims the next unhashed leaf until none remain
+struct udFileTreeHashState
+{
+  udFile *pFile;
+  udCryptoHashes hash;
+  uint32_t leafSize;
+  int64_t fileLength;
+  size_t leafCount;
+  uint8_t *pLeafDigests;
+  std::atomic<size_t> nextLeaf;
+  std::atomic<int> result; // First failure, leaves stop being claimed once set
+  udSemaphore *pDone; // Incremented as each extra thread finishes
+};
+
+// ----------------------------------------------------------------------------
+static uint32_t udFile_TreeHashThread(void *pData)
+{
+  udFileTreeHashState *pState = (udFileTreeHashState*)pData;
+  udResult result = udR_Success;
+  size_t hashLength = udCryptoHash_GetLength(pState->hash);
+  uint8_t *pLeaf = udAllocType(uint8_t, pState->leafSize, udAF_None);
+  UD_ERROR_NULL(pLeaf, udR_MemoryAllocationFailure);
+
+  for (size_t leaf = pState->nextLeaf++; leaf < pState->leafCount && pState->result == udR_Success; leaf = pState->nextLeaf++)
+  {
+    int64_t offset = (int64_t)leaf * pState->leafSize;
+    size_t length = (size_t)std::min((int64_t)pState->leafSize, pState->fileLength - offset);
+    if (length)
+      UD_ERROR_CHECK(udFile_Read(pState->pFile, pLeaf, length, offset, udFSW_SeekSet));
+    UD_ERROR_CHECK(udCryptoHash_TreeLeaf(pState->hash, pLeaf, length, pState->pLeafDigests + leaf * hashLength));
+  }
+
+epilogue:
+  if (result != udR_Success)
+  {
+    int expected = udR_Success;
+    pState->result.compare_exchange_strong(expected, result);
+  }
+  udFree(pLeaf);
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+// Completion is signalled with a semaphore rather than joining, as a thread that finishes before udThread_Create
+// takes a reference parks itself in the udThread cache, where a join would wait out the cache timeout
+static uint32_t udFile_TreeHashExtraThread(void *pData)
+{
+  udFileTreeHashState *pState = (udFileTreeHashState*)pData;
+  udFile_TreeHashThread(pState);
+  udIncrementSemaphore(pState->pDone);
+  return 0;
+}
+
+// ****************************************************************************
+// Hash the file as a tree of leafSize leaves, hashing leaves on multiple threads
+udResult udFile_TreeHash(udFile *pFile, udCryptoHashes hash, uint32_t leafSize, uint8_t *pRootDigest, uint8_t **ppLeafDigests, size_t *pLeafCount, uint32_t threadCount)
+{
+  udResult result;
+  udFileTreeHashState state;
+  size_t hashLength = udCryptoHash_GetLength(hash);
+  uint32_t launched = 0;
+
+  state.pLeafDigests = nullptr;
+  state.pDone = nullptr;
+  UD_ERROR_IF(!pFile || !hashLength || !leafSize || !pRootDigest, udR_InvalidParameter);
+  UD_ERROR_IF(!pFile->fpRead || (pFile->flagsCopy & udFOF_FastOpen), udR_InvalidConfiguration); // Fast open files may not know their length
+
+  state.pFile = pFile;
+  state.hash = hash;
+  state.leafSize = leafSize;
+  state.fileLength = pFile->fileLength;
+  state.leafCount = std::max((size_t)((pFile->fileLength + leafSize - 1) / leafSize), (size_t)1); // An empty file is a single empty leaf
+  state.nextLeaf = 0;
+  state.result = udR_Success;
+  state.pLeafDigests = udAllocType(uint8_t, state.leafCount * hashLength, udAF_None);
+  UD_ERROR_NULL(state.pLeafDigests, udR_MemoryAllocationFailure);
+
+  // Reads from several threads are only safe when the file was opened for it
+  if (threadCount == 0)
+    threadCount = (uint32_t)udGetHardwareThreadCount();
+  if (!(pFile->flagsCopy & udFOF_Multithread))
+    threadCount = 1;
+  threadCount = (uint32_t)std::min((size_t)std::min(threadCount, (uint32_t)TREEHASH_MAX_THREADS), state.leafCount);
+
+  if (threadCount > 1)
+  {
+    state.pDone = udCreateSemaphore();
+    UD_ERROR_NULL(state.pDone, udR_MemoryAllocationFailure);
+  }
+  for (uint32_t i = 1; i < threadCount; ++i)
+  {
+    if (udThread_Create(nullptr, udFile_TreeHashExtraThread, &state, udTCF_None, "udFileTreeHash") == udR_Success)
+      ++launched; // Threads that fail to start leave their leaves to the others
+  }
+  udFile_TreeHashThread(&state);
+  while (launched--)
+    udWaitSemaphore(state.pDone);
+  UD_ERROR_CHECK((udResult)state.result.load());
+  UD_ERROR_CHECK(udCryptoHash_TreeRoot(hash, state.pLeafDigests, state.leafCount, pRootDigest));
+
+  if (pLeafCount)
+    *pLeafCount = state.leafCount;
+  if (ppLeafDigests)
+  {
+    *ppLeafDigests = state.pLeafDigests;
+    state.pLeafDigests = nullptr;
+  }
+
+epilogue:
+  udDestroySemaphore(&state.pDone);
+  udFree(state.pLeafDigests);
+  return result;
+}
+
 udResult udFile_Release(udFile *pFile)
 {
   udResult result;
@@ -452,11 +635,20 @@ udResult udFile_Close(udFile **ppFile)
 
   if (pFile && pFile->additionalRefCount-- <= 0) // Post-increment because the reference count is _additional_ references
   {
+    // A zip opened again while this was being written may have cached a partially written central directory
+    const char *pWrittenFilename = (pFile->flagsCopy & udFOF_Write) ? udStrdup(pFile->pFilenameCopy) : nullptr;
     if (pFile->filenameCopyRequiresFree)
       udFree(pFile->pFilenameCopy);
     if (pFile->pCipherCtx)
       udCryptoCipher_Destroy(&pFile->pCipherCtx);
-    return pFile->fpClose(&pFile);
+    udFree(pFile->pAuthTags);
+    udResult result = pFile->fpClose(&pFile);
+    if (pWrittenFilename)
+    {
+      udFileHandler_MiniZInvalidate(pWrittenFilename);
+      udFree(pWrittenFilename);
+    }
+    return result;
   }
   return udR_Success; // Already closed, no error condition
 }
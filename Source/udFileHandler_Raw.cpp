@@ -19,6 +19,8 @@ static udFile_CloseHandlerFunc      udFileHandler_RawClose;
 struct udFile_Raw : public udFile
 {
   const char *pOriginalFilename;  // Copy of "original" filename, generally a human-readable name rather than base64
+  const char *pBase64;            // When not null, reads decode directly from this text in the filename rather than from pData
+  size_t base64Len;
   uint8_t *pData;
   int64_t fp;
   size_t dataLen;
@@ -179,6 +181,37 @@ bool udFile_IsRaw(const char *pFilename, size_t *pOffsetToBase64, const char **p
   return true;
 }
 
+// ----------------------------------------------------------------------------
+// Uncompressed files opened with udFOF_FastOpen (as udFile_Load does) are decoded straight from the filename as they are read,
+// avoiding a copy of the whole file. This needs the position of each byte in the text to be known, so only applies
+// when nothing but trailing padding is skipped
+static udResult udFileHandler_RawDecodeOnRead(udFile_Raw *pRaw, const char *pBase64, udFileOpenFlags flags)
+{
+  udResult result;
+  udBase64Decoder decoder;
+  size_t base64Len = udStrlen(pBase64);
+  size_t paddingCount = 0;
+  size_t dataLen;
+
+  if (!(flags & udFOF_FastOpen) || (flags & (udFOF_Write | udFOF_Create)))
+    UD_ERROR_SET(udR_Success);
+
+  while (paddingCount < base64Len && pBase64[base64Len - paddingCount - 1] == '=')
+    ++paddingCount;
+  udBase64Decoder_Init(&decoder);
+  UD_ERROR_CHECK(udBase64Decoder_Update(&decoder, pBase64, base64Len, nullptr, 0, nullptr, &dataLen));
+  if (decoder.skippedCount == paddingCount)
+  {
+    pRaw->pBase64 = pBase64;
+    pRaw->base64Len = base64Len;
+    pRaw->dataLen = dataLen;
+  }
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
 // ----------------------------------------------------------------------------
 // Author: Dave Pevreal, March 2014
 // Implementation of OpenHandler to access the crt Raw i/o functions
@@ -219,7 +252,9 @@ udResult udFileHandler_RawOpen(udFile **ppFile, const char *pFilename, udFileOpe
     }
     else
     {
-      UD_ERROR_CHECK(udBase64Decode(&pRaw->pData, &pRaw->dataLen, pFilename + offsetToBase64));
+      UD_ERROR_CHECK(udFileHandler_RawDecodeOnRead(pRaw, pFilename + offsetToBase64, flags));
+      if (!pRaw->pBase64)
+        UD_ERROR_CHECK(udBase64Decode(&pRaw->pData, &pRaw->dataLen, pFilename + offsetToBase64));
     }
   }
   // If a create is specified, ensure the existing file is discarded
@@ -255,7 +290,32 @@ static udResult udFileHandler_RawSeekRead(udFile *pFile, void *pBuffer, size_t b
 
   UD_ERROR_IF(seekOffset < 0 || seekOffset >= (int64_t)pRaw->dataLen, udR_InvalidParameter);
   actualRead = std::min(bufferLength, pRaw->dataLen - (size_t)seekOffset);
-  memcpy(pBuffer, pRaw->pData + seekOffset, actualRead);
+  if (pRaw->pBase64)
+  {
+    // Every 4 characters decode to 3 bytes, so decode from the start of the group containing seekOffset
+    udBase64Decoder decoder;
+    size_t textOffset = (size_t)seekOffset / 3 * 4;
+    size_t groupOffset = (size_t)seekOffset % 3;
+    size_t copied = 0;
+
+    udBase64Decoder_Init(&decoder);
+    if (groupOffset)
+    {
+      uint8_t group[3];
+      size_t groupLength;
+      size_t textLength = std::min(pRaw->base64Len - textOffset, (size_t)4);
+      UD_ERROR_CHECK(udBase64Decoder_Update(&decoder, pRaw->pBase64 + textOffset, textLength, group, sizeof(group), nullptr, &groupLength));
+      copied = std::min(groupLength - groupOffset, actualRead);
+      memcpy(pBuffer, group + groupOffset, copied);
+      textOffset += textLength;
+    }
+    if (copied < actualRead)
+      UD_ERROR_CHECK(udBase64Decoder_Update(&decoder, pRaw->pBase64 + textOffset, pRaw->base64Len - textOffset, (uint8_t*)pBuffer + copied, actualRead - copied));
+  }
+  else
+  {
+    memcpy(pBuffer, pRaw->pData + seekOffset, actualRead);
+  }
 
   if (pActualRead)
     *pActualRead = actualRead;
@@ -0,0 +1,673 @@
+#include "udPlatformUtil.h"
+
+// An implementation of XXH3 for little-endian targets (https://github.com/Cyan4973/xxHash), results are identical to XXH3_64bits_withSeed and XXH3_128bits_withSeed.
+// Inputs up to 240 bytes take dedicated scalar paths, longer inputs are accumulated in 64 byte stripes by the SIMD kernels.
+
+#if defined(__x86_64__) || defined(_M_X64)
+# define UDHASH_SSE2 1
+# include <immintrin.h>
+# if defined(__GNUC__)
+#  define UDHASH_TARGET_AVX2 __attribute__((target("avx2")))
+# else
+#  define UDHASH_TARGET_AVX2
+# endif
+#else
+# define UDHASH_SSE2 0
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+# define UDHASH_NEON 1
+# if defined(_M_ARM64)
+#  include <arm64_neon.h>
+# else
+#  include <arm_neon.h>
+# endif
+#else
+# define UDHASH_NEON 0
+#endif
+
+#if UDPLATFORM_WINDOWS && !UD_32BIT && !defined(_M_ARM64)
+# include <intrin.h>
+#endif
+
+enum
+{
+  udHash_StripeLength = 64,       // Bytes accumulated at a time by the long hash
+  udHash_SecretConsumeRate = 8,   // Secret bytes advanced per stripe
+  udHash_SecretSize = 192,
+  udHash_SecretSizeMin = 136,
+  udHash_MidSizeMax = 240,        // Longest input hashed without the accumulators
+  udHash_MidSizeStartOffset = 3,
+  udHash_MidSizeLastOffset = 17,
+  udHash_SecretLastAccStart = 7,
+  udHash_SecretMergeAccsStart = 11,
+  udHash_StripesPerBlock = (udHash_SecretSize - udHash_StripeLength) / udHash_SecretConsumeRate,
+  udHash_BufferStripes = sizeof(((udHashState*)nullptr)->buffer) / udHash_StripeLength,
+};
+
+static const uint32_t udHash_Prime32_1 = 0x9E3779B1U;
+static const uint32_t udHash_Prime32_2 = 0x85EBCA77U;
+static const uint32_t udHash_Prime32_3 = 0xC2B2AE3DU;
+static const uint64_t udHash_Prime64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t udHash_Prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t udHash_Prime64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t udHash_Prime64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t udHash_Prime64_5 = 0x27D4EB2F165667C5ULL;
+static const uint64_t udHash_PrimeMx1 = 0x165667919E3779F9ULL;
+static const uint64_t udHash_PrimeMx2 = 0x9FB21C651E98DF25ULL;
+
+static const uint8_t udHash_DefaultSecret[udHash_SecretSize] =
+{
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+  0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+  0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+  0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+  0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+typedef void udHashAccumulateFunc(uint64_t acc[8], const uint8_t *pInput, const uint8_t *pSecret, size_t stripeCount);
+typedef void udHashScrambleFunc(uint64_t acc[8], const uint8_t *pSecret);
+
+// ----------------------------------------------------------------------------
+static inline uint32_t udHash_Read32(const uint8_t *pBytes)
+{
+  uint32_t value;
+  memcpy(&value, pBytes, sizeof(value));
+  return value;
+}
+
+// ----------------------------------------------------------------------------
+static inline uint64_t udHash_Read64(const uint8_t *pBytes)
+{
+  uint64_t value;
+  memcpy(&value, pBytes, sizeof(value));
+  return value;
+}
+
+// ----------------------------------------------------------------------------
+static inline void udHash_Write64(uint8_t *pBytes, uint64_t value)
+{
+  memcpy(pBytes, &value, sizeof(value));
+}
+
+// ----------------------------------------------------------------------------
+static inline uint32_t udHash_Swap32(uint32_t x)
+{
+  return ((x << 24) & 0xff000000) | ((x << 8) & 0x00ff0000) | ((x >> 8) & 0x0000ff00) | ((x >> 24) & 0x000000ff);
+}
+
+// ----------------------------------------------------------------------------
+static inline uint64_t udHash_Swap64(uint64_t x)
+{
+  return ((uint64_t)udHash_Swap32((uint32_t)x) << 32) | udHash_Swap32((uint32_t)(x >> 32));
+}
+
+// ----------------------------------------------------------------------------
+static inline uint32_t udHash_Rotl32(uint32_t x, int bits) { return (x << bits) | (x >> (32 - bits)); }
+static inline uint64_t udHash_Rotl64(uint64_t x, int bits) { return (x << bits) | (x >> (64 - bits)); }
+static inline uint64_t udHash_XorShift64(uint64_t x, int shift) { return x ^ (x >> shift); }
+
+// ----------------------------------------------------------------------------
+// Full 64x64 -> 128 bit multiply
+static inline udHash128Value udHash_Multiply128(uint64_t lhs, uint64_t rhs)
+{
+  udHash128Value result;
+#if defined(__SIZEOF_INT128__)
+  __uint128_t product = (__uint128_t)lhs * rhs;
+  result.low64 = (uint64_t)product;
+  result.high64 = (uint64_t)(product >> 64);
+#elif UDPLATFORM_WINDOWS && !UD_32BIT && !defined(_M_ARM64)
+  result.low64 = _umul128(lhs, rhs, &result.high64);
+#else
+  uint64_t loLo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+  uint64_t hiLo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+  uint64_t loHi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+  uint64_t hiHi = (lhs >> 32) * (rhs >> 32);
+  uint64_t cross = (loLo >> 32) + (hiLo & 0xFFFFFFFF) + loHi;
+  result.high64 = (hiLo >> 32) + (cross >> 32) + hiHi;
+  result.low64 = (cross << 32) | (loLo & 0xFFFFFFFF);
+#endif
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+static inline uint64_t udHash_MultiplyFold64(uint64_t lhs, uint64_t rhs)
+{
+  udHash128Value product = udHash_Multiply128(lhs, rhs);
+  return product.low64 ^ product.high64;
+}
+
+// ----------------------------------------------------------------------------
+static inline uint64_t udHash_Avalanche64(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= udHash_Prime64_2;
+  h ^= h >> 29;
+  h *= udHash_Prime64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+// ----------------------------------------------------------------------------
+static inline uint64_t udHash_Avalanche(uint64_t h)
+{
+  h = udHash_XorShift64(h, 37);
+  h *= udHash_PrimeMx1;
+  return udHash_XorShift64(h, 32);
+}
+
+// ----------------------------------------------------------------------------
+static inline uint64_t udHash_RRMXMX(uint64_t h, uint64_t length)
+{
+  h ^= udHash_Rotl64(h, 49) ^ udHash_Rotl64(h, 24);
+  h *= udHash_PrimeMx2;
+  h ^= (h >> 35) + length;
+  h *= udHash_PrimeMx2;
+  return udHash_XorShift64(h, 28);
+}
+
+// ----------------------------------------------------------------------------
+static inline uint64_t udHash_Mix16(const uint8_t *pInput, const uint8_t *pSecret, uint64_t seed)
+{
+  return udHash_MultiplyFold64(udHash_Read64(pInput) ^ (udHash_Read64(pSecret) + seed), udHash_Read64(pInput + 8) ^ (udHash_Read64(pSecret + 8) - seed));
+}
+
+// ----------------------------------------------------------------------------
+static inline udHash128Value udHash_Mix32(udHash128Value acc, const uint8_t *pInput1, const uint8_t *pInput2, const uint8_t *pSecret, uint64_t seed)
+{
+  acc.low64 += udHash_Mix16(pInput1, pSecret, seed);
+  acc.low64 ^= udHash_Read64(pInput2) + udHash_Read64(pInput2 + 8);
+  acc.high64 += udHash_Mix16(pInput2, pSecret + 16, seed);
+  acc.high64 ^= udHash_Read64(pInput1) + udHash_Read64(pInput1 + 8);
+  return acc;
+}
+
+// ----------------------------------------------------------------------------
+static uint64_t udHash_Short64(const uint8_t *pInput, size_t length, const uint8_t *pSecret, uint64_t seed)
+{
+  if (length > 8)
+  {
+    uint64_t inputLow = udHash_Read64(pInput) ^ ((udHash_Read64(pSecret + 24) ^ udHash_Read64(pSecret + 32)) + seed);
+    uint64_t inputHigh = udHash_Read64(pInput + length - 8) ^ ((udHash_Read64(pSecret + 40) ^ udHash_Read64(pSecret + 48)) - seed);
+    return udHash_Avalanche(length + udHash_Swap64(inputLow) + inputHigh + udHash_MultiplyFold64(inputLow, inputHigh));
+  }
+  if (length >= 4)
+  {
+    seed ^= (uint64_t)udHash_Swap32((uint32_t)seed) << 32;
+    uint64_t input64 = udHash_Read32(pInput + length - 4) + ((uint64_t)udHash_Read32(pInput) << 32);
+    return udHash_RRMXMX(input64 ^ ((udHash_Read64(pSecret + 8) ^ udHash_Read64(pSecret + 16)) - seed), length);
+  }
+  if (length)
+  {
+    uint32_t combined = ((uint32_t)pInput[0] << 16) | ((uint32_t)pInput[length >> 1] << 24) | (uint32_t)pInput[length - 1] | ((uint32_t)length << 8);
+    return udHash_Avalanche64((uint64_t)combined ^ ((udHash_Read32(pSecret) ^ udHash_Read32(pSecret + 4)) + seed));
+  }
+  return udHash_Avalanche64(seed ^ (udHash_Read64(pSecret + 56) ^ udHash_Read64(pSecret + 64)));
+}
+
+// ----------------------------------------------------------------------------
+static udHash128Value udHash_Short128(const uint8_t *pInput, size_t length, const uint8_t *pSecret, uint64_t seed)
+{
+  udHash128Value h;
+  if (length > 8)
+  {
+    uint64_t inputLow = udHash_Read64(pInput);
+    uint64_t inputHigh = udHash_Read64(pInput + length - 8);
+    udHash128Value m = udHash_Multiply128(inputLow ^ inputHigh ^ ((udHash_Read64(pSecret + 32) ^ udHash_Read64(pSecret + 40)) - seed), udHash_Prime64_1);
+    m.low64 += (uint64_t)(length - 1) << 54;
+    inputHigh ^= (udHash_Read64(pSecret + 48) ^ udHash_Read64(pSecret + 56)) + seed;
+    m.high64 += inputHigh + (uint64_t)(uint32_t)inputHigh * (udHash_Prime32_2 - 1);
+    m.low64 ^= udHash_Swap64(m.high64);
+    h = udHash_Multiply128(m.low64, udHash_Prime64_2);
+    h.high64 += m.high64 * udHash_Prime64_2;
+    h.low64 = udHash_Avalanche(h.low64);
+    h.high64 = udHash_Avalanche(h.high64);
+  }
+  else if (length >= 4)
+  {
+    seed ^= (uint64_t)udHash_Swap32((uint32_t)seed) << 32;
+    uint64_t input64 = udHash_Read32(pInput) + ((uint64_t)udHash_Read32(pInput + length - 4) << 32);
+    uint64_t keyed = input64 ^ ((udHash_Read64(pSecret + 16) ^ udHash_Read64(pSecret + 24)) + seed);
+    h = udHash_Multiply128(keyed, udHash_Prime64_1 + (length << 2));
+    h.high64 += h.low64 << 1;
+    h.low64 ^= h.high64 >> 3;
+    h.low64 = udHash_XorShift64(h.low64, 35);
+    h.low64 *= udHash_PrimeMx2;
+    h.low64 = udHash_XorShift64(h.low64, 28);
+    h.high64 = udHash_Avalanche(h.high64);
+  }
+  else if (length)
+  {
+    uint32_t combinedLow = ((uint32_t)pInput[0] << 16) | ((uint32_t)pInput[length >> 1] << 24) | (uint32_t)pInput[length - 1] | ((uint32_t)length << 8);
+    uint32_t combinedHigh = udHash_Rotl32(udHash_Swap32(combinedLow), 13);
+    h.low64 = udHash_Avalanche64((uint64_t)combinedLow ^ ((udHash_Read32(pSecret) ^ udHash_Read32(pSecret + 4)) + seed));
+    h.high64 = udHash_Avalanche64((uint64_t)combinedHigh ^ ((udHash_Read32(pSecret + 8) ^ udHash_Read32(pSecret + 12)) - seed));
+  }
+  else
+  {
+    h.low64 = udHash_Avalanche64(seed ^ udHash_Read64(pSecret + 64) ^ udHash_Read64(pSecret + 72));
+    h.high64 = udHash_Avalanche64(seed ^ udHash_Read64(pSecret + 80) ^ udHash_Read64(pSecret + 88));
+  }
+  return h;
+}
+
+// ----------------------------------------------------------------------------
+static uint64_t udHash_Mid64(const uint8_t *pInput, size_t length, const uint8_t *pSecret, uint64_t seed)
+{
+  uint64_t acc = length * udHash_Prime64_1;
+  if (length <= 128)
+  {
+    // Pairs of 16 bytes are taken from each end, working inwards
+    for (size_t i = 0; i < (length + 31) / 32; ++i)
+    {
+      acc += udHash_Mix16(pInput + 16 * i, pSecret + 32 * i, seed);
+      acc += udHash_Mix16(pInput + length - 16 * (i + 1), pSecret + 32 * i + 16, seed);
+    }
+    return udHash_Avalanche(acc);
+  }
+
+  size_t roundCount = length / 16;
+  for (size_t i = 0; i < 8; ++i)
+    acc += udHash_Mix16(pInput + 16 * i, pSecret + 16 * i, seed);
+  uint64_t accEnd = udHash_Mix16(pInput + length - 16, pSecret + udHash_SecretSizeMin - udHash_MidSizeLastOffset, seed);
+  acc = udHash_Avalanche(acc);
+  for (size_t i = 8; i < roundCount; ++i)
+    accEnd += udHash_Mix16(pInput + 16 * i, pSecret + 16 * (i - 8) + udHash_MidSizeStartOffset, seed);
+  return udHash_Avalanche(acc + accEnd);
+}
+
+// ----------------------------------------------------------------------------
+static udHash128Value udHash_Mid128(const uint8_t *pInput, size_t length, const uint8_t *pSecret, uint64_t seed)
+{
+  udHash128Value acc = { length * udHash_Prime64_1, 0 };
+  if (length <= 128)
+  {
+    for (size_t i = (length - 1) / 32 + 1; i-- > 0;)
+      acc = udHash_Mix32(acc, pInput + 16 * i, pInput + length - 16 * (i + 1), pSecret + 32 * i, seed);
+  }
+  else
+  {
+    for (size_t i = 32; i < 160; i += 32)
+      acc = udHash_Mix32(acc, pInput + i - 32, pInput + i - 16, pSecret + i - 32, seed);
+    acc.low64 = udHash_Avalanche(acc.low64);
+    acc.high64 = udHash_Avalanche(acc.high64);
+    for (size_t i = 160; i <= length; i += 32)
+      acc = udHash_Mix32(acc, pInput + i - 32, pInput + i - 16, pSecret + udHash_MidSizeStartOffset + i - 160, seed);
+    acc = udHash_Mix32(acc, pInput + length - 16, pInput + length - 32, pSecret + udHash_SecretSizeMin - udHash_MidSizeLastOffset - 16, 0 - seed);
+  }
+
+  udHash128Value h;
+  h.low64 = udHash_Avalanche(acc.low64 + acc.high64);
+  h.high64 = 0 - udHash_Avalanche((acc.low64 * udHash_Prime64_1) + (acc.high64 * udHash_Prime64_4) + ((length - seed) * udHash_Prime64_2));
+  return h;
+}
+
+#if !UDHASH_SSE2 && !UDHASH_NEON
+// ----------------------------------------------------------------------------
+static void udHash_AccumulateScalar(uint64_t acc[8], const uint8_t *pInput, const uint8_t *pSecret, size_t stripeCount)
+{
+  for (size_t n = 0; n < stripeCount; ++n, pInput += udHash_StripeLength, pSecret += udHash_SecretConsumeRate)
+  {
+    for (size_t lane = 0; lane < 8; ++lane)
+    {
+      uint64_t data = udHash_Read64(pInput + lane * 8);
+      uint64_t dataKey = data ^ udHash_Read64(pSecret + lane * 8);
+      acc[lane ^ 1] += data;
+      acc[lane] += (dataKey & 0xFFFFFFFF) * (dataKey >> 32);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+static void udHash_ScrambleScalar(uint64_t acc[8], const uint8_t *pSecret)
+{
+  for (size_t lane = 0; lane < 8; ++lane)
+    acc[lane] = (udHash_XorShift64(acc[lane], 47) ^ udHash_Read64(pSecret + lane * 8)) * udHash_Prime32_1;
+}
+#endif
+
+#if UDHASH_SSE2
+// ----------------------------------------------------------------------------
+static void udHash_AccumulateSSE2(uint64_t acc[8], const uint8_t *pInput, const uint8_t *pSecret, size_t stripeCount)
+{
+  __m128i a[4];
+  for (int i = 0; i < 4; ++i)
+    a[i] = _mm_loadu_si128((const __m128i*)acc + i);
+
+  for (size_t n = 0; n < stripeCount; ++n, pInput += udHash_StripeLength, pSecret += udHash_SecretConsumeRate)
+  {
+    for (int i = 0; i < 4; ++i)
+    {
+      __m128i data = _mm_loadu_si128((const __m128i*)pInput + i);
+      __m128i dataKey = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*)pSecret + i));
+      __m128i product = _mm_mul_epu32(dataKey, _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1)));
+      a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+  }
+
+  for (int i = 0; i < 4; ++i)
+    _mm_storeu_si128((__m128i*)acc + i, a[i]);
+}
+
+// ----------------------------------------------------------------------------
+static void udHash_ScrambleSSE2(uint64_t acc[8], const uint8_t *pSecret)
+{
+  const __m128i prime = _mm_set1_epi32((int)udHash_Prime32_1);
+  for (int i = 0; i < 4; ++i)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i*)acc + i);
+    __m128i dataKey = _mm_xor_si128(_mm_xor_si128(a, _mm_srli_epi64(a, 47)), _mm_loadu_si128((const __m128i*)pSecret + i));
+    __m128i productLow = _mm_mul_epu32(dataKey, prime);
+    __m128i productHigh = _mm_mul_epu32(_mm_srli_epi64(dataKey, 32), prime);
+    _mm_storeu_si128((__m128i*)acc + i, _mm_add_epi64(productLow, _mm_slli_epi64(productHigh, 32)));
+  }
+}
+
+// ----------------------------------------------------------------------------
+UDHASH_TARGET_AVX2
+static void udHash_AccumulateAVX2(uint64_t acc[8], const uint8_t *pInput, const uint8_t *pSecret, size_t stripeCount)
+{
+  __m256i a0 = _mm256_loadu_si256((const __m256i*)acc);
+  __m256i a1 = _mm256_loadu_si256((const __m256i*)acc + 1);
+
+  for (size_t n = 0; n < stripeCount; ++n, pInput += udHash_StripeLength, pSecret += udHash_SecretConsumeRate)
+  {
+    __m256i data0 = _mm256_loadu_si256((const __m256i*)pInput);
+    __m256i data1 = _mm256_loadu_si256((const __m256i*)pInput + 1);
+    __m256i dataKey0 = _mm256_xor_si256(data0, _mm256_loadu_si256((const __m256i*)pSecret));
+    __m256i dataKey1 = _mm256_xor_si256(data1, _mm256_loadu_si256((const __m256i*)pSecret + 1));
+    __m256i product0 = _mm256_mul_epu32(dataKey0, _mm256_srli_epi64(dataKey0, 32));
+    __m256i product1 = _mm256_mul_epu32(dataKey1, _mm256_srli_epi64(dataKey1, 32));
+    a0 = _mm256_add_epi64(a0, _mm256_add_epi64(product0, _mm256_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2))));
+    a1 = _mm256_add_epi64(a1, _mm256_add_epi64(product1, _mm256_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2))));
+  }
+
+  _mm256_storeu_si256((__m256i*)acc, a0);
+  _mm256_storeu_si256((__m256i*)acc + 1, a1);
+}
+#endif // UDHASH_SSE2
+
+#if UDHASH_NEON
+// ----------------------------------------------------------------------------
+static void udHash_AccumulateNEON(uint64_t acc[8], const uint8_t *pInput, const uint8_t *pSecret, size_t stripeCount)
+{
+  uint64x2_t a[4];
+  for (int i = 0; i < 4; ++i)
+    a[i] = vld1q_u64(acc + i * 2);
+
+  for (size_t n = 0; n < stripeCount; ++n, pInput += udHash_StripeLength, pSecret += udHash_SecretConsumeRate)
+  {
+    for (int i = 0; i < 4; ++i)
+    {
+      uint64x2_t data = vreinterpretq_u64_u8(vld1q_u8(pInput + i * 16));
+      uint64x2_t dataKey = veorq_u64(data, vreinterpretq_u64_u8(vld1q_u8(pSecret + i * 16)));
+      uint64x2_t product = vmull_u32(vmovn_u64(dataKey), vshrn_n_u64(dataKey, 32));
+      a[i] = vaddq_u64(a[i], vaddq_u64(product, vextq_u64(data, data, 1)));
+    }
+  }
+
+  for (int i = 0; i < 4; ++i)
+    vst1q_u64(acc + i * 2, a[i]);
+}
+
+// ----------------------------------------------------------------------------
+static void udHash_ScrambleNEON(uint64_t acc[8], const uint8_t *pSecret)
+{
+  const uint32x2_t prime = vdup_n_u32(udHash_Prime32_1);
+  for (int i = 0; i < 4; ++i)
+  {
+    uint64x2_t a = vld1q_u64(acc + i * 2);
+    uint64x2_t dataKey = veorq_u64(veorq_u64(a, vshrq_n_u64(a, 47)), vreinterpretq_u64_u8(vld1q_u8(pSecret + i * 16)));
+    uint64x2_t productLow = vmull_u32(vmovn_u64(dataKey), prime);
+    uint64x2_t productHigh = vmull_u32(vshrn_n_u64(dataKey, 32), prime);
+    vst1q_u64(acc + i * 2, vaddq_u64(productLow, vshlq_n_u64(productHigh, 32)));
+  }
+}
+#endif // UDHASH_NEON
+
+struct udHashKernels
+{
+  udHashAccumulateFunc *pAccumulate;
+  udHashScrambleFunc *pScramble;
+};
+
+// ----------------------------------------------------------------------------
+// Choose the widest kernels the CPU supports, SSE2 and NEON are always present on their architectures
+static const udHashKernels &udHash_GetKernels()
+{
+  static const udHashKernels kernels =
+#if UDHASH_SSE2
+    { udCPUSupportsAVX2() ? udHash_AccumulateAVX2 : udHash_AccumulateSSE2, udHash_ScrambleSSE2 };
+#elif UDHASH_NEON
+    { udHash_AccumulateNEON, udHash_ScrambleNEON };
+#else
+    { udHash_AccumulateScalar, udHash_ScrambleScalar };
+#endif
+  return kernels;
+}
+
+// ----------------------------------------------------------------------------
+// Accumulates stripes starting stripesSoFar stripes into the current block, scrambling at the end of each block
+static void udHash_ConsumeStripes(uint64_t acc[8], uint32_t *pStripesSoFar, const uint8_t *pInput, size_t stripeCount, const uint8_t *pSecret)
+{
+  const udHashKernels &kernels = udHash_GetKernels();
+  while (stripeCount)
+  {
+    size_t stripes = udHash_StripesPerBlock - *pStripesSoFar;
+    if (stripes > stripeCount)
+      stripes = stripeCount;
+    kernels.pAccumulate(acc, pInput, pSecret + *pStripesSoFar * udHash_SecretConsumeRate, stripes);
+    pInput += stripes * udHash_StripeLength;
+    stripeCount -= stripes;
+    *pStripesSoFar += (uint32_t)stripes;
+    if (*pStripesSoFar == udHash_StripesPerBlock)
+    {
+      kernels.pScramble(acc, pSecret + udHash_SecretSize - udHash_StripeLength);
+      *pStripesSoFar = 0;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+static void udHash_InitAccumulators(uint64_t acc[8])
+{
+  acc[0] = udHash_Prime32_3;
+  acc[1] = udHash_Prime64_1;
+  acc[2] = udHash_Prime64_2;
+  acc[3] = udHash_Prime64_3;
+  acc[4] = udHash_Prime64_4;
+  acc[5] = udHash_Prime32_2;
+  acc[6] = udHash_Prime64_5;
+  acc[7] = udHash_Prime32_1;
+}
+
+// ----------------------------------------------------------------------------
+// Long inputs with a non-zero seed use a secret derived from the seed
+static void udHash_InitSecret(uint8_t pSecret[udHash_SecretSize], uint64_t seed)
+{
+  for (int i = 0; i < udHash_SecretSize; i += 16)
+  {
+    udHash_Write64(pSecret + i, udHash_Read64(udHash_DefaultSecret + i) + seed);
+    udHash_Write64(pSecret + i + 8, udHash_Read64(udHash_DefaultSecret + i + 8) - seed);
+  }
+}
+
+// ----------------------------------------------------------------------------
+static uint64_t udHash_MergeAccumulators(const uint64_t acc[8], const uint8_t *pSecret, uint64_t start)
+{
+  for (int i = 0; i < 4; ++i)
+    start += udHash_MultiplyFold64(acc[2 * i] ^ udHash_Read64(pSecret + 16 * i), acc[2 * i + 1] ^ udHash_Read64(pSecret + 16 * i + 8));
+  return udHash_Avalanche(start);
+}
+
+// ----------------------------------------------------------------------------
+// Runs the accumulators over an input longer than udHash_MidSizeMax, the final (possibly overlapping) stripe uses an offset secret
+static void udHash_Long(uint64_t acc[8], const uint8_t *pInput, size_t length, const uint8_t *pSecret)
+{
+  uint32_t stripesSoFar = 0;
+  udHash_InitAccumulators(acc);
+  udHash_ConsumeStripes(acc, &stripesSoFar, pInput, (length - 1) / udHash_StripeLength, pSecret);
+  udHash_GetKernels().pAccumulate(acc, pInput + length - udHash_StripeLength, pSecret + udHash_SecretSize - udHash_StripeLength - udHash_SecretLastAccStart, 1);
+}
+
+// ----------------------------------------------------------------------------
+static inline udHash128Value udHash_Merge128(const uint64_t acc[8], const uint8_t *pSecret, uint64_t length)
+{
+  udHash128Value h;
+  h.low64 = udHash_MergeAccumulators(acc, pSecret + udHash_SecretMergeAccsStart, length * udHash_Prime64_1);
+  h.high64 = udHash_MergeAccumulators(acc, pSecret + udHash_SecretSize - 64 - udHash_SecretMergeAccsStart, ~(length * udHash_Prime64_2));
+  return h;
+}
+
+// ****************************************************************************
+// Fast 64-bit hash of a buffer
+uint64_t udHash64(const void *pBuffer, size_t length, uint64_t seed)
+{
+  const uint8_t *pInput = (const uint8_t*)pBuffer;
+  if (length <= 16)
+    return udHash_Short64(pInput, length, udHash_DefaultSecret, seed);
+  if (length <= udHash_MidSizeMax)
+    return udHash_Mid64(pInput, length, udHash_DefaultSecret, seed);
+
+  uint8_t customSecret[udHash_SecretSize];
+  const uint8_t *pSecret = udHash_DefaultSecret;
+  if (seed)
+  {
+    udHash_InitSecret(customSecret, seed);
+    pSecret = customSecret;
+  }
+  uint64_t acc[8];
+  udHash_Long(acc, pInput, length, pSecret);
+  return udHash_MergeAccumulators(acc, pSecret + udHash_SecretMergeAccsStart, (uint64_t)length * udHash_Prime64_1);
+}
+
+// ****************************************************************************
+// Fast 128-bit hash of a buffer
+udHash128Value udHash128(const void *pBuffer, size_t length, uint64_t seed)
+{
+  const uint8_t *pInput = (const uint8_t*)pBuffer;
+  if (length <= 16)
+    return udHash_Short128(pInput, length, udHash_DefaultSecret, seed);
+  if (length <= udHash_MidSizeMax)
+    return udHash_Mid128(pInput, length, udHash_DefaultSecret, seed);
+
+  uint8_t customSecret[udHash_SecretSize];
+  const uint8_t *pSecret = udHash_DefaultSecret;
+  if (seed)
+  {
+    udHash_InitSecret(customSecret, seed);
+    pSecret = customSecret;
+  }
+  uint64_t acc[8];
+  udHash_Long(acc, pInput, length, pSecret);
+  return udHash_Merge128(acc, pSecret, length);
+}
+
+// ****************************************************************************
+// Begin a streaming hash
+void udHash_Init(udHashState *pState, uint64_t seed)
+{
+  udHash_InitAccumulators(pState->acc);
+  if (seed)
+    udHash_InitSecret(pState->customSecret, seed);
+  pState->totalLength = 0;
+  pState->seed = seed;
+  pState->bufferedSize = 0;
+  pState->stripesSoFar = 0;
+}
+
+// ****************************************************************************
+// Add bytes to a streaming hash
+void udHash_Update(udHashState *pState, const void *pBuffer, size_t length)
+{
+  const uint8_t *pInput = (const uint8_t*)pBuffer;
+  const uint8_t *pSecret = pState->seed ? pState->customSecret : udHash_DefaultSecret;
+  const size_t bufferSize = sizeof(pState->buffer);
+
+  pState->totalLength += length;
+  if (length <= bufferSize - pState->bufferedSize)
+  {
+    if (length)
+      memcpy(pState->buffer + pState->bufferedSize, pInput, length);
+    pState->bufferedSize += (uint32_t)length;
+    return;
+  }
+
+  // The buffer is only consumed once more input arrives, so the last stripe is always available for the digest
+  const uint8_t *pEnd = pInput + length;
+  if (pState->bufferedSize)
+  {
+    size_t fill = bufferSize - pState->bufferedSize;
+    memcpy(pState->buffer + pState->bufferedSize, pInput, fill);
+    pInput += fill;
+    udHash_ConsumeStripes(pState->acc, &pState->stripesSoFar, pState->buffer, udHash_BufferStripes, pSecret);
+    pState->bufferedSize = 0;
+  }
+  if ((size_t)(pEnd - pInput) > bufferSize)
+  {
+    size_t stripeCount = (size_t)(pEnd - 1 - pInput) / udHash_StripeLength;
+    udHash_ConsumeStripes(pState->acc, &pState->stripesSoFar, pInput, stripeCount, pSecret);
+    pInput += stripeCount * udHash_StripeLength;
+    memcpy(pState->buffer + bufferSize - udHash_StripeLength, pInput - udHash_StripeLength, udHash_StripeLength); // Keep the last stripe in case the remainder is short
+  }
+  memcpy(pState->buffer, pInput, (size_t)(pEnd - pInput));
+  pState->bufferedSize = (uint32_t)(pEnd - pInput);
+}
+
+// ----------------------------------------------------------------------------
+// Finish the accumulators for a streamed input longer than udHash_MidSizeMax without modifying the state
+static void udHash_DigestLong(const udHashState *pState, const uint8_t *pSecret, uint64_t acc[8])
+{
+  uint8_t lastStripe[udHash_StripeLength];
+  const uint8_t *pLastStripe;
+  uint32_t stripesSoFar = pState->stripesSoFar;
+
+  memcpy(acc, pState->acc, sizeof(pState->acc));
+  if (pState->bufferedSize >= udHash_StripeLength)
+  {
+    udHash_ConsumeStripes(acc, &stripesSoFar, pState->buffer, (pState->bufferedSize - 1) / udHash_StripeLength, pSecret);
+    pLastStripe = pState->buffer + pState->bufferedSize - udHash_StripeLength;
+  }
+  else
+  {
+    // The last stripe straddles the end of the previous buffer contents
+    size_t catchUp = udHash_StripeLength - pState->bufferedSize;
+    memcpy(lastStripe, pState->buffer + sizeof(pState->buffer) - catchUp, catchUp);
+    memcpy(lastStripe + catchUp, pState->buffer, pState->bufferedSize);
+    pLastStripe = lastStripe;
+  }
+  udHash_GetKernels().pAccumulate(acc, pLastStripe, pSecret + udHash_SecretSize - udHash_StripeLength - udHash_SecretLastAccStart, 1);
+}
+
+// ****************************************************************************
+// 64-bit digest of everything added so far
+uint64_t udHash_Digest64(const udHashState *pState)
+{
+  if (pState->totalLength <= udHash_MidSizeMax)
+    return udHash64(pState->buffer, (size_t)pState->totalLength, pState->seed);
+
+  const uint8_t *pSecret = pState->seed ? pState->customSecret : udHash_DefaultSecret;
+  uint64_t acc[8];
+  udHash_DigestLong(pState, pSecret, acc);
+  return udHash_MergeAccumulators(acc, pSecret + udHash_SecretMergeAccsStart, pState->totalLength * udHash_Prime64_1);
+}
+
+// ****************************************************************************
+// 128-bit digest of everything added so far
+udHash128Value udHash_Digest128(const udHashState *pState)
+{
+  if (pState->totalLength <= udHash_MidSizeMax)
+    return udHash128(pState->buffer, (size_t)pState->totalLength, pState->seed);
+
+  const uint8_t *pSecret = pState->seed ? pState->customSecret : udHash_DefaultSecret;
+  uint64_t acc[8];
+  udHash_DigestLong(pState, pSecret, acc);
+  return udHash_Merge128(acc, pSecret, pState->totalLength);
+}
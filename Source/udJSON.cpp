@@ -1451,6 +1451,25 @@ epilogue:
   return result;
 }
 
+// ****************************************************************************
+// Calculate the HMAC (or hash) directly to bytes, skipping the base64 round trip
+udResult udJSON::CalculateHMACRaw(uint8_t pDigest[32], const void *pKey, size_t keyLength) const
+{
+  udResult result;
+  const char *pExport = nullptr;
+
+  UD_ERROR_NULL(pDigest, udR_InvalidParameter);
+  UD_ERROR_CHECK(Export(&pExport));
+  if (keyLength)
+    result = udCryptoHash_HMACRaw(udCH_SHA256, pKey, keyLength, pExport, udStrlen(pExport), pDigest, udCHL_SHA256Length);
+  else
+    result = udCryptoHash_HashRaw(udCH_SHA256, pExport, udStrlen(pExport), pDigest, udCHL_SHA256Length);
+
+epilogue:
+  udFree(pExport);
+  return result;
+}
+
 // ----------------------------------------------------------------------------
 // Author: Dave Pevreal, April 2017
 udResult udJSON::ParseJSON(const char *pJSON, int *pCharCount, int *pLineNumber)
@@ -0,0 +1,91 @@
+#include "udParallel.h"
+
+#include "udPlatformUtil.h"
+#include <atomic>
+
+enum
+{
+  udParallel_RangesPerThread = 4, // Ranges per thread when choosing a grain, so threads that finish early can take more
+};
+
+// Shared by the calling thread and the helper tasks, each claims the next unclaimed range until none are left
+struct udParallelForJob
+{
+  const udParallelForCallback *pFunc;
+  size_t begin;
+  size_t end;
+  size_t grain;
+  size_t rangeCount;
+  std::atomic<size_t> nextRange;
+};
+
+// ----------------------------------------------------------------------------
+static void udParallelFor_RunRanges(void *pJobPtr)
+{
+  udParallelForJob *pJob = (udParallelForJob*)pJobPtr;
+
+  for (size_t range = pJob->nextRange++; range < pJob->rangeCount; range = pJob->nextRange++)
+  {
+    size_t first = pJob->begin + range * pJob->grain;
+    (*pJob->pFunc)(first, first + std::min(pJob->grain, pJob->end - first));
+  }
+}
+
+// ----------------------------------------------------------------------------
+size_t udParallel_DefaultGrain(udWorkerPool *pPool, size_t count)
+{
+  size_t threadCount = (size_t)udWorkerPool_GetThreadCount(pPool) + 1; // Including the caller
+  return std::max(count / (threadCount * udParallel_RangesPerThread), (size_t)1);
+}
+
+// ----------------------------------------------------------------------------
+udResult udParallelFor(udWorkerPool *pPool, size_t begin, size_t end, size_t grain, udParallelForCallback func)
+{
+  udResult result = udR_Failure;
+  udParallelForJob job;
+  udWorkerPoolTask **ppHelpers = nullptr;
+  size_t helperCount = 0;
+  size_t addedCount = 0;
+
+  UD_ERROR_NULL(pPool, udR_InvalidParameter);
+  UD_ERROR_IF(!func, udR_InvalidParameter);
+  UD_ERROR_IF(end < begin, udR_InvalidParameter);
+
+  if (grain == 0)
+    grain = udParallel_DefaultGrain(pPool, end - begin);
+
+  job.pFunc = &func;
+  job.begin = begin;
+  job.end = end;
+  job.grain = grain;
+  job.rangeCount = (end - begin + grain - 1) / grain;
+  job.nextRange = 0;
+
+  // The caller takes ranges too, so there's no point in more helpers than other ranges
+  helperCount = std::min((size_t)udWorkerPool_GetThreadCount(pPool), job.rangeCount > 0 ? job.rangeCount - 1 : 0);
+  if (helperCount > 0)
+  {
+    ppHelpers = udAllocType(udWorkerPoolTask*, helperCount, udAF_Zero);
+    UD_ERROR_NULL(ppHelpers, udR_MemoryAllocationFailure);
+  }
+
+  // If a helper can't be queued the remaining ranges are shared between fewer threads
+  while (addedCount < helperCount && udWorkerPool_AddTask(pPool, udParallelFor_RunRanges, &job, false, nullptr, &ppHelpers[addedCount]) == udR_Success)
+    ++addedCount;
+
+  udParallelFor_RunRanges(&job);
+
+  // Every range has been claimed, helpers that haven't started have nothing to do and the rest are finishing their last range
+  for (size_t i = 0; i < addedCount; ++i)
+  {
+    if (udWorkerPool_CancelTask(ppHelpers[i]) != udR_Success)
+      udWorkerPool_WaitTask(ppHelpers[i]);
+    udWorkerPool_ReleaseTask(&ppHelpers[i]);
+  }
+
+  result = udR_Success;
+
+epilogue:
+  udFree(ppHelpers);
+  return result;
+}
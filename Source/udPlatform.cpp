@@ -229,6 +229,12 @@ udResult udGetTotalPhysicalMemory(uint64_t *pTotalMemory)
 # define UD_HASCPUID
 #endif
 
+#if (UDPLATFORM_LINUX || UDPLATFORM_ANDROID) && defined(__aarch64__)
+# include <sys/auxv.h>
+# define UD_ARM_HWCAP_SHA1 (1 << 5)
+# define UD_ARM_HWCAP_SHA2 (1 << 6)
+#endif
+
 class udCPUFeatureDetection
 {
 public:
@@ -246,8 +252,26 @@ private:
 };
 
 static udCPUFeatureDetection s_cpuFeatureDetectionStartup;
+static bool s_udCPUSupportsSSSE3 = false;
+static bool s_udCPUSupportsSSE42 = false;
 static bool s_udCPUSupportsAVX = false;
 static bool s_udCPUSupportsAVX2 = false;
+static bool s_udCPUSupportsAES = false;
+static bool s_udCPUSupportsVAES = false;
+static bool s_udCPUSupportsPCLMUL = false;
+static bool s_udCPUSupportsSHA = false;
+
+bool udCPUSupportsSSSE3()
+{
+  udCPUFeatureDetection::DetectFeatures();
+  return s_udCPUSupportsSSSE3;
+}
+
+bool udCPUSupportsSSE42()
+{
+  udCPUFeatureDetection::DetectFeatures();
+  return s_udCPUSupportsSSE42;
+}
 
 bool udCPUSupportsAVX()
 {
@@ -261,6 +285,30 @@ bool udCPUSupportsAVX2()
   return s_udCPUSupportsAVX2;
 }
 
+bool udCPUSupportsAES()
+{
+  udCPUFeatureDetection::DetectFeatures();
+  return s_udCPUSupportsAES;
+}
+
+bool udCPUSupportsVAES()
+{
+  udCPUFeatureDetection::DetectFeatures();
+  return s_udCPUSupportsVAES;
+}
+
+bool udCPUSupportsPCLMUL()
+{
+  udCPUFeatureDetection::DetectFeatures();
+  return s_udCPUSupportsPCLMUL;
+}
+
+bool udCPUSupportsSHA()
+{
+  udCPUFeatureDetection::DetectFeatures();
+  return s_udCPUSupportsSHA;
+}
+
 void udCPUFeatureDetection::DetectFeatures()
 {
   static bool s_udCPUFeaturesDetected = false;
@@ -278,7 +326,11 @@ void udCPUFeatureDetection::DetectFeatures()
   if (nIds >= 0x00000001)
   {
     cpuid(info, 0x00000001, 0);
+    s_udCPUSupportsSSSE3 = (info[2] & (1 << 9)) != 0;
+    s_udCPUSupportsSSE42 = (info[2] & (1 << 20)) != 0;
     s_udCPUSupportsAVX = (info[2] & (1 << 28)) != 0;
+    s_udCPUSupportsAES = (info[2] & (1 << 25)) != 0;
+    s_udCPUSupportsPCLMUL = (info[2] & (1 << 1)) != 0;
   }
 
   // Get flags for function 0x00000007
@@ -286,7 +338,16 @@ void udCPUFeatureDetection::DetectFeatures()
   {
     cpuid(info, 0x00000007, 0);
     s_udCPUSupportsAVX2 = (info[1] & (1 << 5)) != 0;
+    s_udCPUSupportsVAES = s_udCPUSupportsAVX2 && s_udCPUSupportsAES && (info[2] & (1 << 9)) != 0;
+    s_udCPUSupportsSHA = (info[1] & (1 << 29)) != 0;
   }
+#elif (UDPLATFORM_LINUX || UDPLATFORM_ANDROID) && defined(__aarch64__)
+  unsigned long hwcaps = getauxval(AT_HWCAP);
+  s_udCPUSupportsSHA = (hwcaps & UD_ARM_HWCAP_SHA1) && (hwcaps & UD_ARM_HWCAP_SHA2);
+#elif UDPLATFORM_WINDOWS && defined(_M_ARM64)
+  s_udCPUSupportsSHA = IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != 0;
+#elif (UDPLATFORM_OSX || UDPLATFORM_IOS || UDPLATFORM_IOS_SIMULATOR) && defined(__aarch64__)
+  s_udCPUSupportsSHA = true; // Every Apple ARM64 core has the crypto extensions
 #endif
 
   s_udCPUFeaturesDetected = true;
@@ -26,6 +26,19 @@ static const uint64_t nsec_per_msec = 1000000;   // 1 million nanoseconds in one
 
 static char s_udStrEmptyString[] = "";
 
+// *********************************************************************
+void udLockSpinLock(udSpinLock *pLock)
+{
+  while (pLock->flag.test_and_set(std::memory_order_acquire))
+    udYield();
+}
+
+// *********************************************************************
+void udReleaseSpinLock(udSpinLock *pLock)
+{
+  pLock->flag.clear(std::memory_order_release);
+}
+
 // *********************************************************************
 // Author: Dave Pevreal, March 2014
 uint32_t udGetTimeMs()
@@ -236,162 +249,6 @@ udOSString::~udOSString()
 }
 #endif // UDPLATFORM_WINDOWS
 
-static char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-// *********************************************************************
-// Author: Dave Pevreal, December 2014
-udResult udBase64Decode(const char *pString, size_t length, uint8_t *pOutput, size_t outputLength, size_t *pOutputLengthWritten /*= nullptr*/)
-{
-  udResult result;
-  uint32_t accum = 0; // Accumulator for incoming data (read 6 bits at a time)
-  int accumBits = 0;
-  size_t outputIndex = 0;
-
-  if (!length && pString)
-    length = udStrlen(pString);
-
-  if (!pOutput && pOutputLengthWritten)
-  {
-    outputIndex = length / 4 * 3;
-    UD_ERROR_SET(udR_Success);
-  }
-
-  UD_ERROR_NULL(pString, udR_InvalidParameter);
-  UD_ERROR_NULL(pOutput, udR_InvalidParameter);
-
-  for (size_t inputIndex = 0; inputIndex < length; )
-  {
-    char *c = strchr(b64, pString[inputIndex++]);
-    if (c)
-    {
-      accum |= uint32_t(c - b64) << (16 - accumBits - 6); // Store in accumulator, starting at high byte
-      if ((accumBits += 6) >= 8)
-      {
-        UD_ERROR_IF(outputIndex >= outputLength, udR_BufferTooSmall);
-        pOutput[outputIndex++] = uint8_t(accum >> 8);
-        accum <<= 8;
-        accumBits -= 8;
-      }
-    }
-  }
-  result = udR_Success;
-
-epilogue:
-  if (pOutputLengthWritten)
-    *pOutputLengthWritten = outputIndex;
-
-  return result;
-}
-
-// *********************************************************************
-// Author: Dave Pevreal, September 2017
-udResult udBase64Decode(uint8_t **ppOutput, size_t *pOutputLength, const char *pString)
-{
-  udResult result;
-  uint8_t *pOutput = nullptr;
-
-  UD_ERROR_NULL(ppOutput, udR_InvalidParameter);
-  UD_ERROR_NULL(pOutputLength, udR_InvalidParameter);
-  UD_ERROR_NULL(pString, udR_InvalidParameter);
-
-  result = udBase64Decode(pString, 0, nullptr, 0, pOutputLength);
-  UD_ERROR_HANDLE();
-  pOutput = udAllocType(uint8_t, *pOutputLength, udAF_None);
-  UD_ERROR_NULL(pOutput, udR_MemoryAllocationFailure);
-  result = udBase64Decode(pString, 0, pOutput, *pOutputLength, pOutputLength);
-  UD_ERROR_HANDLE();
-
-  *ppOutput = pOutput;
-  pOutput = nullptr;
-  result = udR_Success;
-
-epilogue:
-  udFree(pOutput);
-  return result;
-}
-
-// *********************************************************************
-// Author: Paul Fox, March 2016
-udResult udBase64Encode(const void *pBinary, size_t binaryLength, char *pString, size_t strLength, size_t *pOutputLengthWritten /*= nullptr*/)
-{
-  udResult result;
-  uint32_t accum = 0; // Accumulator for data (read 8 bits at a time but only consume 6)
-  int accumBits = 0;
-  size_t outputIndex = 0;
-  size_t expectedOutputLength = (binaryLength + 2) / 3 * 4 + 1; // +1 for nul terminator
-
-  if (!pString && pOutputLengthWritten)
-  {
-    outputIndex = expectedOutputLength;
-    UD_ERROR_SET(udR_Success);
-  }
-
-  UD_ERROR_NULL(pString, udR_InvalidParameter);
-  UD_ERROR_IF(!pBinary && binaryLength, udR_InvalidParameter);
-
-  for (size_t inputIndex = 0; inputIndex < binaryLength; ++inputIndex)
-  {
-    accum = (accum << 8) | ((uint8_t*)pBinary)[inputIndex];
-    accumBits += 8;
-    while (accumBits >= 6)
-    {
-      UD_ERROR_IF(outputIndex >= strLength, udR_BufferTooSmall);
-      pString[outputIndex] = b64[((accum >> (accumBits - 6)) & 0x3F)];
-      ++outputIndex;
-      accumBits -= 6;
-    }
-  }
-
-  if (accumBits == 2)
-  {
-    UD_ERROR_IF(outputIndex >= strLength + 3, udR_BufferTooSmall);
-    pString[outputIndex] = b64[(accum & 0x3) << 4];
-    pString[outputIndex+1] = '='; //Pad chars
-    pString[outputIndex+2] = '=';
-    outputIndex += 3;
-  }
-  else if (accumBits == 4)
-  {
-    UD_ERROR_IF(outputIndex + 2 >= strLength, udR_BufferTooSmall);
-    pString[outputIndex] = b64[(accum & 0xF) << 2];
-    pString[outputIndex+1] = '='; //Pad chars
-    outputIndex += 2;
-  }
-  pString[outputIndex++] = 0; // Null terminate if room in the string
-
-  UD_ERROR_IF(outputIndex != expectedOutputLength, udR_InternalError); // Okay, the horse may have bolted at this point.
-
-  result = udR_Success;
-
-epilogue:
-  if (pOutputLengthWritten)
-    *pOutputLengthWritten = outputIndex;
-
-  return result;
-}
-
-// *********************************************************************
-// Author: Dave Pevreal, May 2017
-udResult udBase64Encode(const char **ppDestStr, const void *pBinary, size_t binaryLength)
-{
-  udResult result;
-  size_t expectedOutputLength = (binaryLength + 2) / 3 * 4 + 1; // +1 for nul terminator
-  char *pStr = nullptr;
-
-  UD_ERROR_NULL(ppDestStr, udR_InvalidParameter);
-  pStr = udAllocType(char, expectedOutputLength, udAF_None);
-  UD_ERROR_NULL(pStr, udR_MemoryAllocationFailure);
-  result = udBase64Encode(pBinary, binaryLength, pStr, expectedOutputLength);
-  UD_ERROR_HANDLE();
-  *ppDestStr = pStr;
-  pStr = nullptr;
-  result = udR_Success;
-
-epilogue:
-  udFree(pStr);
-  return result;
-}
-
 // *********************************************************************
 int udGetHardwareThreadCount()
 {
@@ -67,19 +67,13 @@ bool udUUID_IsValid(const char *pUUIDStr)
   return true;
 }
 
-// ***************************************************************************
+// ---------------------------------------------------------------------------
 // Author: Paul Fox, April 2019
-udResult udUUID_GenerateFromRandom(udUUID *pUUID)
+// Format 16 random bytes as a version 4 UUID
+static void udUUID_FormatRandom(udUUID *pUUID, const uint8_t mem[16])
 {
-  udResult result = udR_Failure;
-  uint8_t mem[16];
   int index = 0;
 
-  UD_ERROR_NULL(pUUID, udR_InvalidParameter);
-  UD_ERROR_CHECK(udCrypto_Init());
-  UD_ERROR_CHECK(udCrypto_Random(mem, udLengthOf(mem)));
-  udCrypto_Deinit();
-
   for (int i = 0; i < udUUID::udUUID_Length; ++i)
   {
     if (i == 8 || i == 13 || i == 18 || i == 23) // Hyphens
@@ -101,10 +95,33 @@ udResult udUUID_GenerateFromRandom(udUUID *pUUID)
   }
 
   pUUID->internal_bytes[14] = '4'; // Version number
+}
+
+// ***************************************************************************
+// Author: Paul Fox, April 2019
+udResult udUUID_GenerateFromRandom(udUUID *pUUIDs, size_t count)
+{
+  udResult result = udR_Failure;
+  uint8_t mem[64 * 16]; // Random data is generated for batches of UUIDs at a time
+  bool cryptoInitialised = false;
+
+  UD_ERROR_NULL(pUUIDs, udR_InvalidParameter);
+  UD_ERROR_CHECK(udCrypto_Init());
+  cryptoInitialised = true;
+
+  for (size_t first = 0; first < count; first += udLengthOf(mem) / 16)
+  {
+    size_t batchCount = std::min(count - first, udLengthOf(mem) / 16);
+    UD_ERROR_CHECK(udCrypto_Random(mem, batchCount * 16));
+    for (size_t i = 0; i < batchCount; ++i)
+      udUUID_FormatRandom(&pUUIDs[first + i], mem + i * 16);
+  }
 
   result = udR_Success;
 
 epilogue:
+  if (cryptoInitialised)
+    udCrypto_Deinit();
   return result;
 }
 
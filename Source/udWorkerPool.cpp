@@ -6,237 +6,1860 @@
 #include "udPlatformUtil.h"
 #include "udThread.h"
 #include "udStringUtil.h"
+#include "udJSON.h"
 #include <atomic>
 #include <algorithm>
 
-struct udWorkerPoolThread
+// Each worker owns a deque of tasks (Chase-Lev, as described in "Correct and Efficient Work-Stealing for Weak Memory Models", Le et al. 2013)
+// The owning worker pushes and pops at the bottom without locking, while idle workers steal from the top of other workers' deques.
+// Tasks added from a worker go to its own deque, tasks added from any other thread go to a shared queue that workers check when their deque is empty.
+// Critical and background tasks always go to shared queues, checked before and after the normal tasks respectively. To stop a steady
+// stream of higher priority work starving the rest, every few tasks a worker looks for work from the lowest priority up instead.
+// Delayed tasks wait in a heap ordered by start time until a worker looking for work finds they're due.
+// Tasks are reference counted so handles can outlive them being run; the pool holds one reference until it's finished with a task and each handle holds another.
+// Workers live in a fixed array of slots. A worker is started when queued tasks outnumber the awake workers free to take them, and one that has been
+// idle too long retires, down to the pool's minimum. Workers blocked in udWorkerPool_BeginBlocking don't count towards the maximum, so others can replace them.
+// A retired worker's slot (and its empty deque) is reused by the next worker started, so thieves can always read every slot below slotsInUse.
+// Each slot keeps statistics that only its worker writes, so counting doesn't contend, and udWorkerPool_GetStats sums them when asked.
+
+enum
 {
-  udWorkerPool *pPool;
-  udThread *pThread;
+  udWorkerPool_InitialDequeCapacity = 256, // Tasks each deque holds before growing, always a power of 2
+  udWorkerPool_IdleSpinCount = 32,         // Attempts to find a task before going to sleep
+  udWorkerPool_SleepTimeoutMs = 100,       // Sleeping workers check for work this often even if not woken
+  udWorkerPool_StarvationInterval = 8,     // Every this many tasks a worker checks the lower priorities first
+  udWorkerPool_InitialDelayedCapacity = 32,
+  udWorkerPool_CacheLineSize = 64,
+  udWorkerPool_DefaultIdleTimeoutMs = 5000, // Workers above the minimum retire after being idle this long
 };
 
+struct udWorkerPoolGraphNode;
+
 struct udWorkerPoolTask
 {
+  udWorkerPool *pPool;
+  udWorkerPoolGraphNode *pGraphNode; // Set for tasks owned by a graph node, these are never deleted
   udWorkerPoolCallback function;
   udWorkerPoolCallback postFunction; // runs on main thread
   void *pDataBlock;
   bool freeDataBlock;
+  udWorkerPoolPriority priority;
+  uint32_t startTimeMs; // For delayed tasks, compared with udGetTimeMs
+  uint64_t queuedTicks; // udPerfCounterStart when the task was last queued for a worker, for latency statistics
+  bool isDelayed; // In ppDelayedTasks, protected by pDelayedMutex
+
+  std::atomic<int32_t> refCount;
+  std::atomic<int32_t> state; // udWorkerPoolTaskState, only the thread that moves a task out of udWPTS_Queued may run or cancel it
+  std::atomic<int32_t> waiterCount; // Threads blocked in udWorkerPool_WaitTask, so finishing a task only takes the wait mutex when needed
+  std::atomic<udWorkerPoolTask*> pContinuations; // Tasks to queue when this completes, udWorkerPool_ContinuationsClosed once it has finished
+  udWorkerPoolTask *pNextContinuation;
+};
+
+struct udWorkerPoolGraphNode
+{
+  udWorkerPoolGraph *pGraph;
+  udWorkerPoolTask task; // Reset each time the graph is submitted, so running a graph doesn't allocate
+  std::atomic<int32_t> pendingCount; // Predecessors yet to finish in the current run, the node is queued when this reaches zero
+  uint32_t predecessorCount;
+  uint32_t firstSuccessor; // Index of this node's first entry in pSuccessors
+  uint32_t successorCount;
+};
+
+struct udWorkerPoolGraphEdge
+{
+  uint32_t from;
+  uint32_t to;
+};
+
+struct udWorkerPoolGraph
+{
+  udChunkedArray<udWorkerPoolGraphNode> nodes;
+  udChunkedArray<udWorkerPoolGraphEdge> edges;
+  uint32_t *pSuccessors; // Successor node indices grouped by node, rebuilt on submit when edges were added
+  size_t successorCapacity;
+  bool isDirty;
+
+  udWorkerPoolTask completion; // Completes, or is cancelled, once every node of the current run has finished
+  std::atomic<uint32_t> pendingNodes;
+  std::atomic<bool> isCancelled;
+  std::atomic<bool> isRunning; // Cleared only once the pool is done touching the graph
+};
+
+// Marks a task's continuation list as closed, anything added after this point sees the task's final state instead
+static udWorkerPoolTask *const udWorkerPool_ContinuationsClosed = (udWorkerPoolTask*)(uintptr_t)1;
+
+struct udWorkerPoolDequeArray
+{
+  int64_t capacity;
+  udWorkerPoolDequeArray *pPrevious; // Arrays replaced when growing are kept until the pool is destroyed, as a thief may still be reading them
+  std::atomic<udWorkerPoolTask*> tasks[1];
+};
+
+struct udWorkerPoolDeque
+{
+  std::atomic<int64_t> top;    // Next task to steal, only ever increases
+  std::atomic<int64_t> bottom; // Next free slot, only the owner changes this
+  std::atomic<udWorkerPoolDequeArray*> pArray;
+};
+
+// Only written by the slot's worker (relaxed loads and stores rather than atomic adds), read by udWorkerPool_GetStats from any thread
+struct udWorkerPoolThreadCounters
+{
+  std::atomic<uint64_t> tasksRun;
+  std::atomic<uint64_t> tasksStolen;
+  std::atomic<uint64_t> runTicks;
+  std::atomic<uint64_t> idleTicks;
+  std::atomic<uint64_t> latencyHistogram[udWorkerPool_LatencyBucketCount];
+};
+
+struct udWorkerPoolThread
+{
+  udWorkerPool *pPool;
+  udThread *pThread;
+  udWorkerPoolDeque deque;
+  uint32_t stealSeed; // State for choosing which worker to steal from
+  uint32_t takenCount; // Tasks this worker has taken, for udWorkerPool_StarvationInterval
+  uint32_t lastWorkMs; // When this worker last finished a task, for retiring idle workers
+  uint32_t blockingDepth; // Nesting of udWorkerPool_BeginBlocking calls on this worker
+  std::atomic<bool> hasRetired; // Set by the worker as it leaves, its slot can then be reused once its thread is joined
+  udWorkerPoolThreadCounters counters; // Kept when the worker retires, so the pool's totals include every worker it has had
+  uint8_t padding[udWorkerPool_CacheLineSize]; // Keeps each worker's deque on its own cache lines
 };
 
 struct udWorkerPool
 {
-  udSafeDeque<udWorkerPoolTask> *pQueuedTasks;
-  udSafeDeque<udWorkerPoolTask> *pQueuedPostTasks;
+  udSafeDeque<udWorkerPoolTask*> *pQueuedTasks[udWPP_Count]; // Critical and background tasks, and normal tasks added from threads outside the pool
+  udSafeDeque<udWorkerPoolTask*> *pQueuedPostTasks;
 
   udSemaphore *pSemaphore;
   std::atomic<int32_t> activeThreads;
+  std::atomic<int32_t> sleepingThreads;
+  std::atomic<int64_t> queuedTaskCount; // Tasks added and not yet started, wherever they are queued
+  std::atomic<int64_t> sharedTaskCount[udWPP_Count]; // Tasks in each of pQueuedTasks, so workers can skip the lock when they're empty
+
+  udMutex *pDelayedMutex;
+  udWorkerPoolTask **ppDelayedTasks; // Heap with the earliest start time first, protected by pDelayedMutex
+  size_t delayedCapacity;
+  std::atomic<int64_t> delayedTaskCount;
+  std::atomic<uint32_t> nextStartTimeMs; // Start time of the first delayed task, so workers can skip the lock until it's due
 
-  uint8_t totalThreads;
+  udMutex *pWaitMutex;
+  udConditionVariable *pWaitCondition; // Signalled when a task with waiters finishes
+  int32_t waitingThreads; // Threads waiting on pWaitCondition, protected by pWaitMutex
+
+  udMutex *pThreadMutex; // Protects starting and retiring workers
   udWorkerPoolThread *pThreadData;
+  uint32_t slotCount; // Room for maxThreads plus as many workers replacing blocked ones
+  std::atomic<uint32_t> slotsInUse; // Slots that have been initialised, only grows
+  std::atomic<int32_t> liveThreads;
+  std::atomic<int32_t> blockedThreads;
+  uint32_t minThreads;
+  uint32_t maxThreads; // Limit on workers not blocked in udWorkerPool_BeginBlocking
+  uint32_t idleTimeoutMs;
+  char *pThreadNamePrefix;
+
+  double microsecondsPerTick; // For converting udPerfCounterStart differences
+  udMutex *pStatsMutex; // Held while dumping, so the callback isn't called once udWorkerPool_SetStatsDump has returned
+  std::atomic<uint32_t> statsDumpIntervalMs; // Zero when not dumping
+  std::atomic<uint32_t> nextStatsDumpMs;
+  udWorkerPoolStatsCallback statsDumpCallback; // Protected by pStatsMutex
 
   std::atomic<bool> isRunning;
 };
 
+// Where udWorkerPool_AddTasks sends each task, in the order the groups are queued
+enum udWorkerPoolBatchGroup
+{
+  udWPBG_Delayed,
+  udWPBG_PostOnly,
+  udWPBG_Critical,
+  udWPBG_Normal,
+  udWPBG_Background,
+
+  udWPBG_Count
+};
+
+static thread_local udWorkerPoolThread *t_pWorkerPoolThread = nullptr; // Set on worker threads, so tasks they add go to their own deque
+
 // ----------------------------------------------------------------------------
-// Author: Paul Fox, May 2015
-uint32_t udWorkerPool_DoWork(void *pPoolPtr)
+static udWorkerPoolBatchGroup udWorkerPool_GetBatchGroup(const udWorkerPoolTaskDesc *pDesc)
 {
-  UDRELASSERT(pPoolPtr != nullptr, "Bad Pool Ptr!");
+  if (pDesc->delayMs > 0)
+    return udWPBG_Delayed;
+  if (!pDesc->function && pDesc->postFunction)
+    return udWPBG_PostOnly;
+  return (udWorkerPoolBatchGroup)(udWPBG_Critical + (pDesc->priority - udWPP_Critical));
+}
 
-  udWorkerPoolThread *pThreadData = (udWorkerPoolThread*)pPoolPtr;
-  udWorkerPool *pPool = pThreadData->pPool;
+// ----------------------------------------------------------------------------
+static udWorkerPoolDequeArray *udWorkerPool_CreateDequeArray(int64_t capacity)
+{
+  udWorkerPoolDequeArray *pArray = (udWorkerPoolDequeArray*)udAlloc(sizeof(udWorkerPoolDequeArray) + (size_t)(capacity - 1) * sizeof(std::atomic<udWorkerPoolTask*>));
+  if (pArray)
+  {
+    pArray->capacity = capacity;
+    pArray->pPrevious = nullptr;
+  }
+  return pArray;
+}
 
-  udWorkerPoolTask currentTask;
-  int waitValue;
+// ----------------------------------------------------------------------------
+// Push a task to the bottom of a deque, only called by the owning worker
+static udResult udWorkerPool_DequePush(udWorkerPoolDeque *pDeque, udWorkerPoolTask *pTask)
+{
+  int64_t bottom = pDeque->bottom.load(std::memory_order_relaxed);
+  int64_t top = pDeque->top.load(std::memory_order_acquire);
+  udWorkerPoolDequeArray *pArray = pDeque->pArray.load(std::memory_order_relaxed);
 
-  while (pPool->isRunning)
+  if (bottom - top > pArray->capacity - 1)
   {
-    waitValue = udWaitSemaphore(pPool->pSemaphore, 100);
+    udWorkerPoolDequeArray *pGrown = udWorkerPool_CreateDequeArray(pArray->capacity * 2);
+    if (!pGrown)
+      return udR_MemoryAllocationFailure;
+    for (int64_t i = top; i < bottom; ++i)
+      pGrown->tasks[i & (pGrown->capacity - 1)].store(pArray->tasks[i & (pArray->capacity - 1)].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    pGrown->pPrevious = pArray;
+    pDeque->pArray.store(pGrown, std::memory_order_release);
+    pArray = pGrown;
+  }
 
-    if (waitValue != 0)
-      continue;
+  pArray->tasks[bottom & (pArray->capacity - 1)].store(pTask, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  pDeque->bottom.store(bottom + 1, std::memory_order_relaxed);
+  return udR_Success;
+}
 
-    ++pPool->activeThreads;
+// ----------------------------------------------------------------------------
+// Pop the most recently pushed task from a deque, only called by the owning worker
+static udWorkerPoolTask *udWorkerPool_DequePop(udWorkerPoolDeque *pDeque)
+{
+  int64_t bottom = pDeque->bottom.load(std::memory_order_relaxed) - 1;
+  udWorkerPoolDequeArray *pArray = pDeque->pArray.load(std::memory_order_relaxed);
+  pDeque->bottom.store(bottom, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t top = pDeque->top.load(std::memory_order_relaxed);
 
-    if (udSafeDeque_PopFront(pPool->pQueuedTasks, &currentTask) != udR_Success)
+  udWorkerPoolTask *pTask = nullptr;
+  if (top <= bottom)
+  {
+    pTask = pArray->tasks[bottom & (pArray->capacity - 1)].load(std::memory_order_relaxed);
+    if (top == bottom)
     {
-      --pPool->activeThreads;
-      continue;
+      // Last task, race any thieves for it
+      if (!pDeque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        pTask = nullptr;
+      pDeque->bottom.store(bottom + 1, std::memory_order_relaxed);
     }
+  }
+  else
+  {
+    pDeque->bottom.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return pTask;
+}
 
-    if (currentTask.function)
-      currentTask.function(currentTask.pDataBlock);
-
-    if (currentTask.postFunction)
-      udSafeDeque_PushBack(pPool->pQueuedPostTasks, currentTask);
-    else if (currentTask.freeDataBlock)
-      udFree(currentTask.pDataBlock);
+// ----------------------------------------------------------------------------
+// Steal the oldest task from a deque, called by any thread
+static udWorkerPoolTask *udWorkerPool_DequeSteal(udWorkerPoolDeque *pDeque)
+{
+  int64_t top = pDeque->top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t bottom = pDeque->bottom.load(std::memory_order_acquire);
 
-    --pPool->activeThreads;
-  }
+  if (top >= bottom)
+    return nullptr;
 
-  return 0;
+  udWorkerPoolDequeArray *pArray = pDeque->pArray.load(std::memory_order_acquire);
+  udWorkerPoolTask *pTask = pArray->tasks[top & (pArray->capacity - 1)].load(std::memory_order_relaxed);
+  if (!pDeque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    return nullptr; // Lost the race to the owner or another thief
+  return pTask;
 }
 
+uint32_t udWorkerPool_DoWork(void *pPoolPtr);
+
 // ----------------------------------------------------------------------------
-// Author: Paul Fox, May 2015
-udResult udWorkerPool_Create(udWorkerPool **ppPool, uint8_t totalThreads, const char *pThreadNamePrefix /*= "udWorkerPool"*/)
+// Start a worker in a free slot, unless the pool is stopping or already has as many unblocked workers as allowed
+static udResult udWorkerPool_StartThread(udWorkerPool *pPool)
 {
   udResult result = udR_Failure;
-  udWorkerPool *pPool = nullptr;
+  udWorkerPoolThread *pThread = nullptr;
+  uint32_t slotsInUse = 0;
+  udScopeLock lock(pPool->pThreadMutex);
 
-  UD_ERROR_NULL(ppPool, udR_InvalidParameter);
-  UD_ERROR_IF(totalThreads == 0, udR_InvalidParameter);
+  // These are expected whenever several threads ask for a worker at once, so they aren't recorded as errors
+  if (!pPool->isRunning)
+    return udR_NotAllowed;
+  if (pPool->liveThreads - pPool->blockedThreads >= (int32_t)pPool->maxThreads || pPool->liveThreads >= (int32_t)pPool->slotCount)
+    return udR_NothingToDo;
 
-  pPool = udAllocType(udWorkerPool, 1, udAF_Zero);
-  UD_ERROR_NULL(pPool, udR_MemoryAllocationFailure);
+  slotsInUse = pPool->slotsInUse.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; !pThread && i < slotsInUse; ++i)
+  {
+    if (pPool->pThreadData[i].hasRetired)
+      pThread = &pPool->pThreadData[i];
+  }
 
-  pPool->pSemaphore = udCreateSemaphore();
-  UD_ERROR_NULL(pPool, udR_MemoryAllocationFailure);
+  if (pThread)
+  {
+    udThread_Join(pThread->pThread);
+    udThread_Destroy(&pThread->pThread);
+  }
+  else
+  {
+    // Thieves only read slots below slotsInUse, so the deque must exist before it's increased
+    pThread = &pPool->pThreadData[slotsInUse];
+    pThread->pPool = pPool;
+    pThread->stealSeed = 0x9E3779B9u * (slotsInUse + 1);
+    pThread->deque.pArray = udWorkerPool_CreateDequeArray(udWorkerPool_InitialDequeCapacity);
+    UD_ERROR_NULL(pThread->deque.pArray.load(), udR_MemoryAllocationFailure);
+    pPool->slotsInUse.store(slotsInUse + 1, std::memory_order_release);
+  }
 
-  UD_ERROR_CHECK(udSafeDeque_Create(&pPool->pQueuedTasks, 32));
-  UD_ERROR_CHECK(udSafeDeque_Create(&pPool->pQueuedPostTasks, 32));
+  pThread->hasRetired = false;
+  pThread->blockingDepth = 0;
+  pThread->lastWorkMs = udGetTimeMs();
+  ++pPool->liveThreads;
 
-  pPool->isRunning = true;
-  pPool->totalThreads = totalThreads;
-  pPool->pThreadData = udAllocType(udWorkerPoolThread, pPool->totalThreads, udAF_Zero);
-  UD_ERROR_NULL(pPool->pThreadData, udR_MemoryAllocationFailure);
+  result = udThread_Create(&pThread->pThread, udWorkerPool_DoWork, pThread, udTCF_None, udTempStr("%s%d", pPool->pThreadNamePrefix, (int)(pThread - pPool->pThreadData)));
+  if (result != udR_Success)
+  {
+    --pPool->liveThreads;
+    pThread->hasRetired = true;
+  }
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Retire a worker that found nothing to do if there are more unblocked workers than the maximum, or it has been idle too long and there are more than the minimum
+static bool udWorkerPool_TryRetireThread(udWorkerPool *pPool, udWorkerPoolThread *pThread)
+{
+  int32_t unblockedThreads = pPool->liveThreads - pPool->blockedThreads;
+  if (unblockedThreads <= (int32_t)pPool->maxThreads && (unblockedThreads <= (int32_t)pPool->minThreads || udGetTimeMs() - pThread->lastWorkMs < pPool->idleTimeoutMs))
+    return false;
+
+  udScopeLock lock(pPool->pThreadMutex);
+  if (pPool->liveThreads <= (int32_t)pPool->minThreads)
+    return false;
 
-  for (int i = 0; i < pPool->totalThreads; ++i)
+  // Stop counting as live before the final check, so anything queued after it either sees fewer workers or is seen here
+  --pPool->liveThreads;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (pPool->queuedTaskCount.load(std::memory_order_relaxed) > 0)
   {
-    pPool->pThreadData[i].pPool = pPool;
-    UD_ERROR_CHECK(udThread_Create(&pPool->pThreadData[i].pThread, udWorkerPool_DoWork, &pPool->pThreadData[i], udTCF_None, udTempStr("%s%d", pThreadNamePrefix, i)));
+    ++pPool->liveThreads;
+    return false;
   }
 
-  result = udR_Success;
-  *ppPool = pPool;
-  pPool = nullptr;
+  pThread->hasRetired = true;
+  return true;
+}
 
-epilogue:
-  udWorkerPool_Destroy(&pPool);
+// ----------------------------------------------------------------------------
+// Wake sleeping workers after tasks are queued, nothing is signalled when every worker is already awake
+// If no workers are sleeping and the tasks outnumber the awake workers without a task, another worker is started
+static void udWorkerPool_WakeWorkers(udWorkerPool *pPool, int32_t taskCount)
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst); // Pairs with the sleeping worker checking for tasks after counting itself as sleeping
+  int32_t sleepingThreads = pPool->sleepingThreads.load(std::memory_order_relaxed);
+  if (sleepingThreads > 0)
+  {
+    udIncrementSemaphore(pPool->pSemaphore, std::min(sleepingThreads, taskCount));
+  }
+  else if (pPool->minThreads != pPool->maxThreads || pPool->blockedThreads.load(std::memory_order_relaxed) > 0)
+  {
+    int32_t idleThreads = pPool->liveThreads.load(std::memory_order_relaxed) - pPool->activeThreads.load(std::memory_order_relaxed);
+    if (pPool->queuedTaskCount.load(std::memory_order_relaxed) > idleThreads)
+      udWorkerPool_StartThread(pPool);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Queue a normal task on the calling worker's deque if it belongs to this pool, otherwise on the shared queue for its priority
+static udResult udWorkerPool_QueueTask(udWorkerPool *pPool, udWorkerPoolTask *pTask)
+{
+  udResult result;
+  udWorkerPoolThread *pThread = t_pWorkerPoolThread;
+  udWorkerPoolPriority priority = pTask->priority; // The task may have run and been freed as soon as it's pushed
+
+  pTask->queuedTicks = udPerfCounterStart();
+  ++pPool->queuedTaskCount;
+  if (priority == udWPP_Normal && pThread && pThread->pPool == pPool && udWorkerPool_DequePush(&pThread->deque, pTask) == udR_Success)
+  {
+    result = udR_Success;
+  }
+  else
+  {
+    result = udSafeDeque_PushBack(pPool->pQueuedTasks[priority], pTask);
+    if (result == udR_Success)
+      ++pPool->sharedTaskCount[priority];
+  }
+
+  if (result == udR_Success)
+    udWorkerPool_WakeWorkers(pPool, 1);
+  else
+    --pPool->queuedTaskCount;
 
   return result;
 }
 
 // ----------------------------------------------------------------------------
-// Author: Paul Fox, May 2015
-void udWorkerPool_Destroy(udWorkerPool **ppPool)
+static udWorkerPoolTask *udWorkerPool_CreateTask(udWorkerPool *pPool, udWorkerPoolCallback func, void *pUserData, bool clearMemory, udWorkerPoolCallback postFunction, udWorkerPoolPriority priority, bool hasHandle)
 {
-  if (ppPool == nullptr || *ppPool == nullptr)
-    return;
-
-  udWorkerPool *pPool = *ppPool;
-  *ppPool = nullptr;
+  udWorkerPoolTask *pTask = udNewNoParams(udWorkerPoolTask);
+  if (pTask)
+  {
+    pTask->pPool = pPool;
+    pTask->function = func;
+    pTask->postFunction = postFunction;
+    pTask->pDataBlock = pUserData;
+    pTask->freeDataBlock = clearMemory;
+    pTask->priority = priority;
+    pTask->refCount = hasHandle ? 2 : 1;
+    pTask->state = udWPTS_Queued;
+  }
+  return pTask;
+}
 
-  pPool->isRunning = false;
+static void udWorkerPool_GraphNodeDone(udWorkerPoolGraphNode *pNode);
 
-  for (int i = 0; i < pPool->totalThreads; i++)
+// ----------------------------------------------------------------------------
+static void udWorkerPool_ReleaseTaskRef(udWorkerPoolTask *pTask)
+{
+  if (--pTask->refCount == 0)
   {
-    udThread_Join(pPool->pThreadData[i].pThread);
-    udThread_Destroy(&pPool->pThreadData[i].pThread);
+    if (pTask->pGraphNode)
+      udWorkerPool_GraphNodeDone(pTask->pGraphNode);
+    else
+      udDelete(pTask);
   }
+}
 
-  udWorkerPoolTask currentTask;
-  while (udSafeDeque_PopFront(pPool->pQueuedTasks, &currentTask) == udR_Success)
+// ----------------------------------------------------------------------------
+// Wake any threads blocked waiting for a task that just finished
+static void udWorkerPool_SignalWaiters(udWorkerPoolTask *pTask)
+{
+  // The finished state was stored before this check, a waiter counts itself before checking the state
+  if (pTask->waiterCount.load() > 0)
   {
-    if (currentTask.freeDataBlock)
-      udFree(currentTask.pDataBlock);
+    udWorkerPool *pPool = pTask->pPool;
+    udLockMutex(pPool->pWaitMutex);
+    udSignalConditionVariable(pPool->pWaitCondition, pPool->waitingThreads); // The condition is shared, so every waiter rechecks its own task
+    udReleaseMutex(pPool->pWaitMutex);
   }
+}
+
+static bool udWorkerPool_TryCancel(udWorkerPoolTask *pTask);
+
+// ----------------------------------------------------------------------------
+// Record a task's final state, then queue its continuations (or cancel them with it) and wake its waiters
+static void udWorkerPool_FinishTask(udWorkerPoolTask *pTask, udWorkerPoolTaskState state)
+{
+  pTask->state = state;
 
-  while (udSafeDeque_PopFront(pPool->pQueuedPostTasks, &currentTask) == udR_Success)
+  udWorkerPoolTask *pContinuation = pTask->pContinuations.exchange(udWorkerPool_ContinuationsClosed);
+  while (pContinuation)
   {
-    if (currentTask.freeDataBlock)
-      udFree(currentTask.pDataBlock);
+    udWorkerPoolTask *pNext = pContinuation->pNextContinuation;
+    if (state != udWPTS_Complete || pContinuation->state.load() != udWPTS_Queued || udWorkerPool_QueueTask(pTask->pPool, pContinuation) != udR_Success)
+    {
+      udWorkerPool_TryCancel(pContinuation);
+      udWorkerPool_ReleaseTaskRef(pContinuation);
+    }
+    pContinuation = pNext;
   }
 
-  udSafeDeque_Destroy(&pPool->pQueuedTasks);
-  udSafeDeque_Destroy(&pPool->pQueuedPostTasks);
-  udDestroySemaphore(&pPool->pSemaphore);
+  udWorkerPool_SignalWaiters(pTask);
+}
 
-  udFree(pPool->pThreadData);
-  udFree(pPool);
+// ----------------------------------------------------------------------------
+// Cancel a task if it hasn't started, returns false if it has already started or finished
+static bool udWorkerPool_TryCancel(udWorkerPoolTask *pTask)
+{
+  int32_t expected = udWPTS_Queued;
+  if (!pTask->state.compare_exchange_strong(expected, udWPTS_Cancelled))
+    return false;
+
+  if (pTask->freeDataBlock)
+    udFree(pTask->pDataBlock);
+  udWorkerPool_FinishTask(pTask, udWPTS_Cancelled);
+  return true;
 }
 
 // ----------------------------------------------------------------------------
-// Author: Paul Fox, May 2015
-udResult udWorkerPool_AddTask(udWorkerPool *pPool, udWorkerPoolCallback func, void *pUserData /*= nullptr*/, bool clearMemory /*= true*/, udWorkerPoolCallback postFunction /*= nullptr*/)
+// Add to one of a worker's counters, only the worker itself does this so no atomic add is needed
+static inline void udWorkerPool_AddCount(std::atomic<uint64_t> &counter, uint64_t value)
 {
-  udResult result = udR_Failure;
-  udWorkerPoolTask tempTask;
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
 
-  UD_ERROR_NULL(pPool, udR_InvalidParameter);
-  UD_ERROR_NULL(pPool->pQueuedTasks, udR_NotInitialized);
-  UD_ERROR_NULL(pPool->pQueuedPostTasks, udR_NotInitialized);
-  UD_ERROR_NULL(pPool->pSemaphore, udR_NotInitialized);
-  UD_ERROR_IF(!pPool->isRunning, udR_NotAllowed);
+// ----------------------------------------------------------------------------
+// Bucket 0 counts latencies under 1us, bucket i counts [2^(i-1), 2^i)us
+static int udWorkerPool_LatencyBucket(udWorkerPool *pPool, uint64_t ticks)
+{
+  uint64_t microseconds = (uint64_t)(ticks * pPool->microsecondsPerTick);
+  int bucket = 0;
+  while (microseconds > 0 && bucket < udWorkerPool_LatencyBucketCount - 1)
+  {
+    microseconds >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+// ----------------------------------------------------------------------------
+// Run a task taken by udWorkerPool_FindTask, tasks cancelled while queued are just released
+static void udWorkerPool_RunTask(udWorkerPool *pPool, udWorkerPoolThread *pThread, udWorkerPoolTask *pTask)
+{
+  int32_t expected = udWPTS_Queued;
+  if (pTask->state.compare_exchange_strong(expected, udWPTS_Running))
+  {
+    udWorkerPoolThreadCounters *pCounters = &pThread->counters;
+    uint64_t startTicks = udPerfCounterStart();
+    udWorkerPool_AddCount(pCounters->latencyHistogram[udWorkerPool_LatencyBucket(pPool, (startTicks > pTask->queuedTicks) ? startTicks - pTask->queuedTicks : 0)], 1);
+
+    if (pTask->function)
+      pTask->function(pTask->pDataBlock);
 
-  tempTask.function = func;
-  tempTask.postFunction = postFunction;
-  tempTask.pDataBlock = pUserData;
-  tempTask.freeDataBlock = clearMemory;
+    udWorkerPool_AddCount(pCounters->runTicks, udPerfCounterStart() - startTicks);
+    udWorkerPool_AddCount(pCounters->tasksRun, 1);
 
-  if (func == nullptr && postFunction != nullptr)
-    UD_ERROR_CHECK(udSafeDeque_PushBack(pPool->pQueuedPostTasks, tempTask));
+    if (pTask->postFunction)
+    {
+      // Finished before queueing, as the post work may release the pool's reference at any point after that
+      udWorkerPool_FinishTask(pTask, udWPTS_Complete);
+      udSafeDeque_PushBack(pPool->pQueuedPostTasks, pTask);
+    }
+    else
+    {
+      if (pTask->freeDataBlock)
+        udFree(pTask->pDataBlock);
+      udWorkerPool_FinishTask(pTask, udWPTS_Complete);
+      udWorkerPool_ReleaseTaskRef(pTask);
+    }
+  }
   else
-    UD_ERROR_CHECK(udSafeDeque_PushBack(pPool->pQueuedTasks, tempTask));
+  {
+    udWorkerPool_ReleaseTaskRef(pTask);
+  }
 
-  udIncrementSemaphore(pPool->pSemaphore);
+  --pPool->activeThreads;
+}
 
-  result = udR_Success;
+// ----------------------------------------------------------------------------
+// Queue a task that's ready to start, tasks with only a postFunction skip the workers and go straight to the post work
+static udResult udWorkerPool_StartTask(udWorkerPool *pPool, udWorkerPoolTask *pTask)
+{
+  if (pTask->function == nullptr && pTask->postFunction != nullptr)
+  {
+    int32_t expected = udWPTS_Queued;
+    if (!pTask->state.compare_exchange_strong(expected, udWPTS_Running))
+    {
+      // Cancelled while delayed
+      udWorkerPool_ReleaseTaskRef(pTask);
+      return udR_Success;
+    }
+    udWorkerPool_FinishTask(pTask, udWPTS_Complete);
+    return udSafeDeque_PushBack(pPool->pQueuedPostTasks, pTask);
+  }
 
-epilogue:
-  return result;
+  return udWorkerPool_QueueTask(pPool, pTask);
 }
 
 // ----------------------------------------------------------------------------
-// Author: Paul Fox, May 2015
-udResult udWorkerPool_DoPostWork(udWorkerPool *pPool, int processLimit /*= 0*/)
+static udWorkerPoolTask *udWorkerPool_PopSharedTask(udWorkerPool *pPool, udWorkerPoolPriority priority)
 {
-  udWorkerPoolTask currentTask;
-  udResult result = udR_Success;
-  int processedItems = 0;
+  udWorkerPoolTask *pTask = nullptr;
+  if (pPool->sharedTaskCount[priority].load(std::memory_order_relaxed) > 0 && udSafeDeque_PopFront(pPool->pQueuedTasks[priority], &pTask) == udR_Success)
+    --pPool->sharedTaskCount[priority];
+  return pTask;
+}
 
-  UD_ERROR_NULL(pPool, udR_InvalidParameter);
-  UD_ERROR_NULL(pPool->pQueuedTasks, udR_NotInitialized);
-  UD_ERROR_NULL(pPool->pQueuedPostTasks, udR_NotInitialized);
-  UD_ERROR_NULL(pPool->pSemaphore, udR_NotInitialized);
-  UD_ERROR_IF(!pPool->isRunning, udR_NotAllowed);
+// ----------------------------------------------------------------------------
+// Take a normal priority task: the worker's own newest task, then the shared queue, then the oldest task of another worker
+static udWorkerPoolTask *udWorkerPool_FindNormalTask(udWorkerPool *pPool, udWorkerPoolThread *pThread)
+{
+  udWorkerPoolTask *pTask = udWorkerPool_DequePop(&pThread->deque);
 
-  while (udSafeDeque_PopFront(pPool->pQueuedPostTasks, &currentTask) == udR_Success)
+  if (!pTask)
+    pTask = udWorkerPool_PopSharedTask(pPool, udWPP_Normal);
+
+  uint32_t slotsInUse = pPool->slotsInUse.load(std::memory_order_acquire);
+  if (!pTask && slotsInUse > 1)
   {
-    currentTask.postFunction(currentTask.pDataBlock);
+    // Start at a random worker so thieves spread out
+    pThread->stealSeed ^= pThread->stealSeed << 13;
+    pThread->stealSeed ^= pThread->stealSeed >> 17;
+    pThread->stealSeed ^= pThread->stealSeed << 5;
+    uint32_t first = pThread->stealSeed % slotsInUse;
+    for (uint32_t i = 0; !pTask && i < slotsInUse; ++i)
+    {
+      udWorkerPoolThread *pVictim = &pPool->pThreadData[(first + i) % slotsInUse];
+      if (pVictim != pThread)
+        pTask = udWorkerPool_DequeSteal(&pVictim->deque);
+    }
+    if (pTask)
+      udWorkerPool_AddCount(pThread->counters.tasksStolen, 1);
+  }
 
-    if (currentTask.freeDataBlock)
-      udFree(currentTask.pDataBlock);
+  return pTask;
+}
 
-    if (++processedItems == processLimit)
-      break;
-  }
+// ----------------------------------------------------------------------------
+// Heap ordering for delayed tasks, so the earliest start time is first
+static bool udWorkerPool_LaterStart(const udWorkerPoolTask *pA, const udWorkerPoolTask *pB)
+{
+  return (int32_t)(pA->startTimeMs - pB->startTimeMs) > 0;
+}
 
-epilogue:
-  if (result == udR_Success && processedItems == 0)
-    return udR_NothingToDo;
+// ----------------------------------------------------------------------------
+// Start any delayed tasks that are due
+static void udWorkerPool_StartDelayedTasks(udWorkerPool *pPool)
+{
+  if (pPool->delayedTaskCount.load(std::memory_order_relaxed) == 0)
+    return;
 
-  return result;
+  uint32_t nowMs = udGetTimeMs();
+  if ((int32_t)(nowMs - pPool->nextStartTimeMs.load()) < 0)
+    return;
+
+  udScopeLock lock(pPool->pDelayedMutex);
+  int64_t delayedCount = pPool->delayedTaskCount;
+  while (delayedCount > 0 && (int32_t)(nowMs - pPool->ppDelayedTasks[0]->startTimeMs) >= 0)
+  {
+    std::pop_heap(pPool->ppDelayedTasks, pPool->ppDelayedTasks + delayedCount, udWorkerPool_LaterStart);
+    udWorkerPoolTask *pTask = pPool->ppDelayedTasks[--delayedCount];
+    pTask->isDelayed = false;
+    if (udWorkerPool_StartTask(pPool, pTask) != udR_Success)
+    {
+      udWorkerPool_TryCancel(pTask);
+      udWorkerPool_ReleaseTaskRef(pTask);
+    }
+    pPool->delayedTaskCount = delayedCount; // Only once it's counted as queued, see udWorkerPool_HasActiveWorkers
+  }
+  if (delayedCount > 0)
+    pPool->nextStartTimeMs = pPool->ppDelayedTasks[0]->startTimeMs;
 }
 
 // ----------------------------------------------------------------------------
-// Author: Paul Fox, May 2015
-bool udWorkerPool_HasActiveWorkers(udWorkerPool *pPool, size_t *pActiveThreads /*= nullptr*/, size_t *pQueuedTasks /*= nullptr*/)
+// Take the next task for a worker, critical tasks first and background tasks last, except every udWorkerPool_StarvationInterval tasks
+static udWorkerPoolTask *udWorkerPool_FindTask(udWorkerPool *pPool, udWorkerPoolThread *pThread)
 {
-  if (pPool == nullptr)
-    return false;
+  udWorkerPoolTask *pTask = nullptr;
 
-  udLockMutex(pPool->pQueuedTasks->pMutex);
-  int32_t activeThreads = pPool->activeThreads;
-  size_t queuedTasks = pPool->pQueuedTasks->chunkedArray.length;
-  udReleaseMutex(pPool->pQueuedTasks->pMutex);
+  udWorkerPool_StartDelayedTasks(pPool);
 
-  if (pActiveThreads)
-    *pActiveThreads = (size_t)std::max(activeThreads, 0);
+  if ((pThread->takenCount % udWorkerPool_StarvationInterval) == udWorkerPool_StarvationInterval - 1)
+  {
+    pTask = udWorkerPool_PopSharedTask(pPool, udWPP_Background);
+    if (!pTask)
+      pTask = udWorkerPool_FindNormalTask(pPool, pThread);
+    if (!pTask)
+      pTask = udWorkerPool_PopSharedTask(pPool, udWPP_Critical);
+  }
+  else
+  {
+    pTask = udWorkerPool_PopSharedTask(pPool, udWPP_Critical);
+    if (!pTask)
+      pTask = udWorkerPool_FindNormalTask(pPool, pThread);
+    if (!pTask)
+      pTask = udWorkerPool_PopSharedTask(pPool, udWPP_Background);
+  }
 
-  if (pQueuedTasks)
-    *pQueuedTasks = queuedTasks;
+  if (pTask)
+  {
+    ++pThread->takenCount;
 
-  return (activeThreads > 0 || queuedTasks > 0);
+    // Count as active before no longer counting as queued, so udWorkerPool_HasActiveWorkers never sees neither
+    ++pPool->activeThreads;
+    int64_t queuedTasks = --pPool->queuedTaskCount;
+
+    // Tasks queued while every worker was busy only asked for one worker each, so pools that can grow check again as the backlog is taken
+    if (queuedTasks > 0 && (pPool->minThreads != pPool->maxThreads || pPool->blockedThreads.load(std::memory_order_relaxed) > 0))
+      udWorkerPool_WakeWorkers(pPool, 1);
+  }
+  return pTask;
+}
+
+// ----------------------------------------------------------------------------
+// Add tasks with their start times set to the delayed heap, either all of them are added or none are
+static udResult udWorkerPool_AddDelayedTasks(udWorkerPool *pPool, udWorkerPoolTask **ppTasks, size_t count)
+{
+  udScopeLock lock(pPool->pDelayedMutex);
+  int64_t delayedCount = pPool->delayedTaskCount;
+  udWorkerPoolTask *pPreviousFirst = (delayedCount > 0) ? pPool->ppDelayedTasks[0] : nullptr;
+
+  if ((size_t)delayedCount + count > pPool->delayedCapacity)
+  {
+    size_t capacity = std::max(std::max(pPool->delayedCapacity * 2, (size_t)udWorkerPool_InitialDelayedCapacity), (size_t)delayedCount + count);
+    udWorkerPoolTask **ppGrown = udReallocType(pPool->ppDelayedTasks, udWorkerPoolTask*, capacity);
+    if (ppGrown == nullptr)
+      return udR_MemoryAllocationFailure;
+    pPool->ppDelayedTasks = ppGrown;
+    pPool->delayedCapacity = capacity;
+  }
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    ppTasks[i]->isDelayed = true;
+    pPool->ppDelayedTasks[delayedCount++] = ppTasks[i];
+    std::push_heap(pPool->ppDelayedTasks, pPool->ppDelayedTasks + delayedCount, udWorkerPool_LaterStart);
+  }
+  pPool->nextStartTimeMs = pPool->ppDelayedTasks[0]->startTimeMs;
+  pPool->delayedTaskCount = delayedCount;
+
+  // A sleeping worker may be waiting longer than the new first task's delay, so wake one to shorten its sleep
+  if (pPool->ppDelayedTasks[0] != pPreviousFirst)
+    udWorkerPool_WakeWorkers(pPool, 1);
+
+  return udR_Success;
+}
+
+// ----------------------------------------------------------------------------
+// Queue tasks that were all created by one udWorkerPool_AddTasks call and go to the same place, tasks that can't be queued are cancelled
+static udResult udWorkerPool_QueueBatch(udWorkerPool *pPool, udWorkerPoolBatchGroup group, udWorkerPoolTask **ppTasks, size_t count)
+{
+  udResult result = udR_Success;
+  udWorkerPoolThread *pThread = t_pWorkerPoolThread;
+  udWorkerPoolPriority priority = udWPP_Normal;
+  size_t localCount = 0;
+  uint64_t queuedTicks = 0;
+
+  switch (group)
+  {
+  case udWPBG_Delayed:
+    result = udWorkerPool_AddDelayedTasks(pPool, ppTasks, count);
+    break;
+
+  case udWPBG_PostOnly:
+    // Nothing else can see these tasks yet, so they can be completed directly
+    for (size_t i = 0; i < count; ++i)
+      udWorkerPool_FinishTask(ppTasks[i], udWPTS_Complete);
+    result = udSafeDeque_PushBack(pPool->pQueuedPostTasks, ppTasks, count);
+    if (result != udR_Success)
+    {
+      for (size_t i = 0; i < count; ++i)
+      {
+        if (ppTasks[i]->freeDataBlock)
+          udFree(ppTasks[i]->pDataBlock);
+        udWorkerPool_ReleaseTaskRef(ppTasks[i]);
+      }
+      return result;
+    }
+    break;
+
+  case udWPBG_Critical:
+  case udWPBG_Normal:
+  case udWPBG_Background:
+    priority = (udWorkerPoolPriority)(udWPP_Critical + (group - udWPBG_Critical));
+    queuedTicks = udPerfCounterStart();
+    for (size_t i = 0; i < count; ++i)
+      ppTasks[i]->queuedTicks = queuedTicks;
+    pPool->queuedTaskCount += count;
+
+    // Normal tasks added from one of the pool's workers go to its deque without locking, as many as it can take
+    if (priority == udWPP_Normal && pThread && pThread->pPool == pPool)
+    {
+      while (localCount < count && udWorkerPool_DequePush(&pThread->deque, ppTasks[localCount]) == udR_Success)
+        ++localCount;
+    }
+
+    if (localCount < count)
+    {
+      result = udSafeDeque_PushBack(pPool->pQueuedTasks[priority], ppTasks + localCount, count - localCount);
+      if (result == udR_Success)
+        pPool->sharedTaskCount[priority] += count - localCount;
+      else
+        pPool->queuedTaskCount -= count - localCount;
+    }
+
+    udWorkerPool_WakeWorkers(pPool, (int32_t)std::min(result == udR_Success ? count : localCount, (size_t)INT32_MAX));
+
+    if (result != udR_Success)
+    {
+      ppTasks += localCount;
+      count -= localCount;
+    }
+    break;
+
+  case udWPBG_Count:
+    result = udR_InvalidParameter;
+    break;
+  }
+
+  if (result != udR_Success)
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      udWorkerPool_TryCancel(ppTasks[i]);
+      udWorkerPool_ReleaseTaskRef(ppTasks[i]);
+    }
+  }
+
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Called by workers as they go, one of them calls the dump callback each time the interval passes
+static void udWorkerPool_DumpStatsIfDue(udWorkerPool *pPool, uint32_t nowMs)
+{
+  uint32_t intervalMs = pPool->statsDumpIntervalMs.load(std::memory_order_relaxed);
+  if (intervalMs == 0)
+    return;
+
+  uint32_t nextMs = pPool->nextStatsDumpMs.load(std::memory_order_relaxed);
+  if ((int32_t)(nowMs - nextMs) < 0 || !pPool->nextStatsDumpMs.compare_exchange_strong(nextMs, nowMs + intervalMs))
+    return;
+
+  udScopeLock lock(pPool->pStatsMutex);
+  if (pPool->statsDumpIntervalMs == 0)
+    return;
+
+  udJSON json;
+  const char *pText = nullptr;
+  if (udWorkerPool_ExportStats(pPool, &json) == udR_Success && json.Export(&pText) == udR_Success)
+  {
+    if (pPool->statsDumpCallback)
+      pPool->statsDumpCallback(pText);
+    else
+      udDebugPrintf("%s\n", pText);
+  }
+  udFree(pText);
+}
+
+// ----------------------------------------------------------------------------
+// Author: Paul Fox, May 2015
+uint32_t udWorkerPool_DoWork(void *pPoolPtr)
+{
+  UDRELASSERT(pPoolPtr != nullptr, "Bad Pool Ptr!");
+
+  udWorkerPoolThread *pThreadData = (udWorkerPoolThread*)pPoolPtr;
+  udWorkerPool *pPool = pThreadData->pPool;
+  int idleCount = 0;
+  uint64_t idleStartTicks = udPerfCounterStart();
+
+  t_pWorkerPoolThread = pThreadData;
+
+  while (pPool->isRunning)
+  {
+    udWorkerPoolTask *pTask = udWorkerPool_FindTask(pPool, pThreadData);
+
+    if (!pTask)
+    {
+      if (idleCount == 0)
+        idleStartTicks = udPerfCounterStart();
+
+      if (++idleCount < udWorkerPool_IdleSpinCount)
+      {
+        udYield();
+        continue;
+      }
+
+      // Count as sleeping before the final check, so a task queued after the check will signal the semaphore
+      ++pPool->sleepingThreads;
+      pTask = udWorkerPool_FindTask(pPool, pThreadData);
+      if (!pTask)
+      {
+        int sleepMs = udWorkerPool_SleepTimeoutMs;
+        if (pPool->delayedTaskCount.load() > 0)
+          sleepMs = std::max(std::min((int32_t)(pPool->nextStartTimeMs.load() - udGetTimeMs()), sleepMs), 1);
+        udWaitSemaphore(pPool->pSemaphore, sleepMs);
+      }
+      --pPool->sleepingThreads;
+
+      if (!pTask)
+      {
+        udWorkerPool_DumpStatsIfDue(pPool, udGetTimeMs());
+        if (udWorkerPool_TryRetireThread(pPool, pThreadData))
+          break;
+        continue;
+      }
+    }
+
+    if (idleCount > 0)
+      udWorkerPool_AddCount(pThreadData->counters.idleTicks, udPerfCounterStart() - idleStartTicks);
+    idleCount = 0;
+
+    udWorkerPool_RunTask(pPool, pThreadData, pTask);
+    pThreadData->lastWorkMs = udGetTimeMs();
+    udWorkerPool_DumpStatsIfDue(pPool, pThreadData->lastWorkMs);
+  }
+
+  if (idleCount > 0)
+    udWorkerPool_AddCount(pThreadData->counters.idleTicks, udPerfCounterStart() - idleStartTicks);
+
+  t_pWorkerPoolThread = nullptr;
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+// Author: Paul Fox, May 2015
+udResult udWorkerPool_Create(udWorkerPool **ppPool, uint32_t totalThreads, const char *pThreadNamePrefix /*= "udWorkerPool"*/)
+{
+  return udWorkerPool_CreateElastic(ppPool, totalThreads, totalThreads, udWorkerPool_DefaultIdleTimeoutMs, pThreadNamePrefix);
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_CreateElastic(udWorkerPool **ppPool, uint32_t minThreads, uint32_t maxThreads, uint32_t idleTimeoutMs /*= 5000*/, const char *pThreadNamePrefix /*= "udWorkerPool"*/)
+{
+  udResult result = udR_Failure;
+  udWorkerPool *pPool = nullptr;
+
+  UD_ERROR_NULL(ppPool, udR_InvalidParameter);
+  UD_ERROR_IF(minThreads == 0 || maxThreads < minThreads || maxThreads > INT32_MAX / 2, udR_InvalidParameter);
+
+  pPool = udAllocType(udWorkerPool, 1, udAF_Zero);
+  UD_ERROR_NULL(pPool, udR_MemoryAllocationFailure);
+
+  pPool->pSemaphore = udCreateSemaphore();
+  UD_ERROR_NULL(pPool, udR_MemoryAllocationFailure);
+
+  pPool->pWaitMutex = udCreateMutex();
+  UD_ERROR_NULL(pPool->pWaitMutex, udR_MemoryAllocationFailure);
+  pPool->pWaitCondition = udCreateConditionVariable();
+  UD_ERROR_NULL(pPool->pWaitCondition, udR_MemoryAllocationFailure);
+
+  pPool->pDelayedMutex = udCreateMutex();
+  UD_ERROR_NULL(pPool->pDelayedMutex, udR_MemoryAllocationFailure);
+
+  pPool->pThreadMutex = udCreateMutex();
+  UD_ERROR_NULL(pPool->pThreadMutex, udR_MemoryAllocationFailure);
+
+  pPool->pStatsMutex = udCreateMutex();
+  UD_ERROR_NULL(pPool->pStatsMutex, udR_MemoryAllocationFailure);
+  pPool->microsecondsPerTick = udPerfCounterMilliseconds(0, 1000000) / 1000.0; // Milliseconds for a million ticks is microseconds per tick * 1000
+
+  for (int i = 0; i < udWPP_Count; ++i)
+    UD_ERROR_CHECK(udSafeDeque_Create(&pPool->pQueuedTasks[i], 32));
+  UD_ERROR_CHECK(udSafeDeque_Create(&pPool->pQueuedPostTasks, 32));
+
+  pPool->pThreadNamePrefix = udStrdup(pThreadNamePrefix);
+  UD_ERROR_NULL(pPool->pThreadNamePrefix, udR_MemoryAllocationFailure);
+
+  pPool->minThreads = minThreads;
+  pPool->maxThreads = maxThreads;
+  pPool->idleTimeoutMs = idleTimeoutMs;
+  pPool->slotCount = maxThreads * 2;
+  pPool->pThreadData = udAllocType(udWorkerPoolThread, pPool->slotCount, udAF_Zero);
+  UD_ERROR_NULL(pPool->pThreadData, udR_MemoryAllocationFailure);
+
+  pPool->isRunning = true;
+  for (uint32_t i = 0; i < minThreads; ++i)
+    UD_ERROR_CHECK(udWorkerPool_StartThread(pPool));
+
+  result = udR_Success;
+  *ppPool = pPool;
+  pPool = nullptr;
+
+epilogue:
+  udWorkerPool_Destroy(&pPool);
+
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Author: Paul Fox, May 2015
+void udWorkerPool_Destroy(udWorkerPool **ppPool)
+{
+  if (ppPool == nullptr || *ppPool == nullptr)
+    return;
+
+  udWorkerPool *pPool = *ppPool;
+  *ppPool = nullptr;
+
+  pPool->isRunning = false;
+
+  if (pPool->pThreadData)
+  {
+    // Once the lock has been taken no more workers can start, so every slot in use can be joined
+    udLockMutex(pPool->pThreadMutex);
+    udReleaseMutex(pPool->pThreadMutex);
+
+    uint32_t slotsInUse = pPool->slotsInUse;
+    udIncrementSemaphore(pPool->pSemaphore, (int)slotsInUse);
+    for (uint32_t i = 0; i < slotsInUse; i++)
+    {
+      if (pPool->pThreadData[i].pThread)
+      {
+        udThread_Join(pPool->pThreadData[i].pThread);
+        udThread_Destroy(&pPool->pThreadData[i].pThread);
+      }
+    }
+
+    // With the workers stopped, the owner's end of each deque can be drained from this thread
+    for (uint32_t i = 0; i < slotsInUse; i++)
+    {
+      udWorkerPoolDeque *pDeque = &pPool->pThreadData[i].deque;
+      udWorkerPoolDequeArray *pArray = pDeque->pArray.load();
+      if (!pArray)
+        continue;
+
+      for (udWorkerPoolTask *pTask = udWorkerPool_DequePop(pDeque); pTask; pTask = udWorkerPool_DequePop(pDeque))
+      {
+        udWorkerPool_TryCancel(pTask);
+        udWorkerPool_ReleaseTaskRef(pTask);
+      }
+
+      while (pArray)
+      {
+        udWorkerPoolDequeArray *pPrevious = pArray->pPrevious;
+        udFree(pArray);
+        pArray = pPrevious;
+      }
+    }
+  }
+
+  udWorkerPoolTask *pTask;
+  for (int i = 0; i < udWPP_Count; ++i)
+  {
+    if (pPool->pQueuedTasks[i])
+    {
+      while (udSafeDeque_PopFront(pPool->pQueuedTasks[i], &pTask) == udR_Success)
+      {
+        udWorkerPool_TryCancel(pTask);
+        udWorkerPool_ReleaseTaskRef(pTask);
+      }
+    }
+  }
+
+  for (int64_t i = 0; i < pPool->delayedTaskCount; ++i)
+  {
+    udWorkerPool_TryCancel(pPool->ppDelayedTasks[i]);
+    udWorkerPool_ReleaseTaskRef(pPool->ppDelayedTasks[i]);
+  }
+
+  // Tasks waiting for post work have already completed
+  if (pPool->pQueuedPostTasks)
+  {
+    while (udSafeDeque_PopFront(pPool->pQueuedPostTasks, &pTask) == udR_Success)
+    {
+      if (pTask->freeDataBlock)
+        udFree(pTask->pDataBlock);
+      udWorkerPool_ReleaseTaskRef(pTask);
+    }
+  }
+
+  for (int i = 0; i < udWPP_Count; ++i)
+    udSafeDeque_Destroy(&pPool->pQueuedTasks[i]);
+  udSafeDeque_Destroy(&pPool->pQueuedPostTasks);
+  udFree(pPool->ppDelayedTasks);
+  udDestroyMutex(&pPool->pDelayedMutex);
+  udDestroyMutex(&pPool->pThreadMutex);
+  udDestroyMutex(&pPool->pStatsMutex);
+  udDestroySemaphore(&pPool->pSemaphore);
+  udDestroyConditionVariable(&pPool->pWaitCondition);
+  udDestroyMutex(&pPool->pWaitMutex);
+
+  udFree(pPool->pThreadData);
+  udFree(pPool->pThreadNamePrefix);
+  udFree(pPool);
+}
+
+// ----------------------------------------------------------------------------
+// Author: Paul Fox, May 2015
+udResult udWorkerPool_AddTask(udWorkerPool *pPool, udWorkerPoolCallback func, void *pUserData /*= nullptr*/, bool clearMemory /*= true*/, udWorkerPoolCallback postFunction /*= nullptr*/, udWorkerPoolTask **ppTask /*= nullptr*/)
+{
+  udWorkerPoolTaskDesc desc;
+  desc.function = func;
+  desc.pUserData = pUserData;
+  desc.clearMemory = clearMemory;
+  desc.postFunction = postFunction;
+
+  return udWorkerPool_AddTask(pPool, &desc, ppTask);
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_AddTask(udWorkerPool *pPool, const udWorkerPoolTaskDesc *pDesc, udWorkerPoolTask **ppTask /*= nullptr*/)
+{
+  udResult result = udR_Failure;
+  udWorkerPoolTask *pTask = nullptr;
+
+  UD_ERROR_NULL(pPool, udR_InvalidParameter);
+  UD_ERROR_NULL(pDesc, udR_InvalidParameter);
+  UD_ERROR_IF(pDesc->priority < 0 || pDesc->priority >= udWPP_Count, udR_InvalidParameter);
+  UD_ERROR_NULL(pPool->pQueuedTasks[pDesc->priority], udR_NotInitialized);
+  UD_ERROR_NULL(pPool->pQueuedPostTasks, udR_NotInitialized);
+  UD_ERROR_NULL(pPool->pSemaphore, udR_NotInitialized);
+  UD_ERROR_IF(!pPool->isRunning, udR_NotAllowed);
+
+  pTask = udWorkerPool_CreateTask(pPool, pDesc->function, pDesc->pUserData, pDesc->clearMemory, pDesc->postFunction, pDesc->priority, ppTask != nullptr);
+  UD_ERROR_NULL(pTask, udR_MemoryAllocationFailure);
+
+  if (pDesc->delayMs > 0)
+  {
+    pTask->startTimeMs = udGetTimeMs() + pDesc->delayMs;
+    UD_ERROR_CHECK(udWorkerPool_AddDelayedTasks(pPool, &pTask, 1));
+  }
+  else
+  {
+    UD_ERROR_CHECK(udWorkerPool_StartTask(pPool, pTask));
+  }
+
+  if (ppTask)
+    *ppTask = pTask;
+  pTask = nullptr;
+
+  result = udR_Success;
+
+epilogue:
+  udDelete(pTask);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_AddTasks(udWorkerPool *pPool, const udWorkerPoolTaskDesc *pTasks, size_t count, udWorkerPoolTask **ppTasks /*= nullptr*/)
+{
+  udResult result = udR_Failure;
+  udWorkerPoolTask **ppCreated = nullptr;
+  udWorkerPoolTask **ppBatch = nullptr;
+  size_t createdCount = 0;
+  uint32_t nowMs = udGetTimeMs();
+
+  UD_ERROR_NULL(pPool, udR_InvalidParameter);
+  UD_ERROR_IF(pTasks == nullptr && count > 0, udR_InvalidParameter);
+  UD_ERROR_NULL(pPool->pQueuedPostTasks, udR_NotInitialized);
+  UD_ERROR_IF(!pPool->isRunning, udR_NotAllowed);
+  for (size_t i = 0; i < count; ++i)
+    UD_ERROR_IF(pTasks[i].priority < 0 || pTasks[i].priority >= udWPP_Count, udR_InvalidParameter);
+
+  if (count == 0)
+    UD_ERROR_SET(udR_Success);
+
+  // The second half is used to gather the tasks going to each queue
+  ppCreated = udAllocType(udWorkerPoolTask*, count * 2, udAF_None);
+  UD_ERROR_NULL(ppCreated, udR_MemoryAllocationFailure);
+  ppBatch = ppCreated + count;
+
+  for (; createdCount < count; ++createdCount)
+  {
+    const udWorkerPoolTaskDesc &desc = pTasks[createdCount];
+    udWorkerPoolTask *pTask = udWorkerPool_CreateTask(pPool, desc.function, desc.pUserData, desc.clearMemory, desc.postFunction, desc.priority, ppTasks != nullptr);
+    UD_ERROR_NULL(pTask, udR_MemoryAllocationFailure);
+    pTask->startTimeMs = nowMs + desc.delayMs;
+    ppCreated[createdCount] = pTask;
+  }
+
+  // Each queue is locked once for all the tasks going to it. If one fails, the tasks for it and any queues after it are cancelled
+  result = udR_Success;
+  for (int group = 0; group < udWPBG_Count; ++group)
+  {
+    size_t batchCount = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (udWorkerPool_GetBatchGroup(&pTasks[i]) == group)
+        ppBatch[batchCount++] = ppCreated[i];
+    }
+
+    if (batchCount == 0)
+      continue;
+
+    if (result == udR_Success)
+    {
+      result = udWorkerPool_QueueBatch(pPool, (udWorkerPoolBatchGroup)group, ppBatch, batchCount);
+    }
+    else
+    {
+      for (size_t i = 0; i < batchCount; ++i)
+      {
+        udWorkerPool_TryCancel(ppBatch[i]);
+        udWorkerPool_ReleaseTaskRef(ppBatch[i]);
+      }
+    }
+  }
+
+  // Cancelled tasks still have handles, so every handle the caller asked for needs releasing
+  if (ppTasks)
+    memcpy(ppTasks, ppCreated, sizeof(udWorkerPoolTask*) * count);
+  createdCount = 0;
+
+epilogue:
+  for (size_t i = 0; i < createdCount; ++i)
+    udDelete(ppCreated[i]);
+  udFree(ppCreated);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Author: Paul Fox, May 2015
+udResult udWorkerPool_DoPostWork(udWorkerPool *pPool, int processLimit /*= 0*/)
+{
+  udWorkerPoolTask *pTask;
+  udResult result = udR_Success;
+  int processedItems = 0;
+
+  UD_ERROR_NULL(pPool, udR_InvalidParameter);
+  UD_ERROR_NULL(pPool->pQueuedPostTasks, udR_NotInitialized);
+  UD_ERROR_NULL(pPool->pSemaphore, udR_NotInitialized);
+  UD_ERROR_IF(!pPool->isRunning, udR_NotAllowed);
+
+  while (udSafeDeque_PopFront(pPool->pQueuedPostTasks, &pTask) == udR_Success)
+  {
+    pTask->postFunction(pTask->pDataBlock);
+    if (pTask->freeDataBlock)
+      udFree(pTask->pDataBlock);
+    udWorkerPool_ReleaseTaskRef(pTask);
+
+    if (++processedItems == processLimit)
+      break;
+  }
+
+epilogue:
+  if (result == udR_Success && processedItems == 0)
+    return udR_NothingToDo;
+
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+// Author: Paul Fox, May 2015
+bool udWorkerPool_HasActiveWorkers(udWorkerPool *pPool, size_t *pActiveThreads /*= nullptr*/, size_t *pQueuedTasks /*= nullptr*/)
+{
+  if (pPool == nullptr)
+    return false;
+
+  // Delayed then queued are read first, as a task stops being delayed only after it's queued and stops being queued only after its worker is counted as active
+  int64_t delayedTasks = pPool->delayedTaskCount;
+  int64_t queuedTasks = pPool->queuedTaskCount + delayedTasks;
+  int32_t activeThreads = pPool->activeThreads;
+
+  if (pActiveThreads)
+    *pActiveThreads = (size_t)std::max(activeThreads, 0);
+
+  if (pQueuedTasks)
+    *pQueuedTasks = (size_t)std::max(queuedTasks, (int64_t)0);
+
+  return (activeThreads > 0 || queuedTasks > 0);
+}
+
+// ----------------------------------------------------------------------------
+uint32_t udWorkerPool_GetThreadCount(udWorkerPool *pPool)
+{
+  if (pPool == nullptr)
+    return 0;
+
+  return (uint32_t)std::max(pPool->liveThreads.load(), 0);
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_GetStats(udWorkerPool *pPool, udWorkerPoolStats *pStats, udWorkerPoolThreadStats *pThreadStats /*= nullptr*/, uint32_t threadStatsCount /*= 0*/)
+{
+  if (pPool == nullptr || pStats == nullptr || (pThreadStats == nullptr && threadStatsCount > 0))
+    return udR_InvalidParameter;
+
+  memset(pStats, 0, sizeof(*pStats));
+  pStats->threadSlots = pPool->slotsInUse.load(std::memory_order_acquire);
+
+  for (uint32_t i = 0; i < pStats->threadSlots; ++i)
+  {
+    const udWorkerPoolThread *pThread = &pPool->pThreadData[i];
+    const udWorkerPoolThreadCounters *pCounters = &pThread->counters;
+    udWorkerPoolThreadStats threadStats;
+
+    threadStats.isLive = !pThread->hasRetired.load();
+    threadStats.tasksRun = pCounters->tasksRun.load(std::memory_order_relaxed);
+    threadStats.tasksStolen = pCounters->tasksStolen.load(std::memory_order_relaxed);
+    threadStats.runTimeMs = pCounters->runTicks.load(std::memory_order_relaxed) * pPool->microsecondsPerTick / 1000.0;
+    threadStats.idleTimeMs = pCounters->idleTicks.load(std::memory_order_relaxed) * pPool->microsecondsPerTick / 1000.0;
+    for (int bucket = 0; bucket < udWorkerPool_LatencyBucketCount; ++bucket)
+      threadStats.latencyHistogram[bucket] = pCounters->latencyHistogram[bucket].load(std::memory_order_relaxed);
+
+    pStats->total.tasksRun += threadStats.tasksRun;
+    pStats->total.tasksStolen += threadStats.tasksStolen;
+    pStats->total.runTimeMs += threadStats.runTimeMs;
+    pStats->total.idleTimeMs += threadStats.idleTimeMs;
+    for (int bucket = 0; bucket < udWorkerPool_LatencyBucketCount; ++bucket)
+      pStats->total.latencyHistogram[bucket] += threadStats.latencyHistogram[bucket];
+
+    if (i < threadStatsCount)
+      pThreadStats[i] = threadStats;
+  }
+  pStats->total.isLive = true;
+
+  pStats->liveThreads = (uint32_t)std::max(pPool->liveThreads.load(), 0);
+  pStats->blockedThreads = (uint32_t)std::max(pPool->blockedThreads.load(), 0);
+  pStats->activeThreads = (uint32_t)std::max(pPool->activeThreads.load(), 0);
+  pStats->delayedTasks = (uint64_t)std::max(pPool->delayedTaskCount.load(), (int64_t)0);
+  pStats->queuedTasks = (uint64_t)std::max(pPool->queuedTaskCount.load(), (int64_t)0);
+
+  pStats->postTaskBacklog = udSafeDeque_GetLength(pPool->pQueuedPostTasks);
+
+  return udR_Success;
+}
+
+// ----------------------------------------------------------------------------
+static void udWorkerPool_ExportThreadStats(udJSON *pJSON, const char *pKey, const udWorkerPoolThreadStats &stats)
+{
+  pJSON->Set("%s.tasksRun = %" PRIu64, pKey, stats.tasksRun);
+  pJSON->Set("%s.tasksStolen = %" PRIu64, pKey, stats.tasksStolen);
+  pJSON->Set("%s.runTimeMs = %f", pKey, stats.runTimeMs);
+  pJSON->Set("%s.idleTimeMs = %f", pKey, stats.idleTimeMs);
+  pJSON->Set("%s.utilisation = %f", pKey, (stats.runTimeMs + stats.idleTimeMs > 0) ? stats.runTimeMs / (stats.runTimeMs + stats.idleTimeMs) : 0.0);
+  for (int bucket = 0; bucket < udWorkerPool_LatencyBucketCount; ++bucket)
+    pJSON->Set("%s.latencyHistogram[] = %" PRIu64, pKey, stats.latencyHistogram[bucket]);
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_ExportStats(udWorkerPool *pPool, udJSON *pJSON)
+{
+  udResult result = udR_Failure;
+  udWorkerPoolStats stats;
+  udWorkerPoolThreadStats *pThreadStats = nullptr;
+
+  UD_ERROR_NULL(pPool, udR_InvalidParameter);
+  UD_ERROR_NULL(pJSON, udR_InvalidParameter);
+
+  pThreadStats = udAllocType(udWorkerPoolThreadStats, pPool->slotCount, udAF_None);
+  UD_ERROR_NULL(pThreadStats, udR_MemoryAllocationFailure);
+  UD_ERROR_CHECK(udWorkerPool_GetStats(pPool, &stats, pThreadStats, pPool->slotCount));
+
+  UD_ERROR_CHECK(pJSON->SetObject());
+  pJSON->Set("liveThreads = %u", stats.liveThreads);
+  pJSON->Set("blockedThreads = %u", stats.blockedThreads);
+  pJSON->Set("activeThreads = %u", stats.activeThreads);
+  pJSON->Set("queuedTasks = %" PRIu64, stats.queuedTasks);
+  pJSON->Set("delayedTasks = %" PRIu64, stats.delayedTasks);
+  pJSON->Set("postTaskBacklog = %" PRIu64, stats.postTaskBacklog);
+  udWorkerPool_ExportThreadStats(pJSON, "total", stats.total);
+
+  for (uint32_t i = 0; i < stats.threadSlots; ++i)
+  {
+    pJSON->Set("threads[%u].isLive = %s", i, pThreadStats[i].isLive ? "true" : "false");
+    udWorkerPool_ExportThreadStats(pJSON, udTempStr("threads[%u]", i), pThreadStats[i]);
+  }
+
+  result = udR_Success;
+
+epilogue:
+  udFree(pThreadStats);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_SetStatsDump(udWorkerPool *pPool, uint32_t intervalMs, udWorkerPoolStatsCallback callback /*= nullptr*/)
+{
+  if (pPool == nullptr)
+    return udR_InvalidParameter;
+
+  udScopeLock lock(pPool->pStatsMutex);
+  pPool->statsDumpCallback = callback;
+  pPool->nextStatsDumpMs = udGetTimeMs() + intervalMs;
+  pPool->statsDumpIntervalMs = intervalMs;
+
+  return udR_Success;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_BeginBlocking(udWorkerPool *pPool)
+{
+  udWorkerPoolThread *pThread = t_pWorkerPoolThread;
+
+  if (pPool == nullptr)
+    return udR_InvalidParameter;
+  if (pThread == nullptr || pThread->pPool != pPool)
+    return udR_NothingToDo;
+
+  if (pThread->blockingDepth++ == 0)
+  {
+    ++pPool->blockedThreads;
+
+    // Replace this worker straight away if there's work waiting for it, otherwise the next task queued will start one
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (pPool->queuedTaskCount.load(std::memory_order_relaxed) > 0 && pPool->sleepingThreads.load(std::memory_order_relaxed) == 0)
+      udWorkerPool_StartThread(pPool);
+  }
+
+  return udR_Success;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_EndBlocking(udWorkerPool *pPool)
+{
+  udWorkerPoolThread *pThread = t_pWorkerPoolThread;
+
+  if (pPool == nullptr)
+    return udR_InvalidParameter;
+  if (pThread == nullptr || pThread->pPool != pPool)
+    return udR_NothingToDo;
+  if (pThread->blockingDepth == 0)
+    return udR_NotAllowed;
+
+  // Any worker started in its place retires once it next finds nothing to do
+  if (--pThread->blockingDepth == 0)
+    --pPool->blockedThreads;
+
+  return udR_Success;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_Then(udWorkerPoolTask *pTask, udWorkerPoolCallback func, void *pUserData /*= nullptr*/, bool clearMemory /*= true*/, udWorkerPoolTask **ppContinuation /*= nullptr*/)
+{
+  udResult result = udR_Failure;
+  udWorkerPoolTask *pContinuation = nullptr;
+  udWorkerPoolTask *pHead = nullptr;
+
+  UD_ERROR_NULL(pTask, udR_InvalidParameter);
+
+  pContinuation = udWorkerPool_CreateTask(pTask->pPool, func, pUserData, clearMemory, nullptr, pTask->priority, ppContinuation != nullptr);
+  UD_ERROR_NULL(pContinuation, udR_MemoryAllocationFailure);
+
+  // The continuation list holds the pool's reference until the task finishes
+  pHead = pTask->pContinuations.load();
+  while (pHead != udWorkerPool_ContinuationsClosed)
+  {
+    pContinuation->pNextContinuation = pHead;
+    if (pTask->pContinuations.compare_exchange_weak(pHead, pContinuation))
+      break;
+  }
+
+  if (pHead == udWorkerPool_ContinuationsClosed)
+  {
+    // Already finished, the state was set before the list was closed
+    if (pTask->state.load() == udWPTS_Complete)
+    {
+      UD_ERROR_CHECK(udWorkerPool_QueueTask(pTask->pPool, pContinuation));
+    }
+    else
+    {
+      udWorkerPool_TryCancel(pContinuation);
+      udWorkerPool_ReleaseTaskRef(pContinuation);
+    }
+  }
+
+  if (ppContinuation)
+    *ppContinuation = pContinuation;
+  pContinuation = nullptr;
+  result = udR_Success;
+
+epilogue:
+  udDelete(pContinuation);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_WaitTask(udWorkerPoolTask *pTask, int waitMs /*= UDTHREAD_WAIT_INFINITE*/)
+{
+  udResult result = udR_Failure;
+  udWorkerPool *pPool = nullptr;
+  udWorkerPoolThread *pThread = t_pWorkerPoolThread;
+  uint32_t startMs = udGetTimeMs();
+  int32_t state;
+
+  UD_ERROR_NULL(pTask, udR_InvalidParameter);
+
+  pPool = pTask->pPool;
+  state = pTask->state.load();
+
+  if (state == udWPTS_Queued || state == udWPTS_Running)
+  {
+    if (pThread && pThread->pPool == pPool)
+    {
+      // Blocking one of the pool's own workers could leave nothing to run the task, so help until it's done
+      while ((state = pTask->state.load()) == udWPTS_Queued || state == udWPTS_Running)
+      {
+        if (waitMs != UDTHREAD_WAIT_INFINITE && udGetTimeMs() - startMs >= (uint32_t)waitMs)
+          break;
+
+        udWorkerPoolTask *pOther = udWorkerPool_FindTask(pPool, pThread);
+        if (pOther)
+          udWorkerPool_RunTask(pPool, pThread, pOther);
+        else
+          udYield();
+      }
+    }
+    else
+    {
+      ++pTask->waiterCount;
+      udLockMutex(pPool->pWaitMutex);
+      ++pPool->waitingThreads;
+      while ((state = pTask->state.load()) == udWPTS_Queued || state == udWPTS_Running)
+      {
+        if (waitMs == UDTHREAD_WAIT_INFINITE)
+        {
+          udWaitConditionVariable(pPool->pWaitCondition, pPool->pWaitMutex);
+        }
+        else
+        {
+          uint32_t elapsedMs = udGetTimeMs() - startMs;
+          if (elapsedMs >= (uint32_t)waitMs)
+            break;
+          udWaitConditionVariable(pPool->pWaitCondition, pPool->pWaitMutex, waitMs - (int)elapsedMs);
+        }
+      }
+      --pPool->waitingThreads;
+      udReleaseMutex(pPool->pWaitMutex);
+      --pTask->waiterCount;
+    }
+  }
+
+  UD_ERROR_IF(state == udWPTS_Cancelled, udR_Cancelled);
+  UD_ERROR_IF(state != udWPTS_Complete, udR_Timeout);
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPool_CancelTask(udWorkerPoolTask *pTask)
+{
+  if (pTask == nullptr)
+    return udR_InvalidParameter;
+
+  if (!udWorkerPool_TryCancel(pTask))
+    return udR_NotAllowed;
+
+  // Remove delayed tasks now rather than when they were due to start, so they stop counting as queued
+  udWorkerPool *pPool = pTask->pPool;
+  bool wasDelayed = false;
+  if (pPool != nullptr && pTask->pGraphNode == nullptr)
+  {
+    udScopeLock lock(pPool->pDelayedMutex);
+    if (pTask->isDelayed)
+    {
+      int64_t delayedCount = pPool->delayedTaskCount;
+      udWorkerPoolTask **ppEnd = pPool->ppDelayedTasks + delayedCount;
+      *std::find(pPool->ppDelayedTasks, ppEnd, pTask) = ppEnd[-1];
+      std::make_heap(pPool->ppDelayedTasks, ppEnd - 1, udWorkerPool_LaterStart);
+      if (delayedCount > 1)
+        pPool->nextStartTimeMs = pPool->ppDelayedTasks[0]->startTimeMs;
+      pPool->delayedTaskCount = delayedCount - 1;
+      pTask->isDelayed = false;
+      wasDelayed = true;
+    }
+  }
+
+  if (wasDelayed)
+    udWorkerPool_ReleaseTaskRef(pTask);
+
+  return udR_Success;
+}
+
+// ----------------------------------------------------------------------------
+udWorkerPoolTaskState udWorkerPool_GetTaskState(udWorkerPoolTask *pTask)
+{
+  if (pTask == nullptr)
+    return udWPTS_Cancelled;
+
+  return (udWorkerPoolTaskState)pTask->state.load();
+}
+
+// ----------------------------------------------------------------------------
+void udWorkerPool_ReleaseTask(udWorkerPoolTask **ppTask)
+{
+  if (ppTask == nullptr || *ppTask == nullptr)
+    return;
+
+  udWorkerPool_ReleaseTaskRef(*ppTask);
+  *ppTask = nullptr;
+}
+
+// ----------------------------------------------------------------------------
+// Called once the pool is finished with a graph node, including its post work, to schedule the successors it was the last to wait on
+static void udWorkerPool_GraphNodeDone(udWorkerPoolGraphNode *pNode)
+{
+  udWorkerPoolGraph *pGraph = pNode->pGraph;
+  udWorkerPool *pPool = pNode->task.pPool;
+
+  if (pNode->task.state.load() != udWPTS_Complete)
+    pGraph->isCancelled = true;
+
+  for (uint32_t i = 0; i < pNode->successorCount; ++i)
+  {
+    udWorkerPoolGraphNode *pSuccessor = pGraph->nodes.GetElement(pGraph->pSuccessors[pNode->firstSuccessor + i]);
+    if (--pSuccessor->pendingCount == 0)
+    {
+      // Once anything is cancelled the rest of the graph is too, as is anything left when the pool shuts down
+      if (pGraph->isCancelled || !pPool->isRunning || udWorkerPool_QueueTask(pPool, &pSuccessor->task) != udR_Success)
+      {
+        pSuccessor->task.state = udWPTS_Cancelled;
+        udWorkerPool_GraphNodeDone(pSuccessor);
+      }
+    }
+  }
+
+  if (--pGraph->pendingNodes == 0)
+  {
+    udWorkerPool_FinishTask(&pGraph->completion, pGraph->isCancelled ? udWPTS_Cancelled : udWPTS_Complete);
+    pGraph->isRunning = false;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Rebuild each node's successor list and predecessor count from the edges, fails if the dependencies contain a cycle
+static udResult udWorkerPoolGraph_Build(udWorkerPoolGraph *pGraph)
+{
+  udResult result = udR_Failure;
+  size_t nodeCount = pGraph->nodes.length;
+  size_t edgeCount = pGraph->edges.length;
+  size_t readyCount = 0;
+  size_t visitedCount = 0;
+  uint32_t *pReady = nullptr;
+
+  if (edgeCount > pGraph->successorCapacity)
+  {
+    udFree(pGraph->pSuccessors);
+    pGraph->successorCapacity = 0;
+    pGraph->pSuccessors = udAllocType(uint32_t, edgeCount, udAF_None);
+    UD_ERROR_NULL(pGraph->pSuccessors, udR_MemoryAllocationFailure);
+    pGraph->successorCapacity = edgeCount;
+  }
+
+  for (size_t i = 0; i < nodeCount; ++i)
+  {
+    udWorkerPoolGraphNode *pNode = pGraph->nodes.GetElement(i);
+    pNode->predecessorCount = 0;
+    pNode->successorCount = 0;
+  }
+
+  for (size_t i = 0; i < edgeCount; ++i)
+  {
+    const udWorkerPoolGraphEdge &edge = pGraph->edges[i];
+    ++pGraph->nodes[edge.from].successorCount;
+    ++pGraph->nodes[edge.to].predecessorCount;
+  }
+
+  for (size_t i = 0, first = 0; i < nodeCount; ++i)
+  {
+    udWorkerPoolGraphNode *pNode = pGraph->nodes.GetElement(i);
+    pNode->firstSuccessor = (uint32_t)first;
+    first += pNode->successorCount;
+    pNode->successorCount = 0; // Counted again as the list is filled
+  }
+
+  for (size_t i = 0; i < edgeCount; ++i)
+  {
+    const udWorkerPoolGraphEdge &edge = pGraph->edges[i];
+    udWorkerPoolGraphNode *pFrom = pGraph->nodes.GetElement(edge.from);
+    pGraph->pSuccessors[pFrom->firstSuccessor + pFrom->successorCount++] = edge.to;
+  }
+
+  // Visit the nodes in dependency order, any that can't be reached are part of a cycle
+  pReady = udAllocType(uint32_t, nodeCount + 1, udAF_None);
+  UD_ERROR_NULL(pReady, udR_MemoryAllocationFailure);
+
+  for (size_t i = 0; i < nodeCount; ++i)
+  {
+    udWorkerPoolGraphNode *pNode = pGraph->nodes.GetElement(i);
+    pNode->pendingCount = (int32_t)pNode->predecessorCount;
+    if (pNode->predecessorCount == 0)
+      pReady[readyCount++] = (uint32_t)i;
+  }
+
+  while (visitedCount < readyCount)
+  {
+    udWorkerPoolGraphNode *pNode = pGraph->nodes.GetElement(pReady[visitedCount++]);
+    for (uint32_t i = 0; i < pNode->successorCount; ++i)
+    {
+      uint32_t successor = pGraph->pSuccessors[pNode->firstSuccessor + i];
+      if (--pGraph->nodes[successor].pendingCount == 0)
+        pReady[readyCount++] = successor;
+    }
+  }
+  UD_ERROR_IF(visitedCount != nodeCount, udR_InvalidConfiguration);
+
+  pGraph->isDirty = false;
+  result = udR_Success;
+
+epilogue:
+  udFree(pReady);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPoolGraph_Create(udWorkerPoolGraph **ppGraph)
+{
+  udResult result = udR_Failure;
+  udWorkerPoolGraph *pGraph = nullptr;
+
+  UD_ERROR_NULL(ppGraph, udR_InvalidParameter);
+
+  pGraph = udNewNoParams(udWorkerPoolGraph);
+  UD_ERROR_NULL(pGraph, udR_MemoryAllocationFailure);
+  pGraph->completion.state = udWPTS_Complete; // Nothing to wait for until the graph is submitted
+  pGraph->completion.pContinuations = udWorkerPool_ContinuationsClosed;
+  UD_ERROR_CHECK(pGraph->nodes.Init(64));
+  UD_ERROR_CHECK(pGraph->edges.Init(128));
+
+  *ppGraph = pGraph;
+  pGraph = nullptr;
+  result = udR_Success;
+
+epilogue:
+  udWorkerPoolGraph_Destroy(&pGraph);
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+void udWorkerPoolGraph_Destroy(udWorkerPoolGraph **ppGraph)
+{
+  if (ppGraph == nullptr || *ppGraph == nullptr)
+    return;
+
+  udWorkerPoolGraph *pGraph = *ppGraph;
+  *ppGraph = nullptr;
+
+  udWorkerPoolGraph_Wait(pGraph);
+  udWorkerPoolGraph_Clear(pGraph);
+  pGraph->nodes.Deinit();
+  pGraph->edges.Deinit();
+  udFree(pGraph->pSuccessors);
+  udDelete(pGraph);
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPoolGraph_Clear(udWorkerPoolGraph *pGraph)
+{
+  udResult result = udR_Failure;
+
+  UD_ERROR_NULL(pGraph, udR_InvalidParameter);
+  UD_ERROR_IF(pGraph->isRunning, udR_NotAllowed);
+
+  for (size_t i = 0; i < pGraph->nodes.length; ++i)
+    pGraph->nodes.GetElement(i)->~udWorkerPoolGraphNode();
+  pGraph->nodes.Clear();
+  pGraph->edges.Clear();
+  pGraph->isDirty = true;
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPoolGraph_AddNode(udWorkerPoolGraph *pGraph, udWorkerPoolCallback func, void *pUserData /*= nullptr*/, udWorkerPoolCallback postFunction /*= nullptr*/, uint32_t *pNodeIndex /*= nullptr*/)
+{
+  udResult result = udR_Failure;
+  udWorkerPoolGraphNode *pNode = nullptr;
+
+  UD_ERROR_NULL(pGraph, udR_InvalidParameter);
+  UD_ERROR_IF(pGraph->isRunning, udR_NotAllowed);
+  UD_ERROR_IF(pGraph->nodes.length >= UINT32_MAX, udR_CountExceeded);
+
+  UD_ERROR_CHECK(pGraph->nodes.PushBack(&pNode));
+  new (pNode) udWorkerPoolGraphNode();
+  pNode->pGraph = pGraph;
+  pNode->task.pGraphNode = pNode;
+  pNode->task.function = func;
+  pNode->task.postFunction = postFunction;
+  pNode->task.pDataBlock = pUserData;
+  pNode->task.freeDataBlock = false;
+  pNode->task.priority = udWPP_Normal;
+  pGraph->isDirty = true;
+
+  if (pNodeIndex)
+    *pNodeIndex = (uint32_t)(pGraph->nodes.length - 1);
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPoolGraph_AddDependency(udWorkerPoolGraph *pGraph, uint32_t nodeIndex, uint32_t dependsOnIndex)
+{
+  udResult result = udR_Failure;
+
+  UD_ERROR_NULL(pGraph, udR_InvalidParameter);
+  UD_ERROR_IF(nodeIndex >= pGraph->nodes.length || dependsOnIndex >= pGraph->nodes.length, udR_OutOfRange);
+  UD_ERROR_IF(nodeIndex == dependsOnIndex, udR_InvalidParameter);
+  UD_ERROR_IF(pGraph->isRunning, udR_NotAllowed);
+
+  UD_ERROR_CHECK(pGraph->edges.PushBack({ dependsOnIndex, nodeIndex }));
+  pGraph->isDirty = true;
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPoolGraph_SetNodeUserData(udWorkerPoolGraph *pGraph, uint32_t nodeIndex, void *pUserData)
+{
+  udResult result = udR_Failure;
+
+  UD_ERROR_NULL(pGraph, udR_InvalidParameter);
+  UD_ERROR_IF(nodeIndex >= pGraph->nodes.length, udR_OutOfRange);
+  UD_ERROR_IF(pGraph->isRunning, udR_NotAllowed);
+
+  pGraph->nodes[nodeIndex].task.pDataBlock = pUserData;
+  result = udR_Success;
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPoolGraph_Submit(udWorkerPool *pPool, udWorkerPoolGraph *pGraph)
+{
+  udResult result = udR_Failure;
+  size_t nodeCount = 0;
+
+  UD_ERROR_NULL(pPool, udR_InvalidParameter);
+  UD_ERROR_NULL(pGraph, udR_InvalidParameter);
+  UD_ERROR_IF(!pPool->isRunning, udR_NotAllowed);
+  UD_ERROR_IF(pGraph->isRunning, udR_NotAllowed);
+
+  if (pGraph->isDirty)
+    UD_ERROR_CHECK(udWorkerPoolGraph_Build(pGraph));
+
+  nodeCount = pGraph->nodes.length;
+  pGraph->completion.pPool = pPool;
+  pGraph->completion.state = udWPTS_Queued;
+  pGraph->completion.pContinuations = nullptr;
+  pGraph->isCancelled = false;
+
+  if (nodeCount == 0)
+  {
+    udWorkerPool_FinishTask(&pGraph->completion, udWPTS_Complete);
+    UD_ERROR_SET(udR_Success);
+  }
+
+  // Every node is reset before any is queued, as the first to finish may start decrementing the others
+  pGraph->pendingNodes = (uint32_t)nodeCount;
+  pGraph->isRunning = true;
+  for (size_t i = 0; i < nodeCount; ++i)
+  {
+    udWorkerPoolGraphNode *pNode = pGraph->nodes.GetElement(i);
+    pNode->task.pPool = pPool;
+    pNode->task.state = udWPTS_Queued;
+    pNode->task.refCount = 1;
+    pNode->task.pContinuations = nullptr;
+    pNode->pendingCount = (int32_t)pNode->predecessorCount;
+  }
+
+  result = udR_Success;
+  for (size_t i = 0; i < nodeCount; ++i)
+  {
+    udWorkerPoolGraphNode *pNode = pGraph->nodes.GetElement(i);
+    if (pNode->predecessorCount == 0 && (result != udR_Success || (result = udWorkerPool_QueueTask(pPool, &pNode->task)) != udR_Success))
+    {
+      // The graph still finishes, cancelled, so it can be waited on and submitted again
+      pNode->task.state = udWPTS_Cancelled;
+      udWorkerPool_GraphNodeDone(pNode);
+    }
+  }
+
+epilogue:
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+udResult udWorkerPoolGraph_Wait(udWorkerPoolGraph *pGraph, int waitMs /*= UDTHREAD_WAIT_INFINITE*/)
+{
+  udResult result = udR_Failure;
+
+  UD_ERROR_NULL(pGraph, udR_InvalidParameter);
+
+  result = udWorkerPool_WaitTask(&pGraph->completion, waitMs);
+  if (result == udR_Timeout)
+    UD_ERROR_SET(result);
+
+  // The last node marks the graph complete just before it stops touching the graph
+  while (pGraph->isRunning)
+    udYield();
+
+epilogue:
+  return result;
 }
@@ -1,9 +1,12 @@
 #include "gtest/gtest.h"
 #include "udCompression.h"
 #include "udFile.h"
+#include "udImage.h"
 #include "udPlatform.h"
+#include "udPlatformUtil.h"
 #include "udStringUtil.h"
 #include <algorithm>
+#include <vector>
 
 TEST(udCompressionTests, Basic)
 {
@@ -206,3 +209,408 @@ TEST(udCompressionTests, ZipWithFolder)
   EXPECT_EQ(udR_Success, result);
   udFile_Close(&pFile);
 }
+
+TEST(udCompressionTests, FastLZRoundTrip)
+{
+  // Mix of incompressible data, short period runs (overlapping matches) and long distant repeats
+  const size_t inputSize = 1024 * 1024 + 7;
+  uint8_t *pInput = udAllocType(uint8_t, inputSize, udAF_None);
+  uint8_t *pInflated = udAllocType(uint8_t, inputSize, udAF_None);
+  ASSERT_NE(nullptr, pInput);
+  ASSERT_NE(nullptr, pInflated);
+
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < inputSize;)
+  {
+    seed = seed * 1103515245 + 12345;
+    size_t runLength = std::min((size_t)(seed >> 20) + 1, inputSize - i);
+    switch ((seed >> 8) & 3)
+    {
+    case 0: // Random
+      for (size_t j = 0; j < runLength; ++j)
+        pInput[i + j] = (uint8_t)((seed = seed * 1103515245 + 12345) >> 16);
+      break;
+    case 1: // Short period pattern
+      for (size_t j = 0; j < runLength; ++j)
+        pInput[i + j] = (uint8_t)(j % ((seed & 15) + 1));
+      break;
+    default: // Copy of earlier data
+      for (size_t j = 0; j < runLength; ++j)
+        pInput[i + j] = (i > 40000) ? pInput[i + j - 40000] : (uint8_t)j;
+      break;
+    }
+    i += runLength;
+  }
+
+  void *pDeflated = nullptr;
+  size_t deflatedSize = 0;
+  size_t inflatedSize = 0;
+  EXPECT_EQ(udR_Success, udCompression_Deflate(&pDeflated, &deflatedSize, pInput, inputSize, udCT_FastLZ));
+  EXPECT_LT(deflatedSize, inputSize);
+
+  EXPECT_EQ(udR_Success, udCompression_Inflate(pInflated, inputSize, pDeflated, deflatedSize, &inflatedSize, udCT_FastLZ));
+  EXPECT_EQ(inputSize, inflatedSize);
+  EXPECT_EQ(0, memcmp(pInput, pInflated, inputSize));
+
+  // Truncated input must be detected rather than read out of bounds
+  EXPECT_NE(udR_Success, udCompression_Inflate(pInflated, inputSize, pDeflated, deflatedSize / 2, &inflatedSize, udCT_FastLZ));
+
+  EXPECT_EQ(udR_CompressionError, udCompression_Inflate(pInflated, inputSize, "\x10", 1, &inflatedSize, udCT_FastLZ));
+
+  udFree(pDeflated);
+  udFree(pInflated);
+  udFree(pInput);
+}
+
+TEST(udCompressionTests, Dictionary)
+{
+  // Small JSON blobs typical of per-node metadata
+  char samples[16][256];
+  const void *pSamples[16];
+  size_t sampleLengths[16];
+  for (int i = 0; i < (int)udLengthOf(samples); ++i)
+  {
+    udSprintf(samples[i], "{\"id\":%d,\"name\":\"node_%d\",\"bounds\":{\"min\":[%d,%d,%d],\"max\":[%d,%d,%d]},\"attributes\":[\"udRGB\",\"udIntensity\",\"udClassification\"],\"pointCount\":%d}", i, i * 7, i, i * 2, i * 3, i + 100, i * 2 + 100, i * 3 + 100, i * 12345);
+    pSamples[i] = samples[i];
+    sampleLengths[i] = udStrlen(samples[i]);
+  }
+
+  udCompressionDictionary *pDictionary = nullptr;
+  ASSERT_EQ(udR_Success, udCompressionDictionary_Train(&pDictionary, pSamples, sampleLengths, udLengthOf(samples), 1024));
+  const void *pDictData = nullptr;
+  size_t dictLength = 0;
+  EXPECT_EQ(udR_Success, udCompressionDictionary_GetData(pDictionary, &pDictData, &dictLength));
+  EXPECT_GT(dictLength, 0U);
+  EXPECT_LE(dictLength, 1024U);
+
+  const char *pInput = "{\"id\":99,\"name\":\"node_693\",\"bounds\":{\"min\":[99,198,297],\"max\":[199,298,397]},\"attributes\":[\"udRGB\",\"udIntensity\",\"udClassification\"],\"pointCount\":1222155}";
+  size_t inputLength = udStrlen(pInput);
+  char inflated[256];
+
+  for (udCompressionType ct : { udCT_RawDeflate, udCT_ZlibDeflate })
+  {
+    void *pPlain = nullptr;
+    void *pDeflated = nullptr;
+    size_t plainSize = 0;
+    size_t deflatedSize = 0;
+    size_t inflatedSize = 0;
+
+    EXPECT_EQ(udR_Success, udCompression_Deflate(&pPlain, &plainSize, pInput, inputLength, ct));
+    EXPECT_EQ(udR_Success, udCompression_Deflate(&pDeflated, &deflatedSize, pInput, inputLength, ct, pDictionary));
+    EXPECT_LT(deflatedSize, plainSize);
+
+    EXPECT_EQ(udR_Success, udCompression_Inflate(inflated, sizeof(inflated), pDeflated, deflatedSize, &inflatedSize, ct, pDictionary));
+    EXPECT_EQ(inputLength, inflatedSize);
+    EXPECT_EQ(0, memcmp(pInput, inflated, inputLength));
+
+    // Output too small
+    EXPECT_EQ(udR_BufferTooSmall, udCompression_Inflate(inflated, inputLength / 2, pDeflated, deflatedSize, &inflatedSize, ct, pDictionary));
+
+    // Without the dictionary the back references are invalid
+    EXPECT_NE(udR_Success, udCompression_Inflate(inflated, sizeof(inflated), pDeflated, deflatedSize, &inflatedSize, ct));
+
+    udFree(pPlain);
+    udFree(pDeflated);
+  }
+
+  // Dictionaries are only supported for deflate with no or zlib framing
+  void *pDeflated = nullptr;
+  size_t deflatedSize = 0;
+  EXPECT_EQ(udR_Unsupported, udCompression_Deflate(&pDeflated, &deflatedSize, pInput, inputLength, udCT_GzipDeflate, pDictionary));
+
+  udCompressionDictionary_Destroy(&pDictionary);
+  EXPECT_EQ(nullptr, pDictionary);
+}
+
+// Minimal writer for zips with stored or deflated entries, to test reading archives that aren't practical to embed
+struct udCompressionTests_ZipBuilder
+{
+  std::vector<uint8_t> local;
+  std::vector<uint8_t> central;
+  uint16_t entryCount = 0;
+
+  static void Put16(std::vector<uint8_t> &out, uint32_t v) { out.push_back((uint8_t)v); out.push_back((uint8_t)(v >> 8)); }
+  static void Put32(std::vector<uint8_t> &out, uint32_t v) { Put16(out, v & 0xffff); Put16(out, v >> 16); }
+
+  // Add an entry, pass pUncompressed to add pCompressed as deflated rather than stored
+  void AddEntry(const char *pName, const void *pCompressed, size_t compressedLength, const void *pUncompressed = nullptr, size_t uncompressedLength = 0)
+  {
+    uint16_t method = pUncompressed ? 8 : 0;
+    if (!pUncompressed)
+    {
+      pUncompressed = pCompressed;
+      uncompressedLength = compressedLength;
+    }
+    uint32_t crc = udCrc(pUncompressed, uncompressedLength);
+    uint16_t nameLength = (uint16_t)udStrlen(pName);
+    uint32_t localHeaderOffset = (uint32_t)local.size();
+
+    Put32(local, 0x04034b50); Put16(local, 20); Put16(local, 0); Put16(local, method); Put32(local, 0); Put32(local, crc);
+    Put32(local, (uint32_t)compressedLength); Put32(local, (uint32_t)uncompressedLength); Put16(local, nameLength); Put16(local, 0);
+    local.insert(local.end(), pName, pName + nameLength);
+    local.insert(local.end(), (const uint8_t*)pCompressed, (const uint8_t*)pCompressed + compressedLength);
+
+    Put32(central, 0x02014b50); Put16(central, 20); Put16(central, 20); Put16(central, 0); Put16(central, method); Put32(central, 0); Put32(central, crc);
+    Put32(central, (uint32_t)compressedLength); Put32(central, (uint32_t)uncompressedLength); Put16(central, nameLength);
+    Put16(central, 0); Put16(central, 0); Put16(central, 0); Put16(central, 0); Put32(central, 0); Put32(central, localHeaderOffset);
+    central.insert(central.end(), pName, pName + nameLength);
+    ++entryCount;
+  }
+
+  udResult Save(const char *pFilename)
+  {
+    std::vector<uint8_t> zip(local);
+    zip.insert(zip.end(), central.begin(), central.end());
+    Put32(zip, 0x06054b50); Put16(zip, 0); Put16(zip, 0); Put16(zip, entryCount); Put16(zip, entryCount);
+    Put32(zip, (uint32_t)central.size()); Put32(zip, (uint32_t)local.size()); Put16(zip, 0);
+    return udFile_Save(pFilename, zip.data(), zip.size());
+  }
+};
+
+TEST(udCompressionTests, ZipRandomAccess)
+{
+  // Large enough to need several inflate access points
+  const size_t dataLength = 4 * 1024 * 1024 + 123;
+  uint8_t *pData = udAllocType(uint8_t, dataLength, udAF_None);
+  ASSERT_NE(nullptr, pData);
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < dataLength; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    pData[i] = (uint8_t)((i / 97) + ((seed >> 16) & 7));
+  }
+
+  void *pDeflated = nullptr;
+  size_t deflatedSize = 0;
+  ASSERT_EQ(udR_Success, udCompression_Deflate(&pDeflated, &deflatedSize, pData, dataLength, udCT_RawDeflate));
+
+  // Assemble a single entry zip around the deflated data
+  const char *pZipFilename = "._donotcommit_random.zip";
+  const char entryName[] = "data.bin";
+  udCompressionTests_ZipBuilder zip;
+  zip.AddEntry(entryName, pDeflated, deflatedSize, pData, dataLength);
+  ASSERT_EQ(udR_Success, zip.Save(pZipFilename));
+
+  udFile *pFile = nullptr;
+  int64_t fileLength = 0;
+  ASSERT_EQ(udR_Success, udFile_Open(&pFile, udTempStr("zip://%s:%s", pZipFilename, entryName), udFOF_Read, &fileLength));
+  EXPECT_EQ((int64_t)dataLength, fileLength);
+
+  // Sequential pass first so the crc is verified, then jump around backwards and forwards
+  const size_t chunkSize = 100000;
+  uint8_t *pChunk = udAllocType(uint8_t, chunkSize, udAF_None);
+  for (size_t offset = 0; offset < dataLength; offset += chunkSize)
+  {
+    size_t actualRead = 0;
+    EXPECT_EQ(udR_Success, udFile_Read(pFile, pChunk, chunkSize, (int64_t)offset, udFSW_SeekSet, &actualRead));
+    EXPECT_EQ(std::min(chunkSize, dataLength - offset), actualRead);
+    EXPECT_EQ(0, memcmp(pData + offset, pChunk, actualRead));
+  }
+  for (int i = 0; i < 64; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    size_t offset = (seed >> 4) % dataLength;
+    size_t length = std::min((size_t)(seed % chunkSize) + 1, dataLength - offset);
+    size_t actualRead = 0;
+    EXPECT_EQ(udR_Success, udFile_Read(pFile, pChunk, length, (int64_t)offset, udFSW_SeekSet, &actualRead));
+    EXPECT_EQ(length, actualRead);
+    EXPECT_EQ(0, memcmp(pData + offset, pChunk, length));
+  }
+
+  EXPECT_EQ(udR_Success, udFile_Close(&pFile));
+  EXPECT_EQ(udR_Success, udFileDelete(pZipFilename));
+  udFree(pChunk);
+  udFree(pDeflated);
+  udFree(pData);
+}
+
+TEST(udCompressionTests, ZipSharedArchive)
+{
+  // Many stored entries, opened with differing case and separators
+  const char *pZipFilename = "./._donotcommit_shared.zip"; // Leading folder so the sub filename separator isn't mistaken for part of the zip name
+  const int entryCount = 5000;
+  udCompressionTests_ZipBuilder zip;
+  for (int i = 0; i < entryCount; ++i)
+  {
+    const char *pContent = udTempStr("Content of entry %d", i);
+    zip.AddEntry(udTempStr("folder/entry%d.txt", i), pContent, udStrlen(pContent));
+  }
+  ASSERT_EQ(udR_Success, zip.Save(pZipFilename));
+
+  udFile *pFiles[4] = {};
+  const int indices[4] = { 0, 1234, 4999, 2500 };
+  const char *pFormats[4] = { "zip://%s:folder/entry%d.txt", "zip://%s:folder\\entry%d.txt", "zip://%s:FOLDER/Entry%d.TXT", "zip://%s:folder/entry%d.txt" };
+  for (int i = 0; i < (int)udLengthOf(pFiles); ++i)
+  {
+    int64_t length = 0;
+    ASSERT_EQ(udR_Success, udFile_Open(&pFiles[i], udTempStr(pFormats[i], pZipFilename, indices[i]), udFOF_Read, &length));
+    EXPECT_EQ((int64_t)udStrlen(udTempStr("Content of entry %d", indices[i])), length);
+  }
+
+  // All handles remain valid while reading through each other
+  for (int i = 0; i < (int)udLengthOf(pFiles); ++i)
+  {
+    char buffer[64] = {};
+    size_t actualRead = 0;
+    udFilePipelinedRequest request;
+    EXPECT_EQ(udR_Success, udFile_Read(pFiles[i], buffer, sizeof(buffer) - 1, 0, udFSW_SeekSet, &actualRead, nullptr, &request));
+    EXPECT_EQ(udR_Success, udFile_BlockForPipelinedRequest(pFiles[i], &request, &actualRead));
+    EXPECT_EQ(udStrlen(buffer), actualRead);
+    EXPECT_STREQ(udTempStr("Content of entry %d", indices[i]), buffer);
+  }
+
+  udFile *pMissing = nullptr;
+  EXPECT_EQ(udR_OpenFailure, udFile_Open(&pMissing, udTempStr("zip://%s:folder/entry%d.txt", pZipFilename, entryCount), udFOF_Read));
+
+  // Switching sub file on a handle uses the same index
+  EXPECT_EQ(udR_Success, udFile_SetSubFilename(pFiles[0], "folder/entry42.txt", nullptr));
+
+  // Rewriting the zip to the same length while the handles keep it open must not reuse the old directory
+  udCompressionTests_ZipBuilder renamedZip;
+  for (int i = 0; i < entryCount; ++i)
+  {
+    const char *pContent = udTempStr("Content of entry %d", i);
+    renamedZip.AddEntry(udTempStr("folder/extra%d.txt", i), pContent, udStrlen(pContent));
+  }
+  ASSERT_EQ(udR_Success, renamedZip.Save(pZipFilename));
+  udFile *pRenamed = nullptr;
+  EXPECT_EQ(udR_Success, udFile_Open(&pRenamed, udTempStr("zip://%s:folder/extra%d.txt", pZipFilename, 42), udFOF_Read));
+  EXPECT_EQ(udR_Success, udFile_Close(&pRenamed));
+
+  for (int i = 0; i < (int)udLengthOf(pFiles); ++i)
+    EXPECT_EQ(udR_Success, udFile_Close(&pFiles[i]));
+
+  // Table of contents
+  char *pTOC = nullptr;
+  ASSERT_EQ(udR_Success, udFile_Load(udTempStr("zip://%s", pZipFilename), (void**)&pTOC));
+  EXPECT_EQ(0, memcmp(pTOC, "folder/extra0.txt\nfolder/extra1.txt\n", 36));
+  udFree(pTOC);
+
+  EXPECT_EQ(udR_Success, udFileDelete(pZipFilename));
+}
+
+TEST(udCompressionTests, ZipWriter)
+{
+  const char *pZipFilename = "./._donotcommit_writer.zip";
+  const int entryCount = 200;
+  const size_t maxLength = 64 * 1024;
+  uint8_t *pData = udAllocType(uint8_t, maxLength, udAF_None);
+  ASSERT_NE(nullptr, pData);
+
+  // Entry i is the first length(i) bytes of pData, which is compressible for even entries and noise for odd
+  auto length = [](int i) { return (size_t)((i * 7919) % maxLength); };
+  auto fill = [pData](int i)
+  {
+    uint32_t seed = (uint32_t)i;
+    for (size_t j = 0; j < maxLength; ++j)
+    {
+      seed = seed * 1103515245 + 12345;
+      pData[j] = (i & 1) ? (uint8_t)(seed >> 16) : (uint8_t)('a' + (j / 13) % 26);
+    }
+  };
+
+  udZipWriter *pWriter = nullptr;
+  ASSERT_EQ(udR_Success, udZipWriter_Create(&pWriter, pZipFilename, 4));
+  EXPECT_EQ(udR_Unsupported, udZipWriter_AddFile(pWriter, "bad", pData, 16, udCT_GzipDeflate));
+  for (int i = 0; i < entryCount; ++i)
+  {
+    fill(i);
+    EXPECT_EQ(udR_Success, udZipWriter_AddFile(pWriter, udTempStr("tiles/%d.bin", i), pData, length(i), (i % 5) ? udCT_RawDeflate : udCT_None));
+  }
+  EXPECT_EQ(udR_Success, udZipWriter_Close(&pWriter));
+  EXPECT_EQ(nullptr, pWriter);
+
+  udFile *pFile = nullptr;
+  ASSERT_EQ(udR_Success, udFile_Open(&pFile, udTempStr("zip://%s:", pZipFilename), udFOF_Read));
+  uint8_t *pRead = udAllocType(uint8_t, maxLength, udAF_None);
+  for (int i = 0; i < entryCount; ++i)
+  {
+    int64_t entryLength = 0;
+    ASSERT_EQ(udR_Success, udFile_SetSubFilename(pFile, udTempStr("tiles/%d.bin", i), &entryLength));
+    ASSERT_EQ((int64_t)length(i), entryLength);
+    if (entryLength)
+    {
+      fill(i);
+      EXPECT_EQ(udR_Success, udFile_Read(pFile, pRead, length(i), 0, udFSW_SeekSet));
+      EXPECT_EQ(0, memcmp(pData, pRead, length(i)));
+    }
+  }
+  EXPECT_EQ(udR_Success, udFile_Close(&pFile));
+  EXPECT_EQ(udR_Success, udFileDelete(pZipFilename));
+
+  // More entries than the classic end of central directory record can count requires ZIP64
+  const int zip64EntryCount = 70000;
+  ASSERT_EQ(udR_Success, udZipWriter_Create(&pWriter, pZipFilename));
+  for (int i = 0; i < zip64EntryCount; ++i)
+    ASSERT_EQ(udR_Success, udZipWriter_AddFile(pWriter, udTempStr("%d", i), &i, sizeof(i), udCT_None));
+  EXPECT_EQ(udR_Success, udZipWriter_Close(&pWriter));
+
+  for (int i : { 0, 65535, zip64EntryCount - 1 })
+  {
+    int value = -1;
+    ASSERT_EQ(udR_Success, udFile_Open(&pFile, udTempStr("zip://%s:%d", pZipFilename, i), udFOF_Read));
+    EXPECT_EQ(udR_Success, udFile_Read(pFile, &value, sizeof(value), 0, udFSW_SeekSet));
+    EXPECT_EQ(i, value);
+    EXPECT_EQ(udR_Success, udFile_Close(&pFile));
+  }
+  EXPECT_EQ(udR_Success, udFileDelete(pZipFilename));
+
+  udFree(pRead);
+  udFree(pData);
+}
+
+TEST(udCompressionTests, CreatePNG)
+{
+  // Large enough to be filtered across threads, with smooth gradients and noise so every filter type gets chosen
+  const int width = 600;
+  const int height = 500;
+  uint8_t *pImage = udAllocType(uint8_t, width * height * 4, udAF_None);
+  ASSERT_NE(nullptr, pImage);
+  uint32_t seed = 1;
+  for (int i = 0; i < width * height * 4; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int x = (i / 4) % width;
+    int y = (i / 4) / width;
+    pImage[i] = (y < height / 2) ? (uint8_t)(x + y * (i % 4)) : (uint8_t)(seed >> 16);
+  }
+
+  void *pPNG = nullptr;
+  size_t pngLength = 0;
+  EXPECT_EQ(udR_InvalidParameter, udCompression_CreatePNG(&pPNG, &pngLength, pImage, width, height, 5));
+  EXPECT_EQ(udR_InvalidParameter, udCompression_CreatePNG(&pPNG, &pngLength, pImage, width, height, 4, 13));
+
+  for (int channels = 1; channels <= 4; ++channels)
+  {
+    size_t storedLength = 0;
+    for (int level : { 0, 1, 6, 12 })
+    {
+      ASSERT_EQ(udR_Success, udCompression_CreatePNG(&pPNG, &pngLength, pImage, width, height, channels, level));
+      if (level == 0)
+        storedLength = pngLength;
+      else
+        EXPECT_LT(pngLength, storedLength);
+
+      udImage *pDecoded = nullptr;
+      ASSERT_EQ(udR_Success, udImage_LoadFromMemory(&pDecoded, pPNG, pngLength));
+      ASSERT_EQ((uint32_t)width, pDecoded->width);
+      ASSERT_EQ((uint32_t)height, pDecoded->height);
+      int mismatches = 0;
+      for (int i = 0; i < width * height; ++i)
+      {
+        const uint8_t *pSrc = pImage + i * channels;
+        uint8_t expected[4] = { pSrc[0], pSrc[0], pSrc[0], 255 };
+        if (channels == 2)
+          expected[3] = pSrc[1];
+        if (channels >= 3)
+          memcpy(expected, pSrc, channels);
+        if (memcmp(expected, &pDecoded->pImageData[i], 4) != 0)
+          ++mismatches;
+      }
+      EXPECT_EQ(0, mismatches);
+      udImage_Destroy(&pDecoded);
+      udFree(pPNG);
+    }
+  }
+  udFree(pImage);
+}
@@ -3,6 +3,11 @@
 #include "udJSON.h"
 #include "udStringUtil.h"
 
+#if UDPLATFORM_LINUX || UDPLATFORM_OSX
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
 TEST(udCryptoTests, AES_CBC_MonteCarlo)
 {
   // Do the first only monte carlo tests for CBC mode (400 tests in official monte carlo)
@@ -136,6 +141,289 @@ TEST(udCryptoTests, AES_CTR_MonteCarlo)
   }
 }
 
+TEST(udCryptoTests, AES_CTR_Bulk)
+{
+  // Large enough to be split into several bands, with a partial final block
+  const size_t length = 3 * 1024 * 1024 + 5;
+  const size_t blockCount = (length + 15) / 16;
+  const uint64_t nonce = 0x0123456789abcdefULL;
+  const uint64_t counter = 0xffffff00ULL; // Carries across several counter bytes
+  const char *pKeyBase64 = nullptr;
+  udCryptoCipherContext *pCtx = nullptr;
+  udCryptoIV iv;
+
+  uint8_t *pPlainText = udAllocType(uint8_t, length, udAF_None);
+  uint8_t *pCipherText = udAllocType(uint8_t, length, udAF_None);
+  uint8_t *pSingleThreaded = udAllocType(uint8_t, length, udAF_None);
+  ASSERT_NE(nullptr, pPlainText);
+  ASSERT_NE(nullptr, pCipherText);
+  ASSERT_NE(nullptr, pSingleThreaded);
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < length; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    pPlainText[i] = (uint8_t)(seed >> 16);
+  }
+
+  EXPECT_EQ(udR_Success, udCryptoKey_DeriveFromPassword(&pKeyBase64, udCCKL_AES256KeyLength, "password"));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCtx, udCC_AES256, udCPM_None, pKeyBase64, udCCM_CTR));
+  EXPECT_EQ(udR_Success, udCrypto_CreateIVForCTRMode(pCtx, &iv, nonce, counter));
+  EXPECT_EQ(udR_Success, udCryptoCipher_CryptCTR(pCtx, &iv, pPlainText, pCipherText, length, 0, 4));
+  EXPECT_EQ(udR_Success, udCryptoCipher_CryptCTR(pCtx, &iv, pPlainText, pSingleThreaded, length, 0, 1));
+  EXPECT_EQ(0, memcmp(pCipherText, pSingleThreaded, length));
+
+  // Each block must match encrypting that block alone with its own counter
+  int mismatches = 0;
+  for (size_t block = 0; block < blockCount; ++block)
+  {
+    uint8_t expected[16] = {};
+    size_t blockLength = std::min((size_t)16, length - block * 16);
+    memcpy(expected, pPlainText + block * 16, blockLength);
+    udCryptoIV blockIV;
+    EXPECT_EQ(udR_Success, udCrypto_CreateIVForCTRMode(pCtx, &blockIV, nonce, counter + block));
+    EXPECT_EQ(udR_Success, udCryptoCipher_Encrypt(pCtx, &blockIV, expected, 16, expected, 16));
+    mismatches += (memcmp(expected, pCipherText + block * 16, blockLength) != 0);
+  }
+  EXPECT_EQ(0, mismatches);
+
+  // Random access from a block offset
+  const size_t seekBlock = 1001;
+  EXPECT_EQ(udR_Success, udCryptoCipher_CryptCTR(pCtx, &iv, pPlainText + seekBlock * 16, pSingleThreaded, 100, seekBlock));
+  EXPECT_EQ(0, memcmp(pCipherText + seekBlock * 16, pSingleThreaded, 100));
+
+  // Decrypt in place
+  EXPECT_EQ(udR_Success, udCryptoCipher_CryptCTR(pCtx, &iv, pCipherText, pCipherText, length));
+  EXPECT_EQ(0, memcmp(pCipherText, pPlainText, length));
+
+  EXPECT_EQ(udR_InvalidParameter, udCryptoCipher_CryptCTR(pCtx, nullptr, pPlainText, pCipherText, length));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCtx));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCtx, udCC_AES256, udCPM_None, pKeyBase64, udCCM_CBC));
+  EXPECT_EQ(udR_InvalidConfiguration, udCryptoCipher_CryptCTR(pCtx, &iv, pPlainText, pCipherText, length));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCtx));
+
+  udFree(pKeyBase64);
+  udFree(pPlainText);
+  udFree(pCipherText);
+  udFree(pSingleThreaded);
+}
+
+TEST(udCryptoTests, AES_GCM)
+{
+  // Test cases 2, 3 and 4 from the GCM specification (McGrew & Viega)
+  static const uint8_t key2[16] = {};
+  static const uint8_t key34[16] = { 0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08 };
+  static const udCryptoIV iv2 = {};
+  static const udCryptoIV iv34 = { { 0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad,0xde,0xca,0xf8,0x88 } };
+  static const uint8_t plainText2[16] = {};
+  static const uint8_t cipherText2[16] = { 0x03,0x88,0xda,0xce,0x60,0xb6,0xa3,0x92,0xf3,0x28,0xc2,0xb9,0x71,0xb2,0xfe,0x78 };
+  static const uint8_t tag2[16] = { 0xab,0x6e,0x47,0xd4,0x2c,0xec,0x13,0xbd,0xf5,0x3a,0x67,0xb2,0x12,0x57,0xbd,0xdf };
+  static const uint8_t plainText34[64] =
+  {
+    0xd9,0x31,0x32,0x25,0xf8,0x84,0x06,0xe5,0xa5,0x59,0x09,0xc5,0xaf,0xf5,0x26,0x9a,
+    0x86,0xa7,0xa9,0x53,0x15,0x34,0xf7,0xda,0x2e,0x4c,0x30,0x3d,0x8a,0x31,0x8a,0x72,
+    0x1c,0x3c,0x0c,0x95,0x95,0x68,0x09,0x53,0x2f,0xcf,0x0e,0x24,0x49,0xa6,0xb5,0x25,
+    0xb1,0x6a,0xed,0xf5,0xaa,0x0d,0xe6,0x57,0xba,0x63,0x7b,0x39,0x1a,0xaf,0xd2,0x55
+  };
+  static const uint8_t cipherText34[64] =
+  {
+    0x42,0x83,0x1e,0xc2,0x21,0x77,0x74,0x24,0x4b,0x72,0x21,0xb7,0x84,0xd0,0xd4,0x9c,
+    0xe3,0xaa,0x21,0x2f,0x2c,0x02,0xa4,0xe0,0x35,0xc1,0x7e,0x23,0x29,0xac,0xa1,0x2e,
+    0x21,0xd5,0x14,0xb2,0x54,0x66,0x93,0x1c,0x7d,0x8f,0x6a,0x5a,0xac,0x84,0xaa,0x05,
+    0x1b,0xa3,0x0b,0x39,0x6a,0x0a,0xac,0x97,0x3d,0x58,0xe0,0x91,0x47,0x3f,0x59,0x85
+  };
+  static const uint8_t tag3[16] = { 0x4d,0x5c,0x2a,0xf3,0x27,0xcd,0x64,0xa6,0x2c,0xf3,0x5a,0xbd,0x2b,0xa6,0xfa,0xb4 };
+  static const uint8_t aad4[20] = { 0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,0xab,0xad,0xda,0xd2 };
+  static const uint8_t tag4[16] = { 0x5b,0xc9,0x4f,0xbc,0x32,0x21,0xa5,0xdb,0x94,0xfa,0xe9,0x5a,0xe7,0x12,0x1a,0x47 };
+
+  const char *pKeyBase64 = nullptr;
+  udCryptoCipherContext *pCtx = nullptr;
+  uint8_t buffer[64];
+  udCryptoTag tag;
+
+  EXPECT_EQ(udR_Success, udBase64Encode(&pKeyBase64, key2, sizeof(key2)));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCtx, udCC_AES128, udCPM_None, pKeyBase64, udCCM_GCM));
+  EXPECT_EQ(udR_Success, udCryptoCipher_EncryptGCM(pCtx, &iv2, plainText2, buffer, sizeof(plainText2), &tag));
+  EXPECT_EQ(0, memcmp(buffer, cipherText2, sizeof(cipherText2)));
+  EXPECT_EQ(0, memcmp(tag.tag, tag2, sizeof(tag2)));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCtx));
+  udFree(pKeyBase64);
+
+  EXPECT_EQ(udR_Success, udBase64Encode(&pKeyBase64, key34, sizeof(key34)));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCtx, udCC_AES128, udCPM_None, pKeyBase64, udCCM_GCM));
+  EXPECT_EQ(udR_Success, udCryptoCipher_EncryptGCM(pCtx, &iv34, plainText34, buffer, sizeof(plainText34), &tag));
+  EXPECT_EQ(0, memcmp(buffer, cipherText34, sizeof(cipherText34)));
+  EXPECT_EQ(0, memcmp(tag.tag, tag3, sizeof(tag3)));
+  EXPECT_EQ(udR_Success, udCryptoCipher_EncryptGCM(pCtx, &iv34, plainText34, buffer, 60, &tag, aad4, sizeof(aad4)));
+  EXPECT_EQ(0, memcmp(buffer, cipherText34, 60));
+  EXPECT_EQ(0, memcmp(tag.tag, tag4, sizeof(tag4)));
+
+  // Decrypt in place, then check tampering with the data or the additional data is detected
+  EXPECT_EQ(udR_Success, udCryptoCipher_DecryptGCM(pCtx, &iv34, buffer, buffer, 60, &tag, aad4, sizeof(aad4)));
+  EXPECT_EQ(0, memcmp(buffer, plainText34, 60));
+  memcpy(buffer, cipherText34, 60);
+  buffer[10] ^= 1;
+  EXPECT_EQ(udR_SignatureMismatch, udCryptoCipher_DecryptGCM(pCtx, &iv34, buffer, buffer, 60, &tag, aad4, sizeof(aad4)));
+  EXPECT_EQ(0, buffer[0]); // Unauthenticated output is zeroed
+  memcpy(buffer, cipherText34, 60);
+  EXPECT_EQ(udR_SignatureMismatch, udCryptoCipher_DecryptGCM(pCtx, &iv34, buffer, buffer, 60, &tag, aad4, sizeof(aad4) - 1));
+
+  // GCM contexts can only be used with the GCM functions
+  EXPECT_EQ(udR_InvalidConfiguration, udCryptoCipher_Encrypt(pCtx, &iv34, plainText34, 64, buffer, 64));
+  EXPECT_EQ(udR_InvalidConfiguration, udCryptoCipher_CryptCTR(pCtx, &iv34, plainText34, buffer, 64));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCtx));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCtx, udCC_AES128, udCPM_None, pKeyBase64, udCCM_CTR));
+  EXPECT_EQ(udR_InvalidConfiguration, udCryptoCipher_EncryptGCM(pCtx, &iv34, plainText34, buffer, 64, &tag));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCtx));
+  udFree(pKeyBase64);
+}
+
+TEST(udCryptoTests, AES_GCM_Blocks)
+{
+  const size_t blockSize = 64 * 1024;
+  const size_t length = 40 * blockSize + 1000; // Enough blocks to be split across threads, with a short final block
+  const size_t blockCount = (length + blockSize - 1) / blockSize;
+  const uint64_t nonce = 0x1122334455667788ULL;
+  const char *pKeyBase64 = nullptr;
+  udCryptoCipherContext *pCtx = nullptr;
+
+  uint8_t *pPlainText = udAllocType(uint8_t, length, udAF_None);
+  uint8_t *pCipherText = udAllocType(uint8_t, length, udAF_None);
+  uint8_t *pDecrypted = udAllocType(uint8_t, length, udAF_None);
+  udCryptoTag *pTags = udAllocType(udCryptoTag, blockCount, udAF_Zero);
+  udCryptoTag *pSingleThreadedTags = udAllocType(udCryptoTag, blockCount, udAF_Zero);
+  ASSERT_NE(nullptr, pPlainText);
+  ASSERT_NE(nullptr, pCipherText);
+  ASSERT_NE(nullptr, pDecrypted);
+  ASSERT_NE(nullptr, pTags);
+  ASSERT_NE(nullptr, pSingleThreadedTags);
+  for (size_t i = 0; i < length; ++i)
+    pPlainText[i] = (uint8_t)(i * 7 + (i >> 12));
+
+  EXPECT_EQ(udR_Success, udCryptoKey_DeriveFromPassword(&pKeyBase64, udCCKL_AES256KeyLength, "password"));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCtx, udCC_AES256, udCPM_None, pKeyBase64, udCCM_GCM));
+  EXPECT_EQ(udR_Success, udCryptoCipher_EncryptBlocksGCM(pCtx, nonce, 0, pPlainText, pCipherText, length, blockSize, pTags, 4));
+  EXPECT_EQ(udR_Success, udCryptoCipher_EncryptBlocksGCM(pCtx, nonce, 0, pPlainText, pDecrypted, length, blockSize, pSingleThreadedTags, 1));
+  EXPECT_EQ(0, memcmp(pCipherText, pDecrypted, length));
+  EXPECT_EQ(0, memcmp(pTags, pSingleThreadedTags, sizeof(udCryptoTag) * blockCount));
+
+  // Each block is an ordinary GCM message
+  udCryptoIV iv = {};
+  udCryptoTag tag;
+  for (int i = 0; i < 8; ++i)
+    iv.iv[i] = (uint8_t)(nonce >> (i * 8));
+  iv.iv[11] = 3;
+  EXPECT_EQ(udR_Success, udCryptoCipher_EncryptGCM(pCtx, &iv, pPlainText + 3 * blockSize, pDecrypted, blockSize, &tag));
+  EXPECT_EQ(0, memcmp(pCipherText + 3 * blockSize, pDecrypted, blockSize));
+  EXPECT_EQ(0, memcmp(pTags[3].tag, tag.tag, sizeof(tag.tag)));
+
+  // Decrypt everything, then just the last two blocks
+  EXPECT_EQ(udR_Success, udCryptoCipher_DecryptBlocksGCM(pCtx, nonce, 0, pCipherText, pDecrypted, length, blockSize, pTags));
+  EXPECT_EQ(0, memcmp(pPlainText, pDecrypted, length));
+  size_t tailOffset = (blockCount - 2) * blockSize;
+  EXPECT_EQ(udR_Success, udCryptoCipher_DecryptBlocksGCM(pCtx, nonce, blockCount - 2, pCipherText + tailOffset, pDecrypted, length - tailOffset, blockSize, pTags + blockCount - 2));
+  EXPECT_EQ(0, memcmp(pPlainText + tailOffset, pDecrypted, length - tailOffset));
+
+  // A block decrypted with the wrong index or tampered with fails verification without affecting its neighbours
+  EXPECT_EQ(udR_SignatureMismatch, udCryptoCipher_DecryptBlocksGCM(pCtx, nonce, 1, pCipherText, pDecrypted, blockSize, blockSize, pTags));
+  pCipherText[5 * blockSize + 17] ^= 0x80;
+  EXPECT_EQ(udR_SignatureMismatch, udCryptoCipher_DecryptBlocksGCM(pCtx, nonce, 0, pCipherText, pDecrypted, length, blockSize, pTags));
+  EXPECT_EQ(0, memcmp(pPlainText, pDecrypted, 5 * blockSize));
+  EXPECT_EQ(0, memcmp(pPlainText + 6 * blockSize, pDecrypted + 6 * blockSize, length - 6 * blockSize));
+
+  EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCtx));
+  udFree(pKeyBase64);
+  udFree(pPlainText);
+  udFree(pCipherText);
+  udFree(pDecrypted);
+  udFree(pTags);
+  udFree(pSingleThreadedTags);
+}
+
+TEST(udCryptoTests, CipherStreaming)
+{
+  const size_t length = 100000;
+  static const size_t chunkSizes[] = { 1, 15, 16, 17, 3, 4096, 33, 20000, 7 };
+  static const uint8_t aad[] = { 'h', 'e', 'a', 'd', 'e', 'r' };
+  const char *pKeyBase64 = nullptr;
+  udCryptoCipherContext *pCtx = nullptr;
+  udCryptoIV iv;
+  udCryptoTag expectedTag, tag;
+
+  uint8_t *pPlainText = udAllocType(uint8_t, length, udAF_None);
+  uint8_t *pExpected = udAllocType(uint8_t, length, udAF_None);
+  uint8_t *pStreamed = udAllocType(uint8_t, length, udAF_None);
+  ASSERT_NE(nullptr, pPlainText);
+  ASSERT_NE(nullptr, pExpected);
+  ASSERT_NE(nullptr, pStreamed);
+  for (size_t i = 0; i < length; ++i)
+    pPlainText[i] = (uint8_t)(i ^ (i >> 8));
+  EXPECT_EQ(udR_Success, udCryptoKey_DeriveFromPassword(&pKeyBase64, udCCKL_AES128KeyLength, "password"));
+
+  for (udCryptoChainMode mode : { udCCM_CTR, udCCM_GCM })
+  {
+    EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCtx, udCC_AES128, udCPM_None, pKeyBase64, mode));
+    EXPECT_EQ(udR_NotInitialized, udCryptoCipher_Update(pCtx, pPlainText, pStreamed, 16));
+    for (int i = 0; i < 16; ++i)
+      iv.iv[i] = (uint8_t)(0xf0 + i); // In CTR mode the counter carries across several bytes
+    if (mode == udCCM_CTR)
+    {
+      EXPECT_EQ(udR_Success, udCryptoCipher_CryptCTR(pCtx, &iv, pPlainText, pExpected, length));
+      EXPECT_EQ(udR_Success, udCryptoCipher_Begin(pCtx, &iv, udCSD_Encrypt));
+    }
+    else
+    {
+      EXPECT_EQ(udR_Success, udCryptoCipher_EncryptGCM(pCtx, &iv, pPlainText, pExpected, length, &expectedTag, aad, sizeof(aad)));
+      EXPECT_EQ(udR_Success, udCryptoCipher_Begin(pCtx, &iv, udCSD_Encrypt, aad, sizeof(aad)));
+    }
+
+    // Unaligned chunk sizes must give the same result as a single call
+    size_t offset = 0;
+    for (size_t i = 0; offset < length; ++i)
+    {
+      size_t chunk = std::min(chunkSizes[i % udLengthOf(chunkSizes)], length - offset);
+      EXPECT_EQ(udR_Success, udCryptoCipher_Update(pCtx, pPlainText + offset, pStreamed + offset, chunk));
+      offset += chunk;
+    }
+    EXPECT_EQ(0, memcmp(pExpected, pStreamed, length));
+    EXPECT_EQ(udR_Success, udCryptoCipher_Finish(pCtx, &tag));
+    if (mode == udCCM_GCM)
+    {
+      EXPECT_EQ(0, memcmp(expectedTag.tag, tag.tag, sizeof(tag.tag)));
+    }
+
+    // Decrypt in place in different sized chunks
+    EXPECT_EQ(udR_Success, udCryptoCipher_Begin(pCtx, &iv, udCSD_Decrypt, (mode == udCCM_GCM) ? aad : nullptr, (mode == udCCM_GCM) ? sizeof(aad) : 0));
+    for (offset = 0; offset < length; offset += 999)
+      EXPECT_EQ(udR_Success, udCryptoCipher_Update(pCtx, pStreamed + offset, pStreamed + offset, std::min((size_t)999, length - offset)));
+    EXPECT_EQ(udR_Success, udCryptoCipher_Finish(pCtx, &tag));
+    EXPECT_EQ(0, memcmp(pPlainText, pStreamed, length));
+
+    if (mode == udCCM_GCM)
+    {
+      pExpected[length / 2] ^= 1;
+      EXPECT_EQ(udR_Success, udCryptoCipher_Begin(pCtx, &iv, udCSD_Decrypt, aad, sizeof(aad)));
+      EXPECT_EQ(udR_Success, udCryptoCipher_Update(pCtx, pExpected, pStreamed, length));
+      EXPECT_EQ(udR_SignatureMismatch, udCryptoCipher_Finish(pCtx, &tag));
+      EXPECT_EQ(udR_NotInitialized, udCryptoCipher_Finish(pCtx, &tag));
+    }
+    EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCtx));
+  }
+
+  // Streaming isn't supported for CBC, but one context can both encrypt and decrypt
+  static const udCryptoIV cbcIV = {};
+  EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCtx, udCC_AES128, udCPM_None, pKeyBase64, udCCM_CBC));
+  EXPECT_EQ(udR_InvalidConfiguration, udCryptoCipher_Begin(pCtx, &cbcIV, udCSD_Encrypt));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Encrypt(pCtx, &cbcIV, pPlainText, 4096, pStreamed, 4096));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Decrypt(pCtx, &cbcIV, pStreamed, 4096, pStreamed, 4096));
+  EXPECT_EQ(0, memcmp(pPlainText, pStreamed, 4096));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCtx));
+
+  udFree(pKeyBase64);
+  udFree(pPlainText);
+  udFree(pExpected);
+  udFree(pStreamed);
+}
+
 TEST(udCryptoTests, CipherErrorCodes)
 {
   udResult result;
@@ -245,6 +533,194 @@ TEST(udCryptoTests, SHA)
   }
 }
 
+TEST(udCryptoTests, HashMany)
+{
+  // Lengths straddle the padding boundaries, and there are more messages than SIMD lanes so lanes get refilled
+  static const size_t s_lengths[] = { 0, 1, 3, 55, 56, 63, 64, 65, 119, 120, 127, 128, 1000, 64 * 40 + 7, 17, 200, 2, 4095, 31, 640 };
+  static const size_t s_digestLengths[] = { udCHL_SHA1Length, udCHL_SHA256Length, udCHL_SHA512Length, udCHL_MD5Length };
+  enum { MessageCount = UDARRAYSIZE(s_lengths) };
+
+  uint8_t data[4096 + 64]; // Room for the longest message at the latest start
+  for (size_t i = 0; i < sizeof(data); ++i)
+    data[i] = (uint8_t)(i * 131 + (i >> 7));
+
+  const void *pMessages[MessageCount];
+  for (size_t i = 0; i < MessageCount; ++i)
+    pMessages[i] = data + (i * 7) % 64; // Unaligned starts
+
+  for (int hash = 0; hash < udCH_Count; ++hash)
+  {
+    uint8_t digests[MessageCount * udCHL_MaxHashLength];
+    EXPECT_EQ(udR_Success, udCryptoHash_HashMany((udCryptoHashes)hash, MessageCount, pMessages, s_lengths, digests));
+
+    size_t digestLength = s_digestLengths[hash];
+    for (size_t i = 0; i < MessageCount; ++i)
+    {
+      const char *pExpectedBase64 = nullptr;
+      const char *pActualBase64 = nullptr;
+      EXPECT_EQ(udR_Success, udCryptoHash_Hash((udCryptoHashes)hash, pMessages[i], s_lengths[i], &pExpectedBase64));
+      EXPECT_EQ(udR_Success, udBase64Encode(&pActualBase64, digests + i * digestLength, digestLength));
+      EXPECT_STREQ(pExpectedBase64, pActualBase64);
+      udFree(pExpectedBase64);
+      udFree(pActualBase64);
+    }
+
+    // Digesting in odd sized pieces must match hashing in one go
+    udCryptoHashContext *pCtx = nullptr;
+    const char *pPiecesBase64 = nullptr;
+    const char *pWholeBase64 = nullptr;
+    EXPECT_EQ(udR_Success, udCryptoHash_Create(&pCtx, (udCryptoHashes)hash));
+    for (size_t offset = 0, piece = 1; offset < sizeof(data); offset += piece, piece = piece * 3 + 1)
+      EXPECT_EQ(udR_Success, udCryptoHash_Digest(pCtx, data + offset, std::min(piece, sizeof(data) - offset)));
+    EXPECT_EQ(udR_Success, udCryptoHash_Finalise(pCtx, &pPiecesBase64));
+    EXPECT_EQ(udR_Success, udCryptoHash_Destroy(&pCtx));
+    EXPECT_EQ(udR_Success, udCryptoHash_Hash((udCryptoHashes)hash, data, sizeof(data), &pWholeBase64));
+    EXPECT_STREQ(pWholeBase64, pPiecesBase64);
+    udFree(pPiecesBase64);
+    udFree(pWholeBase64);
+  }
+
+  uint8_t digest[udCHL_MaxHashLength];
+  const void *pNull = nullptr;
+  size_t length = 1;
+  EXPECT_EQ(udR_Success, udCryptoHash_HashMany(udCH_SHA256, 0, nullptr, nullptr, nullptr));
+  EXPECT_EQ(udR_InvalidParameter, udCryptoHash_HashMany(udCH_Count, 1, pMessages, s_lengths, digest));
+  EXPECT_EQ(udR_InvalidParameter, udCryptoHash_HashMany(udCH_SHA256, 1, pMessages, s_lengths, nullptr));
+  EXPECT_EQ(udR_InvalidParameter, udCryptoHash_HashMany(udCH_SHA256, 1, &pNull, &length, digest));
+}
+
+TEST(udCryptoTests, HashManyKernels)
+{
+  // Known answers for each kernel; the FIPS-180 vectors plus runs of 'a' around the padding boundaries, including the million 'a' vector.
+  // The mixed lengths leave lanes finishing at different times, and 13 messages leave idle lanes at the end
+  enum { RunLength = 1000000 };
+  static const char *s_strings[] =
+  {
+    "abc",
+    "",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+  };
+  static const struct
+  {
+    int string;    // Index into s_strings, or -1 for a run of 'a'
+    size_t length; // Length of the run of 'a'
+    const char *pSHA1;
+    const char *pSHA256;
+  } s_tests[] =
+  {
+    { -1, 1000, "KR6abGaZSUm1e6XmUDYemPw2sbo=", "Qe3s5C1j6Nm/UVqbppMuHCDLyfWl0TRkWttdsblzfqM=" },
+    { 0, 0, "qZk+NkcGgWq6PiVxeFDCbJzQ2J0=", "ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=" },
+    { -1, 55, "wci73CJ5bijA4VFj0giZtlYh1lo=", "n0OQ+NMMLdkuyfCVtl4rmumwqSWlJY4kHJ8ekQ9zQxg=" },
+    { -1, RunLength, "NKqXPNTE2qT2Husr260nMWU0AW8=", "zcduXJkU+5KBocfihNc+Z/GAmkiklyAOBG05zMcRLNA=" },
+    { 1, 0, "2jmj7l5rSw0yVb/vlWAYkK/YBwk=", "47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=" },
+    { -1, 56, "wtszD2CDhUyZ1LW/tujynyAb5pk=", "s1Q5pKxvCUi21vnjxq8PX1kM4g8b3nCQ73lwaG7Gc4o=" },
+    { 3, 0, "pJskRqAsZFv0GfmVtnCRJToEolk=", "z1sWp3ivg4ADbOWeewSSNwskmxHo8HpRr6xFA3r+6dE=" },
+    { -1, 64, "AJi6gktcFkJ716ESKlpEKiXsZE0=", "/+BU/nrgy23GXDr5th1SCfQ5hR20PQulmXM33xVGaOs=" },
+    { 2, 0, "hJg+RBw70m66rkqh+VEp5eVGcPE=", "JI1qYdIGOLjlwCaTDD5gOaM85Flk/yFn9uzt1BnbBsE=" },
+    { -1, 119, "7pcQZaqgF+BjKoymx3uzv4sd/FY=", "MeulHDE6XAgiat8Y1KNZz9/Y0ugWsT9K+VL36mWE3Ps=" },
+    { 0, 0, "qZk+NkcGgWq6PiVxeFDCbJzQ2J0=", "ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=" },
+    { -1, 55, "wci73CJ5bijA4VFj0giZtlYh1lo=", "n0OQ+NMMLdkuyfCVtl4rmumwqSWlJY4kHJ8ekQ9zQxg=" },
+    { 1, 0, "2jmj7l5rSw0yVb/vlWAYkK/YBwk=", "47DEQpj8HBSa+/TImW+5JCeuQeRkm5NMpJWZG3hSuFU=" },
+  };
+  enum { MessageCount = UDARRAYSIZE(s_tests) };
+
+  char *pRun = udAllocType(char, RunLength, udAF_None);
+  ASSERT_NE(nullptr, pRun);
+  memset(pRun, 'a', RunLength);
+
+  const void *pMessages[MessageCount];
+  size_t lengths[MessageCount];
+  for (size_t i = 0; i < MessageCount; ++i)
+  {
+    pMessages[i] = (s_tests[i].string < 0) ? pRun : s_strings[s_tests[i].string];
+    lengths[i] = (s_tests[i].string < 0) ? s_tests[i].length : udStrlen(s_strings[s_tests[i].string]);
+  }
+
+  for (int kernel = udCHMK_Auto; kernel < udCHMK_Count; ++kernel)
+  {
+    udResult kernelResult = udCryptoHash_SetHashManyKernel((udCryptoHashManyKernel)kernel);
+    if (kernelResult == udR_Unsupported)
+      continue; // Not every CPU can run every kernel
+    EXPECT_EQ(udR_Success, kernelResult);
+
+    for (udCryptoHashes hash : { udCH_SHA1, udCH_SHA256 })
+    {
+      size_t digestLength = udCryptoHash_GetLength(hash);
+      uint8_t digests[MessageCount * udCHL_MaxHashLength];
+      EXPECT_EQ(udR_Success, udCryptoHash_HashMany(hash, MessageCount, pMessages, lengths, digests));
+      for (size_t i = 0; i < MessageCount; ++i)
+      {
+        const char *pActualBase64 = nullptr;
+        EXPECT_EQ(udR_Success, udBase64Encode(&pActualBase64, digests + i * digestLength, digestLength));
+        EXPECT_STREQ((hash == udCH_SHA1) ? s_tests[i].pSHA1 : s_tests[i].pSHA256, pActualBase64) << "kernel " << kernel << ", message " << i;
+        udFree(pActualBase64);
+      }
+    }
+  }
+
+  EXPECT_EQ(udR_InvalidParameter, udCryptoHash_SetHashManyKernel(udCHMK_Count));
+  EXPECT_EQ(udR_Success, udCryptoHash_SetHashManyKernel(udCHMK_Auto));
+  udFree(pRun);
+}
+
+TEST(udCryptoTests, RawDigests)
+{
+  static const char message[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  uint8_t longKey[100]; // Longer than a block, so it gets hashed down
+  for (size_t i = 0; i < sizeof(longKey); ++i)
+    longKey[i] = (uint8_t)(i * 7 + 1);
+  const char *pLongKeyBase64 = nullptr;
+  EXPECT_EQ(udR_Success, udBase64Encode(&pLongKeyBase64, longKey, sizeof(longKey)));
+
+  for (int hash = 0; hash < udCH_Count; ++hash)
+  {
+    size_t hashLength = udCryptoHash_GetLength((udCryptoHashes)hash);
+    uint8_t raw[udCHL_MaxHashLength];
+    uint8_t expected[udCHL_MaxHashLength];
+    const char *pBase64 = nullptr;
+    size_t written = 0;
+
+    EXPECT_EQ(udR_Success, udCryptoHash_Hash((udCryptoHashes)hash, message, sizeof(message) - 1, &pBase64, message, 5));
+    EXPECT_EQ(udR_Success, udBase64Decode(pBase64, 0, expected, sizeof(expected), &written));
+    EXPECT_EQ(hashLength, written);
+    EXPECT_EQ(udR_Success, udCryptoHash_HashRaw((udCryptoHashes)hash, message, sizeof(message) - 1, raw, sizeof(raw), message, 5));
+    EXPECT_EQ(0, memcmp(expected, raw, hashLength));
+    udFree(pBase64);
+
+    udCryptoHashContext *pCtx = nullptr;
+    EXPECT_EQ(udR_Success, udCryptoHash_Create(&pCtx, (udCryptoHashes)hash));
+    EXPECT_EQ(udR_Success, udCryptoHash_Digest(pCtx, message, sizeof(message) - 1));
+    EXPECT_EQ(udR_BufferTooSmall, udCryptoHash_FinaliseRaw(pCtx, raw, hashLength - 1));
+    EXPECT_EQ(udR_Success, udCryptoHash_FinaliseRaw(pCtx, raw, hashLength, &written));
+    EXPECT_EQ(hashLength, written);
+    EXPECT_EQ(udR_Success, udCryptoHash_Destroy(&pCtx));
+    EXPECT_EQ(udR_Success, udCryptoHash_HashRaw((udCryptoHashes)hash, message, sizeof(message) - 1, expected, sizeof(expected)));
+    EXPECT_EQ(0, memcmp(expected, raw, hashLength));
+
+    // Short ("Jefe") and long keys must match the base64 form
+    const char *keys[] = { "SmVmZQ==", pLongKeyBase64 };
+    const uint8_t *pRawKeys[] = { (const uint8_t*)"Jefe", longKey };
+    const size_t rawKeyLengths[] = { 4, sizeof(longKey) };
+    for (int k = 0; k < 2; ++k)
+    {
+      EXPECT_EQ(udR_Success, udCryptoHash_HMAC((udCryptoHashes)hash, keys[k], message, sizeof(message) - 1, &pBase64));
+      EXPECT_EQ(udR_Success, udBase64Decode(pBase64, 0, expected, sizeof(expected)));
+      EXPECT_EQ(udR_Success, udCryptoHash_HMACRaw((udCryptoHashes)hash, pRawKeys[k], rawKeyLengths[k], message, sizeof(message) - 1, raw, sizeof(raw), &written));
+      EXPECT_EQ(hashLength, written);
+      EXPECT_EQ(0, memcmp(expected, raw, hashLength));
+      udFree(pBase64);
+    }
+    EXPECT_EQ(udR_BufferTooSmall, udCryptoHash_HMACRaw((udCryptoHashes)hash, "Jefe", 4, message, sizeof(message) - 1, raw, hashLength - 1));
+  }
+  udFree(pLongKeyBase64);
+
+  uint8_t digest[udCHL_MaxHashLength];
+  EXPECT_EQ(udR_InvalidParameter, udCryptoHash_HashRaw(udCH_Count, message, 1, digest, sizeof(digest)));
+  EXPECT_EQ(udR_InvalidParameter, udCryptoHash_HashRaw(udCH_SHA256, nullptr, 1, digest, sizeof(digest)));
+  EXPECT_EQ(udR_InvalidParameter, udCryptoHash_HMACRaw(udCH_SHA256, nullptr, 1, message, 1, digest, sizeof(digest)));
+}
+
 TEST(udCryptoTests, Self)
 {
   EXPECT_EQ(udR_Success, udCryptoCipher_SelfTest(udCC_AES128));
@@ -318,6 +794,23 @@ TEST(udCryptoTests, RSACreateSig)
   // Verify the message using the public key
   EXPECT_EQ(udR_Success, udCryptoSig_Verify(pPubCtx, pHash, pSignature, udCH_SHA1));
 
+  // The raw forms must produce and accept the same bytes
+  uint8_t rawHash[udCHL_SHA1Length];
+  uint8_t rawSignature[udCSL_MaxSignatureLength];
+  uint8_t expectedSignature[udCSL_MaxSignatureLength];
+  size_t rawSignatureLength = 0;
+  size_t expectedSignatureLength = 0;
+  EXPECT_EQ(udR_Success, udCryptoHash_HashRaw(udCH_SHA1, pMessage, udStrlen(pMessage), rawHash, sizeof(rawHash)));
+  EXPECT_EQ(udR_Success, udCryptoSig_SignRaw(pPrivCtx, rawHash, sizeof(rawHash), rawSignature, sizeof(rawSignature), &rawSignatureLength, udCH_SHA1));
+  EXPECT_EQ(udR_Success, udBase64Decode(pExpectedSignature, 0, expectedSignature, sizeof(expectedSignature), &expectedSignatureLength));
+  EXPECT_EQ(expectedSignatureLength, rawSignatureLength);
+  EXPECT_EQ(0, memcmp(expectedSignature, rawSignature, rawSignatureLength));
+  EXPECT_EQ(udR_BufferTooSmall, udCryptoSig_SignRaw(pPrivCtx, rawHash, sizeof(rawHash), rawSignature, rawSignatureLength - 1, nullptr, udCH_SHA1));
+  EXPECT_EQ(udR_Success, udCryptoSig_VerifyRaw(pPubCtx, rawHash, sizeof(rawHash), rawSignature, rawSignatureLength, udCH_SHA1));
+  EXPECT_EQ(udR_SignatureMismatch, udCryptoSig_VerifyRaw(pPubCtx, rawHash, sizeof(rawHash), rawSignature, rawSignatureLength - 1, udCH_SHA1));
+  rawHash[0] ^= 1;
+  EXPECT_EQ(udR_SignatureMismatch, udCryptoSig_VerifyRaw(pPubCtx, rawHash, sizeof(rawHash), rawSignature, rawSignatureLength, udCH_SHA1));
+
   // Change the hash slightly to ensure the message isn't verified
   ((char*)pHash)[1] ^= 1;
   EXPECT_EQ(udR_SignatureMismatch, udCryptoSig_Verify(pPrivCtx, pHash, pSignature, udCH_SHA1));
@@ -436,6 +929,69 @@ TEST(udCryptoTests, ECDSADigiSigFromudCloud)
   udCrypto_Deinit();
 }
 
+TEST(udCryptoTests, VerifyMany)
+{
+  // Enough for two bands of udCrypto_VerifyMinBandSize, with the tampered signature in the second band
+  enum { SignatureCount = 40, TamperedIndex = 30 };
+  static const udCryptoSigType s_types[] = { udCST_RSA1024, udCST_ECPBP384 };
+
+  EXPECT_EQ(udR_Success, udCrypto_Init());
+  for (udCryptoSigType type : s_types)
+  {
+    udCryptoSigContext *pPrivCtx = nullptr;
+    udCryptoSigContext *pPubCtx = nullptr;
+    udCryptoSigContext *pPubCtx2 = nullptr;
+    const char *pPublicKeyText = nullptr;
+
+    ASSERT_EQ(udR_Success, udCryptoSig_CreateKeyPair(&pPrivCtx, type));
+    EXPECT_EQ(udR_Success, udCryptoSig_ExportKeyPair(pPrivCtx, &pPublicKeyText, false));
+
+    // The second import of the same key comes from the cache
+    EXPECT_EQ(udR_Success, udCryptoSig_ImportVerifyKey(&pPubCtx, pPublicKeyText));
+    EXPECT_EQ(udR_Success, udCryptoSig_ImportVerifyKey(&pPubCtx2, pPublicKeyText));
+    EXPECT_EQ(pPubCtx, pPubCtx2);
+    udCryptoSig_Destroy(&pPubCtx2);
+    EXPECT_EQ(nullptr, pPubCtx2);
+
+    static uint8_t hashes[SignatureCount * udCHL_SHA256Length];
+    uint8_t signature[udCSL_MaxSignatureLength];
+    size_t signatureLength = 0;
+    const uint8_t *pSignatures[SignatureCount];
+    size_t signatureLengths[SignatureCount];
+    udResult results[SignatureCount];
+    // Signing is slow, so one signature is reused for every message
+    int message = 0;
+    EXPECT_EQ(udR_Success, udCryptoHash_HashRaw(udCH_SHA256, &message, sizeof(message), hashes, udCHL_SHA256Length));
+    EXPECT_EQ(udR_Success, udCryptoSig_SignRaw(pPrivCtx, hashes, udCHL_SHA256Length, signature, sizeof(signature), &signatureLength, udCH_SHA256));
+    for (int i = 0; i < SignatureCount; ++i)
+    {
+      memcpy(hashes + i * udCHL_SHA256Length, hashes, udCHL_SHA256Length);
+      pSignatures[i] = signature;
+      signatureLengths[i] = signatureLength;
+    }
+
+    for (uint32_t threadCount = 1; threadCount <= 4; threadCount += 3)
+    {
+      EXPECT_EQ(udR_Success, udCryptoSig_VerifyMany(pPubCtx, udCH_SHA256, SignatureCount, hashes, pSignatures, signatureLengths, results, threadCount));
+      for (int i = 0; i < SignatureCount; ++i)
+        EXPECT_EQ(udR_Success, results[i]);
+
+      hashes[TamperedIndex * udCHL_SHA256Length] ^= 1;
+      EXPECT_EQ(udR_SignatureMismatch, udCryptoSig_VerifyMany(pPubCtx, udCH_SHA256, SignatureCount, hashes, pSignatures, signatureLengths, results, threadCount));
+      for (int i = 0; i < SignatureCount; ++i)
+        EXPECT_EQ((i == TamperedIndex) ? udR_SignatureMismatch : udR_Success, results[i]);
+      hashes[TamperedIndex * udCHL_SHA256Length] ^= 1;
+    }
+    EXPECT_EQ(udR_Success, udCryptoSig_VerifyMany(pPubCtx, udCH_SHA256, 0, nullptr, nullptr, nullptr));
+    EXPECT_EQ(udR_InvalidParameter, udCryptoSig_VerifyMany(pPubCtx, udCH_Count, SignatureCount, hashes, pSignatures, signatureLengths));
+
+    udCryptoSig_Destroy(&pPubCtx);
+    udCryptoSig_Destroy(&pPrivCtx);
+    udFree(pPublicKeyText);
+  }
+  udCrypto_Deinit();
+}
+
 TEST(udCryptoTests, DHM)
 {
   udResult result;
@@ -541,6 +1097,38 @@ TEST(udCryptoTests, Utilities)
   EXPECT_EQ(udR_Success, udCrypto_Random(&rand1, sizeof(rand1)));
   EXPECT_EQ(udR_Success, udCrypto_Random(&rand2, sizeof(rand2)));
   EXPECT_TRUE(rand1 != rand2);
+
+  // Requests larger than a single DRBG request are supported
+  const size_t bulkLength = 100000;
+  uint8_t *pBulk = udAllocType(uint8_t, bulkLength, udAF_Zero);
+  EXPECT_EQ(udR_Success, udCrypto_Random(pBulk, bulkLength));
+  int zeroCount = 0;
+  for (size_t i = 0; i < bulkLength; ++i)
+    zeroCount += (pBulk[i] == 0);
+  EXPECT_LT(zeroCount, (int)(bulkLength / 128)); // Expect about 1 in 256
+  udFree(pBulk);
+
+#if UDPLATFORM_LINUX || UDPLATFORM_OSX
+  // A forked child must not repeat the parent's output from the inherited DRBG state
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0)
+  {
+    uint64_t childRand = 0;
+    udCrypto_Random(&childRand, sizeof(childRand));
+    ssize_t written = write(fds[1], &childRand, sizeof(childRand));
+    _exit(written == sizeof(childRand) ? 0 : 1);
+  }
+  uint64_t childRand = 0;
+  EXPECT_EQ((ssize_t)sizeof(childRand), read(fds[0], &childRand, sizeof(childRand)));
+  waitpid(pid, nullptr, 0);
+  close(fds[0]);
+  close(fds[1]);
+  EXPECT_EQ(udR_Success, udCrypto_Random(&rand1, sizeof(rand1)));
+  EXPECT_NE(rand1, childRand);
+#endif
   udCrypto_Deinit();
 
   EXPECT_NE(nullptr, pTestStr);
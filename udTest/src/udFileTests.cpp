@@ -167,6 +167,130 @@ TEST(udFileTests, EncryptedReadWriteFILE)
   udCrypto_Deinit();
 }
 
+TEST(udFileTests, AuthenticatedEncryptedReadFILE)
+{
+  udCrypto_Init();
+
+  const char *pFilename = "._donotcommit_AuthEncryptedFILEtest";
+  const uint32_t blockSize = 256;
+  const size_t length = 10 * blockSize + 100;
+  const size_t blockCount = (length + blockSize - 1) / blockSize;
+  uint8_t plainText[length];
+  uint8_t cipherText[length];
+  uint8_t readBuffer[length];
+  udCryptoTag tags[blockCount];
+  uint8_t *pKey = nullptr;
+  size_t keyLen = 0;
+  size_t actualRead = 0;
+  const char *pKeyBase64 = nullptr;
+  udCryptoCipherContext *pCipherCtx = nullptr;
+  udFile *pFile = nullptr;
+
+  for (size_t i = 0; i < length; ++i)
+    plainText[i] = (uint8_t)(i * 13);
+  ASSERT_EQ(udR_Success, udCryptoKey_DeriveFromRandom(&pKeyBase64, udCCKL_AES128KeyLength));
+  EXPECT_EQ(udR_Success, udBase64Decode(&pKey, &keyLen, pKeyBase64));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Create(&pCipherCtx, udCC_AES128, udCPM_None, pKeyBase64, udCCM_GCM));
+  EXPECT_EQ(udR_Success, udCryptoCipher_EncryptBlocksGCM(pCipherCtx, 99, 0, plainText, cipherText, length, blockSize, tags));
+  EXPECT_EQ(udR_Success, udCryptoCipher_Destroy(&pCipherCtx));
+  cipherText[7 * blockSize + 3] ^= 1; // Corrupt a single block
+  EXPECT_EQ(udR_Success, udFile_Save(pFilename, cipherText, length));
+
+  EXPECT_EQ(udR_Success, udFile_Open(&pFile, pFilename, udFOF_Read));
+  EXPECT_EQ(udR_Success, udFile_SetAuthenticatedEncryption(pFile, pKey, (int)keyLen, 99, blockSize, tags, blockCount));
+
+  // Unaligned reads only verify the blocks they touch
+  EXPECT_EQ(udR_Success, udFile_Read(pFile, readBuffer, 3 * blockSize, 100, udFSW_SeekSet));
+  EXPECT_EQ(0, memcmp(plainText + 100, readBuffer, 3 * blockSize));
+  EXPECT_EQ(udR_Success, udFile_Read(pFile, readBuffer, 500, length - 500, udFSW_SeekSet, &actualRead));
+  EXPECT_EQ(500u, actualRead);
+  EXPECT_EQ(0, memcmp(plainText + length - 500, readBuffer, 500));
+  EXPECT_EQ(udR_Success, udFile_Read(pFile, readBuffer, blockSize, 0, udFSW_SeekSet));
+  EXPECT_EQ(0, memcmp(plainText, readBuffer, blockSize));
+  EXPECT_EQ(udR_SignatureMismatch, udFile_Read(pFile, readBuffer, 10, 7 * blockSize + 50, udFSW_SeekSet));
+  EXPECT_EQ(udR_Success, udFile_Close(&pFile));
+
+  udFree(pKey);
+  udFree(pKeyBase64);
+  EXPECT_EQ(udR_Success, udFileDelete(pFilename));
+
+  udCrypto_Deinit();
+}
+
+TEST(udFileTests, TreeHashFILE)
+{
+  udCrypto_Init();
+
+  const char *pFilename = "._donotcommit_TreeHashFILEtest";
+  const uint32_t leafSize = 4096;
+  const size_t length = 5 * leafSize + 100;
+  uint8_t data[length];
+  uint8_t root[udCHL_SHA256Length];
+  uint8_t singleThreadRoot[udCHL_SHA256Length];
+  uint8_t expected[udCHL_SHA256Length];
+  uint8_t *pLeaves = nullptr;
+  uint8_t *pSingleThreadLeaves = nullptr;
+  size_t leafCount = 0;
+  udFile *pFile = nullptr;
+
+  // Parents are built independently of udCryptoHash_TreeRoot from the base64 hash API
+  auto hashParent = [](const uint8_t *pLeft, const uint8_t *pRight, uint8_t *pParent) {
+    uint8_t message[1 + 2 * udCHL_SHA256Length] = { 0x01 };
+    const char *pHashBase64 = nullptr;
+    memcpy(message + 1, pLeft, udCHL_SHA256Length);
+    memcpy(message + 1 + udCHL_SHA256Length, pRight, udCHL_SHA256Length);
+    EXPECT_EQ(udR_Success, udCryptoHash_Hash(udCH_SHA256, message, sizeof(message), &pHashBase64));
+    EXPECT_EQ(udR_Success, udBase64Decode(pHashBase64, 0, pParent, udCHL_SHA256Length));
+    udFree(pHashBase64);
+  };
+
+  for (size_t i = 0; i < length; ++i)
+    data[i] = (uint8_t)(i * 7 + (i >> 11));
+  EXPECT_EQ(udR_Success, udFile_Save(pFilename, data, length));
+
+  EXPECT_EQ(udR_Success, udFile_Open(&pFile, pFilename, udFOF_Read | udFOF_Multithread));
+  EXPECT_EQ(udR_Success, udFile_TreeHash(pFile, udCH_SHA256, leafSize, root, &pLeaves, &leafCount, 4));
+  EXPECT_EQ(udR_Success, udFile_TreeHash(pFile, udCH_SHA256, leafSize, singleThreadRoot, &pSingleThreadLeaves, nullptr, 1));
+  EXPECT_EQ(udR_InvalidParameter, udFile_TreeHash(pFile, udCH_SHA256, 0, root));
+  EXPECT_EQ(udR_Success, udFile_Close(&pFile));
+  ASSERT_EQ(6u, leafCount);
+  EXPECT_EQ(0, memcmp(root, singleThreadRoot, sizeof(root)));
+  EXPECT_EQ(0, memcmp(pLeaves, pSingleThreadLeaves, leafCount * udCHL_SHA256Length));
+
+  // Each leaf can be verified on its own
+  for (size_t i = 0; i < leafCount; ++i)
+  {
+    uint8_t leaf[udCHL_SHA256Length];
+    EXPECT_EQ(udR_Success, udCryptoHash_TreeLeaf(udCH_SHA256, data + i * leafSize, std::min((size_t)leafSize, length - i * leafSize), leaf));
+    EXPECT_EQ(0, memcmp(leaf, pLeaves + i * udCHL_SHA256Length, sizeof(leaf)));
+  }
+
+  // 6 leaves pair into 3 parents, then the odd third parent is promoted: root = P(P(P01, P23), P45)
+  uint8_t p01[udCHL_SHA256Length], p23[udCHL_SHA256Length], p45[udCHL_SHA256Length], p0123[udCHL_SHA256Length];
+  hashParent(pLeaves + 0 * udCHL_SHA256Length, pLeaves + 1 * udCHL_SHA256Length, p01);
+  hashParent(pLeaves + 2 * udCHL_SHA256Length, pLeaves + 3 * udCHL_SHA256Length, p23);
+  hashParent(pLeaves + 4 * udCHL_SHA256Length, pLeaves + 5 * udCHL_SHA256Length, p45);
+  hashParent(p01, p23, p0123);
+  hashParent(p0123, p45, expected);
+  EXPECT_EQ(0, memcmp(root, expected, sizeof(root)));
+
+  udFree(pLeaves);
+  udFree(pSingleThreadLeaves);
+
+  // An empty file is a single empty leaf
+  EXPECT_EQ(udR_Success, udFile_Save(pFilename, data, 0));
+  EXPECT_EQ(udR_Success, udFile_Open(&pFile, pFilename, udFOF_Read));
+  EXPECT_EQ(udR_Success, udFile_TreeHash(pFile, udCH_SHA256, leafSize, root, nullptr, &leafCount));
+  EXPECT_EQ(udR_Success, udFile_Close(&pFile));
+  EXPECT_EQ(1u, leafCount);
+  EXPECT_EQ(udR_Success, udCryptoHash_TreeLeaf(udCH_SHA256, nullptr, 0, expected));
+  EXPECT_EQ(0, memcmp(root, expected, sizeof(root)));
+
+  EXPECT_EQ(udR_Success, udFileDelete(pFilename));
+
+  udCrypto_Deinit();
+}
+
 static char s_customFileHandler_buffer[32];
 udResult udFileTests_CustomFileHandler_Open(udFile **ppFile, const char *pFilename, udFileOpenFlags /*flags*/)
 {
@@ -344,6 +468,43 @@ TEST(udFileTests, RawLoad)
   udFree(pMemory);
 }
 
+TEST(udFileTests, RawRandomRead)
+{
+  static uint8_t data[5000];
+  uint8_t buffer[600];
+  const char *pRawFilename = nullptr;
+  const char *pBrokenFilename = nullptr;
+  udFile *pFile = nullptr;
+  int64_t length;
+  size_t actualRead;
+
+  for (size_t i = 0; i < udLengthOf(data); ++i)
+    data[i] = (uint8_t)(i * 131 + 7);
+  ASSERT_EQ(udR_Success, udFile_GenerateRawFilename(&pRawFilename, data, udLengthOf(data)));
+  // A line break in the text can't be decoded on read, so is decoded when opened instead
+  ASSERT_EQ(udR_Success, udSprintf(&pBrokenFilename, "%.1000s\n%s", pRawFilename, pRawFilename + 1000));
+
+  // Fast open decodes as the file is read, otherwise it's decoded when opened
+  struct { const char *pFilename; udFileOpenFlags flags; } opens[] = { { pRawFilename, udFOF_Read }, { pRawFilename, udFOF_Read | udFOF_FastOpen }, { pBrokenFilename, udFOF_Read | udFOF_FastOpen } };
+  for (auto open : opens)
+  {
+    ASSERT_EQ(udR_Success, udFile_Open(&pFile, open.pFilename, open.flags, &length));
+    EXPECT_EQ((int64_t)udLengthOf(data), length);
+    for (size_t offset = 0; offset < udLengthOf(data); offset += 97)
+    {
+      size_t readLength = (offset % 7) * 83 + 1;
+      size_t expectedLength = std::min(readLength, udLengthOf(data) - offset);
+      EXPECT_EQ(udR_Success, udFile_Read(pFile, buffer, readLength, (int64_t)offset, udFSW_SeekSet, &actualRead));
+      EXPECT_EQ(expectedLength, actualRead);
+      EXPECT_EQ(0, memcmp(data + offset, buffer, expectedLength));
+    }
+    EXPECT_EQ(udR_Success, udFile_Close(&pFile));
+  }
+
+  udFree(pBrokenFilename);
+  udFree(pRawFilename);
+}
+
 // ----------------------------------------------------------------------------
 // Author: Dave Pevreal, August 2019
 TEST(udFileTests, RawWrite)
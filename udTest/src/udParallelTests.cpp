@@ -0,0 +1,130 @@
+#include "gtest/gtest.h"
+#include "udParallel.h"
+#include <atomic>
+
+TEST(udParallelTests, For)
+{
+  udWorkerPool *pPool = nullptr;
+  const size_t count = 10000;
+  std::atomic<int> *pVisits = new std::atomic<int>[count]();
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 4));
+
+  // Every index is visited exactly once, with and without a grain
+  EXPECT_EQ(udR_Success, udParallelFor(pPool, 0, count, 0, [pVisits](size_t begin, size_t end) { for (size_t i = begin; i < end; ++i) ++pVisits[i]; }));
+  EXPECT_EQ(udR_Success, udParallelFor(pPool, 100, count, 7, [pVisits](size_t begin, size_t end) { for (size_t i = begin; i < end; ++i) ++pVisits[i]; }));
+  for (size_t i = 0; i < count; ++i)
+    EXPECT_EQ(i < 100 ? 1 : 2, pVisits[i].load());
+
+  EXPECT_EQ(udR_Success, udParallelFor(pPool, 5, 5, 0, [](size_t, size_t) { ADD_FAILURE(); }));
+  EXPECT_EQ(udR_InvalidParameter, udParallelFor(pPool, 5, 4, 0, [](size_t, size_t) {}));
+  EXPECT_EQ(udR_InvalidParameter, udParallelFor(nullptr, 0, 4, 0, [](size_t, size_t) {}));
+
+  udWorkerPool_Destroy(&pPool);
+  delete[] pVisits;
+}
+
+TEST(udParallelTests, Nested)
+{
+  udWorkerPool *pPool = nullptr;
+  std::atomic<int> total(0);
+
+  // With a single worker the outer loop's helper runs the inner loops, which must not wait on work nothing can run
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 1));
+
+  EXPECT_EQ(udR_Success, udParallelFor(pPool, 0, 16, 1, [pPool, &total](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
+      EXPECT_EQ(udR_Success, udParallelFor(pPool, 0, 100, 3, [&total](size_t innerBegin, size_t innerEnd) { total += (int)(innerEnd - innerBegin); }));
+  }));
+  EXPECT_EQ(1600, total.load());
+
+  udWorkerPool_Destroy(&pPool);
+}
+
+struct ParallelSpan
+{
+  size_t first;
+  size_t last;
+  bool ordered;
+  bool empty;
+};
+
+TEST(udParallelTests, Reduce)
+{
+  udWorkerPool *pPool = nullptr;
+  const size_t count = 100000;
+  uint64_t sum = 0;
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 4));
+
+  EXPECT_EQ(udR_Success, udParallelReduce(pPool, 0, count, 0, (uint64_t)0, [](size_t begin, size_t end)
+  {
+    uint64_t partial = 0;
+    for (size_t i = begin; i < end; ++i)
+      partial += i;
+    return partial;
+  }, [](uint64_t a, uint64_t b) { return a + b; }, &sum));
+  EXPECT_EQ((uint64_t)count * (count - 1) / 2, sum);
+
+  // Partial results are combined in index order, so combine doesn't need to be commutative
+  ParallelSpan span;
+  auto spanMap = [](size_t begin, size_t end) { return ParallelSpan{ begin, end, true, false }; };
+  auto spanCombine = [](const ParallelSpan &a, const ParallelSpan &b)
+  {
+    if (a.empty || b.empty)
+      return a.empty ? b : a;
+    return ParallelSpan{ a.first, b.last, a.ordered && b.ordered && a.last == b.first, false };
+  };
+  EXPECT_EQ(udR_Success, udParallelReduce(pPool, 3, count, 10, ParallelSpan{ 0, 0, true, true }, spanMap, spanCombine, &span));
+  EXPECT_FALSE(span.empty);
+  EXPECT_TRUE(span.ordered);
+  EXPECT_EQ(3u, span.first);
+  EXPECT_EQ(count, span.last);
+
+  EXPECT_EQ(udR_Success, udParallelReduce(pPool, 7, 7, 0, ParallelSpan{ 0, 0, true, true }, spanMap, spanCombine, &span));
+  EXPECT_TRUE(span.empty);
+
+  udWorkerPool_Destroy(&pPool);
+}
+
+TEST(udParallelTests, ChunkedArray)
+{
+  udWorkerPool *pPool = nullptr;
+  udChunkedArray<int> array;
+  const int count = 5000;
+  const int popped = 10;
+  int64_t sum = 0;
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 4));
+  ASSERT_EQ(udR_Success, array.Init(64));
+  for (int i = 0; i < count; ++i)
+    array.PushBack(i);
+
+  // Popping from the front leaves the first chunk partly used
+  for (int i = 0; i < popped; ++i)
+    array.PopFront();
+
+  EXPECT_EQ(udR_Success, udParallelFor(pPool, array, [&array](int *pElements, size_t elementCount, size_t firstIndex)
+  {
+    EXPECT_EQ(array.GetElementRunLength(firstIndex), elementCount);
+    EXPECT_TRUE(firstIndex == 0 || array.GetElementRunLength(firstIndex, true) == 0); // Runs start on a chunk boundary
+    for (size_t i = 0; i < elementCount; ++i)
+      pElements[i] *= 2;
+  }));
+
+  for (int i = 0; i < count - popped; ++i)
+    EXPECT_EQ((i + popped) * 2, array[i]);
+
+  EXPECT_EQ(udR_Success, udParallelReduce(pPool, array, (int64_t)0, [](const int *pElements, size_t elementCount, size_t)
+  {
+    int64_t partial = 0;
+    for (size_t i = 0; i < elementCount; ++i)
+      partial += pElements[i];
+    return partial;
+  }, [](int64_t a, int64_t b) { return a + b; }, &sum));
+  EXPECT_EQ((int64_t)(count - 1) * count - (int64_t)(popped - 1) * popped, sum);
+
+  array.Deinit();
+  udWorkerPool_Destroy(&pPool);
+}
@@ -1,5 +1,7 @@
 #include "gtest/gtest.h"
 #include "udPlatformUtil.h"
+#include "udStringUtil.h"
+#include <algorithm>
 
 TEST(udPlatformUtilTests, udTime)
 {
@@ -18,3 +20,186 @@ TEST(udPlatformUtilTests, udTime)
   EXPECT_EQ(udR_Success, udTime_EpochToString(buffer, udLengthOf(buffer), epoch));
   EXPECT_STREQ(time, buffer);
 }
+
+TEST(udPlatformUtilTests, udHash)
+{
+  // Expected values match the reference XXH3_64bits_withSeed and XXH3_128bits_withSeed
+  static const struct
+  {
+    size_t length;
+    uint64_t seed;
+    uint64_t hash64;
+    uint64_t hash128Low;
+    uint64_t hash128High;
+  } vectors[] =
+  {
+    { 0, 0x0000000000000000ULL, 0x2D06800538D394C2ULL, 0x6001C324468D497FULL, 0x99AA06D3014798D8ULL },
+    { 3, 0x0000000000000000ULL, 0x6E3E2670E61106ACULL, 0x6E3E2670E61106ACULL, 0x390CDC5B4A895DD7ULL },
+    { 8, 0x0000000000000000ULL, 0xF9FD4DD0B04D78F5ULL, 0x61DDBE7F31A6100DULL, 0x6A86A3BDA6AF4E3DULL },
+    { 16, 0x0000000000000000ULL, 0x86ABF6BACCEA0858ULL, 0xE2CE54A7C19C730DULL, 0x7F9A218B0425449AULL },
+    { 100, 0x0000000000000000ULL, 0x5DA67EAC6D4093D5ULL, 0x580B061A98A5A9B4ULL, 0x76B536586DE98B82ULL },
+    { 200, 0x0000000000000000ULL, 0xC0FBC0F4E181C826ULL, 0xA4773493FBBE3543ULL, 0x26D28D07860728F6ULL },
+    { 240, 0x0000000000000000ULL, 0xB6CFAF343FAB81E6ULL, 0x3F2C53E72293711FULL, 0x5293E17BF553903DULL },
+    { 241, 0x0000000000000000ULL, 0x956CAE592C67279EULL, 0x956CAE592C67279EULL, 0xB53840FE3FEDF161ULL },
+    { 1000, 0x0000000000000000ULL, 0x571D5CBFEF44331BULL, 0x571D5CBFEF44331BULL, 0x622239C5C47A6910ULL },
+    { 5000, 0x0000000000000000ULL, 0xE4007929540F095CULL, 0xE4007929540F095CULL, 0x61BEDB627E4A5FDFULL },
+    { 0, 0x9E3779B97F4A7C15ULL, 0x602B0E2CD6662C8BULL, 0x4CA5176998171787ULL, 0xD142977A2CCA554BULL },
+    { 3, 0x9E3779B97F4A7C15ULL, 0xBC74611D87F659E0ULL, 0xBC74611D87F659E0ULL, 0x3F5FD00FF400BA58ULL },
+    { 8, 0x9E3779B97F4A7C15ULL, 0xBC72D0531396303FULL, 0x8A88691D5CECB7B6ULL, 0x9B51BCD70BE038F6ULL },
+    { 16, 0x9E3779B97F4A7C15ULL, 0x69D001B16ECF450AULL, 0x1097F793402C818AULL, 0xD5F6FDBF62CDC681ULL },
+    { 100, 0x9E3779B97F4A7C15ULL, 0xBA21393335A9A3BAULL, 0x0C13FB407B8A2777ULL, 0xFE7093AF14E2900BULL },
+    { 200, 0x9E3779B97F4A7C15ULL, 0x83264818FB531769ULL, 0xBA852C1A37AD8096ULL, 0xFAC3060DAE982A81ULL },
+    { 240, 0x9E3779B97F4A7C15ULL, 0x76A73EC26433F82CULL, 0xFCAC543705C8C541ULL, 0xDE30C63EE85A3579ULL },
+    { 241, 0x9E3779B97F4A7C15ULL, 0x2BE236BA3BACF75CULL, 0x2BE236BA3BACF75CULL, 0x7BE6397A1DFD48CCULL },
+    { 1000, 0x9E3779B97F4A7C15ULL, 0xA6FA06F07FB6C797ULL, 0xA6FA06F07FB6C797ULL, 0xACD6530D1A0A726AULL },
+    { 5000, 0x9E3779B97F4A7C15ULL, 0x2B84B035A03235C8ULL, 0x2B84B035A03235C8ULL, 0x7EB32CC3D9430D4EULL },
+  };
+
+  static uint8_t data[5000];
+  for (size_t i = 0; i < udLengthOf(data); ++i)
+    data[i] = (uint8_t)(i * 131 + 7);
+
+  for (size_t i = 0; i < udLengthOf(vectors); ++i)
+  {
+    EXPECT_EQ(vectors[i].hash64, udHash64(data, vectors[i].length, vectors[i].seed));
+    udHash128Value hash128 = udHash128(data, vectors[i].length, vectors[i].seed);
+    EXPECT_EQ(vectors[i].hash128Low, hash128.low64);
+    EXPECT_EQ(vectors[i].hash128High, hash128.high64);
+
+    // Streaming in uneven chunks must give the same result, including when digested part way through
+    for (size_t chunkSize = 1; chunkSize < 300; chunkSize += 37)
+    {
+      udHashState state;
+      udHash_Init(&state, vectors[i].seed);
+      for (size_t offset = 0; offset < vectors[i].length; offset += chunkSize)
+      {
+        size_t length = (chunkSize < vectors[i].length - offset) ? chunkSize : vectors[i].length - offset;
+        udHash_Update(&state, data + offset, length);
+        EXPECT_EQ(udHash64(data, offset + length, vectors[i].seed), udHash_Digest64(&state));
+      }
+      EXPECT_EQ(vectors[i].hash64, udHash_Digest64(&state));
+      hash128 = udHash_Digest128(&state);
+      EXPECT_EQ(vectors[i].hash128Low, hash128.low64);
+      EXPECT_EQ(vectors[i].hash128High, hash128.high64);
+    }
+  }
+}
+
+TEST(udPlatformUtilTests, udCrc)
+{
+  EXPECT_EQ(0xCBF43926, udCrc("123456789", 9));
+  EXPECT_EQ(0xE3069283, udCrc32c("123456789", 9));
+
+  static uint8_t data[5000];
+  for (size_t i = 0; i < udLengthOf(data); ++i)
+    data[i] = (uint8_t)(i * 131 + 7);
+
+  // Byte at a time updates skip the folding and slicing (CRC-32 uses the byte table, CRC-32C the crc32 instruction where available), so they check the whole buffer paths
+  for (size_t length = 0; length < udLengthOf(data); length += 97)
+  {
+    uint32_t crc = 0;
+    uint32_t crc32c = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+      crc = udCrc(data + i, 1, crc);
+      crc32c = udCrc32c(data + i, 1, crc32c);
+    }
+    EXPECT_EQ(crc, udCrc(data, length));
+    EXPECT_EQ(crc32c, udCrc32c(data, length));
+  }
+
+  for (size_t split = 0; split <= udLengthOf(data); split += 499)
+  {
+    size_t length2 = udLengthOf(data) - split;
+    EXPECT_EQ(udCrc(data, udLengthOf(data)), udCrcCombine(udCrc(data, split), udCrc(data + split, length2), length2));
+    EXPECT_EQ(udCrc32c(data, udLengthOf(data)), udCrc32cCombine(udCrc32c(data, split), udCrc32c(data + split, length2), length2));
+  }
+
+  // Combining over very long lengths must match combining the same zeros in two halves, each half's CRC built by doubling
+  memset(data, 0, 1024);
+  uint32_t zeroCrc = udCrc(data, 1024);
+  uint32_t zeroCrc32c = udCrc32c(data, 1024);
+  uint32_t crc = udCrc("123456789", 9);
+  uint32_t crc32c = udCrc32c("123456789", 9);
+  for (uint64_t length = 1024; length < (1ULL << 40); length *= 2)
+  {
+    uint32_t doubledCrc = udCrcCombine(zeroCrc, zeroCrc, length);
+    uint32_t doubledCrc32c = udCrc32cCombine(zeroCrc32c, zeroCrc32c, length);
+    EXPECT_EQ(udCrcCombine(udCrcCombine(crc, zeroCrc, length), zeroCrc, length), udCrcCombine(crc, doubledCrc, length * 2));
+    EXPECT_EQ(udCrc32cCombine(udCrc32cCombine(crc32c, zeroCrc32c, length), zeroCrc32c, length), udCrc32cCombine(crc32c, doubledCrc32c, length * 2));
+    zeroCrc = doubledCrc;
+    zeroCrc32c = doubledCrc32c;
+  }
+}
+
+TEST(udPlatformUtilTests, udBase64)
+{
+  const char *pEncoded = nullptr;
+  EXPECT_EQ(udR_Success, udBase64Encode(&pEncoded, "Hello World", 11));
+  EXPECT_STREQ("SGVsbG8gV29ybGQ=", pEncoded);
+  udFree(pEncoded);
+
+  // Long enough for the SIMD kernels, with lengths covering each amount of padding
+  static uint8_t data[1000];
+  static uint8_t decoded[1000];
+  for (size_t i = 0; i < udLengthOf(data); ++i)
+    data[i] = (uint8_t)(i * 131 + 7);
+
+  for (size_t length = 0; length < udLengthOf(data); length += 37)
+  {
+    size_t decodedLength = 0;
+    ASSERT_EQ(udR_Success, udBase64Encode(&pEncoded, data, length));
+    EXPECT_EQ((length + 2) / 3 * 4, udStrlen(pEncoded));
+    EXPECT_EQ(udR_Success, udBase64Decode(pEncoded, 0, decoded, length, &decodedLength));
+    EXPECT_EQ(length, decodedLength);
+    EXPECT_EQ(0, memcmp(data, decoded, length));
+    if (length >= 3)
+    {
+      EXPECT_EQ(udR_BufferTooSmall, udBase64Decode(pEncoded, 0, decoded, length - 3));
+    }
+    udFree(pEncoded);
+  }
+
+  // Characters outside the alphabet are skipped, including within a run the kernels would otherwise decode
+  const size_t testLength = 300;
+  ASSERT_EQ(udR_Success, udBase64Encode(&pEncoded, data, testLength));
+  const char *pWithBreaks = nullptr;
+  size_t decodedLength = 0;
+  ASSERT_EQ(udR_Success, udSprintf(&pWithBreaks, "%.100s\r\n%.100s %s", pEncoded, pEncoded + 100, pEncoded + 200));
+  EXPECT_EQ(udR_Success, udBase64Decode(pWithBreaks, 0, decoded, udLengthOf(decoded), &decodedLength));
+  EXPECT_EQ(testLength, decodedLength);
+  EXPECT_EQ(0, memcmp(data, decoded, testLength));
+
+  // Streaming in small pieces with limited output space gives the same result, and counting gives the exact length
+  udBase64Decoder decoder;
+  udBase64Decoder_Init(&decoder);
+  EXPECT_EQ(udR_Success, udBase64Decoder_Update(&decoder, pWithBreaks, udStrlen(pWithBreaks), nullptr, 0, nullptr, &decodedLength));
+  EXPECT_EQ(testLength, decodedLength);
+  EXPECT_EQ((size_t)3, decoder.skippedCount);
+
+  memset(decoded, 0, sizeof(decoded));
+  udBase64Decoder_Init(&decoder);
+  size_t inputOffset = 0;
+  size_t outputOffset = 0;
+  size_t inputLength = udStrlen(pWithBreaks);
+  while (inputOffset < inputLength)
+  {
+    size_t inputUsed = 0;
+    size_t outputWritten = 0;
+    size_t pieceLength = std::min(inputLength - inputOffset, (size_t)13);
+    EXPECT_EQ(udR_Success, udBase64Decoder_Update(&decoder, pWithBreaks + inputOffset, pieceLength, decoded + outputOffset, 7, &inputUsed, &outputWritten));
+    inputOffset += inputUsed;
+    outputOffset += outputWritten;
+  }
+  EXPECT_EQ(testLength, outputOffset);
+  EXPECT_EQ(0, memcmp(data, decoded, testLength));
+
+  // Decoding in place
+  char *pInPlace = const_cast<char*>(pWithBreaks);
+  EXPECT_EQ(udR_Success, udBase64Decode(pInPlace, 0, (uint8_t*)pInPlace, udStrlen(pInPlace), &decodedLength));
+  EXPECT_EQ(testLength, decodedLength);
+  EXPECT_EQ(0, memcmp(data, pInPlace, testLength));
+
+  udFree(pWithBreaks);
+  udFree(pEncoded);
+}
@@ -44,3 +44,31 @@ TEST(udSafeDequeTests, ValidationTests)
   udSafeDeque_Destroy(&pQueue);
   udSafeDeque_Destroy((udSafeDeque<int> **)nullptr);
 }
+
+TEST(udSafeDequeTests, PushBackMany)
+{
+  udSafeDeque<int> *pQueue = nullptr;
+  const int values[] = { 4, 8, 15, 16, 23, 42 };
+  int result = -1;
+
+  ASSERT_EQ(udR_Success, udSafeDeque_Create(&pQueue, 4));
+
+  EXPECT_EQ(udR_Success, udSafeDeque_PushBack(pQueue, 1));
+  EXPECT_EQ(udR_Success, udSafeDeque_PushBack(pQueue, values, udLengthOf(values)));
+  EXPECT_EQ(udR_Success, udSafeDeque_PushBack(pQueue, values, 0));
+  EXPECT_EQ(udR_InvalidParameter, udSafeDeque_PushBack(pQueue, (const int *)nullptr, 1));
+  EXPECT_EQ(udLengthOf(values) + 1, udSafeDeque_GetLength(pQueue));
+
+  EXPECT_EQ(udR_Success, udSafeDeque_PopFront(pQueue, &result));
+  EXPECT_EQ(1, result);
+  for (size_t i = 0; i < udLengthOf(values); ++i)
+  {
+    EXPECT_EQ(udR_Success, udSafeDeque_PopFront(pQueue, &result));
+    EXPECT_EQ(values[i], result);
+  }
+  EXPECT_EQ(udR_NotFound, udSafeDeque_PopFront(pQueue, &result));
+  EXPECT_EQ(0u, udSafeDeque_GetLength(pQueue));
+  EXPECT_EQ(0u, udSafeDeque_GetLength((udSafeDeque<int> *)nullptr));
+
+  udSafeDeque_Destroy(&pQueue);
+}
@@ -99,4 +99,20 @@ TEST(udUUID, GenerationTests)
   EXPECT_EQ(udR_Success, udUUID_GenerateFromRandom(&generated));
   EXPECT_EQ(udR_Success, udUUID_GenerateFromRandom(&expected));
   EXPECT_NE(expected, generated);
+
+  // Bulk generation, spanning several internal batches
+  const size_t count = 1000;
+  udUUID *pUUIDs = udAllocType(udUUID, count, udAF_Zero);
+  ASSERT_NE(nullptr, pUUIDs);
+  EXPECT_EQ(udR_Success, udUUID_GenerateFromRandom(pUUIDs, count));
+  for (size_t i = 0; i < count; ++i)
+  {
+    EXPECT_TRUE(udUUID_IsValid(pUUIDs[i]));
+    EXPECT_EQ('4', pUUIDs[i].internal_bytes[14]);
+    if (i > 0)
+    {
+      EXPECT_NE(pUUIDs[i - 1], pUUIDs[i]);
+    }
+  }
+  udFree(pUUIDs);
 }
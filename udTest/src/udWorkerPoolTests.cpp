@@ -3,6 +3,8 @@
 #include "udWorkerPool.h"
 #include "udPlatformUtil.h"
 #include "udThread.h"
+#include "udJSON.h"
+#include <atomic>
 
 struct WorkerTestData
 {
@@ -116,3 +118,532 @@ TEST(udWorkerPoolTests, Validate)
   udWorkerPool_Destroy(&pPool);
   udWorkerPool_Destroy(nullptr);
 }
+
+struct NestedTaskData
+{
+  udWorkerPool *pPool;
+  std::atomic<int> *pCount;
+  int depth;
+  int width;
+};
+
+void NestedTask(void *pDataPtr)
+{
+  NestedTaskData *pData = (NestedTaskData*)pDataPtr;
+
+  ++(*pData->pCount);
+  for (int i = 0; i < pData->width; ++i)
+  {
+    NestedTaskData *pChild = udAllocType(NestedTaskData, 1, udAF_None);
+    *pChild = *pData;
+    pChild->depth = pData->depth - 1;
+    pChild->width = (pChild->depth > 0) ? 2 : 0;
+    EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pData->pPool, NestedTask, pChild));
+  }
+}
+
+TEST(udWorkerPoolTests, NestedTasks)
+{
+  udWorkerPool *pPool = nullptr;
+  std::atomic<int> count(0);
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 4));
+
+  // Tasks added by tasks go to the worker's own queue for the others to steal, a wide first level makes that queue grow
+  const int rootWidth = 1000;
+  const int depth = 4;
+  NestedTaskData *pRoot = udAllocType(NestedTaskData, 1, udAF_None);
+  pRoot->pPool = pPool;
+  pRoot->pCount = &count;
+  pRoot->depth = depth;
+  pRoot->width = rootWidth;
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, NestedTask, pRoot));
+
+  while (udWorkerPool_HasActiveWorkers(pPool))
+    udYield();
+
+  // The root, then each of its children has a binary tree of depth - 1 levels below it
+  EXPECT_EQ(1 + rootWidth * ((1 << depth) - 1), count.load());
+
+  udWorkerPool_Destroy(&pPool);
+}
+
+struct TaskHandleData
+{
+  udWorkerPool *pPool;
+  udSemaphore *pSema;
+  std::atomic<int> *pValue;
+};
+
+void TaskHandleBlock(void *pDataPtr)
+{
+  TaskHandleData *pData = (TaskHandleData*)pDataPtr;
+  udWaitSemaphore(pData->pSema);
+}
+
+void TaskHandleAdd(void *pDataPtr)
+{
+  TaskHandleData *pData = (TaskHandleData*)pDataPtr;
+  ++(*pData->pValue);
+}
+
+void TaskHandleDouble(void *pDataPtr)
+{
+  TaskHandleData *pData = (TaskHandleData*)pDataPtr;
+  *pData->pValue = *pData->pValue * 2;
+}
+
+void TaskHandleWaitOnChild(void *pDataPtr)
+{
+  TaskHandleData *pData = (TaskHandleData*)pDataPtr;
+  udWorkerPoolTask *pChild = nullptr;
+
+  // The pool only has one worker, so this only finishes if waiting runs the child
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pData->pPool, TaskHandleAdd, pData, false, nullptr, &pChild));
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pChild));
+  udWorkerPool_ReleaseTask(&pChild);
+  ++(*pData->pValue);
+}
+
+TEST(udWorkerPoolTests, TaskHandles)
+{
+  udWorkerPool *pPool = nullptr;
+  std::atomic<int> value(0);
+  TaskHandleData data = { nullptr, udCreateSemaphore(), &value };
+  udWorkerPoolTask *pBlocker = nullptr;
+  udWorkerPoolTask *pCancelled = nullptr;
+  udWorkerPoolTask *pContinuation = nullptr;
+  udWorkerPoolTask *pTask = nullptr;
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 1));
+  data.pPool = pPool;
+
+  // With the only worker blocked, queued tasks can time out and be cancelled
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, TaskHandleBlock, &data, false, nullptr, &pBlocker));
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, TaskHandleAdd, &data, false, nullptr, &pCancelled));
+  EXPECT_EQ(udR_Success, udWorkerPool_Then(pCancelled, TaskHandleAdd, &data, false, &pContinuation));
+  EXPECT_EQ(udR_Timeout, udWorkerPool_WaitTask(pCancelled, 10));
+  EXPECT_EQ(udWPTS_Queued, udWorkerPool_GetTaskState(pCancelled));
+
+  EXPECT_EQ(udR_Success, udWorkerPool_CancelTask(pCancelled));
+  EXPECT_EQ(udR_NotAllowed, udWorkerPool_CancelTask(pCancelled));
+  EXPECT_EQ(udR_Cancelled, udWorkerPool_WaitTask(pCancelled));
+  EXPECT_EQ(udR_Cancelled, udWorkerPool_WaitTask(pContinuation));
+  udWorkerPool_ReleaseTask(&pContinuation);
+
+  // Continuations of an already cancelled task are cancelled too
+  EXPECT_EQ(udR_Success, udWorkerPool_Then(pCancelled, TaskHandleAdd, &data, false, &pContinuation));
+  EXPECT_EQ(udWPTS_Cancelled, udWorkerPool_GetTaskState(pContinuation));
+  udWorkerPool_ReleaseTask(&pContinuation);
+  udWorkerPool_ReleaseTask(&pCancelled);
+  EXPECT_EQ(nullptr, pCancelled);
+
+  udIncrementSemaphore(data.pSema);
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pBlocker));
+  EXPECT_EQ(udR_NotAllowed, udWorkerPool_CancelTask(pBlocker));
+  EXPECT_EQ(0, value.load());
+
+  // Continuations run in order after the task completes, including ones added once it already has
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, TaskHandleAdd, &data, false, nullptr, &pTask));
+  EXPECT_EQ(udR_Success, udWorkerPool_Then(pTask, TaskHandleDouble, &data, false, &pContinuation));
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pContinuation));
+  EXPECT_EQ(2, value.load());
+  udWorkerPool_ReleaseTask(&pContinuation);
+
+  EXPECT_EQ(udR_Success, udWorkerPool_Then(pBlocker, TaskHandleAdd, &data, false, &pContinuation));
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pContinuation));
+  EXPECT_EQ(3, value.load());
+  udWorkerPool_ReleaseTask(&pContinuation);
+  udWorkerPool_ReleaseTask(&pTask);
+  udWorkerPool_ReleaseTask(&pBlocker);
+
+  // Waiting from a worker runs other tasks rather than blocking the pool
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, TaskHandleWaitOnChild, &data, false, nullptr, &pTask));
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pTask, 10000));
+  EXPECT_EQ(5, value.load());
+  EXPECT_EQ(udWPTS_Complete, udWorkerPool_GetTaskState(pTask));
+
+  // Handles outlive the pool
+  udWorkerPool_Destroy(&pPool);
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pTask));
+  udWorkerPool_ReleaseTask(&pTask);
+
+  udDestroySemaphore(&data.pSema);
+}
+
+struct GraphTileData
+{
+  std::atomic<int> stage;
+  std::atomic<int> outOfOrder;
+};
+
+void GraphTileStage(void *pDataPtr)
+{
+  GraphTileData *pData = (GraphTileData*)pDataPtr;
+  int expected = pData->stage.load();
+  if (!pData->stage.compare_exchange_strong(expected, expected + 1))
+    ++pData->outOfOrder;
+}
+
+struct GraphFrameData
+{
+  GraphTileData *pTiles;
+  int tileCount;
+  int stageCount;
+  int completeCount;
+};
+
+void GraphFrameComplete(void *pDataPtr)
+{
+  GraphFrameData *pData = (GraphFrameData*)pDataPtr;
+  for (int i = 0; i < pData->tileCount; ++i)
+  {
+    if (pData->pTiles[i].stage.load() == pData->stageCount)
+      ++pData->completeCount;
+  }
+}
+
+TEST(udWorkerPoolTests, TaskGraph)
+{
+  enum { TileCount = 16, StageCount = 4, FrameCount = 3 };
+
+  udWorkerPool *pPool = nullptr;
+  udWorkerPoolGraph *pGraph = nullptr;
+  GraphTileData tiles[FrameCount][TileCount];
+  GraphFrameData frames[FrameCount];
+  uint32_t stageNodes[TileCount][StageCount];
+  uint32_t frameNode = 0;
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 4));
+  ASSERT_EQ(udR_Success, udWorkerPoolGraph_Create(&pGraph));
+
+  // Each tile is a chain of stages with the last on the main thread, then one node waits on every tile
+  EXPECT_EQ(udR_Success, udWorkerPoolGraph_AddNode(pGraph, GraphFrameComplete, nullptr, nullptr, &frameNode));
+  for (int tile = 0; tile < TileCount; ++tile)
+  {
+    for (int stage = 0; stage < StageCount; ++stage)
+    {
+      if (stage == StageCount - 1)
+      {
+        EXPECT_EQ(udR_Success, udWorkerPoolGraph_AddNode(pGraph, nullptr, nullptr, GraphTileStage, &stageNodes[tile][stage]));
+      }
+      else
+      {
+        EXPECT_EQ(udR_Success, udWorkerPoolGraph_AddNode(pGraph, GraphTileStage, nullptr, nullptr, &stageNodes[tile][stage]));
+      }
+
+      if (stage > 0)
+      {
+        EXPECT_EQ(udR_Success, udWorkerPoolGraph_AddDependency(pGraph, stageNodes[tile][stage], stageNodes[tile][stage - 1]));
+      }
+    }
+    EXPECT_EQ(udR_Success, udWorkerPoolGraph_AddDependency(pGraph, frameNode, stageNodes[tile][StageCount - 1]));
+  }
+
+  // The same graph is reused for each frame with the data pointed somewhere new
+  for (int frame = 0; frame < FrameCount; ++frame)
+  {
+    frames[frame] = { tiles[frame], TileCount, StageCount, 0 };
+    EXPECT_EQ(udR_Success, udWorkerPoolGraph_SetNodeUserData(pGraph, frameNode, &frames[frame]));
+    for (int tile = 0; tile < TileCount; ++tile)
+    {
+      tiles[frame][tile].stage = 0;
+      tiles[frame][tile].outOfOrder = 0;
+      for (int stage = 0; stage < StageCount; ++stage)
+        EXPECT_EQ(udR_Success, udWorkerPoolGraph_SetNodeUserData(pGraph, stageNodes[tile][stage], &tiles[frame][tile]));
+    }
+
+    EXPECT_EQ(udR_Success, udWorkerPoolGraph_Submit(pPool, pGraph));
+    EXPECT_EQ(udR_NotAllowed, udWorkerPoolGraph_Submit(pPool, pGraph));
+
+    udResult result;
+    while ((result = udWorkerPoolGraph_Wait(pGraph, 1)) == udR_Timeout)
+      udWorkerPool_DoPostWork(pPool);
+    EXPECT_EQ(udR_Success, result);
+
+    EXPECT_EQ(TileCount, frames[frame].completeCount);
+    for (int tile = 0; tile < TileCount; ++tile)
+      EXPECT_EQ(0, tiles[frame][tile].outOfOrder.load());
+  }
+
+  // Cycles are rejected when submitted
+  EXPECT_EQ(udR_Success, udWorkerPoolGraph_AddDependency(pGraph, stageNodes[0][0], frameNode));
+  EXPECT_EQ(udR_InvalidConfiguration, udWorkerPoolGraph_Submit(pPool, pGraph));
+  EXPECT_EQ(udR_Success, udWorkerPoolGraph_Wait(pGraph, 0));
+
+  // An empty graph completes straight away
+  EXPECT_EQ(udR_Success, udWorkerPoolGraph_Clear(pGraph));
+  EXPECT_EQ(udR_Success, udWorkerPoolGraph_Submit(pPool, pGraph));
+  EXPECT_EQ(udR_Success, udWorkerPoolGraph_Wait(pGraph, 0));
+
+  udWorkerPoolGraph_Destroy(&pGraph);
+  EXPECT_EQ(nullptr, pGraph);
+  udWorkerPool_Destroy(&pPool);
+}
+
+TEST(udWorkerPoolTests, PrioritiesAndDelays)
+{
+  udWorkerPool *pPool = nullptr;
+  udSemaphore *pSema = udCreateSemaphore();
+  char order[64] = {};
+  std::atomic<int> orderCount(0);
+  udWorkerPoolTask *pTask = nullptr;
+  udWorkerPoolTaskDesc desc;
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 1));
+
+  // Hold the only worker so everything below is queued before any of it runs
+  desc.function = [pSema](void *) { udWaitSemaphore(pSema); };
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, &desc));
+
+  const char kinds[] = { 'B', 'N', 'C' };
+  const udWorkerPoolPriority priorities[] = { udWPP_Background, udWPP_Normal, udWPP_Critical };
+  const int counts[] = { 4, 40, 4 };
+  for (int kind = 0; kind < 3; ++kind)
+  {
+    for (int i = 0; i < counts[kind]; ++i)
+    {
+      char name = kinds[kind];
+      desc.function = [&order, &orderCount, name](void *) { order[orderCount++] = name; };
+      desc.priority = priorities[kind];
+      EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, &desc, (kind == 1 && i == counts[kind] - 1) ? &pTask : nullptr));
+    }
+  }
+
+  udIncrementSemaphore(pSema);
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pTask));
+  while (udWorkerPool_HasActiveWorkers(pPool))
+    udYield();
+  udWorkerPool_ReleaseTask(&pTask);
+  ASSERT_EQ(48, orderCount.load());
+
+  // Critical tasks go first, background tasks still get a turn while normal ones are waiting
+  EXPECT_EQ(0, memcmp(order, "CCCC", 4));
+  EXPECT_EQ(nullptr, strchr(order + 4, 'C'));
+  const char *pLastBackground = strrchr(order, 'B');
+  ASSERT_NE(nullptr, pLastBackground);
+  EXPECT_NE(nullptr, strchr(pLastBackground, 'N'));
+
+  // Delayed tasks don't start early or hold up other tasks, and cancelling them removes them straight away
+  uint32_t startMs = udGetTimeMs();
+  std::atomic<uint32_t> ranAtMs(0);
+  udWorkerPoolTask *pDelayed = nullptr;
+  udWorkerPoolTask *pCancelled = nullptr;
+
+  desc.priority = udWPP_Normal;
+  desc.function = [&ranAtMs](void *) { ranAtMs = udGetTimeMs(); };
+  desc.delayMs = 50;
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, &desc, &pDelayed));
+  desc.delayMs = 60000;
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, &desc, &pCancelled));
+  desc.delayMs = 0;
+  desc.function = [](void *) {};
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, &desc, &pTask));
+
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pTask));
+  EXPECT_EQ(udWPTS_Queued, udWorkerPool_GetTaskState(pDelayed));
+  EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(pDelayed));
+  EXPECT_GE(ranAtMs.load() - startMs, 50u);
+
+  EXPECT_EQ(udR_Success, udWorkerPool_CancelTask(pCancelled));
+  while (udWorkerPool_HasActiveWorkers(pPool))
+    udYield();
+
+  udWorkerPool_ReleaseTask(&pTask);
+  udWorkerPool_ReleaseTask(&pDelayed);
+  udWorkerPool_ReleaseTask(&pCancelled);
+  udWorkerPool_Destroy(&pPool);
+  udDestroySemaphore(&pSema);
+}
+
+TEST(udWorkerPoolTests, AddTasks)
+{
+  udWorkerPool *pPool = nullptr;
+  const size_t count = 1000;
+  std::atomic<int> ran(0);
+  std::atomic<int> postRan(0);
+  udWorkerPoolTaskDesc *pDescs = new udWorkerPoolTaskDesc[count];
+  udWorkerPoolTask **ppTasks = new udWorkerPoolTask*[count];
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 4));
+
+  // A mix of every kind of task, each handle still refers to the task at the same index
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (i % 10 != 5)
+      pDescs[i].function = [&ran](void *) { ++ran; };
+    if (i % 5 == 0)
+      pDescs[i].postFunction = [&postRan](void *) { ++postRan; };
+    pDescs[i].priority = (udWorkerPoolPriority)(i % udWPP_Count);
+    pDescs[i].delayMs = (i % 100 == 1) ? 10 : 0;
+  }
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTasks(pPool, pDescs, count, ppTasks));
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    EXPECT_EQ(udR_Success, udWorkerPool_WaitTask(ppTasks[i]));
+    udWorkerPool_ReleaseTask(&ppTasks[i]);
+  }
+  while (udWorkerPool_HasActiveWorkers(pPool))
+    udYield();
+  EXPECT_EQ(udR_Success, udWorkerPool_DoPostWork(pPool));
+  EXPECT_EQ(900, ran.load());
+  EXPECT_EQ(200, postRan.load());
+
+  // Batches added by a task go to that worker's deque
+  ran = 0;
+  udWorkerPoolTaskDesc parent;
+  parent.function = [pPool, pDescs](void *) { EXPECT_EQ(udR_Success, udWorkerPool_AddTasks(pPool, pDescs, 50)); };
+  for (size_t i = 0; i < 50; ++i)
+  {
+    pDescs[i].function = [&ran](void *) { ++ran; };
+    pDescs[i].postFunction = nullptr;
+    pDescs[i].priority = udWPP_Normal;
+    pDescs[i].delayMs = 0;
+  }
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, &parent));
+  while (udWorkerPool_HasActiveWorkers(pPool))
+    udYield();
+  EXPECT_EQ(50, ran.load());
+
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTasks(pPool, nullptr, 0));
+  pDescs[0].priority = udWPP_Count;
+  EXPECT_EQ(udR_InvalidParameter, udWorkerPool_AddTasks(pPool, pDescs, 1));
+  EXPECT_EQ(udR_InvalidParameter, udWorkerPool_AddTasks(nullptr, pDescs, 1));
+
+  udWorkerPool_Destroy(&pPool);
+  delete[] pDescs;
+  delete[] ppTasks;
+}
+
+TEST(udWorkerPoolTests, ElasticThreads)
+{
+  udWorkerPool *pPool = nullptr;
+  udSemaphore *pSema = udCreateSemaphore();
+  std::atomic<int> started(0);
+  std::atomic<int> finished(0);
+  uint32_t startMs;
+
+  ASSERT_EQ(udR_Success, udWorkerPool_CreateElastic(&pPool, 1, 4, 50));
+  EXPECT_EQ(1u, udWorkerPool_GetThreadCount(pPool));
+
+  // Blocked tasks leave the backlog waiting, so workers are started up to the maximum
+  for (int i = 0; i < 6; ++i)
+    EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, [pSema, &started, &finished](void *) { ++started; udWaitSemaphore(pSema); ++finished; }));
+
+  startMs = udGetTimeMs();
+  while (started < 4 && udGetTimeMs() - startMs < 5000)
+    udYield();
+  udSleep(20);
+  EXPECT_EQ(4, started.load());
+  EXPECT_EQ(4u, udWorkerPool_GetThreadCount(pPool));
+
+  udIncrementSemaphore(pSema, 6);
+  while (udWorkerPool_HasActiveWorkers(pPool))
+    udYield();
+  EXPECT_EQ(6, finished.load());
+
+  // Idle workers retire back down to the minimum
+  startMs = udGetTimeMs();
+  while (udWorkerPool_GetThreadCount(pPool) > 1 && udGetTimeMs() - startMs < 5000)
+    udSleep(10);
+  EXPECT_EQ(1u, udWorkerPool_GetThreadCount(pPool));
+
+  udWorkerPool_Destroy(&pPool);
+
+  // A single worker blocked inside a task is replaced so the task it waits for can run
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 1));
+  EXPECT_EQ(udR_NothingToDo, udWorkerPool_BeginBlocking(pPool));
+
+  std::atomic<bool> blocking(false);
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, [pPool, pSema, &blocking, &finished](void *)
+  {
+    EXPECT_EQ(udR_Success, udWorkerPool_BeginBlocking(pPool));
+    blocking = true;
+    udWaitSemaphore(pSema);
+    EXPECT_EQ(udR_Success, udWorkerPool_EndBlocking(pPool));
+    EXPECT_EQ(udR_NotAllowed, udWorkerPool_EndBlocking(pPool));
+    ++finished;
+  }));
+  while (!blocking)
+    udYield();
+  EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, [pSema](void *) { udIncrementSemaphore(pSema); }));
+
+  startMs = udGetTimeMs();
+  while (finished < 7 && udGetTimeMs() - startMs < 5000)
+    udYield();
+  EXPECT_EQ(7, finished.load());
+
+  udWorkerPool_Destroy(&pPool);
+
+  // More than 255 threads
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 300));
+  EXPECT_EQ(300u, udWorkerPool_GetThreadCount(pPool));
+  udWorkerPool_Destroy(&pPool);
+
+  EXPECT_EQ(udR_InvalidParameter, udWorkerPool_CreateElastic(&pPool, 0, 4));
+  EXPECT_EQ(udR_InvalidParameter, udWorkerPool_CreateElastic(&pPool, 4, 2));
+
+  udDestroySemaphore(&pSema);
+}
+
+TEST(udWorkerPoolTests, Stats)
+{
+  udWorkerPool *pPool = nullptr;
+  udWorkerPoolStats stats;
+  udWorkerPoolThreadStats threadStats[2];
+
+  ASSERT_EQ(udR_Success, udWorkerPool_Create(&pPool, 2));
+
+  for (int i = 0; i < 100; ++i)
+    EXPECT_EQ(udR_Success, udWorkerPool_AddTask(pPool, [](void *) {}, nullptr, true, (i < 3) ? udWorkerPoolCallback([](void *) {}) : udWorkerPoolCallback(nullptr)));
+  while (udWorkerPool_HasActiveWorkers(pPool))
+    udYield();
+
+  EXPECT_EQ(udR_Success, udWorkerPool_GetStats(pPool, &stats, threadStats, (uint32_t)udLengthOf(threadStats)));
+  EXPECT_EQ(100u, stats.total.tasksRun);
+  EXPECT_EQ(2u, stats.liveThreads);
+  EXPECT_EQ(2u, stats.threadSlots);
+  EXPECT_EQ(3u, stats.postTaskBacklog);
+  EXPECT_EQ(0u, stats.queuedTasks);
+
+  uint64_t histogramTotal = 0;
+  for (int bucket = 0; bucket < udWorkerPool_LatencyBucketCount; ++bucket)
+    histogramTotal += stats.total.latencyHistogram[bucket];
+  EXPECT_EQ(100u, histogramTotal);
+  EXPECT_EQ(100u, threadStats[0].tasksRun + threadStats[1].tasksRun);
+  EXPECT_TRUE(threadStats[0].isLive && threadStats[1].isLive);
+  EXPECT_GE(stats.total.idleTimeMs, 0.0);
+
+  EXPECT_EQ(udR_Success, udWorkerPool_DoPostWork(pPool));
+  EXPECT_EQ(udR_Success, udWorkerPool_GetStats(pPool, &stats));
+  EXPECT_EQ(0u, stats.postTaskBacklog);
+
+  udJSON json;
+  EXPECT_EQ(udR_Success, udWorkerPool_ExportStats(pPool, &json));
+  EXPECT_EQ(100, json.Get("total.tasksRun").AsInt());
+  EXPECT_EQ(2u, json.Get("threads").ArrayLength());
+  EXPECT_EQ((size_t)udWorkerPool_LatencyBucketCount, json.Get("threads[1].latencyHistogram").ArrayLength());
+
+  // Dumps are periodic and stop as soon as the interval is set back to 0
+  std::atomic<int> dumpCount(0);
+  EXPECT_EQ(udR_Success, udWorkerPool_SetStatsDump(pPool, 10, [&dumpCount](const char *pJSON)
+  {
+    udJSON dump;
+    EXPECT_EQ(udR_Success, dump.Parse(pJSON));
+    EXPECT_EQ(2, dump.Get("liveThreads").AsInt());
+    ++dumpCount;
+  }));
+
+  uint32_t startMs = udGetTimeMs();
+  while (dumpCount < 2 && udGetTimeMs() - startMs < 5000)
+    udSleep(5);
+  EXPECT_EQ(udR_Success, udWorkerPool_SetStatsDump(pPool, 0));
+  int finalCount = dumpCount;
+  EXPECT_GE(finalCount, 2);
+  udSleep(50);
+  EXPECT_EQ(finalCount, dumpCount.load());
+
+  EXPECT_EQ(udR_InvalidParameter, udWorkerPool_GetStats(pPool, nullptr));
+  udWorkerPool_Destroy(&pPool);
+}